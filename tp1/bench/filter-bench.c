@@ -0,0 +1,435 @@
+/*
+ * Measures every filter of filter.h on synthetic frames of several sizes,
+ * single threaded and through the destination-passing variants so only the
+ * filter itself is timed. Each filter runs once per instruction set the CPU
+ * supports, and the fused chain runs next to its three steps. Filters whose
+ * steps all have a planar version also run through filter-planar.c, once per
+ * instruction set and with both conversions timed. Runs of nearest scale_up
+ * and flips, and a sobel or convolution step reading through them, also run
+ * through filter-view.c. The large blurs also run a direct separable
+ * convolution of the same boxes, every window summed again for every pixel.
+ * Every variant is checked against the scalar output first.
+ *
+ * Rounds repeat the filter enough times to last ROUND_MIN_SECONDS, after
+ * WARMUP_ROUNDS untimed ones. Throughput counts the bytes read and written.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "filter-planar.h"
+#include "filter-simd.h"
+#include "filter-view.h"
+#include "filter.h"
+#include "log.h"
+
+#define DEFAULT_ROUNDS 10
+#define DEFAULT_SIZES "64x64,640x360,1920x1080"
+#define WARMUP_ROUNDS 2
+#define ROUND_MIN_SECONDS 0.02
+#define MAX_SIZES 16
+#define MAX_STEPS 3
+
+typedef struct bench_filter {
+    const char* name;
+    filter_step_t steps[MAX_STEPS];
+    size_t num_steps;
+    bool simd;   /* has a vectorized path, runs once per instruction set */
+    bool fused;  /* also runs filter_chain_scale2_sharpen_sobel_into */
+    bool direct; /* also runs bench_direct_blur */
+} bench_filter_t;
+
+static const bench_filter_t bench_filters[] = {
+    {"scale_up:2", {{.kind = FILTER_SCALE_UP, .factor = 2}}, 1, .simd = true},
+    {"scale_up:4", {{.kind = FILTER_SCALE_UP, .factor = 4}}, 1},
+    {"scale_up:2/bilinear",
+     {{.kind = FILTER_SCALE_UP, .factor = 2, .scale_mode = FILTER_SCALE_BILINEAR}},
+     1,
+     .simd = true},
+    {"scale_up:2/bicubic",
+     {{.kind = FILTER_SCALE_UP, .factor = 2, .scale_mode = FILTER_SCALE_BICUBIC}},
+     1,
+     .simd = true},
+    {"sobel", {{.kind = FILTER_SOBEL}}, 1},
+    {"to_hsv", {{.kind = FILTER_TO_HSV}}, 1, .simd = true},
+    {"to_rgb", {{.kind = FILTER_TO_RGB}}, 1, .simd = true},
+    {"hsv_round_trip", {{.kind = FILTER_TO_HSV}, {.kind = FILTER_TO_RGB}}, 2, .simd = true},
+    {"add_pixel", {{.kind = FILTER_ADD_PIXEL, .add_pixel = {{10, 20, 30, 0}}}}, 1},
+    {"desaturate", {{.kind = FILTER_DESATURATE}}, 1},
+    {"convolution33",
+     {{.kind = FILTER_CONVOLUTION33, .m = {{0.1, 0.2, 0.1}, {0.05, 0.1, 0.05}, {0.1, 0.2, 0.1}}}},
+     1,
+     .simd = true},
+    {"edge_identity", {{.kind = FILTER_EDGE_IDENTITY}}, 1, .simd = true},
+    {"edge_detect", {{.kind = FILTER_EDGE_DETECT}}, 1, .simd = true},
+    {"sharpen", {{.kind = FILTER_SHARPEN}}, 1, .simd = true},
+    {"box_blur", {{.kind = FILTER_BOX_BLUR}}, 1, .simd = true},
+    {"gaussian_blur", {{.kind = FILTER_GAUSSIAN_BLUR}}, 1, .simd = true},
+    {"horizontal_flip", {{.kind = FILTER_HORIZONTAL_FLIP}}, 1},
+    {"vertical_flip", {{.kind = FILTER_VERTICAL_FLIP}}, 1},
+    {"crop", {{.kind = FILTER_CROP, .crop = {1, 1, 62, 62}}}, 1},
+    {"scale_up:2+sharpen", {{.kind = FILTER_SCALE_UP, .factor = 2}, {.kind = FILTER_SHARPEN}}, 2, .simd = true},
+    {"horizontal_flip+sobel", {{.kind = FILTER_HORIZONTAL_FLIP}, {.kind = FILTER_SOBEL}}, 2},
+    {"box_blur_radius:5", {{.kind = FILTER_BOX_BLUR_RADIUS, .radius = 5}}, 1, .simd = true, .direct = true},
+    {"box_blur_radius:50", {{.kind = FILTER_BOX_BLUR_RADIUS, .radius = 50}}, 1, .simd = true, .direct = true},
+    {"gaussian_blur_sigma:2", {{.kind = FILTER_GAUSSIAN_BLUR_SIGMA, .sigma = 2}}, 1, .simd = true, .direct = true},
+    {"gaussian_blur_sigma:16", {{.kind = FILTER_GAUSSIAN_BLUR_SIGMA, .sigma = 16}}, 1, .simd = true, .direct = true},
+    {"scale_up:2+sharpen+sobel",
+     {{.kind = FILTER_SCALE_UP, .factor = 2}, {.kind = FILTER_SHARPEN}, {.kind = FILTER_SOBEL}},
+     3,
+     .simd  = true,
+     .fused = true},
+};
+
+#define NUM_BENCH_FILTERS (sizeof(bench_filters) / sizeof(bench_filters[0]))
+
+typedef enum bench_kind {
+    BENCH_STEPS,  /* filter_chain_apply */
+    BENCH_FUSED,  /* filter_chain_scale2_sharpen_sobel_into */
+    BENCH_PLANAR, /* filter_planar_chain_apply_parallel, conversions included */
+    BENCH_VIEW,   /* filter_view_steps_apply_parallel */
+    BENCH_DIRECT, /* bench_direct_blur */
+} bench_kind_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* same frame on every run, noise so no filter hits a fast path */
+static image_t* image_create_synthetic(size_t width, size_t height) {
+    image_t* image = image_create(0, width, height);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    unsigned int state = 2463534242u;
+    for (size_t i = 0; i < width * height; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        memcpy(image->pixels[i].bytes, &state, sizeof(image->pixels[i].bytes));
+        image->pixels[i].bytes[3] = 255;
+    }
+    return image;
+}
+
+static size_t clamp_index(ptrdiff_t index, size_t size) {
+    return (index < 0) ? 0 : (((size_t)index >= size) ? size - 1 : (size_t)index);
+}
+
+/* box blur of filter-blur.c summing the 2 * radius + 1 taps of both passes for every pixel, `dst` may be `src` */
+static int bench_direct_box(const image_t* src, image_t* dst, size_t radius) {
+    size_t width    = src->width;
+    size_t height   = src->height;
+    uint16_t* sums  = malloc(4 * width * height * sizeof(*sums));
+    uint32_t area   = (2 * radius + 1) * (2 * radius + 1);
+    double inverse  = (1.0 + 0x1p-30) / area;
+    ptrdiff_t reach = radius;
+    if (sums == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        return -1;
+    }
+
+    for (size_t y = 0; y < height; y++) {
+        const unsigned char* in = src->pixels[y * width].bytes;
+        for (size_t n = 0; n < 4 * width; n++) {
+            unsigned int sum = 0;
+            for (ptrdiff_t i = -reach; i <= reach; i++) {
+                sum += in[4 * clamp_index(n / 4 + i, width) + n % 4];
+            }
+            sums[4 * y * width + n] = sum;
+        }
+    }
+
+    if (image_reshape(dst, width, height) < 0) {
+        free(sums);
+        return -1;
+    }
+
+    for (size_t y = 0; y < height; y++) {
+        unsigned char* out = dst->pixels[y * width].bytes;
+        for (size_t n = 0; n < 4 * width; n++) {
+            uint32_t sum = 0;
+            for (ptrdiff_t i = -reach; i <= reach; i++) {
+                sum += sums[4 * clamp_index(y + i, height) * width + n];
+            }
+            out[n] = (unsigned char)((double)(sum + area / 2) * inverse);
+        }
+    }
+
+    free(sums);
+    return 0;
+}
+
+static int bench_direct_blur(const filter_step_t* step, const image_t* src, image_t* dst) {
+    if (step->kind == FILTER_BOX_BLUR_RADIUS) {
+        return bench_direct_box(src, dst, step->radius);
+    }
+
+    size_t radii[3];
+    filter_gaussian_blur_radii(step->sigma, radii);
+    if (bench_direct_box(src, dst, radii[0]) < 0 || bench_direct_box(dst, dst, radii[1]) < 0 ||
+        bench_direct_box(dst, dst, radii[2]) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* result of one run of the filter, in one of `buffers` */
+static image_t* bench_run(const bench_filter_t* filter, bench_kind_t kind, const image_t* src, image_t* buffers[2]) {
+    switch (kind) {
+    case BENCH_FUSED:
+        if (filter_chain_scale2_sharpen_sobel_into(src, buffers[0]) < 0) {
+            return NULL;
+        }
+        return buffers[0];
+    case BENCH_PLANAR:
+        return filter_planar_chain_apply_parallel(NULL, filter->steps, filter->num_steps, src, buffers);
+    case BENCH_DIRECT:
+        if (bench_direct_blur(&filter->steps[0], src, buffers[0]) < 0) {
+            return NULL;
+        }
+        return buffers[0];
+    case BENCH_VIEW:
+        if (filter_view_steps_apply_parallel(NULL, filter->steps, filter->num_steps, src, buffers[0]) < 0) {
+            return NULL;
+        }
+        return buffers[0];
+    default:
+        return filter_chain_apply(filter->steps, filter->num_steps, src, buffers);
+    }
+}
+
+static bool bench_planar_supports(const bench_filter_t* filter) {
+    for (size_t i = 0; i < filter->num_steps; i++) {
+        if (!filter_planar_supports(&filter->steps[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* lazy steps, then at most one step reading through them */
+static bool bench_view_supports(const bench_filter_t* filter) {
+    size_t lazy = 0;
+    while (lazy < filter->num_steps && filter_view_is_lazy(&filter->steps[lazy])) {
+        lazy++;
+    }
+    return lazy > 0 &&
+           (lazy == filter->num_steps || (lazy + 1 == filter->num_steps && filter_view_reads(&filter->steps[lazy])));
+}
+
+static bool image_equal(const image_t* a, const image_t* b) {
+    return a->width == b->width && a->height == b->height &&
+           memcmp(a->pixels, b->pixels, a->width * a->height * sizeof(*a->pixels)) == 0;
+}
+
+/* times one variant and prints its CSV line, returns -1 if it fails or its output differs from `expected` */
+static int bench_variant(const bench_filter_t* filter, const char* variant, bench_kind_t kind, const image_t* src,
+                         const image_t* expected, int rounds) {
+    image_t* buffers[2] = {image_create(0, 0, 0), image_create(0, 0, 0)};
+    double* samples     = calloc(rounds, sizeof(*samples));
+    int ret             = -1;
+    if (buffers[0] == NULL || buffers[1] == NULL || samples == NULL) {
+        LOG_ERROR("cannot allocate the benchmark buffers");
+        goto free_buffers;
+    }
+
+    image_t* result = bench_run(filter, kind, src, buffers);
+    if (result == NULL) {
+        goto free_buffers;
+    }
+    bool identical = image_equal(result, expected);
+
+    /* size the rounds on the warmup so small frames are not all timer resolution */
+    size_t repeat = 1;
+    for (int round = 0; round < WARMUP_ROUNDS; round++) {
+        double start = now();
+        for (size_t r = 0; r < repeat; r++) {
+            bench_run(filter, kind, src, buffers);
+        }
+        double elapsed = now() - start;
+        if (elapsed < ROUND_MIN_SECONDS) {
+            repeat = (elapsed > 0) ? repeat * ROUND_MIN_SECONDS / elapsed + 1 : repeat * 2;
+        }
+    }
+
+    size_t pixels = src->width * src->height;
+    size_t bytes  = (pixels + result->width * result->height) * sizeof(pixel_t);
+    double sum    = 0;
+    double min    = INFINITY;
+
+    for (int round = 0; round < rounds; round++) {
+        double start = now();
+        for (size_t r = 0; r < repeat; r++) {
+            bench_run(filter, kind, src, buffers);
+        }
+        samples[round] = (now() - start) / repeat;
+        sum += samples[round];
+        min = fmin(min, samples[round]);
+    }
+
+    double mean     = sum / rounds;
+    double variance = 0;
+    for (int round = 0; round < rounds; round++) {
+        variance += (samples[round] - mean) * (samples[round] - mean);
+    }
+    variance /= rounds;
+
+    printf("%s,%s,%ld,%ld,%d,%ld,%.3f,%.3f,%.3f,%.3f,%s\n", filter->name, variant, src->width, src->height, rounds,
+           repeat, mean * 1e9 / pixels, min * 1e9 / pixels, sqrt(variance) * 1e9 / pixels, bytes / 1e9 / mean,
+           identical ? "yes" : "no");
+    fflush(stdout);
+
+    if (!identical) {
+        LOG_ERROR("%s (%s) differs from the scalar output on %ldx%ld", filter->name, variant, src->width, src->height);
+        goto free_buffers;
+    }
+    ret = 0;
+
+free_buffers:
+    free(samples);
+    for (int b = 0; b < 2; b++) {
+        if (buffers[b] != NULL) {
+            image_destroy(buffers[b]);
+        }
+    }
+    return ret;
+}
+
+static int bench_filter(const bench_filter_t* filter, const image_t* src, int rounds) {
+    filter_simd_t best  = filter_simd_supported();
+    image_t* buffers[2] = {image_create(0, 0, 0), image_create(0, 0, 0)};
+    image_t* expected   = NULL;
+    int ret             = 0;
+    if (buffers[0] == NULL || buffers[1] == NULL) {
+        LOG_ERROR("cannot allocate the benchmark buffers");
+        ret = -1;
+        goto free_buffers;
+    }
+
+    filter_simd_set(FILTER_SIMD_SCALAR);
+    expected = bench_run(filter, BENCH_STEPS, src, buffers);
+    if (expected == NULL) {
+        ret = -1;
+        goto free_buffers;
+    }
+
+    filter_simd_t last = filter->simd ? best : FILTER_SIMD_SCALAR;
+    for (filter_simd_t simd = FILTER_SIMD_SCALAR; simd <= last; simd++) {
+        filter_simd_set(simd);
+        if (bench_variant(filter, filter_simd_name(simd), BENCH_STEPS, src, expected, rounds) < 0) {
+            ret = -1;
+        }
+    }
+
+    if (filter->fused) {
+        filter_simd_set(best);
+        if (bench_variant(filter, "fused", BENCH_FUSED, src, expected, rounds) < 0) {
+            ret = -1;
+        }
+    }
+
+    if (bench_planar_supports(filter)) {
+        for (filter_simd_t simd = FILTER_SIMD_SCALAR; simd <= best; simd++) {
+            char variant[32];
+            snprintf(variant, sizeof(variant), "planar-%s", filter_simd_name(simd));
+
+            filter_simd_set(simd);
+            if (bench_variant(filter, variant, BENCH_PLANAR, src, expected, rounds) < 0) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (filter->direct) {
+        filter_simd_set(best);
+        if (bench_variant(filter, "direct", BENCH_DIRECT, src, expected, rounds) < 0) {
+            ret = -1;
+        }
+    }
+
+    if (bench_view_supports(filter)) {
+        filter_simd_set(best);
+        if (bench_variant(filter, "view", BENCH_VIEW, src, expected, rounds) < 0) {
+            ret = -1;
+        }
+    }
+
+free_buffers:
+    filter_simd_set(best);
+    for (int b = 0; b < 2; b++) {
+        if (buffers[b] != NULL) {
+            image_destroy(buffers[b]);
+        }
+    }
+    return ret;
+}
+
+/* "WxH,WxH,..." */
+static int parse_sizes(const char* arg, size_t widths[MAX_SIZES], size_t heights[MAX_SIZES], size_t* num_sizes) {
+    *num_sizes = 0;
+    while (*arg != '\0') {
+        char* end;
+        long width = strtol(arg, &end, 10);
+        if (end == arg || *end != 'x' || width <= 0) {
+            return -1;
+        }
+
+        arg         = end + 1;
+        long height = strtol(arg, &end, 10);
+        if (end == arg || (*end != ',' && *end != '\0') || height <= 0 || *num_sizes == MAX_SIZES) {
+            return -1;
+        }
+
+        widths[*num_sizes]  = width;
+        heights[*num_sizes] = height;
+        (*num_sizes)++;
+        arg = (*end == ',') ? end + 1 : end;
+    }
+    return (*num_sizes > 0) ? 0 : -1;
+}
+
+int main(int argc, char* argv[]) {
+    int rounds        = (argc > 1) ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    const char* sizes = (argc > 2) ? argv[2] : DEFAULT_SIZES;
+    const char* only  = (argc > 3) ? argv[3] : NULL;
+
+    size_t widths[MAX_SIZES], heights[MAX_SIZES], num_sizes;
+    if (rounds <= 0 || parse_sizes(sizes, widths, heights, &num_sizes) < 0) {
+        fprintf(stderr, "Usage: %s [ROUNDS] [WxH[,WxH]...] [FILTER]\n", argv[0]);
+        return 1;
+    }
+
+    printf(
+        "filter,variant,width,height,rounds,repeat,ns_per_pixel,min_ns_per_pixel,stddev_ns_per_pixel,gbps,"
+        "identical\n");
+
+    int ret = 0;
+    for (size_t s = 0; s < num_sizes; s++) {
+        image_t* src = image_create_synthetic(widths[s], heights[s]);
+        if (src == NULL) {
+            return 1;
+        }
+
+        for (size_t i = 0; i < NUM_BENCH_FILTERS; i++) {
+            if (only != NULL && strcmp(only, bench_filters[i].name) != 0) {
+                continue;
+            }
+            if (bench_filter(&bench_filters[i], src, rounds) < 0) {
+                ret = 1;
+            }
+        }
+
+        image_destroy(src);
+    }
+
+    return ret;
+}
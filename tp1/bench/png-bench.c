@@ -0,0 +1,120 @@
+/*
+ * Measures image_create_from_png and image_save_png_profile throughput on the
+ * frames of a directory (NNNN.png like the pipelines). Throughput counts the
+ * decoded RGBA bytes. Every write profile encodes the frames to the output
+ * directory (/tmp by default), the files are removed after measuring their size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "image.h"
+#include "log.h"
+
+#define MAX_FRAMES 4096
+#define DEFAULT_ROUNDS 5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t image_bytes(const image_t* image) {
+    return image->width * image->height * sizeof(*image->pixels);
+}
+
+int main(int argc, char* argv[]) {
+    const char* directory = (argc > 1) ? argv[1] : "data";
+    int rounds            = (argc > 2) ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    const char* out       = (argc > 3) ? argv[3] : "/tmp";
+
+    if (rounds <= 0) {
+        fprintf(stderr, "Usage: %s [DIRECTORY] [ROUNDS] [OUTPUT DIRECTORY]\n", argv[0]);
+        return 1;
+    }
+
+    char filename[256];
+    image_t** frames  = calloc(MAX_FRAMES, sizeof(*frames));
+    size_t num_frames = 0;
+    if (frames == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        return 1;
+    }
+
+    for (; num_frames < MAX_FRAMES; num_frames++) {
+        snprintf(filename, sizeof(filename), "%s/%04ld.png", directory, num_frames);
+        if (access(filename, F_OK) < 0) {
+            break;
+        }
+    }
+
+    if (num_frames == 0) {
+        LOG_ERROR("no image found in directory `%s`", directory);
+        return 1;
+    }
+
+    printf("operation,profile,round,frames,megabytes,seconds,mbps,bytes_written\n");
+
+    for (int round = 0; round < rounds; round++) {
+        size_t bytes = 0;
+        double start = now();
+
+        for (size_t i = 0; i < num_frames; i++) {
+            snprintf(filename, sizeof(filename), "%s/%04ld.png", directory, i);
+            if (frames[i] != NULL) {
+                image_destroy(frames[i]);
+            }
+
+            frames[i] = image_create_from_png(filename);
+            if (frames[i] == NULL) {
+                return 1;
+            }
+            bytes += image_bytes(frames[i]);
+        }
+
+        double elapsed = now() - start;
+        printf("decode,-,%d,%ld,%.2f,%.4f,%.2f,0\n", round, num_frames, bytes / 1e6, elapsed, bytes / 1e6 / elapsed);
+        fflush(stdout);
+    }
+
+    for (image_png_profile_t profile = IMAGE_PNG_DEFAULT; profile <= IMAGE_PNG_SMALL; profile++) {
+        for (int round = 0; round < rounds; round++) {
+            size_t bytes   = 0;
+            size_t written = 0;
+            double elapsed = 0;
+
+            for (size_t i = 0; i < num_frames; i++) {
+                snprintf(filename, sizeof(filename), "%s/png-bench-%d-%04ld.png", out, getpid(), i);
+
+                double start = now();
+                if (image_save_png_profile(frames[i], filename, profile) < 0) {
+                    return 1;
+                }
+                elapsed += now() - start;
+                bytes += image_bytes(frames[i]);
+
+                struct stat st;
+                if (stat(filename, &st) == 0) {
+                    written += st.st_size;
+                }
+                unlink(filename);
+            }
+
+            printf("encode,%s,%d,%ld,%.2f,%.4f,%.2f,%ld\n", image_png_profile_name(profile), round, num_frames,
+                   bytes / 1e6, elapsed, bytes / 1e6 / elapsed, written);
+            fflush(stdout);
+        }
+    }
+
+    for (size_t i = 0; i < num_frames; i++) {
+        image_destroy(frames[i]);
+    }
+    free(frames);
+
+    return 0;
+}
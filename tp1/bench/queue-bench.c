@@ -0,0 +1,152 @@
+/*
+ * Compares queue_t and ring_queue_t throughput with P producers and C consumers.
+ * Producers push ITEMS values in total, consumers pop until they get a NULL.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "queue.h"
+#include "ring-queue.h"
+
+#define ITEMS 200000
+#define QUEUE_SIZE 512
+
+typedef struct bench_queue_ops {
+    const char* name;
+    void* (*create)(size_t size);
+    void (*destroy)(void* queue);
+    int (*push)(void* queue, void* ptr);
+    void* (*pop)(void* queue);
+} bench_queue_ops_t;
+
+typedef struct bench_worker {
+    const bench_queue_ops_t* ops;
+    void* queue;
+    size_t count;
+} bench_worker_t;
+
+static const bench_queue_ops_t bench_queues[] = {
+    {
+        .name    = "queue",
+        .create  = (void* (*)(size_t))queue_create,
+        .destroy = (void (*)(void*))queue_destroy,
+        .push    = (int (*)(void*, void*))queue_push,
+        .pop     = (void* (*)(void*))queue_pop,
+    },
+    {
+        .name    = "ring_queue",
+        .create  = (void* (*)(size_t))ring_queue_create,
+        .destroy = (void (*)(void*))ring_queue_destroy,
+        .push    = (int (*)(void*, void*))ring_queue_push,
+        .pop     = (void* (*)(void*))ring_queue_pop,
+    },
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* producer(void* args) {
+    bench_worker_t* worker = args;
+    for (size_t i = 1; i <= worker->count; i++) {
+        worker->ops->push(worker->queue, (void*)(uintptr_t)i);
+    }
+    return NULL;
+}
+
+static void* consumer(void* args) {
+    bench_worker_t* worker = args;
+    while (worker->ops->pop(worker->queue) != NULL) {
+        worker->count++;
+    }
+    return NULL;
+}
+
+static int bench_run(const bench_queue_ops_t* ops, size_t producers, size_t consumers, double* elapsed) {
+    pthread_t* tids         = calloc(producers + consumers, sizeof(*tids));
+    bench_worker_t* workers = calloc(producers + consumers, sizeof(*workers));
+    if (tids == NULL || workers == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_free;
+    }
+
+    void* queue = ops->create(QUEUE_SIZE);
+    if (queue == NULL) {
+        goto fail_free;
+    }
+
+    double start = now();
+    for (size_t i = 0; i < producers + consumers; i++) {
+        workers[i].ops   = ops;
+        workers[i].queue = queue;
+        workers[i].count = (i < producers) ? ITEMS / producers : 0;
+
+        errno = pthread_create(&tids[i], NULL, (i < producers) ? producer : consumer, &workers[i]);
+        if (errno != 0) {
+            LOG_ERROR_ERRNO("pthread_create");
+            exit(1);
+        }
+    }
+
+    for (size_t i = 0; i < producers; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    for (size_t i = 0; i < consumers; i++) {
+        ops->push(queue, NULL);
+    }
+
+    size_t received = 0;
+    for (size_t i = producers; i < producers + consumers; i++) {
+        pthread_join(tids[i], NULL);
+        received += workers[i].count;
+    }
+    *elapsed = now() - start;
+
+    ops->destroy(queue);
+    free(workers);
+    free(tids);
+
+    if (received != (ITEMS / producers) * producers) {
+        LOG_ERROR("%s: received %ld items", ops->name, received);
+        goto fail_exit;
+    }
+    return 0;
+
+fail_free:
+    free(workers);
+    free(tids);
+fail_exit:
+    return -1;
+}
+
+int main(void) {
+    const size_t counts[]   = {1, 2, 4, 8, 16, 32, 64};
+    const size_t num_counts = sizeof(counts) / sizeof(counts[0]);
+
+    printf("queue,producers,consumers,items,seconds,mops\n");
+    for (size_t p = 0; p < num_counts; p++) {
+        for (size_t c = 0; c < num_counts; c++) {
+            for (size_t q = 0; q < sizeof(bench_queues) / sizeof(bench_queues[0]); q++) {
+                double elapsed;
+                if (bench_run(&bench_queues[q], counts[p], counts[c], &elapsed) < 0) {
+                    return 1;
+                }
+
+                size_t items = (ITEMS / counts[p]) * counts[p];
+                printf("%s,%ld,%ld,%ld,%.4f,%.3f\n", bench_queues[q].name, counts[p], counts[c], items, elapsed,
+                       items / elapsed / 1e6);
+                fflush(stdout);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef INCLUDE_FILTER_GRAPH_H_
+#define INCLUDE_FILTER_GRAPH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "filter.h"
+
+/*
+ * Filter chains given on the command line, e.g. "scale_up:2,gaussian_blur,sobel".
+ * Every function of filter.h has a step name, the arguments follow a colon:
+ *
+ *   scale_up:FACTOR[/MODE]  add_pixel:R/G/B  convolution33:M00/M01/.../M22  crop:X/Y/WIDTH/HEIGHT
+ *   sobel  to_hsv  to_rgb  desaturate  edge_identity  edge_detect  sharpen
+ *   box_blur  gaussian_blur  horizontal_flip  vertical_flip
+ *   box_blur_radius:RADIUS  gaussian_blur_sigma:SIGMA
+ *
+ * MODE is nearest, bilinear or bicubic, `scale_mode` when omitted. FACTOR is at
+ * most FILTER_GRAPH_MAX_FACTOR, a larger one only makes images that can't be allocated.
+ *
+ * The steps are then grouped in stages, the unit every pipeline schedules:
+ * runs of cheap per-pixel steps share a stage so their frames don't go
+ * through a queue between each of them, and with `fuse` every
+ * scale_up:2,sharpen,sobel becomes the single pass of filter-fused.c.
+ * With `planar`, every run of steps filter-planar.c supports becomes one
+ * stage that converts its input to planar and its result back only once.
+ * With `views`, every run of nearest scale_up, crop and flips followed by a
+ * sobel or convolution step becomes one stage where that step reads through
+ * an image view of the run, see filter-view.h. The fused stage comes first,
+ * then views, then planar.
+ */
+
+#define FILTER_GRAPH_DEFAULT "scale_up:2,sharpen,sobel"
+#define FILTER_GRAPH_MAX_STEPS 32
+#define FILTER_GRAPH_NAME_SIZE 64
+#define FILTER_GRAPH_MAX_FACTOR 64
+
+typedef enum filter_stage_kind {
+    FILTER_STAGE_STEPS,                /* its steps one after the other */
+    FILTER_STAGE_SCALE2_SHARPEN_SOBEL, /* filter_chain_scale2_sharpen_sobel */
+    FILTER_STAGE_PLANAR,               /* filter_planar_chain_apply_parallel */
+    FILTER_STAGE_VIEW,                 /* filter_view_steps_apply_parallel */
+} filter_stage_kind_t;
+
+typedef struct filter_stage {
+    char name[FILTER_GRAPH_NAME_SIZE]; /* step names joined by '+' */
+    filter_stage_kind_t kind;
+    const filter_step_t* steps;
+    size_t num_steps;
+} filter_stage_t;
+
+/* stages point into `steps`, a graph is parsed in place and never copied */
+typedef struct filter_graph {
+    filter_step_t steps[FILTER_GRAPH_MAX_STEPS];
+    size_t num_steps;
+    filter_stage_t stages[FILTER_GRAPH_MAX_STEPS];
+    size_t num_stages;
+} filter_graph_t;
+
+/* parses `spec` and groups its steps, see above */
+int filter_graph_parse(filter_graph_t* graph, const char* spec, bool fuse, bool planar, bool views,
+                       filter_scale_mode_t scale_mode);
+
+const char* filter_step_name(filter_kind_t kind);
+
+/* per-pixel steps without neighbours, merged with the cheap steps next to them */
+bool filter_step_is_cheap(const filter_step_t* step);
+
+int filter_stage_output_size(const filter_stage_t* stage, size_t width, size_t height, size_t* out_width,
+                             size_t* out_height);
+
+/*
+ * Runs the stage on `src` like filter_chain_apply_parallel(), `src` must not be one of
+ * `buffers`. Returns the buffer holding the result, or NULL on failure.
+ */
+image_t* filter_stage_apply_parallel(const parallel_for_t* parallel_for, const filter_stage_t* stage,
+                                     const image_t* src, image_t* buffers[2]);
+
+/*
+ * Runs every stage on `src`, each one writing into the two buffers that don't hold its input.
+ * Returns the buffer holding the result, or NULL on failure. `stage_ns` (may be NULL) receives
+ * the time spent in each stage, in nanoseconds.
+ */
+image_t* filter_graph_apply_parallel(const parallel_for_t* parallel_for, const filter_graph_t* graph,
+                                     const image_t* src, image_t* buffers[3], uint64_t* stage_ns);
+
+/* the two of `buffers` that aren't `current`, where a stage reading `current` writes */
+void filter_graph_stage_buffers(image_t* buffers[3], const image_t* current, image_t* pair[2]);
+
+/* result of the stage in a new image acquired from `pool`, the intermediate images go back to it */
+image_t* filter_stage_apply_pool(image_pool_t* pool, const filter_stage_t* stage, const image_t* src);
+
+#endif /* INCLUDE_FILTER_GRAPH_H_ */
@@ -0,0 +1,39 @@
+#ifndef INCLUDE_FILTER_PLANAR_H_
+#define INCLUDE_FILTER_PLANAR_H_
+
+#include <stdbool.h>
+
+#include "filter.h"
+#include "image-planar.h"
+
+/*
+ * Filters on planar images, with the same output as their interleaved
+ * counterparts of filter.h. `dst` is reshaped to the output dimensions and
+ * overwritten, `src` and `dst` must differ, and the output is split in bands
+ * of FILTER_PARALLEL_GRAIN rows on `parallel_for` (inline when NULL).
+ */
+
+int filter_planar_scale_up_parallel(const parallel_for_t* parallel_for, const image_planar_t* src, image_planar_t* dst,
+                                    size_t factor);
+int filter_planar_sobel_parallel(const parallel_for_t* parallel_for, const image_planar_t* src, image_planar_t* dst);
+int filter_planar_desaturate_parallel(const parallel_for_t* parallel_for, const image_planar_t* src,
+                                      image_planar_t* dst);
+int filter_planar_convolution33_parallel(const parallel_for_t* parallel_for, const image_planar_t* src,
+                                         image_planar_t* dst, const double m[3][3]);
+
+/* nearest neighbour scale_up, sobel, desaturate and the convolution steps */
+bool filter_planar_supports(const filter_step_t* step);
+
+int filter_planar_step_apply_parallel(const parallel_for_t* parallel_for, const filter_step_t* step,
+                                      const image_planar_t* src, image_planar_t* dst);
+
+/*
+ * Same as filter_chain_apply_parallel() on planar images: `src` is deinterleaved
+ * once into `buffers[0]`, every step alternates between the planes held by the two
+ * buffers, and the result is interleaved once into the buffer that doesn't hold
+ * it. Every step must be supported. Returns that buffer, or NULL on failure.
+ */
+image_t* filter_planar_chain_apply_parallel(const parallel_for_t* parallel_for, const filter_step_t* steps,
+                                            size_t num_steps, const image_t* src, image_t* buffers[2]);
+
+#endif /* INCLUDE_FILTER_PLANAR_H_ */
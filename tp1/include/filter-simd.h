@@ -0,0 +1,51 @@
+#ifndef INCLUDE_FILTER_SIMD_H_
+#define INCLUDE_FILTER_SIMD_H_
+
+#include <stdbool.h>
+
+#include "image.h"
+
+/* instruction sets the vectorized filters can run on, the best one is picked at startup */
+
+typedef enum filter_simd {
+    FILTER_SIMD_SCALAR = 0,
+    FILTER_SIMD_SSE41  = 1,
+    FILTER_SIMD_AVX2   = 2,
+} filter_simd_t;
+
+filter_simd_t filter_simd_get(void);
+filter_simd_t filter_simd_supported(void);
+const char* filter_simd_name(filter_simd_t simd);
+int filter_simd_parse(const char* name, filter_simd_t* simd);
+
+/* lowers the level used by the filters, fails if the CPU doesn't support `simd` */
+int filter_simd_set(filter_simd_t simd);
+
+/*
+ * True when every weight of `m` is a multiple of 2^-shift small enough for the
+ * sums to fit 16-bit lanes, the kernel then runs exactly in fixed point.
+ */
+bool filter_simd_fixed_point(const double m[3][3], int* shift);
+
+/*
+ * Vectorized backend of filter_convolution33, writes the (width - 2) x (height - 2)
+ * result in `new_image`. Returns -1 when the scalar path must be used instead.
+ */
+int filter_simd_convolution33(const image_t* image, image_t* new_image, const double m[3][3]);
+
+/* same as filter_simd_convolution33 for output rows [begin, end) only */
+int filter_simd_convolution33_rows(const image_t* image, image_t* new_image, const double m[3][3], size_t begin,
+                                   size_t end);
+
+/*
+ * Vectorized backends of filter_to_hsv and filter_to_rgb over `count` pixels, alpha
+ * copied. Return how many leading pixels they converted (none at the scalar level),
+ * the scalar code converts the rest.
+ */
+size_t filter_simd_to_hsv(const pixel_t* src, pixel_t* dst, size_t count);
+size_t filter_simd_to_rgb(const pixel_t* src, pixel_t* dst, size_t count);
+
+/* nearest neighbour scale_up:2 of one row of `count` pixels, returns how many source pixels it doubled */
+size_t filter_simd_scale_up2(const pixel_t* src, pixel_t* dst, size_t count);
+
+#endif /* INCLUDE_FILTER_SIMD_H_ */
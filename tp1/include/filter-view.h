@@ -0,0 +1,36 @@
+#ifndef INCLUDE_FILTER_VIEW_H_
+#define INCLUDE_FILTER_VIEW_H_
+
+#include <stdbool.h>
+
+#include "filter.h"
+#include "image-view.h"
+
+/*
+ * Sobel and the convolution steps reading their input through an image view,
+ * with the same output as filter.h on the image the view stands for. `dst` is
+ * reshaped to the output dimensions and overwritten, the output is split in
+ * bands of FILTER_PARALLEL_GRAIN rows on `parallel_for` (inline when NULL).
+ */
+
+int filter_view_sobel_parallel(const parallel_for_t* parallel_for, const image_view_t* src, image_t* dst);
+int filter_view_convolution33_parallel(const parallel_for_t* parallel_for, const image_view_t* src, image_t* dst,
+                                       const double m[3][3]);
+
+/* nearest neighbour scale_up, crop and the flips, steps that only change the view of their input */
+bool filter_view_is_lazy(const filter_step_t* step);
+
+/* sobel and the convolution steps */
+bool filter_view_reads(const filter_step_t* step);
+
+/* applies a lazy step to `view` */
+int filter_view_step_apply(const filter_step_t* step, image_view_t* view);
+
+/*
+ * Runs lazy steps, and optionally a last step that reads through them, on `src`
+ * without materializing any intermediate image: only `dst` is written, once.
+ */
+int filter_view_steps_apply_parallel(const parallel_for_t* parallel_for, const filter_step_t* steps, size_t num_steps,
+                                     const image_t* src, image_t* dst);
+
+#endif /* INCLUDE_FILTER_VIEW_H_ */
@@ -4,6 +4,7 @@
 #define INCLUDE_FILTER_H_
 
 #include "image.h"
+#include "parallel-for.h"
 
 /* all filter return a newly allocated image, input image is not freed  */
 
@@ -22,4 +23,177 @@ image_t* filter_gaussian_blur(image_t* image);
 image_t* filter_horizontal_flip(image_t* image);
 image_t* filter_vertical_flip(image_t* image);
 
+/* pool-aware variants, the new image is acquired from `pool` (allocated when NULL) */
+
+image_t* filter_scale_up_pool(image_pool_t* pool, image_t* image, size_t factor);
+image_t* filter_sobel_pool(image_pool_t* pool, image_t* image);
+image_t* filter_to_hsv_pool(image_pool_t* pool, image_t* image);
+image_t* filter_to_rgb_pool(image_pool_t* pool, image_t* image);
+image_t* filter_add_pixel_pool(image_pool_t* pool, image_t* image, pixel_t* add_pixel);
+image_t* filter_desaturate_pool(image_pool_t* pool, image_t* image);
+image_t* filter_convolution33_pool(image_pool_t* pool, image_t* image, const double m[3][3]);
+image_t* filter_edge_identity_pool(image_pool_t* pool, image_t* image);
+image_t* filter_edge_detect_pool(image_pool_t* pool, image_t* image);
+image_t* filter_sharpen_pool(image_pool_t* pool, image_t* image);
+image_t* filter_box_blur_pool(image_pool_t* pool, image_t* image);
+image_t* filter_gaussian_blur_pool(image_pool_t* pool, image_t* image);
+image_t* filter_horizontal_flip_pool(image_pool_t* pool, image_t* image);
+image_t* filter_vertical_flip_pool(image_pool_t* pool, image_t* image);
+
+/*
+ * destination-passing variants, `dst` is reshaped to the output dimensions (its storage only
+ * grows when too small) and overwritten, `src` and `dst` must differ, return -1 on failure
+ */
+
+int filter_scale_up_into(const image_t* src, image_t* dst, size_t factor);
+int filter_sobel_into(const image_t* src, image_t* dst);
+int filter_to_hsv_into(const image_t* src, image_t* dst);
+int filter_to_rgb_into(const image_t* src, image_t* dst);
+int filter_add_pixel_into(const image_t* src, image_t* dst, const pixel_t* add_pixel);
+int filter_desaturate_into(const image_t* src, image_t* dst);
+int filter_convolution33_into(const image_t* src, image_t* dst, const double m[3][3]);
+int filter_edge_identity_into(const image_t* src, image_t* dst);
+int filter_edge_detect_into(const image_t* src, image_t* dst);
+int filter_sharpen_into(const image_t* src, image_t* dst);
+int filter_box_blur_into(const image_t* src, image_t* dst);
+int filter_gaussian_blur_into(const image_t* src, image_t* dst);
+int filter_horizontal_flip_into(const image_t* src, image_t* dst);
+int filter_vertical_flip_into(const image_t* src, image_t* dst);
+
+/*
+ * parallel variants of the destination-passing filters, the output is split in bands of at least
+ * FILTER_PARALLEL_GRAIN rows run on `parallel_for` (in the calling thread when NULL)
+ */
+
+#define FILTER_PARALLEL_GRAIN 16
+
+int filter_scale_up_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst, size_t factor);
+int filter_sobel_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+int filter_to_hsv_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+int filter_to_rgb_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+int filter_add_pixel_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst,
+                              const pixel_t* add_pixel);
+int filter_desaturate_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+int filter_convolution33_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst,
+                                  const double m[3][3]);
+int filter_edge_identity_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+int filter_edge_detect_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+int filter_sharpen_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+int filter_box_blur_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+int filter_gaussian_blur_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+int filter_horizontal_flip_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+int filter_vertical_flip_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+
+/* the `width` x `height` rectangle of `src` at (`x`, `y`), fails when it doesn't fit, see filter-view.c */
+int filter_crop_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst, size_t x, size_t y,
+                         size_t width, size_t height);
+
+/* fused filter_sobel(filter_sharpen(filter_scale_up(image, 2))), same output in a single pass */
+
+image_t* filter_chain_scale2_sharpen_sobel(image_t* image);
+image_t* filter_chain_scale2_sharpen_sobel_pool(image_pool_t* pool, image_t* image);
+int filter_chain_scale2_sharpen_sobel_into(const image_t* src, image_t* dst);
+int filter_chain_scale2_sharpen_sobel_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst);
+
+/*
+ * scale_up with interpolation, see filter-scale.c: FILTER_SCALE_NEAREST is filter_scale_up_parallel,
+ * bilinear and bicubic blend the 2x2 and 4x4 source pixels around every output pixel, alpha included
+ */
+
+typedef enum filter_scale_mode {
+    FILTER_SCALE_NEAREST,
+    FILTER_SCALE_BILINEAR,
+    FILTER_SCALE_BICUBIC,
+} filter_scale_mode_t;
+
+const char* filter_scale_mode_name(filter_scale_mode_t mode);
+int filter_scale_mode_parse(const char* name, filter_scale_mode_t* mode);
+
+int filter_scale_up_mode_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst, size_t factor,
+                                  filter_scale_mode_t mode);
+
+/*
+ * Blurs at a constant cost per pixel whatever their size, see filter-blur.c: the mean of the
+ * (2 * radius + 1)^2 box around every pixel, and a Gaussian of standard deviation `sigma` made of
+ * three box blurs. Edge pixels repeat and alpha is blurred too, the image keeps its dimensions.
+ */
+
+#define FILTER_BLUR_MAX_RADIUS 100
+
+image_t* filter_box_blur_radius(image_t* image, size_t radius);
+image_t* filter_gaussian_blur_sigma(image_t* image, double sigma);
+image_t* filter_box_blur_radius_pool(image_pool_t* pool, image_t* image, size_t radius);
+image_t* filter_gaussian_blur_sigma_pool(image_pool_t* pool, image_t* image, double sigma);
+
+/* `dst` may be `src` for these two */
+int filter_box_blur_radius_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst,
+                                    size_t radius);
+int filter_gaussian_blur_sigma_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst,
+                                        double sigma);
+
+/* radii of the three box blurs of filter_gaussian_blur_sigma(), in increasing order */
+void filter_gaussian_blur_radii(double sigma, size_t radii[3]);
+
+/* filter chains, a sequence of steps applied one after the other */
+
+typedef enum filter_kind {
+    FILTER_SCALE_UP,
+    FILTER_SOBEL,
+    FILTER_TO_HSV,
+    FILTER_TO_RGB,
+    FILTER_ADD_PIXEL,
+    FILTER_DESATURATE,
+    FILTER_CONVOLUTION33,
+    FILTER_EDGE_IDENTITY,
+    FILTER_EDGE_DETECT,
+    FILTER_SHARPEN,
+    FILTER_BOX_BLUR,
+    FILTER_GAUSSIAN_BLUR,
+    FILTER_HORIZONTAL_FLIP,
+    FILTER_VERTICAL_FLIP,
+    FILTER_CROP,
+    FILTER_BOX_BLUR_RADIUS,
+    FILTER_GAUSSIAN_BLUR_SIGMA,
+} filter_kind_t;
+
+typedef struct filter_step {
+    filter_kind_t kind;
+    size_t factor;                  /* FILTER_SCALE_UP */
+    filter_scale_mode_t scale_mode; /* FILTER_SCALE_UP */
+    pixel_t add_pixel;              /* FILTER_ADD_PIXEL */
+    double m[3][3];                 /* FILTER_CONVOLUTION33 */
+    struct {
+        size_t x, y, width, height;
+    } crop;        /* FILTER_CROP */
+    size_t radius; /* FILTER_BOX_BLUR_RADIUS */
+    double sigma;  /* FILTER_GAUSSIAN_BLUR_SIGMA */
+} filter_step_t;
+
+int filter_step_apply_into(const filter_step_t* step, const image_t* src, image_t* dst);
+int filter_step_apply_parallel(const parallel_for_t* parallel_for, const filter_step_t* step, const image_t* src,
+                               image_t* dst);
+int filter_step_output_size(const filter_step_t* step, size_t width, size_t height, size_t* out_width,
+                            size_t* out_height);
+
+/* weights of a convolution step (convolution33, edge_identity, ..., gaussian_blur), fails for the other steps */
+int filter_step_kernel33(const filter_step_t* step, double m[3][3]);
+
+/*
+ * Output dimensions of the whole chain for a `width` x `height` input, `max_pixels` (may be NULL)
+ * receives the largest pixel count of any intermediate image, enough for ping-pong buffers.
+ * Fails when the bytes of one of these images don't fit in a size_t.
+ */
+int filter_chain_output_size(const filter_step_t* steps, size_t num_steps, size_t width, size_t height,
+                             size_t* out_width, size_t* out_height, size_t* max_pixels);
+
+/*
+ * Runs the chain on `src` alternating between `buffers[0]` and `buffers[1]`, which only allocate
+ * when they need to grow. Returns the buffer holding the result, or NULL on failure.
+ */
+image_t* filter_chain_apply(const filter_step_t* steps, size_t num_steps, const image_t* src, image_t* buffers[2]);
+
+/* same as filter_chain_apply() with every step split in bands on `parallel_for` */
+image_t* filter_chain_apply_parallel(const parallel_for_t* parallel_for, const filter_step_t* steps, size_t num_steps,
+                                     const image_t* src, image_t* buffers[2]);
+
 #endif /* INCLUDE_FILTER_H_ */
@@ -0,0 +1,57 @@
+#ifndef INCLUDE_IMAGE_PLANAR_H_
+#define INCLUDE_IMAGE_PLANAR_H_
+
+#include <stddef.h>
+
+#include "image.h"
+#include "parallel-for.h"
+
+/*
+ * Planar (structure of arrays) images: one plane of bytes per channel, so the
+ * filters load 16 or 32 values of the same channel at once and skip alpha,
+ * which only ever gets copied. Every row of every plane starts on an
+ * IMAGE_PLANAR_ALIGN boundary.
+ *
+ * The planes either live in storage of their own or in the pixels of an
+ * image_t used as a plain byte buffer, which lets the filter chains run
+ * planar in the same ping-pong buffers as the interleaved path.
+ */
+
+#define IMAGE_PLANAR_ALIGN 64
+
+typedef enum image_planar_channel {
+    IMAGE_PLANAR_R = 0,
+    IMAGE_PLANAR_G = 1,
+    IMAGE_PLANAR_B = 2,
+    IMAGE_PLANAR_A = 3,
+} image_planar_channel_t;
+
+typedef struct image_planar {
+    size_t id;
+    size_t width;
+    size_t height;
+    size_t stride;            /* bytes from a row to the next, a multiple of IMAGE_PLANAR_ALIGN */
+    unsigned char* planes[4]; /* indexed by image_planar_channel_t */
+    unsigned char* data;      /* owned storage of the planes, NULL when they live in `storage` */
+    size_t capacity;          /* bytes of `data` */
+    image_t* storage;         /* image whose pixels hold the planes, or NULL */
+} image_planar_t;
+
+image_planar_t* image_planar_create(size_t id, size_t width, size_t height);
+void image_planar_destroy(image_planar_t* planar);
+
+/* a planar image whose planes live in the pixels of `storage`, which is reshaped as needed */
+void image_planar_init_in(image_planar_t* planar, image_t* storage);
+
+/* changes the dimensions, growing the storage when needed, the content is undefined afterward */
+int image_planar_reshape(image_planar_t* planar, size_t width, size_t height);
+
+static inline unsigned char* image_planar_row(const image_planar_t* planar, image_planar_channel_t channel, size_t y) {
+    return &planar->planes[channel][y * planar->stride];
+}
+
+/* deinterleaves `src` into `dst` and back, split in bands of rows on `parallel_for` (inline when NULL) */
+int image_planar_from_image(const parallel_for_t* parallel_for, const image_t* src, image_planar_t* dst);
+int image_planar_to_image(const parallel_for_t* parallel_for, const image_planar_t* src, image_t* dst);
+
+#endif /* INCLUDE_IMAGE_PLANAR_H_ */
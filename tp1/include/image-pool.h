@@ -0,0 +1,64 @@
+#ifndef INCLUDE_IMAGE_POOL_H_
+#define INCLUDE_IMAGE_POOL_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "image.h"
+
+/*
+ * Recycles images of the same dimensions so pipelines stop handing multi-megabyte
+ * buffers back to the allocator (and page-faulting them in again) every frame.
+ *
+ * Released images first go to a small cache owned by the releasing thread, then
+ * to a shared list per (width, height) class. An image acquired from a pool
+ * remembers it, so image_destroy() gives it back instead of freeing it.
+ */
+
+#define IMAGE_POOL_THREAD_CACHE 4
+#define IMAGE_POOL_MAX_CLASSES 16
+#define IMAGE_POOL_MAX_BYTES (512 * 1024 * 1024)
+
+typedef struct image_pool_cache {
+    image_pool_t* pool;
+    image_t* images[IMAGE_POOL_THREAD_CACHE];
+    size_t count;
+    struct image_pool_cache* next;
+} image_pool_cache_t;
+
+typedef struct image_pool_class {
+    size_t width;
+    size_t height;
+    image_t** images;
+    size_t count;
+    size_t capacity;
+} image_pool_class_t;
+
+typedef struct image_pool {
+    size_t max_bytes;
+    size_t cached_bytes;
+    pthread_mutex_t mutex;
+    pthread_key_t cache_key;
+    image_pool_cache_t* caches;
+    image_pool_class_t classes[IMAGE_POOL_MAX_CLASSES];
+    size_t num_classes;
+
+    atomic_size_t thread_hits;
+    atomic_size_t shared_hits;
+    atomic_size_t misses;
+    atomic_size_t releases;
+    atomic_size_t evictions;
+} image_pool_t;
+
+/* `max_bytes` bounds the memory kept by the shared lists, thread caches come on top */
+image_pool_t* image_pool_create(size_t max_bytes);
+void image_pool_destroy(image_pool_t* pool);
+
+/* same as image_create() when `pool` is NULL */
+image_t* image_pool_acquire(image_pool_t* pool, size_t id, size_t width, size_t height);
+void image_pool_release(image_pool_t* pool, image_t* image);
+
+void image_pool_print_stats(image_pool_t* pool, FILE* file);
+
+#endif /* INCLUDE_IMAGE_POOL_H_ */
@@ -0,0 +1,48 @@
+#ifndef INCLUDE_IMAGE_PREFETCH_H_
+#define INCLUDE_IMAGE_PREFETCH_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "image.h"
+
+/*
+ * Decodes the frames of an image directory ahead of the pipeline on a few I/O
+ * threads and hands them out in order. At most `depth` frames are loaded or
+ * waiting past the one the pipeline asks for next, and no new load starts
+ * while the decoded frames waiting exceed `max_bytes`. Each claimed frame also
+ * asks the kernel to read the file `depth` frames further ahead.
+ */
+
+#define IMAGE_PREFETCH_THREADS 4
+#define IMAGE_PREFETCH_MAX_BYTES (256 * 1024 * 1024)
+
+typedef struct image_prefetch {
+    image_dir_t* image_dir;
+    size_t depth;
+    size_t max_bytes;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t loaded; /* a frame is ready or the end is known */
+    pthread_cond_t space;  /* the window moved or the prefetcher closes */
+    image_t** slots;       /* frame i waits in slots[i % depth] */
+    size_t next_claim;     /* next frame an I/O thread loads */
+    size_t next_out;       /* next frame handed to the pipeline */
+    size_t end;            /* end of the frames to load, lowered by a failed load */
+    size_t ready_bytes;
+    bool closing;
+
+    pthread_t* tids;
+    size_t num_threads;
+} image_prefetch_t;
+
+image_prefetch_t* image_prefetch_create(image_dir_t* image_dir, size_t depth, size_t num_threads, size_t max_bytes);
+
+/* frees the frames nobody took, joins the threads after their current load */
+void image_prefetch_destroy(image_prefetch_t* prefetch);
+
+/* next frame in order, NULL at the end of the directory or once `image_dir->stop` is set */
+image_t* image_prefetch_next(image_prefetch_t* prefetch);
+
+#endif /* INCLUDE_IMAGE_PREFETCH_H_ */
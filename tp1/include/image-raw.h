@@ -0,0 +1,59 @@
+#ifndef INCLUDE_IMAGE_RAW_H_
+#define INCLUDE_IMAGE_RAW_H_
+
+#include <stdint.h>
+
+#include "image.h"
+
+/*
+ * Raw frame container: a 64 byte header followed by `num_frames` frames of
+ * width * height RGBA pixels, stored in the host byte order. Frames keep the
+ * 4 byte alignment of pixel_t, so the reader maps the file and hands out
+ * images pointing straight into the mapping.
+ */
+
+#define IMAGE_RAW_MAGIC "INFRAW01"
+#define IMAGE_RAW_FILENAME "frames.raw" /* name of the container inside an image directory */
+#define IMAGE_RAW_WRITE_BUFFER (4 * 1024 * 1024)
+
+typedef struct image_raw_header {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint64_t num_frames;
+    uint64_t frame_offset; /* offset of the first frame from the start of the file */
+    uint8_t reserved[32];
+} image_raw_header_t;
+
+typedef struct image_raw_reader {
+    void* map;
+    size_t map_size;
+    size_t width;
+    size_t height;
+    size_t num_frames;
+    const pixel_t* frames;
+} image_raw_reader_t;
+
+typedef struct image_raw_writer {
+    int fd;
+    size_t width;
+    size_t height;
+    size_t num_frames;
+    unsigned char* buffer; /* small frames are gathered here and written together */
+    size_t buffered;
+} image_raw_writer_t;
+
+image_raw_reader_t* image_raw_open(const char* filename);
+void image_raw_close(image_raw_reader_t* reader);
+
+/* read-only image borrowing frame `index` from the mapping, must be destroyed before closing the reader */
+image_t* image_raw_view(image_raw_reader_t* reader, size_t index);
+
+/* the first appended frame sets the dimensions of the container, the others must match */
+image_raw_writer_t* image_raw_writer_create(const char* filename);
+int image_raw_append(image_raw_writer_t* writer, const image_t* image);
+
+/* flushes the frames, writes the header and frees the writer, even on failure */
+int image_raw_writer_finish(image_raw_writer_t* writer);
+
+#endif /* INCLUDE_IMAGE_RAW_H_ */
@@ -0,0 +1,29 @@
+#ifndef INCLUDE_IMAGE_SCAN_H_
+#define INCLUDE_IMAGE_SCAN_H_
+
+#include <stddef.h>
+
+/*
+ * Listing of the frames of an input directory: the regular files whose name
+ * matches a glob, read once and sorted naturally ("frame2.png" before
+ * "frame10.png"). The id of a frame is its position in the listing, so the
+ * same directory always gives the same ids and any frame can be loaded by id.
+ */
+
+#define IMAGE_SCAN_DEFAULT_PATTERN "[0-9]*.png" /* skips the outputs written next to the inputs */
+
+typedef struct image_scan {
+    char** names;
+    size_t count;
+} image_scan_t;
+
+image_scan_t* image_scan_create(const char* directory, const char* pattern);
+void image_scan_destroy(image_scan_t* scan);
+
+/* strcmp, except runs of digits compare by their value */
+int image_scan_natural_compare(const char* a, const char* b);
+
+/* ids [*begin, *end) of shard `index` out of `count` equal ranges of `num_frames` ids */
+void image_scan_shard(size_t num_frames, size_t index, size_t count, size_t* begin, size_t* end);
+
+#endif /* INCLUDE_IMAGE_SCAN_H_ */
@@ -0,0 +1,100 @@
+#ifndef INCLUDE_IMAGE_STREAM_H_
+#define INCLUDE_IMAGE_STREAM_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "image.h"
+
+/*
+ * Uncompressed frames over a pipe or a file descriptor, for running the
+ * pipeline between a decoder and an encoder process:
+ *
+ * - raw RGBA: width * height pixels per frame and nothing else, the size is
+ *   given on the command line since the stream doesn't carry it,
+ * - YUV4MPEG2 (Y4M): a header line, then a FRAME line and the Y, Cb and Cr
+ *   planes of each frame. Samples are converted from and to RGB with the
+ *   BT.601 studio range coefficients, chroma is upsampled by repeating samples
+ *   and downsampled by averaging them.
+ *
+ * Frames are read with large read() calls straight into the pixels when the
+ * layout allows it. The writer keeps the stream in id order whatever the order
+ * the save stages hand the frames in.
+ */
+
+#define IMAGE_STREAM_BUFFER (1024 * 1024) /* read-ahead for the header and frame lines */
+#define IMAGE_STREAM_PARAMS 128           /* Y4M header parameters passed from input to output */
+
+typedef enum image_stream_format {
+    IMAGE_STREAM_RGBA = 0,
+    IMAGE_STREAM_Y4M  = 1,
+} image_stream_format_t;
+
+typedef enum image_stream_chroma {
+    IMAGE_STREAM_C420  = 0, /* 420, 420jpeg, 420paldv and 420mpeg2 are read alike */
+    IMAGE_STREAM_C422  = 1,
+    IMAGE_STREAM_C444  = 2,
+    IMAGE_STREAM_CMONO = 3,
+} image_stream_chroma_t;
+
+typedef struct image_stream_reader {
+    int fd;
+    image_stream_format_t format;
+    size_t width;
+    size_t height;
+    image_stream_chroma_t chroma;
+    char params[IMAGE_STREAM_PARAMS]; /* frame rate, interlacing, aspect ratio... of a Y4M header */
+    size_t num_frames;
+    bool failed; /* a frame was truncated or malformed, the stream didn't end cleanly */
+
+    unsigned char* buffer;
+    size_t begin; /* unread bytes of `buffer` are [begin, end) */
+    size_t end;
+    unsigned char* planes; /* one Y4M frame */
+} image_stream_reader_t;
+
+typedef struct image_stream_pending {
+    size_t id;
+    size_t width;
+    size_t height;
+    unsigned char* data;
+    size_t size;
+    struct image_stream_pending* next;
+} image_stream_pending_t;
+
+typedef struct image_stream_writer {
+    int fd;
+    image_stream_format_t format;
+    image_stream_chroma_t chroma;
+    char params[IMAGE_STREAM_PARAMS];
+    size_t width; /* of the first frame written, the others must match */
+    size_t height;
+
+    pthread_mutex_t mutex;
+    size_t next_id;
+    image_stream_pending_t* pending; /* frames saved ahead of `next_id`, sorted by id */
+    size_t num_pending;
+    bool failed;
+} image_stream_writer_t;
+
+int image_stream_format_parse(const char* name, image_stream_format_t* format);
+
+/* reads the Y4M header right away, `width` and `height` are only used by RGBA streams */
+image_stream_reader_t* image_stream_reader_create(int fd, image_stream_format_t format, size_t width, size_t height);
+void image_stream_reader_destroy(image_stream_reader_t* reader);
+
+/* next frame with the next id, NULL at the end of the stream or on failure, which sets `failed` */
+image_t* image_stream_read(image_stream_reader_t* reader, image_pool_t* pool);
+
+/* Y4M streams copy the chroma and the header parameters of `input` when it is a Y4M reader, C444 otherwise */
+image_stream_writer_t* image_stream_writer_create(int fd, image_stream_format_t format,
+                                                  const image_stream_reader_t* input, size_t first_id);
+
+/* thread-safe, frames are written once all frames with a lower id were */
+int image_stream_write(image_stream_writer_t* writer, const image_t* image);
+
+/* fails when frames were dropped waiting for a frame that never came */
+int image_stream_writer_destroy(image_stream_writer_t* writer);
+
+#endif /* INCLUDE_IMAGE_STREAM_H_ */
@@ -0,0 +1,66 @@
+#ifndef INCLUDE_IMAGE_VIEW_H_
+#define INCLUDE_IMAGE_VIEW_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "image.h"
+#include "parallel-for.h"
+
+/*
+ * Read-only views of an image: nearest neighbour upscales, crops and flips
+ * only change how logical coordinates map to the source pixels, so they cost
+ * nothing until a kernel reads through them. Logical pixel (x, y) is
+ *
+ *   base[((y + offset_y) / scale) * stride + ((x + offset_x) / scale) * step]
+ *
+ * where the offsets (below `scale`) place a crop or a flip in the middle of a
+ * scaled source pixel. A view never owns pixels, the image must outlive it.
+ */
+
+typedef struct image_view {
+    size_t id;
+    size_t width; /* logical dimensions */
+    size_t height;
+    const pixel_t* base; /* source pixel holding logical (0, 0) */
+    ptrdiff_t step;      /* source pixels from a column to the next, negative once flipped horizontally */
+    ptrdiff_t stride;    /* source pixels from a row to the next, negative once flipped vertically */
+    size_t scale;        /* logical pixels per source pixel along each axis */
+    size_t offset_x;
+    size_t offset_y;
+} image_view_t;
+
+/* the whole of `image` as it is */
+void image_view_init(image_view_t* view, const image_t* image);
+
+void image_view_scale_up(image_view_t* view, size_t factor);
+void image_view_flip_horizontal(image_view_t* view);
+void image_view_flip_vertical(image_view_t* view);
+
+/* fails when the rectangle doesn't fit in the view */
+int image_view_crop(image_view_t* view, size_t x, size_t y, size_t width, size_t height);
+
+/* unscaled and unflipped, logical rows are runs of source pixels */
+static inline bool image_view_is_contiguous(const image_view_t* view) {
+    return view->scale == 1 && view->step == 1;
+}
+
+static inline const pixel_t* image_view_row(const image_view_t* view, size_t y) {
+    return view->base + (ptrdiff_t)((y + view->offset_y) / view->scale) * view->stride;
+}
+
+/* offset from image_view_row() of logical column `x` */
+static inline ptrdiff_t image_view_column(const image_view_t* view, size_t x) {
+    return (ptrdiff_t)((x + view->offset_x) / view->scale) * view->step;
+}
+
+/* image_view_column() of every logical column, in a new array to free() */
+ptrdiff_t* image_view_columns(const image_view_t* view);
+
+/* copies logical row `y` to `out`, `columns` comes from image_view_columns() */
+void image_view_copy_row(const image_view_t* view, const ptrdiff_t* columns, size_t y, pixel_t* out);
+
+/* copies the view into `dst`, split in bands of rows on `parallel_for` (inline when NULL) */
+int image_view_copy_into(const parallel_for_t* parallel_for, const image_view_t* view, image_t* dst);
+
+#endif /* INCLUDE_IMAGE_VIEW_H_ */
@@ -12,11 +12,16 @@ typedef struct pixel {
     unsigned char bytes[4];
 } pixel_t;
 
+typedef struct image_pool image_pool_t;
+
 typedef struct image {
     size_t id;
     size_t width;
     size_t height;
     pixel_t* pixels;
+    size_t capacity;    /* number of pixels `pixels` can hold, at least width * height */
+    image_pool_t* pool; /* pool the image returns to when destroyed, if any */
+    bool borrowed;      /* read-only `pixels` owned by someone else (e.g. a mapped file), never freed */
 } image_t;
 
 static inline pixel_t* image_get_pixel(image_t* image, unsigned int x, unsigned int y) {
@@ -31,20 +36,83 @@ image_t* image_create(size_t id, size_t width, size_t height);
 image_t* image_create_from_png(char* filename);
 image_t* image_copy(image_t* image);
 void image_destroy(image_t* image);
+
+/* changes the dimensions of `image`, growing its storage when needed, the content is undefined afterward */
+int image_reshape(image_t* image, size_t width, size_t height);
 int image_save_png(image_t* image, char* filename);
 
+/* zlib level and row filters used when writing PNG files */
+typedef enum image_png_profile {
+    IMAGE_PNG_DEFAULT = 0, /* libpng defaults, zlib level 6 and adaptive filters */
+    IMAGE_PNG_FAST    = 1, /* zlib level 1 and no filtering, larger files */
+    IMAGE_PNG_SMALL   = 2, /* zlib level 9 with the largest deflate state, adaptive filters */
+} image_png_profile_t;
+
+const char* image_png_profile_name(image_png_profile_t profile);
+int image_png_profile_parse(const char* name, image_png_profile_t* profile);
+int image_save_png_profile(image_t* image, char* filename, image_png_profile_t profile);
+
+typedef enum image_input_format {
+    IMAGE_INPUT_PNG  = 0, /* NNNN.png files */
+    IMAGE_INPUT_RAW  = 1, /* frames of the IMAGE_RAW_FILENAME container, see image-raw.h */
+    IMAGE_INPUT_Y4M  = 2, /* YUV4MPEG2 stream on stdin, see image-stream.h */
+    IMAGE_INPUT_RGBA = 3, /* raw RGBA frames of `stream_width` x `stream_height` on stdin */
+} image_input_format_t;
+
+typedef enum image_output_format {
+    IMAGE_OUTPUT_PNG  = 0, /* <prefix>-<name>.png files in the output directory */
+    IMAGE_OUTPUT_Y4M  = 1, /* YUV4MPEG2 stream on `output_fd` */
+    IMAGE_OUTPUT_RGBA = 2, /* raw RGBA frames on `output_fd` */
+} image_output_format_t;
+
+typedef struct image_raw_reader image_raw_reader_t;
+typedef struct image_prefetch image_prefetch_t;
+typedef struct image_scan image_scan_t;
+typedef struct image_stream_reader image_stream_reader_t;
+typedef struct image_stream_writer image_stream_writer_t;
+
 typedef struct image_dir {
     const char* input_dir_name;
     const char* output_dir_name;
     const char* save_prefix;
     size_t load_current;
     bool stop;
+    image_pool_t* pool; /* loaded images are acquired from it when not NULL */
+    image_png_profile_t write_profile;
+    image_input_format_t input_format;
+    image_raw_reader_t* raw;   /* opened by the first load of a raw input */
+    image_scan_t* scan;        /* listing of a PNG input, made by the first load */
+    const char* input_pattern; /* glob of the PNG frames, IMAGE_SCAN_DEFAULT_PATTERN when NULL */
+    size_t shard_index;        /* only the frames of shard `shard_index` out of `shard_count` are loaded */
+    size_t shard_count;        /* 0 loads every frame */
+    size_t load_end;           /* end of the frames to load, set when the input is opened */
+    bool open_failed;          /* the input was missing, had no frame, or stdin no valid stream header */
+    size_t prefetch_depth;     /* frames decoded ahead of the pipeline, 0 to load them on demand */
+    image_prefetch_t* prefetch;
+    size_t stream_width; /* of the frames of a raw RGBA input, which doesn't carry them */
+    size_t stream_height;
+    image_stream_reader_t* stream_in; /* stdin, opened with the input */
+    image_output_format_t output_format;
+    int output_fd;
+    image_stream_writer_t* stream_out; /* `output_fd`, opened with the input */
 } image_dir_t;
 
+/*
+ * Lists or maps the input and selects the frames of the shard, done by the first load when not called
+ * before. Fails on a missing input or one without any frame, image_dir_close() then fails too.
+ */
+int image_dir_open(image_dir_t* image_dir);
 image_t* image_dir_load_next(image_dir_t* image_dir);
+
+/* loads the frame with id `index` of the input, NULL past the last frame or on failure */
+image_t* image_dir_load(image_dir_t* image_dir, size_t index);
+int image_dir_input_path(const image_dir_t* image_dir, size_t index, char* buffer, size_t size);
 int image_dir_save(image_dir_t* image_dir, image_t* image);
 
 void image_dir_reset(image_dir_t* image_dir, const char* input_dir_name, const char* output_dir_name,
                      const char* save_prefix);
 
+/* releases what the loads kept open, every loaded image must be destroyed before, fails if saved frames were lost */
+int image_dir_close(image_dir_t* image_dir);
+
 #endif /* INCLUDE_IMAGE_H_ */
@@ -0,0 +1,42 @@
+#ifndef INCLUDE_PARALLEL_FOR_H_
+#define INCLUDE_PARALLEL_FOR_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Executor running `fn` over disjoint ranges covering [0, count), possibly on
+ * several threads at once, and returning once every range is done. Ranges hold
+ * at least `grain` items except the last one.
+ */
+
+typedef void (*parallel_for_fn_t)(void* args, size_t begin, size_t end);
+
+typedef struct parallel_for {
+    void (*run)(void* ctx, size_t count, size_t grain, parallel_for_fn_t fn, void* args);
+    void* ctx;
+} parallel_for_t;
+
+/* runs inline in the calling thread when `parallel_for` is NULL or there isn't enough work to split */
+static inline void parallel_for_run(const parallel_for_t* parallel_for, size_t count, size_t grain,
+                                    parallel_for_fn_t fn, void* args) {
+    if (parallel_for == NULL || count < 2 * grain) {
+        if (count > 0) {
+            fn(args, 0, count);
+        }
+        return;
+    }
+    parallel_for->run(parallel_for->ctx, count, grain, fn, args);
+}
+
+/* executor backed by tbb::parallel_for, fails when the binary is built without TBB */
+int parallel_for_tbb(parallel_for_t* parallel_for);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* INCLUDE_PARALLEL_FOR_H_ */
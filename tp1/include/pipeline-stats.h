@@ -0,0 +1,51 @@
+#ifndef INCLUDE_PIPELINE_STATS_H_
+#define INCLUDE_PIPELINE_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Per-stage instrumentation of a pipeline run. Every metric is a log-linear
+ * histogram (HDR style, 16 sub-buckets per power of two, so values are kept
+ * within 6%) with one copy per thread: recording is a few relaxed loads and
+ * stores on memory no other thread writes, cheap enough to leave on. The
+ * copies are merged when the report is printed, after the run.
+ *
+ * Stage metrics hold the service time of each frame in nanoseconds, queue
+ * metrics hold the occupancy seen by each push. All functions accept a NULL
+ * `stats` and a negative metric and do nothing then.
+ */
+
+typedef struct pipeline_stats pipeline_stats_t;
+
+pipeline_stats_t* pipeline_stats_create(const char* name);
+void pipeline_stats_destroy(pipeline_stats_t* stats);
+
+/* metrics are registered before the run, the ids returned are passed to the record functions */
+int pipeline_stats_add_stage(pipeline_stats_t* stats, const char* name);
+int pipeline_stats_add_queue(pipeline_stats_t* stats, const char* name);
+
+/* monotonic clock in nanoseconds */
+uint64_t pipeline_stats_now(void);
+
+void pipeline_stats_record(pipeline_stats_t* stats, int metric, uint64_t value);
+
+/* records the time elapsed since `start` and returns the current time, for back to back stages */
+uint64_t pipeline_stats_record_since(pipeline_stats_t* stats, int metric, uint64_t start);
+
+/* wall time and throughput of the run */
+void pipeline_stats_start(pipeline_stats_t* stats);
+void pipeline_stats_stop(pipeline_stats_t* stats);
+void pipeline_stats_count_frame(pipeline_stats_t* stats);
+
+void pipeline_stats_print_json(pipeline_stats_t* stats, FILE* f);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* INCLUDE_PIPELINE_STATS_H_ */
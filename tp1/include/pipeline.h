@@ -3,15 +3,60 @@
 #ifndef INCLUDE_PIPELINE_H_
 #define INCLUDE_PIPELINE_H_
 
+#include "filter-graph.h"
 #include "image.h"
+#include "parallel-for.h"
+#include "pipeline-stats.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
-int pipeline_serial(image_dir_t* image_dir);
-int pipeline_pthread(image_dir_t* image_dir);
-int pipeline_tbb(image_dir_t* image_dir);
+#define PIPELINE_MAX_STAGE_THREADS 8
+#define PIPELINE_DEFAULT_BUDGET_MIB 512
+
+typedef struct pipeline_options {
+    bool fused;                  /* run scale_up, sharpen and sobel as one stage */
+    bool planar;                 /* run the filters filter-planar.c supports on planar images */
+    bool views;                  /* read upscales, crops and flips through image views, see filter-view.h */
+    image_pool_t* pool;          /* recycles the filter outputs when not NULL */
+    const filter_graph_t* graph; /* stages applied to every frame, planned with `fused`, `planar` and `views` */
+
+    /* workers of each pthread stage, the last count repeats, no count means one worker per CPU */
+    size_t stage_threads[PIPELINE_MAX_STAGE_THREADS];
+    size_t num_stage_threads;
+
+    /* pthread workers move between stages during the run, one per CPU in total, stage_threads is ignored */
+    bool adaptive_threads;
+
+    /* splits each frame in row bands for the latency pipeline */
+    const parallel_for_t* parallel_for;
+
+    /* per-stage metrics of the run when not NULL */
+    pipeline_stats_t* stats;
+
+    /* bytes of frames in flight in the tbb-flow pipeline, a larger frame still runs alone */
+    size_t budget_bytes;
+
+    /* frames the pthread and tbb pipelines may hold back to save them in order, 0 saves them as they come */
+    size_t reorder_window;
+
+    /* no messages besides errors, such as the decisions of the adaptive threads */
+    bool quiet;
+} pipeline_options_t;
+
+int pipeline_serial(image_dir_t* image_dir, const pipeline_options_t* options);
+int pipeline_pthread(image_dir_t* image_dir, const pipeline_options_t* options);
+int pipeline_tbb(image_dir_t* image_dir, const pipeline_options_t* options);
+
+/* flow graph admitting frames while their buffers fit in `budget_bytes`, see pipeline-tbb-flow.cpp */
+int pipeline_tbb_flow(image_dir_t* image_dir, const pipeline_options_t* options);
+
+/* frames as chains of tasks on work-stealing workers, see pipeline-steal.c */
+int pipeline_steal(image_dir_t* image_dir, const pipeline_options_t* options);
+
+/* one frame at a time, every filter split across all cores, prints the latency of each frame */
+int pipeline_latency(image_dir_t* image_dir, const pipeline_options_t* options);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,58 @@
+#ifndef INCLUDE_REORDER_BUFFER_H_
+#define INCLUDE_REORDER_BUFFER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Puts the frames of a parallel stage back in id order before they are saved.
+ * Frames complete in any order and are parked in a window of `window` slots
+ * starting at the next id to release, the thread that completes the next one
+ * releases it along with every parked frame that follows.
+ *
+ * The window is enforced at the source: a frame is only loaded once its id
+ * fits, so pushing never blocks and never deadlocks waiting on a frame still
+ * upstream: the loader blocks in reorder_buffer_wait(). Task-based engines,
+ * where that would stall the thread carrying the missing frame, bound their
+ * tokens instead and count the frames they hold back (see pipeline-tbb.cpp).
+ */
+
+typedef struct reorder_buffer reorder_buffer_t;
+
+reorder_buffer_t* reorder_buffer_create(size_t window, size_t first_id);
+void reorder_buffer_destroy(reorder_buffer_t* buffer);
+
+/* blocks until `id` fits in the window */
+void reorder_buffer_wait(reorder_buffer_t* buffer, size_t id);
+
+/* parks `item` under `id`, fails if `id` isn't in the window */
+int reorder_buffer_push(reorder_buffer_t* buffer, size_t id, void* item);
+
+/* for a frame that was dropped and will never be pushed, the following ones may then be ready */
+void reorder_buffer_skip(reorder_buffer_t* buffer, size_t id);
+
+/*
+ * Returns the next item in order when it is ready and no other thread is
+ * releasing items, `releasing` (false before the first call) then tells the
+ * caller to release it and call again. NULL ends the release: the caller
+ * either had nothing ready or another thread is releasing and takes its items.
+ */
+void* reorder_buffer_try_pop(reorder_buffer_t* buffer, bool* releasing);
+
+/* most items parked at once, to size the window */
+size_t reorder_buffer_high_water(reorder_buffer_t* buffer);
+void reorder_buffer_print_stats(reorder_buffer_t* buffer, FILE* file);
+
+/* the line of reorder_buffer_print_stats(), for an engine that holds frames back without a buffer */
+void reorder_buffer_print_window(FILE* file, size_t window, size_t high_water);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* INCLUDE_REORDER_BUFFER_H_ */
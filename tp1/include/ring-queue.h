@@ -0,0 +1,55 @@
+#ifndef INCLUDE_RING_QUEUE_H_
+#define INCLUDE_RING_QUEUE_H_
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bounded multi-producer/multi-consumer queue with the same blocking push/pop
+ * semantics as queue_t, including NULL values used as end-of-stream markers.
+ *
+ * Slots live in a fixed array (capacity rounded up to a power of two), each
+ * one tagged with a sequence number telling producers and consumers whose turn
+ * it is. Push and pop never allocate: they claim a position with a CAS, spin a
+ * little when the queue is full/empty, then sleep on a futex.
+ */
+
+#define RING_QUEUE_CACHE_LINE 64
+
+typedef struct ring_queue_cell {
+    atomic_size_t sequence;
+    void* value;
+} ring_queue_cell_t;
+
+typedef struct ring_queue {
+    size_t mask;
+    int spin;
+    ring_queue_cell_t* cells;
+
+    alignas(RING_QUEUE_CACHE_LINE) atomic_size_t enqueue_pos;
+    alignas(RING_QUEUE_CACHE_LINE) atomic_size_t dequeue_pos;
+
+    /* futex words bumped after every push/pop, and number of threads sleeping on them */
+    alignas(RING_QUEUE_CACHE_LINE) atomic_uint pushed;
+    atomic_uint pop_waiters;
+    alignas(RING_QUEUE_CACHE_LINE) atomic_uint popped;
+    atomic_uint push_waiters;
+} ring_queue_t;
+
+ring_queue_t* ring_queue_create(size_t size);
+void ring_queue_destroy(ring_queue_t* queue);
+int ring_queue_push(ring_queue_t* queue, void* ptr);
+void* ring_queue_pop(ring_queue_t* queue);
+
+/* non-blocking variants, return -1 when the queue is full/empty */
+int ring_queue_try_push(ring_queue_t* queue, void* ptr);
+int ring_queue_try_pop(ring_queue_t* queue, void** ptr);
+
+size_t ring_queue_capacity(ring_queue_t* queue);
+
+/* number of claimed slots, only a snapshot when other threads push or pop */
+size_t ring_queue_size(ring_queue_t* queue);
+
+#endif /* INCLUDE_RING_QUEUE_H_ */
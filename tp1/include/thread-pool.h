@@ -0,0 +1,49 @@
+#ifndef INCLUDE_THREAD_POOL_H_
+#define INCLUDE_THREAD_POOL_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "parallel-for.h"
+
+/*
+ * Persistent workers sharing parallel_for jobs with the calling thread, which
+ * takes ranges too instead of sleeping until the job is done. Ranges are
+ * claimed from an atomic counter so faster threads pick up more of them.
+ * Jobs submitted concurrently by several threads run one after the other.
+ */
+
+typedef struct thread_pool {
+    pthread_mutex_t run_mutex; /* serializes jobs */
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    bool stop;
+
+    /* current job, `generation` changes every time a new one is published */
+    size_t generation;
+    parallel_for_fn_t fn;
+    void* args;
+    size_t count;
+    size_t chunk;
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+    size_t finished_chunks; /* protected by `mutex`, like `busy` */
+    size_t busy;            /* workers that joined the current job and haven't left it yet */
+
+    pthread_t* tids;
+    size_t num_threads;
+} thread_pool_t;
+
+/* `num_threads` workers on top of the calling thread, 0 means one thread per CPU in total */
+thread_pool_t* thread_pool_create(size_t num_threads);
+void thread_pool_destroy(thread_pool_t* pool);
+
+void thread_pool_run(thread_pool_t* pool, size_t count, size_t grain, parallel_for_fn_t fn, void* args);
+
+/* executor handing jobs to `pool` */
+parallel_for_t thread_pool_parallel_for(thread_pool_t* pool);
+
+#endif /* INCLUDE_THREAD_POOL_H_ */
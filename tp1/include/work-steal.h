@@ -0,0 +1,43 @@
+#ifndef INCLUDE_WORK_STEAL_H_
+#define INCLUDE_WORK_STEAL_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Work-stealing task scheduler. Every worker owns a Chase-Lev deque: it
+ * pushes and takes its own tasks at the bottom (last spawned runs first,
+ * while its data is still in cache) and idle workers steal the oldest ones at
+ * the top of a random victim. Workers that find nothing to run or steal for
+ * a while park on a futex and are woken by the next spawn.
+ *
+ * Tasks are embedded in the caller's structures and never copied. A task
+ * spawned from a worker goes to that worker's deque, one spawned from any
+ * other thread goes to a shared injection list. A task may spawn itself again
+ * as its own continuation, but must not touch itself after spawning.
+ */
+
+typedef struct work_steal work_steal_t;
+typedef struct work_steal_task work_steal_task_t;
+
+typedef void (*work_steal_fn_t)(work_steal_t* ws, work_steal_task_t* task);
+
+struct work_steal_task {
+    work_steal_fn_t run;
+    work_steal_task_t* next; /* in the injection list */
+};
+
+/* `num_threads` workers, 0 means one per CPU */
+work_steal_t* work_steal_create(size_t num_threads);
+void work_steal_destroy(work_steal_t* ws);
+
+size_t work_steal_num_threads(work_steal_t* ws);
+
+void work_steal_spawn(work_steal_t* ws, work_steal_task_t* task);
+
+/* blocks until every task spawned, and every task they spawned, has run */
+void work_steal_wait(work_steal_t* ws);
+
+void work_steal_print_stats(work_steal_t* ws, FILE* file);
+
+#endif /* INCLUDE_WORK_STEAL_H_ */
@@ -0,0 +1,362 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "filter-simd.h"
+#include "filter.h"
+#include "image-pool.h"
+#include "log.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_BLUR_X86
+#endif
+
+/*
+ * Box blurs of any radius from running sums, separable: every source row is
+ * first summed horizontally over its 2r + 1 window into 16-bit intermediates
+ * (255 * 201 fits), adding the channel entering the window and removing the
+ * one leaving it, then a window of 2r + 1 of those rows slides down the image
+ * the same way, so each pixel costs the same whatever the radius. Edge pixels
+ * repeat, alpha is blurred like the other channels.
+ *
+ * The horizontal pass keeps the four sums of a pixel in one SSE4.1 register.
+ * The vertical pass runs in strips of BLUR_STRIP channels, each one going down
+ * every row with its own accumulators, so no band pays for priming a window.
+ * It divides by (2r + 1)^2 and slides 8 (SSE4.1) or 16 (AVX2) channels per
+ * step. The division multiplies by a reciprocal a little above 1 / area in
+ * double, exact for every sum below 2^24 and the same on every instruction set.
+ *
+ * The Gaussian is three box blurs whose radii give the closest variance, see
+ * filter_gaussian_blur_radii(), with the frame rounded to bytes between them.
+ */
+
+#define BLUR_STRIP 256
+
+typedef struct blur_rows_args {
+    const image_t* src;
+    image_t* dst;
+    size_t radius;
+    uint16_t* sums; /* the source rows summed horizontally, 4 * width channels each */
+    uint32_t half;  /* rounds the quotient to nearest, area / 2 */
+    double inverse;
+} blur_rows_args_t;
+
+/* sums of the 2r + 1 window of every pixel from `begin` on, `sum` holds the one of pixel `begin` */
+static void blur_horizontal_scalar(const unsigned char* in, uint16_t* out, unsigned int sum[4], size_t radius,
+                                   size_t begin, size_t width) {
+    for (size_t x = begin; x < width; x++) {
+        size_t enter = (x + radius + 1 < width) ? x + radius + 1 : width - 1;
+        size_t leave = (x > radius) ? x - radius : 0;
+
+        for (int c = 0; c < 4; c++) {
+            out[4 * x + c] = sum[c];
+            sum[c] += in[4 * enter + c] - in[4 * leave + c];
+        }
+    }
+}
+
+static void blur_slide_scalar(uint32_t* acc, const uint16_t* enter, const uint16_t* leave, unsigned char* out,
+                              uint32_t half, double inverse, size_t begin, size_t count) {
+    for (size_t n = begin; n < count; n++) {
+        out[n] = (unsigned char)((double)(acc[n] + half) * inverse);
+        acc[n] += enter[n] - leave[n];
+    }
+}
+
+#ifdef FILTER_BLUR_X86
+
+/* the four channels of a pixel in one register, over the columns whose window doesn't cross the right edge */
+__attribute__((target("sse4.1"))) static size_t blur_horizontal_sse41(const unsigned char* in, uint16_t* out,
+                                                                      unsigned int sum[4], size_t radius,
+                                                                      size_t width) {
+    __m128i total = _mm_loadu_si128((const __m128i*)sum);
+
+    size_t x = 0;
+    for (; x + radius + 1 < width; x++) {
+        size_t leave  = (x > radius) ? x - radius : 0;
+        __m128i enter = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int*)&in[4 * (x + radius + 1)]));
+        __m128i old   = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int*)&in[4 * leave]));
+
+        _mm_storel_epi64((__m128i*)&out[4 * x], _mm_packus_epi32(total, total));
+        total = _mm_sub_epi32(_mm_add_epi32(total, enter), old);
+    }
+
+    _mm_storeu_si128((__m128i*)sum, total);
+    return x;
+}
+
+__attribute__((target("sse4.1"))) static size_t blur_slide_sse41(uint32_t* acc, const uint16_t* enter,
+                                                                 const uint16_t* leave, unsigned char* out,
+                                                                 uint32_t half, double inverse, size_t count) {
+    const __m128i rounding = _mm_set1_epi32(half);
+    const __m128d scale    = _mm_set1_pd(inverse);
+
+    size_t n = 0;
+    for (; n + 8 <= count; n += 8) {
+        __m128i a[2], q[2];
+        for (int k = 0; k < 2; k++) {
+            a[k]      = _mm_loadu_si128((const __m128i*)&acc[n + 4 * k]);
+            __m128i t = _mm_add_epi32(a[k], rounding);
+            __m128i l = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtepi32_pd(t), scale));
+            __m128i h = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(t, 8)), scale));
+            q[k]      = _mm_unpacklo_epi64(l, h);
+        }
+
+        __m128i words = _mm_packus_epi32(q[0], q[1]);
+        _mm_storel_epi64((__m128i*)&out[n], _mm_packus_epi16(words, words));
+
+        __m128i in  = _mm_loadu_si128((const __m128i*)&enter[n]);
+        __m128i old = _mm_loadu_si128((const __m128i*)&leave[n]);
+        a[0]        = _mm_sub_epi32(_mm_add_epi32(a[0], _mm_cvtepu16_epi32(in)), _mm_cvtepu16_epi32(old));
+        a[1]        = _mm_sub_epi32(_mm_add_epi32(a[1], _mm_cvtepu16_epi32(_mm_srli_si128(in, 8))),
+                                    _mm_cvtepu16_epi32(_mm_srli_si128(old, 8)));
+        _mm_storeu_si128((__m128i*)&acc[n], a[0]);
+        _mm_storeu_si128((__m128i*)&acc[n + 4], a[1]);
+    }
+    return n;
+}
+
+__attribute__((target("avx2"))) static size_t blur_slide_avx2(uint32_t* acc, const uint16_t* enter,
+                                                              const uint16_t* leave, unsigned char* out, uint32_t half,
+                                                              double inverse, size_t count) {
+    const __m256i rounding = _mm256_set1_epi32(half);
+    const __m256d scale    = _mm256_set1_pd(inverse);
+
+    size_t n = 0;
+    for (; n + 16 <= count; n += 16) {
+        __m256i a[2];
+        __m128i q[4];
+        for (int k = 0; k < 2; k++) {
+            a[k]         = _mm256_loadu_si256((const __m256i*)&acc[n + 8 * k]);
+            __m256i t    = _mm256_add_epi32(a[k], rounding);
+            __m256d l    = _mm256_cvtepi32_pd(_mm256_castsi256_si128(t));
+            __m256d h    = _mm256_cvtepi32_pd(_mm256_extracti128_si256(t, 1));
+            q[2 * k]     = _mm256_cvttpd_epi32(_mm256_mul_pd(l, scale));
+            q[2 * k + 1] = _mm256_cvttpd_epi32(_mm256_mul_pd(h, scale));
+        }
+
+        __m128i words = _mm_packus_epi16(_mm_packus_epi32(q[0], q[1]), _mm_packus_epi32(q[2], q[3]));
+        _mm_storeu_si128((__m128i*)&out[n], words);
+
+        for (int k = 0; k < 2; k++) {
+            __m256i in  = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&enter[n + 8 * k]));
+            __m256i old = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&leave[n + 8 * k]));
+            _mm256_storeu_si256((__m256i*)&acc[n + 8 * k], _mm256_sub_epi32(_mm256_add_epi32(a[k], in), old));
+        }
+    }
+    return n;
+}
+
+#endif /* FILTER_BLUR_X86 */
+
+/* bands of source rows */
+static void blur_horizontal_rows(void* args, size_t begin, size_t end) {
+    const blur_rows_args_t* rows = args;
+    size_t width                 = rows->src->width;
+    size_t radius                = rows->radius;
+
+    for (size_t y = begin; y < end; y++) {
+        const unsigned char* in = rows->src->pixels[y * width].bytes;
+        uint16_t* out           = &rows->sums[4 * y * width];
+
+        unsigned int sum[4];
+        for (int c = 0; c < 4; c++) {
+            sum[c] = (radius + 1) * in[c];
+        }
+        for (size_t i = 1; i <= radius; i++) {
+            size_t x = (i < width) ? i : width - 1;
+            for (int c = 0; c < 4; c++) {
+                sum[c] += in[4 * x + c];
+            }
+        }
+
+        size_t x = 0;
+#ifdef FILTER_BLUR_X86
+        if (filter_simd_get() != FILTER_SIMD_SCALAR) {
+            x = blur_horizontal_sse41(in, out, sum, radius, width);
+        }
+#endif
+        blur_horizontal_scalar(in, out, sum, radius, x, width);
+    }
+}
+
+/* strips of BLUR_STRIP channels, each one slides its window from the top row to the bottom one */
+static void blur_vertical_strips(void* args, size_t begin, size_t end) {
+    const blur_rows_args_t* rows = args;
+    size_t height                = rows->src->height;
+    size_t radius                = rows->radius;
+    size_t channels              = 4 * rows->src->width;
+    filter_simd_t simd           = filter_simd_get();
+
+    for (size_t s = begin; s < end; s++) {
+        size_t first = s * BLUR_STRIP;
+        size_t count = (channels - first < BLUR_STRIP) ? channels - first : BLUR_STRIP;
+        uint32_t acc[BLUR_STRIP];
+
+        const uint16_t* top = &rows->sums[first];
+        for (size_t n = 0; n < count; n++) {
+            acc[n] = (radius + 1) * top[n];
+        }
+        for (size_t i = 1; i <= radius; i++) {
+            const uint16_t* row = &rows->sums[((i < height) ? i : height - 1) * channels + first];
+            for (size_t n = 0; n < count; n++) {
+                acc[n] += row[n];
+            }
+        }
+
+        for (size_t y = 0; y < height; y++) {
+            size_t enter        = (y + radius + 1 < height) ? y + radius + 1 : height - 1;
+            size_t leave        = (y > radius) ? y - radius : 0;
+            const uint16_t* in  = &rows->sums[enter * channels + first];
+            const uint16_t* old = &rows->sums[leave * channels + first];
+            unsigned char* out  = &rows->dst->pixels[y * rows->dst->width].bytes[first];
+
+            size_t n = 0;
+#ifdef FILTER_BLUR_X86
+            if (simd == FILTER_SIMD_AVX2) {
+                n = blur_slide_avx2(acc, in, old, out, rows->half, rows->inverse, count);
+            } else if (simd == FILTER_SIMD_SSE41) {
+                n = blur_slide_sse41(acc, in, old, out, rows->half, rows->inverse, count);
+            }
+#endif
+            blur_slide_scalar(acc, in, old, out, rows->half, rows->inverse, n, count);
+        }
+    }
+}
+
+/* one box blur, `dst` may be `src` since its rows are all summed before any is written */
+static void blur_box_pass(const parallel_for_t* parallel_for, const image_t* src, image_t* dst, size_t radius,
+                          uint16_t* sums) {
+    uint32_t area = (2 * radius + 1) * (2 * radius + 1);
+
+    blur_rows_args_t args = {
+        .src     = src,
+        .dst     = dst,
+        .radius  = radius,
+        .sums    = sums,
+        .half    = area / 2,
+        .inverse = (1.0 + 0x1p-30) / area,
+    };
+
+    size_t strips = (4 * src->width + BLUR_STRIP - 1) / BLUR_STRIP;
+    parallel_for_run(parallel_for, src->height, FILTER_PARALLEL_GRAIN, blur_horizontal_rows, &args);
+    parallel_for_run(parallel_for, strips, 1, blur_vertical_strips, &args);
+}
+
+/*
+ * Sizes of three boxes whose variance is closest to sigma^2, the lower odd
+ * size around the ideal one and the next odd size (Wells, Kovesi).
+ */
+void filter_gaussian_blur_radii(double sigma, size_t radii[3]) {
+    double ideal = sqrt(4 * sigma * sigma + 1);
+    int lower    = (int)floor(ideal);
+    if (lower % 2 == 0) {
+        lower--;
+    }
+
+    int count = (int)round((12 * sigma * sigma - 3 * lower * lower - 12 * lower - 9) / (-4.0 * lower - 4));
+    for (int i = 0; i < 3; i++) {
+        int size = (i < count) ? lower : lower + 2;
+        radii[i] = (size - 1) / 2;
+    }
+}
+
+/* reshapes `dst` like `src` and allocates the horizontal sums, NULL for an empty image */
+static int blur_prepare(const image_t* src, image_t* dst, uint16_t** sums) {
+    if (image_reshape(dst, src->width, src->height) < 0) {
+        return -1;
+    }
+    dst->id = src->id;
+
+    *sums = NULL;
+    if (src->width == 0 || src->height == 0) {
+        return 0;
+    }
+
+    *sums = malloc(4 * src->width * src->height * sizeof(**sums));
+    if (*sums == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        return -1;
+    }
+    return 0;
+}
+
+int filter_box_blur_radius_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst,
+                                    size_t radius) {
+    if (radius > FILTER_BLUR_MAX_RADIUS) {
+        LOG_ERROR("blur radius %ld larger than %d", radius, FILTER_BLUR_MAX_RADIUS);
+        goto fail_exit;
+    }
+
+    uint16_t* sums;
+    if (blur_prepare(src, dst, &sums) < 0) {
+        goto fail_exit;
+    }
+
+    if (sums != NULL) {
+        blur_box_pass(parallel_for, src, dst, radius, sums);
+        free(sums);
+    }
+    return 0;
+
+fail_exit:
+    return -1;
+}
+
+int filter_gaussian_blur_sigma_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst,
+                                        double sigma) {
+    size_t radii[3];
+    if (sigma < 0 || !isfinite(sigma)) {
+        LOG_ERROR("invalid gaussian blur sigma %g", sigma);
+        goto fail_exit;
+    }
+
+    filter_gaussian_blur_radii(sigma, radii);
+    if (radii[2] > FILTER_BLUR_MAX_RADIUS) {
+        LOG_ERROR("gaussian blur sigma %g needs a radius larger than %d", sigma, FILTER_BLUR_MAX_RADIUS);
+        goto fail_exit;
+    }
+
+    uint16_t* sums;
+    if (blur_prepare(src, dst, &sums) < 0) {
+        goto fail_exit;
+    }
+
+    if (sums != NULL) {
+        blur_box_pass(parallel_for, src, dst, radii[0], sums);
+        blur_box_pass(parallel_for, dst, dst, radii[1], sums);
+        blur_box_pass(parallel_for, dst, dst, radii[2], sums);
+        free(sums);
+    }
+    return 0;
+
+fail_exit:
+    return -1;
+}
+
+image_t* filter_box_blur_radius_pool(image_pool_t* pool, image_t* image, size_t radius) {
+    image_t* new_image = image_pool_acquire(pool, image->id, image->width, image->height);
+    if (new_image != NULL && filter_box_blur_radius_parallel(NULL, image, new_image, radius) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_gaussian_blur_sigma_pool(image_pool_t* pool, image_t* image, double sigma) {
+    image_t* new_image = image_pool_acquire(pool, image->id, image->width, image->height);
+    if (new_image != NULL && filter_gaussian_blur_sigma_parallel(NULL, image, new_image, sigma) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_box_blur_radius(image_t* image, size_t radius) {
+    return filter_box_blur_radius_pool(NULL, image, radius);
+}
+
+image_t* filter_gaussian_blur_sigma(image_t* image, double sigma) {
+    return filter_gaussian_blur_sigma_pool(NULL, image, sigma);
+}
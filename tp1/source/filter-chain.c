@@ -0,0 +1,168 @@
+#include <stdint.h>
+
+#include "filter.h"
+#include "log.h"
+
+int filter_step_apply_into(const filter_step_t* step, const image_t* src, image_t* dst) {
+    return filter_step_apply_parallel(NULL, step, src, dst);
+}
+
+int filter_step_apply_parallel(const parallel_for_t* parallel_for, const filter_step_t* step, const image_t* src,
+                               image_t* dst) {
+    switch (step->kind) {
+    case FILTER_SCALE_UP:
+        return filter_scale_up_mode_parallel(parallel_for, src, dst, step->factor, step->scale_mode);
+    case FILTER_SOBEL:
+        return filter_sobel_parallel(parallel_for, src, dst);
+    case FILTER_TO_HSV:
+        return filter_to_hsv_parallel(parallel_for, src, dst);
+    case FILTER_TO_RGB:
+        return filter_to_rgb_parallel(parallel_for, src, dst);
+    case FILTER_ADD_PIXEL:
+        return filter_add_pixel_parallel(parallel_for, src, dst, &step->add_pixel);
+    case FILTER_DESATURATE:
+        return filter_desaturate_parallel(parallel_for, src, dst);
+    case FILTER_CONVOLUTION33:
+        return filter_convolution33_parallel(parallel_for, src, dst, step->m);
+    case FILTER_EDGE_IDENTITY:
+        return filter_edge_identity_parallel(parallel_for, src, dst);
+    case FILTER_EDGE_DETECT:
+        return filter_edge_detect_parallel(parallel_for, src, dst);
+    case FILTER_SHARPEN:
+        return filter_sharpen_parallel(parallel_for, src, dst);
+    case FILTER_BOX_BLUR:
+        return filter_box_blur_parallel(parallel_for, src, dst);
+    case FILTER_GAUSSIAN_BLUR:
+        return filter_gaussian_blur_parallel(parallel_for, src, dst);
+    case FILTER_HORIZONTAL_FLIP:
+        return filter_horizontal_flip_parallel(parallel_for, src, dst);
+    case FILTER_VERTICAL_FLIP:
+        return filter_vertical_flip_parallel(parallel_for, src, dst);
+    case FILTER_CROP:
+        return filter_crop_parallel(parallel_for, src, dst, step->crop.x, step->crop.y, step->crop.width,
+                                    step->crop.height);
+    case FILTER_BOX_BLUR_RADIUS:
+        return filter_box_blur_radius_parallel(parallel_for, src, dst, step->radius);
+    case FILTER_GAUSSIAN_BLUR_SIGMA:
+        return filter_gaussian_blur_sigma_parallel(parallel_for, src, dst, step->sigma);
+    }
+
+    LOG_ERROR("unknown filter %d", step->kind);
+    return -1;
+}
+
+int filter_step_output_size(const filter_step_t* step, size_t width, size_t height, size_t* out_width,
+                            size_t* out_height) {
+    switch (step->kind) {
+    case FILTER_SCALE_UP:
+        if (step->factor != 0 && (width > SIZE_MAX / step->factor || height > SIZE_MAX / step->factor)) {
+            LOG_ERROR("scale_up:%ld of a %ldx%ld image overflows", step->factor, width, height);
+            return -1;
+        }
+        *out_width  = step->factor * width;
+        *out_height = step->factor * height;
+        return 0;
+    case FILTER_SOBEL:
+    case FILTER_CONVOLUTION33:
+    case FILTER_EDGE_IDENTITY:
+    case FILTER_EDGE_DETECT:
+    case FILTER_SHARPEN:
+    case FILTER_BOX_BLUR:
+    case FILTER_GAUSSIAN_BLUR:
+        if (width < 2 || height < 2) {
+            LOG_ERROR("image too small (%ldx%ld)", width, height);
+            return -1;
+        }
+        *out_width  = width - 2;
+        *out_height = height - 2;
+        return 0;
+    case FILTER_TO_HSV:
+    case FILTER_TO_RGB:
+    case FILTER_ADD_PIXEL:
+    case FILTER_DESATURATE:
+    case FILTER_HORIZONTAL_FLIP:
+    case FILTER_VERTICAL_FLIP:
+    case FILTER_BOX_BLUR_RADIUS:
+    case FILTER_GAUSSIAN_BLUR_SIGMA:
+        *out_width  = width;
+        *out_height = height;
+        return 0;
+    case FILTER_CROP:
+        if (step->crop.x + step->crop.width > width || step->crop.y + step->crop.height > height) {
+            LOG_ERROR("crop %ldx%ld+%ld+%ld out of a %ldx%ld image", step->crop.width, step->crop.height, step->crop.x,
+                      step->crop.y, width, height);
+            return -1;
+        }
+        *out_width  = step->crop.width;
+        *out_height = step->crop.height;
+        return 0;
+    }
+
+    LOG_ERROR("unknown filter %d", step->kind);
+    return -1;
+}
+
+int filter_chain_output_size(const filter_step_t* steps, size_t num_steps, size_t width, size_t height,
+                             size_t* out_width, size_t* out_height, size_t* max_pixels) {
+    size_t largest = 0;
+
+    for (size_t i = 0; i < num_steps; i++) {
+        if (filter_step_output_size(&steps[i], width, height, &width, &height) < 0) {
+            return -1;
+        }
+        if (height != 0 && width > SIZE_MAX / sizeof(pixel_t) / height) {
+            LOG_ERROR("%ldx%ld image too large", width, height);
+            return -1;
+        }
+        if (width * height > largest) {
+            largest = width * height;
+        }
+    }
+
+    *out_width  = width;
+    *out_height = height;
+    if (max_pixels != NULL) {
+        *max_pixels = largest;
+    }
+    return 0;
+}
+
+image_t* filter_chain_apply(const filter_step_t* steps, size_t num_steps, const image_t* src, image_t* buffers[2]) {
+    return filter_chain_apply_parallel(NULL, steps, num_steps, src, buffers);
+}
+
+image_t* filter_chain_apply_parallel(const parallel_for_t* parallel_for, const filter_step_t* steps, size_t num_steps,
+                                     const image_t* src, image_t* buffers[2]) {
+    if (num_steps == 0) {
+        LOG_ERROR("empty filter chain");
+        goto fail_exit;
+    }
+
+    /* grow both buffers up front so the steps never reallocate halfway through the chain */
+    size_t width, height, max_pixels;
+    if (filter_chain_output_size(steps, num_steps, src->width, src->height, &width, &height, &max_pixels) < 0) {
+        goto fail_exit;
+    }
+
+    for (int b = 0; b < 2; b++) {
+        if (image_reshape(buffers[b], max_pixels, 1) < 0) {
+            goto fail_exit;
+        }
+    }
+
+    const image_t* current = src;
+    image_t* result        = NULL;
+
+    for (size_t i = 0; i < num_steps; i++) {
+        result = buffers[i % 2];
+        if (filter_step_apply_parallel(parallel_for, &steps[i], current, result) < 0) {
+            goto fail_exit;
+        }
+        current = result;
+    }
+
+    return result;
+
+fail_exit:
+    return NULL;
+}
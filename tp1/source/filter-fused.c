@@ -0,0 +1,150 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+#include "image-pool.h"
+#include "log.h"
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
+/*
+ * Fused equivalent of filter_sobel(filter_sharpen(filter_scale_up(image, 2))).
+ *
+ * The upscaled image is never materialized: a sharpened row only depends on
+ * three source rows, and a sobel row only depends on three sharpened rows, so
+ * we keep a rolling window of three sharpened rows and emit one output row each
+ * time a new sharpened row is computed. All arithmetic is done on integers,
+ * which gives the same bytes as the double accumulation of filter_convolution33
+ * since every weight involved is an integer.
+ */
+
+static inline unsigned char clamp_u8(int value) {
+    return (value < 0) ? 0 : ((value > 255) ? 255 : value);
+}
+
+/*
+ * Computes sharpened row `b` of the upscaled image. Each sharpened pixel reads
+ * the upscaled pixels U(a+1, b), U(a, b+1), U(a+1, b+1), U(a+2, b+1) and
+ * U(a+1, b+2) where U(u, v) = src(u / 2, v / 2), so an even/odd pair of output
+ * pixels always maps to the source columns t and t + 1.
+ */
+static void sharpen_row_scale2(const pixel_t* r0, const pixel_t* r1, const pixel_t* r2, size_t width, pixel_t* out) {
+    for (size_t t = 0; t + 1 < width; t++) {
+        pixel_t* even = &out[2 * t];
+        pixel_t* odd  = &out[2 * t + 1];
+
+        for (int k = 0; k < 3; k++) {
+            int center = r1[t].bytes[k];
+            int right  = r1[t + 1].bytes[k];
+
+            even->bytes[k] = clamp_u8(9 * center - 2 * (r0[t].bytes[k] + center + right + r2[t].bytes[k]));
+            odd->bytes[k]  = clamp_u8(9 * right - 2 * (r0[t + 1].bytes[k] + center + right + r2[t + 1].bytes[k]));
+        }
+
+        even->bytes[3] = r1[t].bytes[3];
+        odd->bytes[3]  = r1[t + 1].bytes[3];
+    }
+}
+
+static void sobel_row(const pixel_t* s0, const pixel_t* s1, const pixel_t* s2, size_t width, pixel_t* out) {
+    for (size_t x = 0; x + 2 < width; x++) {
+        for (int k = 0; k < 3; k++) {
+            int gx = (s0[x].bytes[k] + 2 * s1[x].bytes[k] + s2[x].bytes[k]) -
+                     (s0[x + 2].bytes[k] + 2 * s1[x + 2].bytes[k] + s2[x + 2].bytes[k]);
+            int gy = (s0[x].bytes[k] + 2 * s0[x + 1].bytes[k] + s0[x + 2].bytes[k]) -
+                     (s2[x].bytes[k] + 2 * s2[x + 1].bytes[k] + s2[x + 2].bytes[k]);
+
+            out[x].bytes[k] = min(abs(gx) + abs(gy), 255);
+        }
+
+        out[x].bytes[3] = s1[x + 1].bytes[3];
+    }
+}
+
+typedef struct fused_rows_args {
+    const image_t* src;
+    image_t* dst;
+    atomic_bool failed;
+} fused_rows_args_t;
+
+/*
+ * Bands of output rows, output row r needs sharpened rows r to r + 2 so every
+ * band primes its own window with two sharpened rows before emitting anything.
+ */
+static void fused_rows(void* args, size_t begin, size_t end) {
+    fused_rows_args_t* rows = args;
+    const image_t* src      = rows->src;
+    image_t* dst            = rows->dst;
+    size_t sharp_width      = 2 * src->width - 2;
+
+    pixel_t* window = malloc(3 * sharp_width * sizeof(*window));
+    if (window == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        atomic_store(&rows->failed, true);
+        return;
+    }
+
+    pixel_t* sharp[3] = {&window[0], &window[sharp_width], &window[2 * sharp_width]};
+
+    for (size_t b = begin; b < end + 2; b++) {
+        const pixel_t* r0 = &src->pixels[(b / 2) * src->width];
+        const pixel_t* r1 = &src->pixels[((b + 1) / 2) * src->width];
+        const pixel_t* r2 = &src->pixels[((b + 2) / 2) * src->width];
+
+        sharpen_row_scale2(r0, r1, r2, src->width, sharp[b % 3]);
+
+        if (b >= begin + 2) {
+            sobel_row(sharp[(b - 2) % 3], sharp[(b - 1) % 3], sharp[b % 3], sharp_width,
+                      &dst->pixels[(b - 2) * dst->width]);
+        }
+    }
+
+    free(window);
+}
+
+int filter_chain_scale2_sharpen_sobel_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    if (src->width < 2 || src->height < 2) {
+        LOG_ERROR("image too small (%ldx%ld)", src->width, src->height);
+        goto fail_exit;
+    }
+
+    if (image_reshape(dst, 2 * src->width - 4, 2 * src->height - 4) < 0) {
+        goto fail_exit;
+    }
+    dst->id = src->id;
+
+    fused_rows_args_t args = {.src = src, .dst = dst};
+    atomic_init(&args.failed, false);
+
+    parallel_for_run(parallel_for, dst->height, FILTER_PARALLEL_GRAIN, fused_rows, &args);
+    if (atomic_load(&args.failed)) {
+        goto fail_exit;
+    }
+
+    return 0;
+
+fail_exit:
+    return -1;
+}
+
+int filter_chain_scale2_sharpen_sobel_into(const image_t* src, image_t* dst) {
+    return filter_chain_scale2_sharpen_sobel_parallel(NULL, src, dst);
+}
+
+image_t* filter_chain_scale2_sharpen_sobel_pool(image_pool_t* pool, image_t* image) {
+    size_t width  = (image->width >= 2) ? 2 * image->width - 4 : 0;
+    size_t height = (image->height >= 2) ? 2 * image->height - 4 : 0;
+
+    image_t* new_image = image_pool_acquire(pool, image->id, width, height);
+    if (new_image != NULL && filter_chain_scale2_sharpen_sobel_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_chain_scale2_sharpen_sobel(image_t* image) {
+    return filter_chain_scale2_sharpen_sobel_pool(NULL, image);
+}
@@ -0,0 +1,470 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "filter-graph.h"
+#include "filter-planar.h"
+#include "filter-view.h"
+#include "image-pool.h"
+#include "log.h"
+
+#define FILTER_GRAPH_SPEC_SIZE 1024
+
+static const struct {
+    const char* name;
+    filter_kind_t kind;
+} filter_names[] = {
+    {"scale_up", FILTER_SCALE_UP},
+    {"sobel", FILTER_SOBEL},
+    {"to_hsv", FILTER_TO_HSV},
+    {"to_rgb", FILTER_TO_RGB},
+    {"add_pixel", FILTER_ADD_PIXEL},
+    {"desaturate", FILTER_DESATURATE},
+    {"convolution33", FILTER_CONVOLUTION33},
+    {"edge_identity", FILTER_EDGE_IDENTITY},
+    {"edge_detect", FILTER_EDGE_DETECT},
+    {"sharpen", FILTER_SHARPEN},
+    {"box_blur", FILTER_BOX_BLUR},
+    {"gaussian_blur", FILTER_GAUSSIAN_BLUR},
+    {"horizontal_flip", FILTER_HORIZONTAL_FLIP},
+    {"vertical_flip", FILTER_VERTICAL_FLIP},
+    {"crop", FILTER_CROP},
+    {"box_blur_radius", FILTER_BOX_BLUR_RADIUS},
+    {"gaussian_blur_sigma", FILTER_GAUSSIAN_BLUR_SIGMA},
+};
+
+#define NUM_FILTER_NAMES (sizeof(filter_names) / sizeof(filter_names[0]))
+
+const char* filter_step_name(filter_kind_t kind) {
+    for (size_t i = 0; i < NUM_FILTER_NAMES; i++) {
+        if (filter_names[i].kind == kind) {
+            return filter_names[i].name;
+        }
+    }
+    return "unknown";
+}
+
+bool filter_step_is_cheap(const filter_step_t* step) {
+    switch (step->kind) {
+    case FILTER_SCALE_UP:
+    case FILTER_ADD_PIXEL:
+    case FILTER_DESATURATE:
+    case FILTER_HORIZONTAL_FLIP:
+    case FILTER_VERTICAL_FLIP:
+    case FILTER_CROP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* splits `arg` on '/' into exactly `count` numbers */
+static int filter_parse_numbers(const char* arg, double* values, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        char* end;
+        values[i] = strtod(arg, &end);
+        if (end == arg || *end != ((i + 1 < count) ? '/' : '\0')) {
+            return -1;
+        }
+        arg = end + 1;
+    }
+    return 0;
+}
+
+static int filter_step_parse(filter_step_t* step, const char* name, const char* arg, filter_scale_mode_t scale_mode) {
+    size_t i = 0;
+    while (i < NUM_FILTER_NAMES && strcmp(filter_names[i].name, name) != 0) {
+        i++;
+    }
+    if (i == NUM_FILTER_NAMES) {
+        LOG_ERROR("unknown filter `%s`", name);
+        return -1;
+    }
+
+    *step = (filter_step_t){.kind = filter_names[i].kind};
+
+    switch (step->kind) {
+    case FILTER_SCALE_UP: {
+        char* end     = NULL;
+        double factor = (arg != NULL) ? strtod(arg, &end) : 0;
+        if (arg == NULL || end == arg || (*end != '\0' && *end != '/') || factor < 1 || factor != (size_t)factor ||
+            factor > FILTER_GRAPH_MAX_FACTOR) {
+            LOG_ERROR("scale_up expects an integer factor up to %d and an optional mode, e.g. scale_up:2/bilinear",
+                      FILTER_GRAPH_MAX_FACTOR);
+            return -1;
+        }
+        step->factor     = factor;
+        step->scale_mode = scale_mode;
+        if (*end == '/' && filter_scale_mode_parse(end + 1, &step->scale_mode) < 0) {
+            LOG_ERROR("unknown scale_up mode `%s`, expected nearest, bilinear or bicubic", end + 1);
+            return -1;
+        }
+        return 0;
+    }
+    case FILTER_ADD_PIXEL: {
+        double rgb[3];
+        if (arg == NULL || filter_parse_numbers(arg, rgb, 3) < 0) {
+            LOG_ERROR("add_pixel expects three values, e.g. add_pixel:10/0/0");
+            return -1;
+        }
+        for (int k = 0; k < 3; k++) {
+            if (rgb[k] < 0 || rgb[k] > 255) {
+                LOG_ERROR("add_pixel values must be between 0 and 255");
+                return -1;
+            }
+            step->add_pixel.bytes[k] = rgb[k];
+        }
+        return 0;
+    }
+    case FILTER_CONVOLUTION33:
+        if (arg == NULL || filter_parse_numbers(arg, &step->m[0][0], 9) < 0) {
+            LOG_ERROR("convolution33 expects nine weights row by row, e.g. convolution33:0/0/0/0/1/0/0/0/0");
+            return -1;
+        }
+        return 0;
+    case FILTER_CROP: {
+        double rect[4];
+        if (arg == NULL || filter_parse_numbers(arg, rect, 4) < 0) {
+            LOG_ERROR("crop expects a position and a size, e.g. crop:16/16/320/240");
+            return -1;
+        }
+        for (int k = 0; k < 4; k++) {
+            if (rect[k] < 0 || rect[k] != (size_t)rect[k]) {
+                LOG_ERROR("crop values must be non-negative integers");
+                return -1;
+            }
+        }
+        step->crop.x      = rect[0];
+        step->crop.y      = rect[1];
+        step->crop.width  = rect[2];
+        step->crop.height = rect[3];
+        return 0;
+    }
+    case FILTER_BOX_BLUR_RADIUS: {
+        double radius;
+        if (arg == NULL || filter_parse_numbers(arg, &radius, 1) < 0 || radius < 0 || radius != (size_t)radius ||
+            radius > FILTER_BLUR_MAX_RADIUS) {
+            LOG_ERROR("box_blur_radius expects an integer radius up to %d, e.g. box_blur_radius:8",
+                      FILTER_BLUR_MAX_RADIUS);
+            return -1;
+        }
+        step->radius = radius;
+        return 0;
+    }
+    case FILTER_GAUSSIAN_BLUR_SIGMA:
+        /* the boxes of a Gaussian are at most sigma + 1 wide on each side */
+        if (arg == NULL || filter_parse_numbers(arg, &step->sigma, 1) < 0 || !(step->sigma >= 0) ||
+            step->sigma > FILTER_BLUR_MAX_RADIUS - 1) {
+            LOG_ERROR("gaussian_blur_sigma expects a standard deviation up to %d, e.g. gaussian_blur_sigma:4.5",
+                      FILTER_BLUR_MAX_RADIUS - 1);
+            return -1;
+        }
+        return 0;
+    default:
+        if (arg != NULL) {
+            LOG_ERROR("filter `%s` takes no argument", name);
+            return -1;
+        }
+        return 0;
+    }
+}
+
+static bool filter_graph_is_scale2_sharpen_sobel(const filter_graph_t* graph, size_t i) {
+    return i + 2 < graph->num_steps && graph->steps[i].kind == FILTER_SCALE_UP && graph->steps[i].factor == 2 &&
+           graph->steps[i].scale_mode == FILTER_SCALE_NEAREST && graph->steps[i + 1].kind == FILTER_SHARPEN &&
+           graph->steps[i + 2].kind == FILTER_SOBEL;
+}
+
+static void filter_stage_append(filter_stage_t* stage, const filter_step_t* step) {
+    size_t length = strlen(stage->name);
+    snprintf(&stage->name[length], sizeof(stage->name) - length, "%s%s", (length > 0) ? "+" : "",
+             filter_step_name(step->kind));
+    stage->num_steps++;
+}
+
+/* lazy steps from `i` on and the step reading through them, 0 without such a step to replace their copies */
+static size_t filter_graph_view_length(const filter_graph_t* graph, size_t i) {
+    size_t end = i;
+    while (end < graph->num_steps && filter_view_is_lazy(&graph->steps[end])) {
+        end++;
+    }
+    if (end == i || end == graph->num_steps || !filter_view_reads(&graph->steps[end])) {
+        return 0;
+    }
+    return end + 1 - i;
+}
+
+static void filter_graph_plan(filter_graph_t* graph, bool fuse, bool planar, bool views) {
+    graph->num_stages     = 0;
+    filter_stage_t* stage = NULL;
+
+    for (size_t i = 0; i < graph->num_steps; i++) {
+        if (fuse && filter_graph_is_scale2_sharpen_sobel(graph, i)) {
+            stage  = &graph->stages[graph->num_stages++];
+            *stage = (filter_stage_t){.kind = FILTER_STAGE_SCALE2_SHARPEN_SOBEL, .steps = &graph->steps[i]};
+            snprintf(stage->name, sizeof(stage->name), "fused");
+            stage->num_steps = 3;
+
+            /* nothing merges into a fused stage */
+            stage = NULL;
+            i += 2;
+            continue;
+        }
+
+        size_t length = views ? filter_graph_view_length(graph, i) : 0;
+        if (length > 0) {
+            stage  = &graph->stages[graph->num_stages++];
+            *stage = (filter_stage_t){.kind = FILTER_STAGE_VIEW, .steps = &graph->steps[i]};
+            for (size_t k = 0; k < length; k++) {
+                filter_stage_append(stage, &graph->steps[i + k]);
+            }
+
+            /* the step after the view starts a stage of its own */
+            stage = NULL;
+            i += length - 1;
+            continue;
+        }
+
+        if (planar && filter_planar_supports(&graph->steps[i])) {
+            if (stage == NULL || stage->kind != FILTER_STAGE_PLANAR) {
+                stage  = &graph->stages[graph->num_stages++];
+                *stage = (filter_stage_t){.kind = FILTER_STAGE_PLANAR, .steps = &graph->steps[i]};
+            }
+            filter_stage_append(stage, &graph->steps[i]);
+            continue;
+        }
+
+        /* the steps after a planar run start a stage of their own */
+        if (stage != NULL && stage->kind == FILTER_STAGE_PLANAR) {
+            stage = NULL;
+        }
+
+        bool cheap = filter_step_is_cheap(&graph->steps[i]);
+        if (stage == NULL || !cheap || !filter_step_is_cheap(&stage->steps[stage->num_steps - 1])) {
+            stage  = &graph->stages[graph->num_stages++];
+            *stage = (filter_stage_t){.kind = FILTER_STAGE_STEPS, .steps = &graph->steps[i]};
+        }
+        filter_stage_append(stage, &graph->steps[i]);
+
+        /* an expensive step ends its stage */
+        if (!cheap) {
+            stage = NULL;
+        }
+    }
+}
+
+int filter_graph_parse(filter_graph_t* graph, const char* spec, bool fuse, bool planar, bool views,
+                       filter_scale_mode_t scale_mode) {
+    char buffer[FILTER_GRAPH_SPEC_SIZE];
+    if (snprintf(buffer, sizeof(buffer), "%s", spec) >= sizeof(buffer)) {
+        LOG_ERROR("filter chain too long");
+        goto fail_exit;
+    }
+
+    graph->num_steps = 0;
+
+    char* save;
+    for (char* item = strtok_r(buffer, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        if (graph->num_steps == FILTER_GRAPH_MAX_STEPS) {
+            LOG_ERROR("more than %d filters", FILTER_GRAPH_MAX_STEPS);
+            goto fail_exit;
+        }
+
+        char* arg = strchr(item, ':');
+        if (arg != NULL) {
+            *arg++ = '\0';
+        }
+
+        if (filter_step_parse(&graph->steps[graph->num_steps], item, arg, scale_mode) < 0) {
+            goto fail_exit;
+        }
+        graph->num_steps++;
+    }
+
+    if (graph->num_steps == 0) {
+        LOG_ERROR("empty filter chain");
+        goto fail_exit;
+    }
+
+    filter_graph_plan(graph, fuse, planar, views);
+    return 0;
+
+fail_exit:
+    return -1;
+}
+
+int filter_stage_output_size(const filter_stage_t* stage, size_t width, size_t height, size_t* out_width,
+                             size_t* out_height) {
+    return filter_chain_output_size(stage->steps, stage->num_steps, width, height, out_width, out_height, NULL);
+}
+
+image_t* filter_stage_apply_parallel(const parallel_for_t* parallel_for, const filter_stage_t* stage,
+                                     const image_t* src, image_t* buffers[2]) {
+    if (stage->kind == FILTER_STAGE_SCALE2_SHARPEN_SOBEL) {
+        if (filter_chain_scale2_sharpen_sobel_parallel(parallel_for, src, buffers[0]) < 0) {
+            return NULL;
+        }
+        return buffers[0];
+    }
+
+    if (stage->kind == FILTER_STAGE_PLANAR) {
+        return filter_planar_chain_apply_parallel(parallel_for, stage->steps, stage->num_steps, src, buffers);
+    }
+
+    if (stage->kind == FILTER_STAGE_VIEW) {
+        if (filter_view_steps_apply_parallel(parallel_for, stage->steps, stage->num_steps, src, buffers[0]) < 0) {
+            return NULL;
+        }
+        return buffers[0];
+    }
+
+    return filter_chain_apply_parallel(parallel_for, stage->steps, stage->num_steps, src, buffers);
+}
+
+void filter_graph_stage_buffers(image_t* buffers[3], const image_t* current, image_t* pair[2]) {
+    size_t count = 0;
+    for (int b = 0; b < 3 && count < 2; b++) {
+        if (buffers[b] != current) {
+            pair[count++] = buffers[b];
+        }
+    }
+}
+
+static uint64_t filter_graph_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+image_t* filter_graph_apply_parallel(const parallel_for_t* parallel_for, const filter_graph_t* graph,
+                                     const image_t* src, image_t* buffers[3], uint64_t* stage_ns) {
+    const image_t* current = src;
+    image_t* result        = NULL;
+    uint64_t start         = (stage_ns != NULL) ? filter_graph_now() : 0;
+
+    for (size_t i = 0; i < graph->num_stages; i++) {
+        image_t* pair[2];
+        filter_graph_stage_buffers(buffers, current, pair);
+
+        result = filter_stage_apply_parallel(parallel_for, &graph->stages[i], current, pair);
+        if (result == NULL) {
+            return NULL;
+        }
+        current = result;
+
+        if (stage_ns != NULL) {
+            uint64_t end = filter_graph_now();
+            stage_ns[i]  = end - start;
+            start        = end;
+        }
+    }
+
+    return result;
+}
+
+/* the planes of both ping-pong buffers live in pooled images, the one not holding the result goes back */
+static image_t* filter_stage_apply_planar_pool(image_pool_t* pool, const filter_stage_t* stage, const image_t* src) {
+    size_t width, height;
+    if (filter_stage_output_size(stage, src->width, src->height, &width, &height) < 0) {
+        goto fail_exit;
+    }
+
+    image_t* buffers[2];
+    buffers[0] = image_pool_acquire(pool, src->id, width, height);
+    if (buffers[0] == NULL) {
+        goto fail_exit;
+    }
+    buffers[1] = image_pool_acquire(pool, src->id, width, height);
+    if (buffers[1] == NULL) {
+        goto fail_destroy_buffer;
+    }
+
+    image_t* result = filter_planar_chain_apply_parallel(NULL, stage->steps, stage->num_steps, src, buffers);
+    if (result == NULL) {
+        goto fail_destroy_buffers;
+    }
+
+    image_t* other = (result == buffers[0]) ? buffers[1] : buffers[0];
+    image_reshape(other, width, height);
+    image_destroy(other);
+    return result;
+
+fail_destroy_buffers:
+    image_reshape(buffers[1], width, height);
+    image_destroy(buffers[1]);
+fail_destroy_buffer:
+    image_reshape(buffers[0], width, height);
+    image_destroy(buffers[0]);
+fail_exit:
+    return NULL;
+}
+
+/* a view stage writes only its output */
+static image_t* filter_stage_apply_view_pool(image_pool_t* pool, const filter_stage_t* stage, const image_t* src) {
+    size_t width, height;
+    if (filter_stage_output_size(stage, src->width, src->height, &width, &height) < 0) {
+        goto fail_exit;
+    }
+
+    image_t* result = image_pool_acquire(pool, src->id, width, height);
+    if (result == NULL) {
+        goto fail_exit;
+    }
+
+    if (filter_view_steps_apply_parallel(NULL, stage->steps, stage->num_steps, src, result) < 0) {
+        goto fail_destroy_result;
+    }
+    return result;
+
+fail_destroy_result:
+    image_destroy(result);
+fail_exit:
+    return NULL;
+}
+
+image_t* filter_stage_apply_pool(image_pool_t* pool, const filter_stage_t* stage, const image_t* src) {
+    if (stage->kind == FILTER_STAGE_SCALE2_SHARPEN_SOBEL) {
+        return filter_chain_scale2_sharpen_sobel_pool(pool, (image_t*)src);
+    }
+
+    if (stage->kind == FILTER_STAGE_PLANAR) {
+        return filter_stage_apply_planar_pool(pool, stage, src);
+    }
+
+    if (stage->kind == FILTER_STAGE_VIEW) {
+        return filter_stage_apply_view_pool(pool, stage, src);
+    }
+
+    const image_t* current = src;
+    image_t* result        = NULL;
+
+    for (size_t i = 0; i < stage->num_steps; i++) {
+        size_t width, height;
+        if (filter_chain_output_size(&stage->steps[i], 1, current->width, current->height, &width, &height, NULL) < 0) {
+            goto fail_destroy_result;
+        }
+
+        image_t* next = image_pool_acquire(pool, src->id, width, height);
+        if (next == NULL) {
+            goto fail_destroy_result;
+        }
+
+        int ret = filter_step_apply_into(&stage->steps[i], current, next);
+        if (result != NULL) {
+            image_destroy(result);
+        }
+        result  = next;
+        current = next;
+        if (ret < 0) {
+            goto fail_destroy_result;
+        }
+    }
+
+    return result;
+
+fail_destroy_result:
+    if (result != NULL) {
+        image_destroy(result);
+    }
+    return NULL;
+}
@@ -0,0 +1,515 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter-planar.h"
+#include "filter-simd.h"
+#include "log.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_PLANAR_X86
+#endif
+
+/*
+ * Every kernel runs on one plane at a time: the three color planes go through
+ * the same row function and alpha is a memcpy. Vector loops cover 16 (AVX2) or
+ * 8 (SSE4.1) output bytes per iteration on 16-bit lanes, the last columns of
+ * each row and the scalar level use the arithmetic of filter.c as is.
+ */
+
+typedef struct planar_taps {
+    int count;
+    int dx[9]; /* 0 to 2, from the top left corner of the neighbourhood */
+    int dy[9];
+    short weight[9]; /* times 2^shift, fixed point only */
+    double value[9];
+    bool fixed;
+    int shift;
+} planar_taps_t;
+
+typedef struct filter_planar_rows_args {
+    const image_planar_t* src;
+    image_planar_t* dst;
+    size_t factor;
+    const planar_taps_t* taps;
+} filter_planar_rows_args_t;
+
+static int filter_planar_reshape(const image_planar_t* src, image_planar_t* dst, size_t width, size_t height) {
+    dst->id = src->id;
+    return image_planar_reshape(dst, width, height);
+}
+
+static int filter_planar_reshape_border(const image_planar_t* src, image_planar_t* dst) {
+    if (src->width < 2 || src->height < 2) {
+        LOG_ERROR("image too small (%ldx%ld)", src->width, src->height);
+        return -1;
+    }
+    return filter_planar_reshape(src, dst, src->width - 2, src->height - 2);
+}
+
+#ifdef FILTER_PLANAR_X86
+
+__attribute__((target("sse4.1"))) static size_t scale_up2_sse41(const unsigned char* in, unsigned char* out,
+                                                                size_t width) {
+    size_t i = 0;
+    for (; i + 16 <= width; i += 16) {
+        __m128i v = _mm_load_si128((const __m128i*)&in[i]);
+        _mm_store_si128((__m128i*)&out[2 * i], _mm_unpacklo_epi8(v, v));
+        _mm_store_si128((__m128i*)&out[2 * i + 16], _mm_unpackhi_epi8(v, v));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t scale_up2_avx2(const unsigned char* in, unsigned char* out,
+                                                             size_t width) {
+    size_t i = 0;
+    for (; i + 32 <= width; i += 32) {
+        __m256i v  = _mm256_load_si256((const __m256i*)&in[i]);
+        __m256i lo = _mm256_unpacklo_epi8(v, v);
+        __m256i hi = _mm256_unpackhi_epi8(v, v);
+        _mm256_store_si256((__m256i*)&out[2 * i], _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_store_si256((__m256i*)&out[2 * i + 32], _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    return i;
+}
+
+#endif /* FILTER_PLANAR_X86 */
+
+/* bands of source rows, the first output row of each source row is built once and copied `factor` - 1 times */
+static void scale_up_rows(void* args, size_t begin, size_t end) {
+    const filter_planar_rows_args_t* rows = args;
+    const image_planar_t* src             = rows->src;
+    const image_planar_t* dst             = rows->dst;
+    size_t factor                         = rows->factor;
+    filter_simd_t simd                    = filter_simd_get();
+
+    for (size_t j = begin; j < end; j++) {
+        for (int c = 0; c < 4; c++) {
+            const unsigned char* in = image_planar_row(src, c, j);
+            unsigned char* out      = image_planar_row(dst, c, factor * j);
+
+            size_t i = 0;
+#ifdef FILTER_PLANAR_X86
+            if (factor == 2 && simd == FILTER_SIMD_AVX2) {
+                i = scale_up2_avx2(in, out, src->width);
+            } else if (factor == 2 && simd == FILTER_SIMD_SSE41) {
+                i = scale_up2_sse41(in, out, src->width);
+            }
+#endif
+            for (; i < src->width; i++) {
+                memset(&out[factor * i], in[i], factor);
+            }
+
+            for (size_t k = 1; k < factor; k++) {
+                memcpy(image_planar_row(dst, c, factor * j + k), out, dst->width);
+            }
+        }
+    }
+}
+
+int filter_planar_scale_up_parallel(const parallel_for_t* parallel_for, const image_planar_t* src, image_planar_t* dst,
+                                    size_t factor) {
+    if (filter_planar_reshape(src, dst, factor * src->width, factor * src->height) < 0) {
+        return -1;
+    }
+
+    filter_planar_rows_args_t args = {.src = src, .dst = dst, .factor = factor};
+    parallel_for_run(parallel_for, src->height, FILTER_PARALLEL_GRAIN, scale_up_rows, &args);
+    return 0;
+}
+
+/* output rows of a 3x3 kernel read the source rows `j` to `j + 2`, alpha comes from the center */
+static void copy_alpha_row(const image_planar_t* src, const image_planar_t* dst, size_t j) {
+    memcpy(image_planar_row(dst, IMAGE_PLANAR_A, j), image_planar_row(src, IMAGE_PLANAR_A, j + 1) + 1, dst->width);
+}
+
+static void sobel_row_scalar(const unsigned char* r0, const unsigned char* r1, const unsigned char* r2,
+                             unsigned char* out, size_t begin, size_t width) {
+    for (size_t x = begin; x < width; x++) {
+        int gx = (r0[x] - r0[x + 2]) + 2 * (r1[x] - r1[x + 2]) + (r2[x] - r2[x + 2]);
+        int gy = (r0[x] + 2 * r0[x + 1] + r0[x + 2]) - (r2[x] + 2 * r2[x + 1] + r2[x + 2]);
+        int g  = abs(gx) + abs(gy);
+
+        out[x] = (g > 255) ? 255 : g;
+    }
+}
+
+#ifdef FILTER_PLANAR_X86
+
+#define LOAD8_EPI16(p) _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(p)))
+#define LOAD16_EPI16(p) _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(p)))
+
+/* |gx| + |gy| is at most 2040, packus saturates it to 255 like the scalar clamp */
+__attribute__((target("sse4.1"))) static size_t sobel_row_sse41(const unsigned char* r0, const unsigned char* r1,
+                                                                const unsigned char* r2, unsigned char* out,
+                                                                size_t width) {
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i a0 = LOAD8_EPI16(&r0[x]), a1 = LOAD8_EPI16(&r0[x + 1]), a2 = LOAD8_EPI16(&r0[x + 2]);
+        __m128i b0 = LOAD8_EPI16(&r1[x]), b2 = LOAD8_EPI16(&r1[x + 2]);
+        __m128i c0 = LOAD8_EPI16(&r2[x]), c1 = LOAD8_EPI16(&r2[x + 1]), c2 = LOAD8_EPI16(&r2[x + 2]);
+
+        __m128i b  = _mm_sub_epi16(b0, b2);
+        __m128i gx = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(a0, a2), _mm_add_epi16(b, b)), _mm_sub_epi16(c0, c2));
+        __m128i gy = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(a0, a2), _mm_add_epi16(a1, a1)),
+                                   _mm_add_epi16(_mm_add_epi16(c0, c2), _mm_add_epi16(c1, c1)));
+
+        __m128i g = _mm_add_epi16(_mm_abs_epi16(gx), _mm_abs_epi16(gy));
+        _mm_storel_epi64((__m128i*)&out[x], _mm_packus_epi16(g, g));
+    }
+    return x;
+}
+
+__attribute__((target("avx2"))) static size_t sobel_row_avx2(const unsigned char* r0, const unsigned char* r1,
+                                                             const unsigned char* r2, unsigned char* out,
+                                                             size_t width) {
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i a0 = LOAD16_EPI16(&r0[x]), a1 = LOAD16_EPI16(&r0[x + 1]), a2 = LOAD16_EPI16(&r0[x + 2]);
+        __m256i b0 = LOAD16_EPI16(&r1[x]), b2 = LOAD16_EPI16(&r1[x + 2]);
+        __m256i c0 = LOAD16_EPI16(&r2[x]), c1 = LOAD16_EPI16(&r2[x + 1]), c2 = LOAD16_EPI16(&r2[x + 2]);
+
+        __m256i b  = _mm256_sub_epi16(b0, b2);
+        __m256i gx = _mm256_add_epi16(_mm256_add_epi16(_mm256_sub_epi16(a0, a2), _mm256_add_epi16(b, b)),
+                                      _mm256_sub_epi16(c0, c2));
+        __m256i gy = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(a0, a2), _mm256_add_epi16(a1, a1)),
+                                      _mm256_add_epi16(_mm256_add_epi16(c0, c2), _mm256_add_epi16(c1, c1)));
+
+        /* packus works within 128-bit lanes, the permute brings both halves to the low lane */
+        __m256i g      = _mm256_add_epi16(_mm256_abs_epi16(gx), _mm256_abs_epi16(gy));
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(g, g), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)&out[x], _mm256_castsi256_si128(packed));
+    }
+    return x;
+}
+
+#endif /* FILTER_PLANAR_X86 */
+
+static void sobel_rows(void* args, size_t begin, size_t end) {
+    const filter_planar_rows_args_t* rows = args;
+    const image_planar_t* src             = rows->src;
+    const image_planar_t* dst             = rows->dst;
+    filter_simd_t simd                    = filter_simd_get();
+
+    for (size_t j = begin; j < end; j++) {
+        for (int c = 0; c < 3; c++) {
+            const unsigned char* r0 = image_planar_row(src, c, j);
+            const unsigned char* r1 = image_planar_row(src, c, j + 1);
+            const unsigned char* r2 = image_planar_row(src, c, j + 2);
+            unsigned char* out      = image_planar_row(dst, c, j);
+
+            size_t x = 0;
+#ifdef FILTER_PLANAR_X86
+            if (simd == FILTER_SIMD_AVX2) {
+                x = sobel_row_avx2(r0, r1, r2, out, dst->width);
+            } else if (simd == FILTER_SIMD_SSE41) {
+                x = sobel_row_sse41(r0, r1, r2, out, dst->width);
+            }
+#endif
+            sobel_row_scalar(r0, r1, r2, out, x, dst->width);
+        }
+        copy_alpha_row(src, dst, j);
+    }
+}
+
+int filter_planar_sobel_parallel(const parallel_for_t* parallel_for, const image_planar_t* src, image_planar_t* dst) {
+    if (filter_planar_reshape_border(src, dst) < 0) {
+        return -1;
+    }
+
+    filter_planar_rows_args_t args = {.src = src, .dst = dst};
+    parallel_for_run(parallel_for, dst->height, FILTER_PARALLEL_GRAIN, sobel_rows, &args);
+    return 0;
+}
+
+/* same sums as filter.c, in the same order, zero weights left out since adding them changes nothing */
+static void convolution33_row_scalar(const unsigned char* r[3], const planar_taps_t* taps, unsigned char* out,
+                                     size_t begin, size_t width) {
+    for (size_t x = begin; x < width; x++) {
+        double value = 0;
+        for (int t = 0; t < taps->count; t++) {
+            value += r[taps->dy[t]][x + taps->dx[t]] * taps->value[t];
+        }
+        out[x] = (value < 0) ? 0 : ((value > 255) ? 255 : (unsigned char)value);
+    }
+}
+
+#ifdef FILTER_PLANAR_X86
+
+__attribute__((target("sse4.1"))) static size_t convolution33_row_fixed_sse41(const unsigned char* r[3],
+                                                                              const planar_taps_t* taps,
+                                                                              unsigned char* out, size_t width) {
+    const __m128i count = _mm_cvtsi32_si128(taps->shift);
+    size_t x            = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        __m128i sum = _mm_setzero_si128();
+        for (int t = 0; t < taps->count; t++) {
+            __m128i values = LOAD8_EPI16(&r[taps->dy[t]][x + taps->dx[t]]);
+            sum            = _mm_add_epi16(sum, _mm_mullo_epi16(values, _mm_set1_epi16(taps->weight[t])));
+        }
+
+        sum = _mm_sra_epi16(sum, count);
+        _mm_storel_epi64((__m128i*)&out[x], _mm_packus_epi16(sum, sum));
+    }
+    return x;
+}
+
+__attribute__((target("avx2"))) static size_t convolution33_row_fixed_avx2(const unsigned char* r[3],
+                                                                           const planar_taps_t* taps,
+                                                                           unsigned char* out, size_t width) {
+    const __m128i count = _mm_cvtsi32_si128(taps->shift);
+    size_t x            = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m256i sum = _mm256_setzero_si256();
+        for (int t = 0; t < taps->count; t++) {
+            __m256i values = LOAD16_EPI16(&r[taps->dy[t]][x + taps->dx[t]]);
+            sum            = _mm256_add_epi16(sum, _mm256_mullo_epi16(values, _mm256_set1_epi16(taps->weight[t])));
+        }
+
+        sum            = _mm256_sra_epi16(sum, count);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(sum, sum), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)&out[x], _mm256_castsi256_si128(packed));
+    }
+    return x;
+}
+
+__attribute__((target("sse4.1"))) static size_t convolution33_row_double_sse41(const unsigned char* r[3],
+                                                                               const planar_taps_t* taps,
+                                                                               unsigned char* out, size_t width) {
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d max  = _mm_set1_pd(255);
+    size_t x           = 0;
+
+    for (; x + 2 <= width; x += 2) {
+        __m128d sum = _mm_setzero_pd();
+        for (int t = 0; t < taps->count; t++) {
+            const unsigned char* p = &r[taps->dy[t]][x + taps->dx[t]];
+            __m128d values         = _mm_setr_pd(p[0], p[1]);
+            sum                    = _mm_add_pd(sum, _mm_mul_pd(values, _mm_set1_pd(taps->value[t])));
+        }
+
+        __m128i result = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(sum, zero), max));
+        out[x]         = _mm_cvtsi128_si32(result);
+        out[x + 1]     = _mm_extract_epi32(result, 1);
+    }
+    return x;
+}
+
+__attribute__((target("avx2"))) static size_t convolution33_row_double_avx2(const unsigned char* r[3],
+                                                                            const planar_taps_t* taps,
+                                                                            unsigned char* out, size_t width) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d max  = _mm256_set1_pd(255);
+    size_t x           = 0;
+
+    for (; x + 4 <= width; x += 4) {
+        __m256d sum = _mm256_setzero_pd();
+        for (int t = 0; t < taps->count; t++) {
+            const unsigned char* p = &r[taps->dy[t]][x + taps->dx[t]];
+            __m128i bytes          = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int*)p));
+            sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_cvtepi32_pd(bytes), _mm256_set1_pd(taps->value[t])));
+        }
+
+        __m128i result = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(sum, zero), max));
+        result         = _mm_packus_epi16(_mm_packus_epi32(result, result), result);
+        *(int*)&out[x] = _mm_cvtsi128_si32(result);
+    }
+    return x;
+}
+
+#endif /* FILTER_PLANAR_X86 */
+
+static void convolution33_rows(void* args, size_t begin, size_t end) {
+    const filter_planar_rows_args_t* rows = args;
+    const image_planar_t* src             = rows->src;
+    const image_planar_t* dst             = rows->dst;
+    const planar_taps_t* taps             = rows->taps;
+    filter_simd_t simd                    = filter_simd_get();
+
+    for (size_t j = begin; j < end; j++) {
+        for (int c = 0; c < 3; c++) {
+            const unsigned char* r[3] = {image_planar_row(src, c, j), image_planar_row(src, c, j + 1),
+                                         image_planar_row(src, c, j + 2)};
+            unsigned char* out        = image_planar_row(dst, c, j);
+
+            size_t x = 0;
+#ifdef FILTER_PLANAR_X86
+            if (simd == FILTER_SIMD_AVX2) {
+                x = taps->fixed ? convolution33_row_fixed_avx2(r, taps, out, dst->width)
+                                : convolution33_row_double_avx2(r, taps, out, dst->width);
+            } else if (simd == FILTER_SIMD_SSE41) {
+                x = taps->fixed ? convolution33_row_fixed_sse41(r, taps, out, dst->width)
+                                : convolution33_row_double_sse41(r, taps, out, dst->width);
+            }
+#endif
+            convolution33_row_scalar(r, taps, out, x, dst->width);
+        }
+        copy_alpha_row(src, dst, j);
+    }
+}
+
+static void planar_taps(const double m[3][3], planar_taps_t* taps) {
+    taps->shift = 0;
+    taps->fixed = filter_simd_fixed_point(m, &taps->shift);
+    taps->count = 0;
+
+    for (int y = 0; y < 3; y++) {
+        for (int x = 0; x < 3; x++) {
+            if (m[y][x] == 0) {
+                continue;
+            }
+            taps->dx[taps->count]     = x;
+            taps->dy[taps->count]     = y;
+            taps->weight[taps->count] = taps->fixed ? (short)ldexp(m[y][x], taps->shift) : 0;
+            taps->value[taps->count]  = m[y][x];
+            taps->count++;
+        }
+    }
+}
+
+int filter_planar_convolution33_parallel(const parallel_for_t* parallel_for, const image_planar_t* src,
+                                         image_planar_t* dst, const double m[3][3]) {
+    if (filter_planar_reshape_border(src, dst) < 0) {
+        return -1;
+    }
+
+    planar_taps_t taps;
+    planar_taps(m, &taps);
+
+    filter_planar_rows_args_t args = {.src = src, .dst = dst, .taps = &taps};
+    parallel_for_run(parallel_for, dst->height, FILTER_PARALLEL_GRAIN, convolution33_rows, &args);
+    return 0;
+}
+
+/* ((0.30 r + 0.59 g) + 0.11 b) in doubles and truncated, as in filter.c */
+static void desaturate_row_scalar(const unsigned char* r, const unsigned char* g, const unsigned char* b,
+                                  unsigned char* out, size_t begin, size_t width) {
+    for (size_t x = begin; x < width; x++) {
+        double value = 0;
+        value += 0.30 * ((double)r[x]);
+        value += 0.59 * ((double)g[x]);
+        value += 0.11 * ((double)b[x]);
+        out[x] = (unsigned char)value;
+    }
+}
+
+#ifdef FILTER_PLANAR_X86
+
+__attribute__((target("avx2"))) static size_t desaturate_row_avx2(const unsigned char* r, const unsigned char* g,
+                                                                  const unsigned char* b, unsigned char* out,
+                                                                  size_t width) {
+    const __m256d wr = _mm256_set1_pd(0.30);
+    const __m256d wg = _mm256_set1_pd(0.59);
+    const __m256d wb = _mm256_set1_pd(0.11);
+    size_t x         = 0;
+
+    for (; x + 4 <= width; x += 4) {
+        __m256d vr = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int*)&r[x])));
+        __m256d vg = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int*)&g[x])));
+        __m256d vb = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int*)&b[x])));
+
+        __m256d value =
+            _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vr, wr), _mm256_mul_pd(vg, wg)), _mm256_mul_pd(vb, wb));
+
+        __m128i result = _mm256_cvttpd_epi32(value);
+        result         = _mm_packus_epi16(_mm_packus_epi32(result, result), result);
+        *(int*)&out[x] = _mm_cvtsi128_si32(result);
+    }
+    return x;
+}
+
+#endif /* FILTER_PLANAR_X86 */
+
+static void desaturate_rows(void* args, size_t begin, size_t end) {
+    const filter_planar_rows_args_t* rows = args;
+    const image_planar_t* src             = rows->src;
+    const image_planar_t* dst             = rows->dst;
+
+    for (size_t j = begin; j < end; j++) {
+        const unsigned char* r = image_planar_row(src, IMAGE_PLANAR_R, j);
+        const unsigned char* g = image_planar_row(src, IMAGE_PLANAR_G, j);
+        const unsigned char* b = image_planar_row(src, IMAGE_PLANAR_B, j);
+        unsigned char* out     = image_planar_row(dst, IMAGE_PLANAR_R, j);
+
+        size_t x = 0;
+#ifdef FILTER_PLANAR_X86
+        if (filter_simd_get() == FILTER_SIMD_AVX2) {
+            x = desaturate_row_avx2(r, g, b, out, src->width);
+        }
+#endif
+        desaturate_row_scalar(r, g, b, out, x, src->width);
+
+        memcpy(image_planar_row(dst, IMAGE_PLANAR_G, j), out, src->width);
+        memcpy(image_planar_row(dst, IMAGE_PLANAR_B, j), out, src->width);
+        memcpy(image_planar_row(dst, IMAGE_PLANAR_A, j), image_planar_row(src, IMAGE_PLANAR_A, j), src->width);
+    }
+}
+
+int filter_planar_desaturate_parallel(const parallel_for_t* parallel_for, const image_planar_t* src,
+                                      image_planar_t* dst) {
+    if (filter_planar_reshape(src, dst, src->width, src->height) < 0) {
+        return -1;
+    }
+
+    filter_planar_rows_args_t args = {.src = src, .dst = dst};
+    parallel_for_run(parallel_for, src->height, FILTER_PARALLEL_GRAIN, desaturate_rows, &args);
+    return 0;
+}
+
+bool filter_planar_supports(const filter_step_t* step) {
+    double m[3][3];
+    return (step->kind == FILTER_SCALE_UP && step->scale_mode == FILTER_SCALE_NEAREST) || step->kind == FILTER_SOBEL ||
+           step->kind == FILTER_DESATURATE || filter_step_kernel33(step, m) == 0;
+}
+
+int filter_planar_step_apply_parallel(const parallel_for_t* parallel_for, const filter_step_t* step,
+                                      const image_planar_t* src, image_planar_t* dst) {
+    double m[3][3];
+
+    switch (step->kind) {
+    case FILTER_SCALE_UP:
+        return filter_planar_scale_up_parallel(parallel_for, src, dst, step->factor);
+    case FILTER_SOBEL:
+        return filter_planar_sobel_parallel(parallel_for, src, dst);
+    case FILTER_DESATURATE:
+        return filter_planar_desaturate_parallel(parallel_for, src, dst);
+    default:
+        if (filter_step_kernel33(step, m) == 0) {
+            return filter_planar_convolution33_parallel(parallel_for, src, dst, m);
+        }
+    }
+
+    LOG_ERROR("filter %d has no planar version", step->kind);
+    return -1;
+}
+
+image_t* filter_planar_chain_apply_parallel(const parallel_for_t* parallel_for, const filter_step_t* steps,
+                                            size_t num_steps, const image_t* src, image_t* buffers[2]) {
+    image_planar_t planar[2];
+    image_planar_init_in(&planar[0], buffers[0]);
+    image_planar_init_in(&planar[1], buffers[1]);
+
+    if (image_planar_from_image(parallel_for, src, &planar[0]) < 0) {
+        goto fail_exit;
+    }
+
+    size_t current = 0;
+    for (size_t i = 0; i < num_steps; i++) {
+        if (filter_planar_step_apply_parallel(parallel_for, &steps[i], &planar[current], &planar[1 - current]) < 0) {
+            goto fail_exit;
+        }
+        current = 1 - current;
+    }
+
+    image_t* result = buffers[1 - current];
+    if (image_planar_to_image(parallel_for, &planar[current], result) < 0) {
+        goto fail_exit;
+    }
+    return result;
+
+fail_exit:
+    return NULL;
+}
@@ -0,0 +1,650 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "filter-simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_SIMD_X86
+#endif
+
+static filter_simd_t simd_supported = FILTER_SIMD_SCALAR;
+static filter_simd_t simd_current   = FILTER_SIMD_SCALAR;
+
+__attribute__((constructor)) static void filter_simd_init(void) {
+#ifdef FILTER_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        simd_supported = FILTER_SIMD_AVX2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        simd_supported = FILTER_SIMD_SSE41;
+    }
+#endif
+    simd_current = simd_supported;
+}
+
+filter_simd_t filter_simd_get(void) {
+    return simd_current;
+}
+
+filter_simd_t filter_simd_supported(void) {
+    return simd_supported;
+}
+
+const char* filter_simd_name(filter_simd_t simd) {
+    switch (simd) {
+    case FILTER_SIMD_SSE41:
+        return "sse4.1";
+    case FILTER_SIMD_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+int filter_simd_parse(const char* name, filter_simd_t* simd) {
+    for (filter_simd_t s = FILTER_SIMD_SCALAR; s <= FILTER_SIMD_AVX2; s++) {
+        if (strcmp(name, filter_simd_name(s)) == 0) {
+            *simd = s;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int filter_simd_set(filter_simd_t simd) {
+    if (simd > simd_supported) {
+        return -1;
+    }
+    simd_current = simd;
+    return 0;
+}
+
+/*
+ * Kernels whose weights are all multiples of 2^-shift (sharpen, edge detect,
+ * identity, gaussian blur) are computed exactly by the scalar path since every
+ * partial sum is representable as a double. They run on 16-bit lanes as
+ * sum(w * 2^shift * p) >> shift, which truncates exactly like the conversion
+ * to unsigned char. Any other kernel (box blur) goes through the double path
+ * which performs the multiply-adds in the same order as the scalar code.
+ */
+
+#define FIXED_MAX_SHIFT 8
+
+typedef struct convolution33_taps {
+    int count;
+    int dx[9];
+    int dy[9];
+    short weight[9];
+    double value[9];
+} convolution33_taps_t;
+
+bool filter_simd_fixed_point(const double m[3][3], int* shift) {
+    for (int s = 0; s <= FIXED_MAX_SHIFT; s++) {
+        double total = 0;
+        bool exact   = true;
+
+        for (int y = 0; y < 3 && exact; y++) {
+            for (int x = 0; x < 3 && exact; x++) {
+                double w = ldexp(m[y][x], s);
+                exact    = (w == nearbyint(w)) && fabs(w) <= 32767;
+                total += fabs(w);
+            }
+        }
+
+        if (exact && total * 255 <= 32767) {
+            *shift = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void convolution33_taps(const double m[3][3], int shift, convolution33_taps_t* taps) {
+    taps->count = 0;
+    for (int y = 0; y < 3; y++) {
+        for (int x = 0; x < 3; x++) {
+            if (m[y][x] == 0) {
+                continue;
+            }
+            taps->dx[taps->count]     = x - 1;
+            taps->dy[taps->count]     = y - 1;
+            taps->weight[taps->count] = (short)ldexp(m[y][x], shift);
+            taps->value[taps->count]  = m[y][x];
+            taps->count++;
+        }
+    }
+}
+
+/* same computation as the scalar filter_convolution33, used for the columns left by the vector loops */
+static void convolution33_pixel(const image_t* image, image_t* new_image, const convolution33_taps_t* taps, size_t i,
+                                size_t j) {
+    double values[3] = {0, 0, 0};
+
+    for (int t = 0; t < taps->count; t++) {
+        const pixel_t* pixel = &image->pixels[(i + taps->dx[t]) + (j + taps->dy[t]) * image->width];
+        for (int k = 0; k < 3; k++) {
+            values[k] += pixel->bytes[k] * taps->value[t];
+        }
+    }
+
+    pixel_t* new_pixel = &new_image->pixels[(i - 1) + (j - 1) * new_image->width];
+    for (int k = 0; k < 3; k++) {
+        new_pixel->bytes[k] = (values[k] < 0) ? 0 : ((values[k] > 255) ? 255 : (unsigned char)values[k]);
+    }
+    new_pixel->bytes[3] = image->pixels[i + j * image->width].bytes[3];
+}
+
+#ifdef FILTER_SIMD_X86
+
+__attribute__((target("sse4.1"))) static void convolution33_fixed_sse41(const image_t* image, image_t* new_image,
+                                                                        const convolution33_taps_t* taps, int shift,
+                                                                        size_t begin, size_t end) {
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+
+    for (size_t j = begin + 1; j < end + 1; j++) {
+        size_t i = 1;
+
+        for (; i + 4 <= image->width - 1; i += 4) {
+            __m128i lo = _mm_setzero_si128();
+            __m128i hi = _mm_setzero_si128();
+
+            for (int t = 0; t < taps->count; t++) {
+                const pixel_t* pixel = &image->pixels[(i + taps->dx[t]) + (j + taps->dy[t]) * image->width];
+                __m128i bytes        = _mm_loadu_si128((const __m128i*)pixel);
+                __m128i weight       = _mm_set1_epi16(taps->weight[t]);
+
+                lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_cvtepu8_epi16(bytes), weight));
+                hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(bytes, 8)), weight));
+            }
+
+            __m128i center = _mm_loadu_si128((const __m128i*)&image->pixels[i + j * image->width]);
+            __m128i result = _mm_packus_epi16(_mm_sra_epi16(lo, count), _mm_sra_epi16(hi, count));
+
+            result = _mm_blendv_epi8(result, center, alpha);
+            _mm_storeu_si128((__m128i*)&new_image->pixels[(i - 1) + (j - 1) * new_image->width], result);
+        }
+
+        for (; i < image->width - 1; i++) {
+            convolution33_pixel(image, new_image, taps, i, j);
+        }
+    }
+}
+
+__attribute__((target("avx2"))) static void convolution33_fixed_avx2(const image_t* image, image_t* new_image,
+                                                                     const convolution33_taps_t* taps, int shift,
+                                                                     size_t begin, size_t end) {
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+
+    for (size_t j = begin + 1; j < end + 1; j++) {
+        size_t i = 1;
+
+        for (; i + 8 <= image->width - 1; i += 8) {
+            __m256i lo = _mm256_setzero_si256();
+            __m256i hi = _mm256_setzero_si256();
+
+            for (int t = 0; t < taps->count; t++) {
+                const pixel_t* pixel = &image->pixels[(i + taps->dx[t]) + (j + taps->dy[t]) * image->width];
+                __m256i weight       = _mm256_set1_epi16(taps->weight[t]);
+
+                __m256i first  = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)pixel));
+                __m256i second = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pixel + 4)));
+
+                lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(first, weight));
+                hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(second, weight));
+            }
+
+            /* packus works within 128-bit lanes, reorder the quadwords back into pixel order */
+            __m256i center = _mm256_loadu_si256((const __m256i*)&image->pixels[i + j * image->width]);
+            __m256i result = _mm256_packus_epi16(_mm256_sra_epi16(lo, count), _mm256_sra_epi16(hi, count));
+
+            result = _mm256_permute4x64_epi64(result, _MM_SHUFFLE(3, 1, 2, 0));
+            result = _mm256_blendv_epi8(result, center, alpha);
+            _mm256_storeu_si256((__m256i*)&new_image->pixels[(i - 1) + (j - 1) * new_image->width], result);
+        }
+
+        for (; i < image->width - 1; i++) {
+            convolution33_pixel(image, new_image, taps, i, j);
+        }
+    }
+}
+
+__attribute__((target("sse4.1"))) static void convolution33_double_sse41(const image_t* image, image_t* new_image,
+                                                                         const convolution33_taps_t* taps, size_t begin,
+                                                                         size_t end) {
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d max  = _mm_set1_pd(255);
+
+    for (size_t j = begin + 1; j < end + 1; j++) {
+        for (size_t i = 1; i < image->width - 1; i++) {
+            __m128d rg = _mm_setzero_pd();
+            __m128d ba = _mm_setzero_pd();
+
+            for (int t = 0; t < taps->count; t++) {
+                const pixel_t* pixel = &image->pixels[(i + taps->dx[t]) + (j + taps->dy[t]) * image->width];
+                __m128i bytes        = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int*)pixel));
+                __m128d weight       = _mm_set1_pd(taps->value[t]);
+
+                rg = _mm_add_pd(rg, _mm_mul_pd(_mm_cvtepi32_pd(bytes), weight));
+                ba = _mm_add_pd(ba, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(bytes, 8)), weight));
+            }
+
+            rg = _mm_min_pd(_mm_max_pd(rg, zero), max);
+            ba = _mm_min_pd(_mm_max_pd(ba, zero), max);
+
+            __m128i values = _mm_unpacklo_epi64(_mm_cvttpd_epi32(rg), _mm_cvttpd_epi32(ba));
+            values         = _mm_packus_epi16(_mm_packus_epi32(values, values), values);
+
+            pixel_t* new_pixel  = &new_image->pixels[(i - 1) + (j - 1) * new_image->width];
+            *(int*)new_pixel    = _mm_cvtsi128_si32(values);
+            new_pixel->bytes[3] = image->pixels[i + j * image->width].bytes[3];
+        }
+    }
+}
+
+__attribute__((target("avx2"))) static void convolution33_double_avx2(const image_t* image, image_t* new_image,
+                                                                      const convolution33_taps_t* taps, size_t begin,
+                                                                      size_t end) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d max  = _mm256_set1_pd(255);
+
+    for (size_t j = begin + 1; j < end + 1; j++) {
+        for (size_t i = 1; i < image->width - 1; i++) {
+            __m256d rgba = _mm256_setzero_pd();
+
+            for (int t = 0; t < taps->count; t++) {
+                const pixel_t* pixel = &image->pixels[(i + taps->dx[t]) + (j + taps->dy[t]) * image->width];
+                __m128i bytes        = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int*)pixel));
+
+                rgba = _mm256_add_pd(rgba, _mm256_mul_pd(_mm256_cvtepi32_pd(bytes), _mm256_set1_pd(taps->value[t])));
+            }
+
+            rgba = _mm256_min_pd(_mm256_max_pd(rgba, zero), max);
+
+            __m128i values = _mm256_cvttpd_epi32(rgba);
+            values         = _mm_packus_epi16(_mm_packus_epi32(values, values), values);
+
+            pixel_t* new_pixel  = &new_image->pixels[(i - 1) + (j - 1) * new_image->width];
+            *(int*)new_pixel    = _mm_cvtsi128_si32(values);
+            new_pixel->bytes[3] = image->pixels[i + j * image->width].bytes[3];
+        }
+    }
+}
+
+#endif /* FILTER_SIMD_X86 */
+
+int filter_simd_convolution33(const image_t* image, image_t* new_image, const double m[3][3]) {
+    if (image->height < 3) {
+        return -1;
+    }
+    return filter_simd_convolution33_rows(image, new_image, m, 0, image->height - 2);
+}
+
+int filter_simd_convolution33_rows(const image_t* image, image_t* new_image, const double m[3][3], size_t begin,
+                                   size_t end) {
+#ifdef FILTER_SIMD_X86
+    if (simd_current == FILTER_SIMD_SCALAR || image->width < 3 || image->height < 3) {
+        return -1;
+    }
+
+    int shift  = 0;
+    bool fixed = filter_simd_fixed_point(m, &shift);
+
+    convolution33_taps_t taps;
+    convolution33_taps(m, shift, &taps);
+
+    if (simd_current == FILTER_SIMD_AVX2) {
+        if (fixed) {
+            convolution33_fixed_avx2(image, new_image, &taps, shift, begin, end);
+        } else {
+            convolution33_double_avx2(image, new_image, &taps, begin, end);
+        }
+    } else {
+        if (fixed) {
+            convolution33_fixed_sse41(image, new_image, &taps, shift, begin, end);
+        } else {
+            convolution33_double_sse41(image, new_image, &taps, begin, end);
+        }
+    }
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * rgb_to_hsv and hsv_to_rgb of filter.c on 16-bit lanes, bit-exact: every
+ * product of their integer formulas fits 16 bits unsigned. The divisions by
+ * cmax - cmin and by v multiply by hsv_reciprocals[d] = floor(2^16 / d), the
+ * high half of n * R[d] is n / d or one less for any n < 2^16 and a single
+ * remainder check corrects it. The branches of the scalar code become blends.
+ */
+
+static int32_t hsv_reciprocals[256];
+
+__attribute__((constructor)) static void hsv_reciprocals_init(void) {
+    hsv_reciprocals[0] = 0; /* lanes dividing by zero are masked afterward */
+    hsv_reciprocals[1] = UINT16_MAX;
+    for (int d = 2; d < 256; d++) {
+        hsv_reciprocals[d] = 65536 / d;
+    }
+}
+
+#ifdef FILTER_SIMD_X86
+
+/* 8 pixels to one vector of 16-bit lanes per channel */
+__attribute__((target("sse4.1"))) static inline void hsv_load_sse41(const pixel_t* pixels, __m128i channels[4]) {
+    const __m128i group = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+    __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&pixels[0]), group);
+    __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&pixels[4]), group);
+    __m128i rg = _mm_unpacklo_epi32(lo, hi);
+    __m128i ba = _mm_unpackhi_epi32(lo, hi);
+
+    channels[0] = _mm_cvtepu8_epi16(rg);
+    channels[1] = _mm_cvtepu8_epi16(_mm_srli_si128(rg, 8));
+    channels[2] = _mm_cvtepu8_epi16(ba);
+    channels[3] = _mm_cvtepu8_epi16(_mm_srli_si128(ba, 8));
+}
+
+__attribute__((target("sse4.1"))) static inline void hsv_store_sse41(pixel_t* pixels, const __m128i channels[4]) {
+    __m128i r = _mm_packus_epi16(channels[0], channels[0]);
+    __m128i g = _mm_packus_epi16(channels[1], channels[1]);
+    __m128i b = _mm_packus_epi16(channels[2], channels[2]);
+    __m128i a = _mm_packus_epi16(channels[3], channels[3]);
+
+    __m128i rg = _mm_unpacklo_epi8(r, g);
+    __m128i ba = _mm_unpacklo_epi8(b, a);
+    _mm_storeu_si128((__m128i*)&pixels[0], _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i*)&pixels[4], _mm_unpackhi_epi16(rg, ba));
+}
+
+/* n / d for n < 2^16 and d < 256, lanes where d is 0 hold garbage */
+__attribute__((target("sse4.1"))) static inline __m128i hsv_divide_sse41(__m128i n, __m128i d) {
+    uint16_t divisors[8];
+    _mm_storeu_si128((__m128i*)divisors, d);
+
+    __m128i reciprocal =
+        _mm_setr_epi16(hsv_reciprocals[divisors[0]], hsv_reciprocals[divisors[1]], hsv_reciprocals[divisors[2]],
+                       hsv_reciprocals[divisors[3]], hsv_reciprocals[divisors[4]], hsv_reciprocals[divisors[5]],
+                       hsv_reciprocals[divisors[6]], hsv_reciprocals[divisors[7]]);
+
+    __m128i q = _mm_mulhi_epu16(n, reciprocal);
+    __m128i r = _mm_sub_epi16(n, _mm_mullo_epi16(q, d));
+
+    /* q + 1 unless the remainder is below d */
+    return _mm_add_epi16(_mm_add_epi16(q, _mm_set1_epi16(1)), _mm_cmpgt_epi16(d, r));
+}
+
+__attribute__((target("sse4.1"))) static size_t to_hsv_sse41(const pixel_t* src, pixel_t* dst, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi16(0xff);
+    size_t i           = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i c[4];
+        hsv_load_sse41(&src[i], c);
+
+        __m128i cmax  = _mm_max_epi16(c[0], _mm_max_epi16(c[1], c[2]));
+        __m128i cmin  = _mm_min_epi16(c[0], _mm_min_epi16(c[1], c[2]));
+        __m128i delta = _mm_sub_epi16(cmax, cmin);
+        __m128i gray  = _mm_cmpeq_epi16(delta, zero); /* s == 0, covers v == 0 */
+
+        __m128i s = hsv_divide_sse41(_mm_mullo_epi16(delta, _mm_set1_epi16(255)), cmax);
+
+        /* blue region unless green is the max, unless red is, in the order of the scalar if-else chain */
+        __m128i is_r = _mm_cmpeq_epi16(cmax, c[0]);
+        __m128i is_g = _mm_cmpeq_epi16(cmax, c[1]);
+        __m128i diff = _mm_blendv_epi8(_mm_sub_epi16(c[0], c[1]), _mm_sub_epi16(c[2], c[0]), is_g);
+        diff         = _mm_blendv_epi8(diff, _mm_sub_epi16(c[1], c[2]), is_r);
+        __m128i base = _mm_blendv_epi8(_mm_set1_epi16(171), _mm_set1_epi16(85), is_g);
+        base         = _mm_blendv_epi8(base, zero, is_r);
+
+        /* C division truncates toward zero: divide the magnitude, then put the sign back */
+        __m128i n      = _mm_mullo_epi16(diff, _mm_set1_epi16(43));
+        __m128i offset = _mm_sign_epi16(hsv_divide_sse41(_mm_abs_epi16(n), delta), n);
+        __m128i h      = _mm_and_si128(_mm_add_epi16(base, offset), mask);
+
+        c[0] = _mm_andnot_si128(gray, h);
+        c[1] = _mm_andnot_si128(gray, s);
+        c[2] = cmax;
+        hsv_store_sse41(&dst[i], c);
+    }
+    return i;
+}
+
+__attribute__((target("sse4.1"))) static size_t to_rgb_sse41(const pixel_t* src, pixel_t* dst, size_t count) {
+    const __m128i max = _mm_set1_epi16(255);
+    size_t i          = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i c[4];
+        hsv_load_sse41(&src[i], c);
+        __m128i h = c[0], s = c[1], v = c[2];
+
+        /* h / 43 as the count of region starts at or below h */
+        __m128i region = _mm_setzero_si128();
+        region         = _mm_sub_epi16(region, _mm_cmpgt_epi16(h, _mm_set1_epi16(42)));
+        region         = _mm_sub_epi16(region, _mm_cmpgt_epi16(h, _mm_set1_epi16(85)));
+        region         = _mm_sub_epi16(region, _mm_cmpgt_epi16(h, _mm_set1_epi16(128)));
+        region         = _mm_sub_epi16(region, _mm_cmpgt_epi16(h, _mm_set1_epi16(171)));
+        region         = _mm_sub_epi16(region, _mm_cmpgt_epi16(h, _mm_set1_epi16(214)));
+
+        __m128i remainder =
+            _mm_mullo_epi16(_mm_sub_epi16(h, _mm_mullo_epi16(region, _mm_set1_epi16(43))), _mm_set1_epi16(6));
+
+        /* (s * remainder) >> 8 and (s * (255 - remainder)) >> 8 */
+        __m128i sq = _mm_srli_epi16(_mm_mullo_epi16(s, remainder), 8);
+        __m128i st = _mm_srli_epi16(_mm_mullo_epi16(s, _mm_sub_epi16(max, remainder)), 8);
+
+        __m128i p = _mm_srli_epi16(_mm_mullo_epi16(v, _mm_sub_epi16(max, s)), 8);
+        __m128i q = _mm_srli_epi16(_mm_mullo_epi16(v, _mm_sub_epi16(max, sq)), 8);
+        __m128i t = _mm_srli_epi16(_mm_mullo_epi16(v, _mm_sub_epi16(max, st)), 8);
+
+        __m128i in[6];
+        for (int k = 0; k < 6; k++) {
+            in[k] = _mm_cmpeq_epi16(region, _mm_set1_epi16(k));
+        }
+
+        /* regions 0 to 5: (v, t, p) (q, v, p) (p, v, t) (p, q, v) (t, p, v) (v, p, q) */
+        __m128i r = _mm_blendv_epi8(v, q, in[1]);
+        r         = _mm_blendv_epi8(r, p, _mm_or_si128(in[2], in[3]));
+        r         = _mm_blendv_epi8(r, t, in[4]);
+        __m128i g = _mm_blendv_epi8(p, t, in[0]);
+        g         = _mm_blendv_epi8(g, v, _mm_or_si128(in[1], in[2]));
+        g         = _mm_blendv_epi8(g, q, in[3]);
+        __m128i b = _mm_blendv_epi8(p, t, in[2]);
+        b         = _mm_blendv_epi8(b, v, _mm_or_si128(in[3], in[4]));
+        b         = _mm_blendv_epi8(b, q, in[5]);
+
+        __m128i gray = _mm_cmpeq_epi16(s, _mm_setzero_si128());
+        c[0]         = _mm_blendv_epi8(r, v, gray);
+        c[1]         = _mm_blendv_epi8(g, v, gray);
+        c[2]         = _mm_blendv_epi8(b, v, gray);
+        hsv_store_sse41(&dst[i], c);
+    }
+    return i;
+}
+
+/* 16 pixels as two halves of 8, the arithmetic runs on the whole register */
+__attribute__((target("avx2"))) static inline void hsv_load_avx2(const pixel_t* pixels, __m256i channels[4]) {
+    __m128i lo[4], hi[4];
+    hsv_load_sse41(&pixels[0], lo);
+    hsv_load_sse41(&pixels[8], hi);
+    for (int k = 0; k < 4; k++) {
+        channels[k] = _mm256_set_m128i(hi[k], lo[k]);
+    }
+}
+
+__attribute__((target("avx2"))) static inline void hsv_store_avx2(pixel_t* pixels, const __m256i channels[4]) {
+    __m128i lo[4], hi[4];
+    for (int k = 0; k < 4; k++) {
+        lo[k] = _mm256_castsi256_si128(channels[k]);
+        hi[k] = _mm256_extracti128_si256(channels[k], 1);
+    }
+    hsv_store_sse41(&pixels[0], lo);
+    hsv_store_sse41(&pixels[8], hi);
+}
+
+__attribute__((target("avx2"))) static inline __m256i hsv_divide_avx2(__m256i n, __m256i d) {
+    __m256i lo = _mm256_i32gather_epi32(hsv_reciprocals, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(d)), 4);
+    __m256i hi = _mm256_i32gather_epi32(hsv_reciprocals, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1)), 4);
+
+    /* packus interleaves the 128-bit lanes of its operands, the permute restores the order */
+    __m256i reciprocal = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+
+    __m256i q = _mm256_mulhi_epu16(n, reciprocal);
+    __m256i r = _mm256_sub_epi16(n, _mm256_mullo_epi16(q, d));
+    return _mm256_add_epi16(_mm256_add_epi16(q, _mm256_set1_epi16(1)), _mm256_cmpgt_epi16(d, r));
+}
+
+__attribute__((target("avx2"))) static size_t to_hsv_avx2(const pixel_t* src, pixel_t* dst, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi16(0xff);
+    size_t i           = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m256i c[4];
+        hsv_load_avx2(&src[i], c);
+
+        __m256i cmax  = _mm256_max_epi16(c[0], _mm256_max_epi16(c[1], c[2]));
+        __m256i cmin  = _mm256_min_epi16(c[0], _mm256_min_epi16(c[1], c[2]));
+        __m256i delta = _mm256_sub_epi16(cmax, cmin);
+        __m256i gray  = _mm256_cmpeq_epi16(delta, zero);
+
+        __m256i s = hsv_divide_avx2(_mm256_mullo_epi16(delta, _mm256_set1_epi16(255)), cmax);
+
+        __m256i is_r = _mm256_cmpeq_epi16(cmax, c[0]);
+        __m256i is_g = _mm256_cmpeq_epi16(cmax, c[1]);
+        __m256i diff = _mm256_blendv_epi8(_mm256_sub_epi16(c[0], c[1]), _mm256_sub_epi16(c[2], c[0]), is_g);
+        diff         = _mm256_blendv_epi8(diff, _mm256_sub_epi16(c[1], c[2]), is_r);
+        __m256i base = _mm256_blendv_epi8(_mm256_set1_epi16(171), _mm256_set1_epi16(85), is_g);
+        base         = _mm256_blendv_epi8(base, zero, is_r);
+
+        __m256i n      = _mm256_mullo_epi16(diff, _mm256_set1_epi16(43));
+        __m256i offset = _mm256_sign_epi16(hsv_divide_avx2(_mm256_abs_epi16(n), delta), n);
+        __m256i h      = _mm256_and_si256(_mm256_add_epi16(base, offset), mask);
+
+        c[0] = _mm256_andnot_si256(gray, h);
+        c[1] = _mm256_andnot_si256(gray, s);
+        c[2] = cmax;
+        hsv_store_avx2(&dst[i], c);
+    }
+    return i + to_hsv_sse41(&src[i], &dst[i], count - i);
+}
+
+__attribute__((target("avx2"))) static size_t to_rgb_avx2(const pixel_t* src, pixel_t* dst, size_t count) {
+    const __m256i max = _mm256_set1_epi16(255);
+    size_t i          = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m256i c[4];
+        hsv_load_avx2(&src[i], c);
+        __m256i h = c[0], s = c[1], v = c[2];
+
+        __m256i region = _mm256_setzero_si256();
+        region         = _mm256_sub_epi16(region, _mm256_cmpgt_epi16(h, _mm256_set1_epi16(42)));
+        region         = _mm256_sub_epi16(region, _mm256_cmpgt_epi16(h, _mm256_set1_epi16(85)));
+        region         = _mm256_sub_epi16(region, _mm256_cmpgt_epi16(h, _mm256_set1_epi16(128)));
+        region         = _mm256_sub_epi16(region, _mm256_cmpgt_epi16(h, _mm256_set1_epi16(171)));
+        region         = _mm256_sub_epi16(region, _mm256_cmpgt_epi16(h, _mm256_set1_epi16(214)));
+
+        __m256i remainder = _mm256_mullo_epi16(_mm256_sub_epi16(h, _mm256_mullo_epi16(region, _mm256_set1_epi16(43))),
+                                               _mm256_set1_epi16(6));
+
+        __m256i sq = _mm256_srli_epi16(_mm256_mullo_epi16(s, remainder), 8);
+        __m256i st = _mm256_srli_epi16(_mm256_mullo_epi16(s, _mm256_sub_epi16(max, remainder)), 8);
+
+        __m256i p = _mm256_srli_epi16(_mm256_mullo_epi16(v, _mm256_sub_epi16(max, s)), 8);
+        __m256i q = _mm256_srli_epi16(_mm256_mullo_epi16(v, _mm256_sub_epi16(max, sq)), 8);
+        __m256i t = _mm256_srli_epi16(_mm256_mullo_epi16(v, _mm256_sub_epi16(max, st)), 8);
+
+        __m256i in[6];
+        for (int k = 0; k < 6; k++) {
+            in[k] = _mm256_cmpeq_epi16(region, _mm256_set1_epi16(k));
+        }
+
+        __m256i r = _mm256_blendv_epi8(v, q, in[1]);
+        r         = _mm256_blendv_epi8(r, p, _mm256_or_si256(in[2], in[3]));
+        r         = _mm256_blendv_epi8(r, t, in[4]);
+        __m256i g = _mm256_blendv_epi8(p, t, in[0]);
+        g         = _mm256_blendv_epi8(g, v, _mm256_or_si256(in[1], in[2]));
+        g         = _mm256_blendv_epi8(g, q, in[3]);
+        __m256i b = _mm256_blendv_epi8(p, t, in[2]);
+        b         = _mm256_blendv_epi8(b, v, _mm256_or_si256(in[3], in[4]));
+        b         = _mm256_blendv_epi8(b, q, in[5]);
+
+        __m256i gray = _mm256_cmpeq_epi16(s, _mm256_setzero_si256());
+        c[0]         = _mm256_blendv_epi8(r, v, gray);
+        c[1]         = _mm256_blendv_epi8(g, v, gray);
+        c[2]         = _mm256_blendv_epi8(b, v, gray);
+        hsv_store_avx2(&dst[i], c);
+    }
+    return i + to_rgb_sse41(&src[i], &dst[i], count - i);
+}
+
+#endif /* FILTER_SIMD_X86 */
+
+size_t filter_simd_to_hsv(const pixel_t* src, pixel_t* dst, size_t count) {
+#ifdef FILTER_SIMD_X86
+    if (simd_current == FILTER_SIMD_AVX2) {
+        return to_hsv_avx2(src, dst, count);
+    } else if (simd_current == FILTER_SIMD_SSE41) {
+        return to_hsv_sse41(src, dst, count);
+    }
+#endif
+    return 0;
+}
+
+size_t filter_simd_to_rgb(const pixel_t* src, pixel_t* dst, size_t count) {
+#ifdef FILTER_SIMD_X86
+    if (simd_current == FILTER_SIMD_AVX2) {
+        return to_rgb_avx2(src, dst, count);
+    } else if (simd_current == FILTER_SIMD_SSE41) {
+        return to_rgb_sse41(src, dst, count);
+    }
+#endif
+    return 0;
+}
+
+#ifdef FILTER_SIMD_X86
+
+__attribute__((target("sse4.1"))) static size_t scale_up2_sse41(const pixel_t* src, pixel_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&src[i]);
+        _mm_storeu_si128((__m128i*)&dst[2 * i], _mm_unpacklo_epi32(v, v));
+        _mm_storeu_si128((__m128i*)&dst[2 * i + 4], _mm_unpackhi_epi32(v, v));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t scale_up2_avx2(const pixel_t* src, pixel_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v  = _mm256_loadu_si256((const __m256i*)&src[i]);
+        __m256i lo = _mm256_unpacklo_epi32(v, v);
+        __m256i hi = _mm256_unpackhi_epi32(v, v);
+        _mm256_storeu_si256((__m256i*)&dst[2 * i], _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)&dst[2 * i + 8], _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    return i + scale_up2_sse41(&src[i], &dst[2 * i], count - i);
+}
+
+#endif /* FILTER_SIMD_X86 */
+
+size_t filter_simd_scale_up2(const pixel_t* src, pixel_t* dst, size_t count) {
+#ifdef FILTER_SIMD_X86
+    if (simd_current == FILTER_SIMD_AVX2) {
+        return scale_up2_avx2(src, dst, count);
+    } else if (simd_current == FILTER_SIMD_SSE41) {
+        return scale_up2_sse41(src, dst, count);
+    }
+#endif
+    return 0;
+}
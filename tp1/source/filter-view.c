@@ -0,0 +1,185 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter-view.h"
+#include "log.h"
+
+/*
+ * Output rows are produced in tiles of FILTER_VIEW_TILE_ROWS: the logical rows
+ * a tile reads, two more than it writes, are copied through the view into a
+ * scratch buffer local to the band, then the filter.c kernel (vectorized when
+ * it is) runs on that buffer straight into the rows of `dst`. A band only
+ * holds a few rows of the frame the view stands for, and a logical row mapped
+ * to the same source row as the one before it is copied from the buffer.
+ */
+
+#define FILTER_VIEW_TILE_ROWS 16
+
+typedef struct filter_view_rows_args {
+    const image_view_t* src;
+    image_t* dst;
+    const ptrdiff_t* columns; /* image_view_columns() of `src` */
+    const double (*m)[3];     /* NULL for sobel */
+    atomic_bool failed;
+} filter_view_rows_args_t;
+
+static void filter_view_rows(void* args, size_t begin, size_t end) {
+    filter_view_rows_args_t* rows = args;
+    const image_view_t* src       = rows->src;
+    size_t width                  = src->width;
+
+    pixel_t* scratch = malloc((FILTER_VIEW_TILE_ROWS + 2) * width * sizeof(*scratch));
+    if (scratch == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        atomic_store(&rows->failed, true);
+        return;
+    }
+
+    for (size_t j = begin; j < end; j += FILTER_VIEW_TILE_ROWS) {
+        size_t count = (end - j < FILTER_VIEW_TILE_ROWS) ? end - j : FILTER_VIEW_TILE_ROWS;
+
+        for (size_t y = 0; y < count + 2; y++) {
+            pixel_t* row = &scratch[y * width];
+            if (y > 0 && image_view_row(src, j + y) == image_view_row(src, j + y - 1)) {
+                memcpy(row, row - width, width * sizeof(*row));
+            } else {
+                image_view_copy_row(src, rows->columns, j + y, row);
+            }
+        }
+
+        /* only reshaped to their own dimensions, neither allocates */
+        image_t tile  = {.id = src->id, .width = width, .height = count + 2, .pixels = scratch};
+        image_t out   = {.width = width - 2, .height = count, .pixels = &rows->dst->pixels[j * rows->dst->width]};
+        tile.capacity = tile.width * tile.height;
+        out.capacity  = out.width * out.height;
+
+        int ret = (rows->m == NULL) ? filter_sobel_parallel(NULL, &tile, &out)
+                                    : filter_convolution33_parallel(NULL, &tile, &out, rows->m);
+        if (ret < 0) {
+            atomic_store(&rows->failed, true);
+            break;
+        }
+    }
+
+    free(scratch);
+}
+
+/* 3x3 kernels drop the border like filter.c */
+static int filter_view_read_parallel(const parallel_for_t* parallel_for, const image_view_t* src, image_t* dst,
+                                     const double m[3][3]) {
+    if (src->width < 2 || src->height < 2) {
+        LOG_ERROR("image too small (%ldx%ld)", src->width, src->height);
+        goto fail_exit;
+    }
+    if (image_reshape(dst, src->width - 2, src->height - 2) < 0) {
+        goto fail_exit;
+    }
+    dst->id = src->id;
+
+    filter_view_rows_args_t args = {.src = src, .dst = dst, .columns = image_view_columns(src), .m = m};
+    if (args.columns == NULL) {
+        goto fail_exit;
+    }
+    atomic_init(&args.failed, false);
+
+    parallel_for_run(parallel_for, dst->height, FILTER_PARALLEL_GRAIN, filter_view_rows, &args);
+    free((ptrdiff_t*)args.columns);
+    if (atomic_load(&args.failed)) {
+        goto fail_exit;
+    }
+    return 0;
+
+fail_exit:
+    return -1;
+}
+
+int filter_view_sobel_parallel(const parallel_for_t* parallel_for, const image_view_t* src, image_t* dst) {
+    return filter_view_read_parallel(parallel_for, src, dst, NULL);
+}
+
+int filter_view_convolution33_parallel(const parallel_for_t* parallel_for, const image_view_t* src, image_t* dst,
+                                       const double m[3][3]) {
+    return filter_view_read_parallel(parallel_for, src, dst, m);
+}
+
+bool filter_view_is_lazy(const filter_step_t* step) {
+    switch (step->kind) {
+    case FILTER_SCALE_UP:
+        return step->scale_mode == FILTER_SCALE_NEAREST;
+    case FILTER_HORIZONTAL_FLIP:
+    case FILTER_VERTICAL_FLIP:
+    case FILTER_CROP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool filter_view_reads(const filter_step_t* step) {
+    double m[3][3];
+    return step->kind == FILTER_SOBEL || filter_step_kernel33(step, m) == 0;
+}
+
+int filter_view_step_apply(const filter_step_t* step, image_view_t* view) {
+    switch (step->kind) {
+    case FILTER_SCALE_UP:
+        if (step->scale_mode != FILTER_SCALE_NEAREST) {
+            break;
+        }
+        image_view_scale_up(view, step->factor);
+        return 0;
+    case FILTER_HORIZONTAL_FLIP:
+        image_view_flip_horizontal(view);
+        return 0;
+    case FILTER_VERTICAL_FLIP:
+        image_view_flip_vertical(view);
+        return 0;
+    case FILTER_CROP:
+        return image_view_crop(view, step->crop.x, step->crop.y, step->crop.width, step->crop.height);
+    default:
+        break;
+    }
+
+    LOG_ERROR("filter %d is not a view", step->kind);
+    return -1;
+}
+
+int filter_view_steps_apply_parallel(const parallel_for_t* parallel_for, const filter_step_t* steps, size_t num_steps,
+                                     const image_t* src, image_t* dst) {
+    image_view_t view;
+    image_view_init(&view, src);
+
+    size_t i = 0;
+    for (; i < num_steps && filter_view_is_lazy(&steps[i]); i++) {
+        if (filter_view_step_apply(&steps[i], &view) < 0) {
+            return -1;
+        }
+    }
+
+    if (i == num_steps) {
+        return image_view_copy_into(parallel_for, &view, dst);
+    }
+    if (i + 1 != num_steps || !filter_view_reads(&steps[i])) {
+        LOG_ERROR("filter %d can't read through a view", steps[i].kind);
+        return -1;
+    }
+
+    if (steps[i].kind == FILTER_SOBEL) {
+        return filter_view_sobel_parallel(parallel_for, &view, dst);
+    }
+
+    double m[3][3];
+    filter_step_kernel33(&steps[i], m);
+    return filter_view_convolution33_parallel(parallel_for, &view, dst, m);
+}
+
+int filter_crop_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst, size_t x, size_t y,
+                         size_t width, size_t height) {
+    image_view_t view;
+    image_view_init(&view, src);
+    if (image_view_crop(&view, x, y, width, height) < 0) {
+        return -1;
+    }
+    return image_view_copy_into(parallel_for, &view, dst);
+}
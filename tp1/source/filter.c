@@ -2,14 +2,19 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "filter-simd.h"
+#include "filter.h"
+#include "image-pool.h"
 #include "image.h"
+#include "log.h"
 
 #define max(a, b) (((a) < (b)) ? (b) : (a))
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #define clamp(x, min, max) ((x) < (min)) ? (min) : (((x) > (max)) ? (max) : (x))
 
-static void hsv_to_rgb(unsigned char hsv[3], unsigned char rgb[3]) {
+static void hsv_to_rgb(const unsigned char hsv[3], unsigned char rgb[3]) {
     unsigned char h = hsv[0];
     unsigned char s = hsv[1];
     unsigned char v = hsv[2];
@@ -73,7 +78,7 @@ done:
     rgb[2] = b;
 }
 
-static void rgb_to_hsv(unsigned char rgb[3], unsigned char hsv[3]) {
+static void rgb_to_hsv(const unsigned char rgb[3], unsigned char hsv[3]) {
     unsigned char r = rgb[0];
     unsigned char g = rgb[1];
     unsigned char b = rgb[2];
@@ -113,36 +118,92 @@ done:
     hsv[2] = v;
 }
 
-image_t* filter_scale_up(image_t* image, size_t factor) {
-    image_t* new_image = image_create(image->id, factor * image->width, factor * image->height);
-    if (new_image == NULL) {
-        goto fail_exit;
+/*
+ * Destination-passing filters: `dst` is reshaped to the output size and
+ * overwritten, its storage only grows when it is too small. `src` and `dst`
+ * must be different images.
+ *
+ * Every filter is written as a kernel over a band of rows so the parallel
+ * variants can hand disjoint bands to several threads. A band of a 3x3 kernel
+ * reads one extra source row above and below it; neighbouring bands read those
+ * halo rows concurrently but never write them, so no copy is needed.
+ */
+
+typedef struct filter_rows_args {
+    const image_t* src;
+    image_t* dst;
+    size_t factor;
+    const pixel_t* add_pixel;
+    const double (*m)[3];
+} filter_rows_args_t;
+
+static inline const pixel_t* src_pixel(const image_t* image, size_t x, size_t y) {
+    return &image->pixels[x + y * image->width];
+}
+
+static inline pixel_t* dst_pixel(image_t* image, size_t x, size_t y) {
+    return &image->pixels[x + y * image->width];
+}
+
+static int filter_reshape(const image_t* src, image_t* dst, size_t width, size_t height) {
+    if (image_reshape(dst, width, height) < 0) {
+        return -1;
     }
+    dst->id = src->id;
+    return 0;
+}
 
-    for (int j = 0; j < image->height; j++) {
-        for (int i = 0; i < image->width; i++) {
-            pixel_t* pixel = image_get_pixel(image, i, j);
+/* 3x3 kernels drop the border, they need at least a 2x2 image to produce an empty one */
+static int filter_reshape_border(const image_t* src, image_t* dst) {
+    if (src->width < 2 || src->height < 2) {
+        LOG_ERROR("image too small (%ldx%ld)", src->width, src->height);
+        return -1;
+    }
+    return filter_reshape(src, dst, src->width - 2, src->height - 2);
+}
 
-            for (int kj = 0; kj < factor; kj++) {
-                for (int ki = 0; ki < factor; ki++) {
-                    pixel_t* new_pixel = image_get_pixel(new_image, factor * i + ki, factor * j + kj);
-                    *new_pixel         = *pixel;
-                }
+/* bands of source rows, each one builds its first output row and copies it to the `factor` - 1 next ones */
+static void scale_up_rows(void* args, size_t begin, size_t end) {
+    const filter_rows_args_t* rows = args;
+    const image_t* src             = rows->src;
+    image_t* dst                   = rows->dst;
+    size_t factor                  = rows->factor;
+
+    for (size_t j = begin; j < end; j++) {
+        const pixel_t* in = src_pixel(src, 0, j);
+        pixel_t* out      = dst_pixel(dst, 0, factor * j);
+
+        size_t i = (factor == 2) ? filter_simd_scale_up2(in, out, src->width) : 0;
+        for (; i < src->width; i++) {
+            for (size_t k = 0; k < factor; k++) {
+                out[factor * i + k] = in[i];
             }
         }
+
+        for (size_t k = 1; k < factor; k++) {
+            memcpy(dst_pixel(dst, 0, factor * j + k), out, dst->width * sizeof(*out));
+        }
     }
+}
 
-    return new_image;
+int filter_scale_up_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst, size_t factor) {
+    if (filter_reshape(src, dst, factor * src->width, factor * src->height) < 0) {
+        goto fail_exit;
+    }
+
+    filter_rows_args_t args = {.src = src, .dst = dst, .factor = factor};
+    parallel_for_run(parallel_for, src->height, FILTER_PARALLEL_GRAIN, scale_up_rows, &args);
+    return 0;
 
 fail_exit:
-    return NULL;
+    return -1;
 }
 
-image_t* filter_sobel(image_t* image) {
-    image_t* new_image = image_create(image->id, image->width - 2, image->height - 2);
-    if (new_image == NULL) {
-        goto fail_exit;
-    }
+/* bands of output rows, output row j reads source rows j to j + 2 */
+static void sobel_rows(void* args, size_t begin, size_t end) {
+    const filter_rows_args_t* rows = args;
+    const image_t* src             = rows->src;
+    image_t* dst                   = rows->dst;
 
     const int gx[3][3] = {
         {1, 0, -1},
@@ -156,117 +217,141 @@ image_t* filter_sobel(image_t* image) {
         {-1, -2, -1},
     };
 
-    for (int j = 1; j < image->height - 1; j++) {
-        for (int i = 1; i < image->width - 1; i++) {
-            int values_x[4] = {0, 0, 0, 0};
-            int values_y[4] = {0, 0, 0, 0};
+    for (size_t j = begin + 1; j < end + 1; j++) {
+        for (size_t i = 1; i + 1 < src->width; i++) {
+            int values_x[3] = {0, 0, 0};
+            int values_y[3] = {0, 0, 0};
 
             for (int y = -1; y <= 1; y++) {
                 for (int x = -1; x <= 1; x++) {
-                    pixel_t* pixel = image_get_pixel(image, i + x, j + y);
+                    const pixel_t* pixel = src_pixel(src, i + x, j + y);
 
-                    for (int k = 0; k < 4; k++) {
+                    for (int k = 0; k < 3; k++) {
                         values_x[k] += pixel->bytes[k] * gx[y + 1][x + 1];
                         values_y[k] += pixel->bytes[k] * gy[y + 1][x + 1];
                     }
                 }
             }
 
-            pixel_t* new_pixel = image_get_pixel(new_image, i - 1, j - 1);
-            pixel_t* pixel     = image_get_pixel(image, i, j);
+            pixel_t* new_pixel = dst_pixel(dst, i - 1, j - 1);
 
             for (int k = 0; k < 3; k++) {
                 new_pixel->bytes[k] = clamp(abs(values_x[k]) + abs(values_y[k]), 0, 255);
             }
-            new_pixel->bytes[3] = pixel->bytes[3];
+            new_pixel->bytes[3] = src_pixel(src, i, j)->bytes[3];
         }
     }
+}
 
-    return new_image;
+int filter_sobel_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    if (filter_reshape_border(src, dst) < 0) {
+        goto fail_exit;
+    }
+
+    filter_rows_args_t args = {.src = src, .dst = dst};
+    parallel_for_run(parallel_for, dst->height, FILTER_PARALLEL_GRAIN, sobel_rows, &args);
+    return 0;
 
 fail_exit:
-    return NULL;
+    return -1;
 }
 
-image_t* filter_to_hsv(image_t* image) {
-    image_t* new_image = image_create(image->id, image->width, image->height);
-    if (new_image == NULL) {
-        goto fail_exit;
-    }
+static void to_hsv_rows(void* args, size_t begin, size_t end) {
+    const filter_rows_args_t* rows = args;
+
+    for (size_t j = begin; j < end; j++) {
+        size_t i = filter_simd_to_hsv(src_pixel(rows->src, 0, j), dst_pixel(rows->dst, 0, j), rows->src->width);
 
-    for (int j = 0; j < image->height; j++) {
-        for (int i = 0; i < image->width; i++) {
-            pixel_t* pixel     = image_get_pixel(image, i, j);
-            pixel_t* new_pixel = image_get_pixel(new_image, i, j);
+        for (; i < rows->src->width; i++) {
+            const pixel_t* pixel = src_pixel(rows->src, i, j);
+            pixel_t* new_pixel   = dst_pixel(rows->dst, i, j);
 
             rgb_to_hsv(pixel->bytes, new_pixel->bytes);
             new_pixel->bytes[3] = pixel->bytes[3];
         }
     }
+}
 
-    return new_image;
+int filter_to_hsv_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    if (filter_reshape(src, dst, src->width, src->height) < 0) {
+        goto fail_exit;
+    }
+
+    filter_rows_args_t args = {.src = src, .dst = dst};
+    parallel_for_run(parallel_for, src->height, FILTER_PARALLEL_GRAIN, to_hsv_rows, &args);
+    return 0;
 
 fail_exit:
-    return NULL;
+    return -1;
 }
 
-image_t* filter_to_rgb(image_t* image) {
-    image_t* new_image = image_create(image->id, image->width, image->height);
-    if (new_image == NULL) {
-        goto fail_exit;
-    }
+static void to_rgb_rows(void* args, size_t begin, size_t end) {
+    const filter_rows_args_t* rows = args;
 
-    for (int j = 0; j < image->height; j++) {
-        for (int i = 0; i < image->width; i++) {
-            pixel_t* pixel     = image_get_pixel(image, i, j);
-            pixel_t* new_pixel = image_get_pixel(new_image, i, j);
+    for (size_t j = begin; j < end; j++) {
+        size_t i = filter_simd_to_rgb(src_pixel(rows->src, 0, j), dst_pixel(rows->dst, 0, j), rows->src->width);
+
+        for (; i < rows->src->width; i++) {
+            const pixel_t* pixel = src_pixel(rows->src, i, j);
+            pixel_t* new_pixel   = dst_pixel(rows->dst, i, j);
 
             hsv_to_rgb(pixel->bytes, new_pixel->bytes);
             new_pixel->bytes[3] = pixel->bytes[3];
         }
     }
+}
 
-    return new_image;
+int filter_to_rgb_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    if (filter_reshape(src, dst, src->width, src->height) < 0) {
+        goto fail_exit;
+    }
+
+    filter_rows_args_t args = {.src = src, .dst = dst};
+    parallel_for_run(parallel_for, src->height, FILTER_PARALLEL_GRAIN, to_rgb_rows, &args);
+    return 0;
 
 fail_exit:
-    return NULL;
+    return -1;
 }
 
-image_t* filter_add_pixel(image_t* image, pixel_t* add_pixel) {
-    image_t* new_image = image_create(image->id, image->width, image->height);
-    if (new_image == NULL) {
-        goto fail_exit;
-    }
+static void add_pixel_rows(void* args, size_t begin, size_t end) {
+    const filter_rows_args_t* rows = args;
 
-    for (int j = 0; j < image->height; j++) {
-        for (int i = 0; i < image->width; i++) {
-            pixel_t* pixel     = image_get_pixel(image, i, j);
-            pixel_t* new_pixel = image_get_pixel(new_image, i, j);
+    for (size_t j = begin; j < end; j++) {
+        for (size_t i = 0; i < rows->src->width; i++) {
+            const pixel_t* pixel = src_pixel(rows->src, i, j);
+            pixel_t* new_pixel   = dst_pixel(rows->dst, i, j);
 
             for (int k = 0; k < 3; k++) {
-                new_pixel->bytes[k] = pixel->bytes[k] + add_pixel->bytes[k];
+                new_pixel->bytes[k] = pixel->bytes[k] + rows->add_pixel->bytes[k];
             }
 
             new_pixel->bytes[3] = pixel->bytes[3];
         }
     }
+}
 
-    return new_image;
+int filter_add_pixel_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst,
+                              const pixel_t* add_pixel) {
+    if (filter_reshape(src, dst, src->width, src->height) < 0) {
+        goto fail_exit;
+    }
+
+    filter_rows_args_t args = {.src = src, .dst = dst, .add_pixel = add_pixel};
+    parallel_for_run(parallel_for, src->height, FILTER_PARALLEL_GRAIN, add_pixel_rows, &args);
+    return 0;
 
 fail_exit:
-    return NULL;
+    return -1;
 }
 
-image_t* filter_desaturate(image_t* image) {
-    image_t* new_image = image_create(image->id, image->width, image->height);
-    if (new_image == NULL) {
-        goto fail_exit;
-    }
+static void desaturate_rows(void* args, size_t begin, size_t end) {
+    const filter_rows_args_t* rows = args;
 
-    for (int j = 0; j < image->height; j++) {
-        for (int i = 0; i < image->width; i++) {
-            pixel_t* pixel     = image_get_pixel(image, i, j);
-            pixel_t* new_pixel = image_get_pixel(new_image, i, j);
+    for (size_t j = begin; j < end; j++) {
+        for (size_t i = 0; i < rows->src->width; i++) {
+            const pixel_t* pixel = src_pixel(rows->src, i, j);
+            pixel_t* new_pixel   = dst_pixel(rows->dst, i, j);
 
             double value = 0;
             value += 0.30 * ((double)pixel->bytes[0]);
@@ -279,26 +364,39 @@ image_t* filter_desaturate(image_t* image) {
             new_pixel->bytes[3] = pixel->bytes[3];
         }
     }
+}
 
-    return new_image;
+int filter_desaturate_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    if (filter_reshape(src, dst, src->width, src->height) < 0) {
+        goto fail_exit;
+    }
+
+    filter_rows_args_t args = {.src = src, .dst = dst};
+    parallel_for_run(parallel_for, src->height, FILTER_PARALLEL_GRAIN, desaturate_rows, &args);
+    return 0;
 
 fail_exit:
-    return NULL;
+    return -1;
 }
 
-image_t* filter_convolution33(image_t* image, const double m[3][3]) {
-    image_t* new_image = image_create(image->id, image->width - 2, image->height - 2);
-    if (new_image == NULL) {
-        goto fail_exit;
+/* bands of output rows, same halo as sobel */
+static void convolution33_rows(void* args, size_t begin, size_t end) {
+    const filter_rows_args_t* rows = args;
+    const image_t* src             = rows->src;
+    image_t* dst                   = rows->dst;
+    const double(*m)[3]            = rows->m;
+
+    if (filter_simd_convolution33_rows(src, dst, m, begin, end) == 0) {
+        return;
     }
 
-    for (int j = 1; j < image->height - 1; j++) {
-        for (int i = 1; i < image->width - 1; i++) {
+    for (size_t j = begin + 1; j < end + 1; j++) {
+        for (size_t i = 1; i + 1 < src->width; i++) {
             double values[3] = {0, 0, 0};
 
             for (int y = -1; y <= 1; y++) {
                 for (int x = -1; x <= 1; x++) {
-                    pixel_t* pixel = image_get_pixel(image, i + x, j + y);
+                    const pixel_t* pixel = src_pixel(src, i + x, j + y);
 
                     for (int k = 0; k < 3; k++) {
                         values[k] += pixel->bytes[k] * m[y + 1][x + 1];
@@ -306,111 +404,405 @@ image_t* filter_convolution33(image_t* image, const double m[3][3]) {
                 }
             }
 
-            pixel_t* new_pixel = image_get_pixel(new_image, i - 1, j - 1);
-            pixel_t* pixel     = image_get_pixel(image, i, j);
+            pixel_t* new_pixel = dst_pixel(dst, i - 1, j - 1);
 
             for (int k = 0; k < 3; k++) {
                 new_pixel->bytes[k] = (unsigned char)clamp(values[k], 0, 255);
             }
 
-            new_pixel->bytes[3] = pixel->bytes[3];
+            new_pixel->bytes[3] = src_pixel(src, i, j)->bytes[3];
         }
     }
+}
 
-    return new_image;
+int filter_convolution33_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst,
+                                  const double m[3][3]) {
+    if (filter_reshape_border(src, dst) < 0) {
+        goto fail_exit;
+    }
+
+    filter_rows_args_t args = {.src = src, .dst = dst, .m = m};
+    parallel_for_run(parallel_for, dst->height, FILTER_PARALLEL_GRAIN, convolution33_rows, &args);
+    return 0;
 
 fail_exit:
-    return NULL;
+    return -1;
 }
 
-image_t* filter_edge_identity(image_t* image) {
-    const double m[3][3] = {
-        {0, 0, 0},
-        {0, 1, 0},
-        {0, 0, 0},
-    };
+/* kernels of the convolution steps */
+
+static const double edge_identity_kernel[3][3] = {
+    {0, 0, 0},
+    {0, 1, 0},
+    {0, 0, 0},
+};
+
+static const double edge_detect_kernel[3][3] = {
+    {-1, -1, -1},
+    {-1, 8, -1},
+    {-1, -1, -1},
+};
+
+static const double sharpen_kernel[3][3] = {
+    {0, -2, 0},
+    {-2, 9, -2},
+    {0, -2, 0},
+};
+
+static const double box_blur_kernel[3][3] = {
+    {1.0 / 9.0, 1.0 / 9.0, 1.0 / 9.0},
+    {1.0 / 9.0, 1.0 / 9.0, 1.0 / 9.0},
+    {1.0 / 9.0, 1.0 / 9.0, 1.0 / 9.0},
+};
+
+static const double gaussian_blur_kernel[3][3] = {
+    {1.0 / 16.0, 2.0 / 16.0, 1.0 / 16.0},
+    {2.0 / 16.0, 4.0 / 16.0, 4.0 / 16.0},
+    {1.0 / 16.0, 2.0 / 16.0, 1.0 / 16.0},
+};
+
+int filter_step_kernel33(const filter_step_t* step, double m[3][3]) {
+    const double(*kernel)[3];
+    switch (step->kind) {
+    case FILTER_CONVOLUTION33:
+        kernel = step->m;
+        break;
+    case FILTER_EDGE_IDENTITY:
+        kernel = edge_identity_kernel;
+        break;
+    case FILTER_EDGE_DETECT:
+        kernel = edge_detect_kernel;
+        break;
+    case FILTER_SHARPEN:
+        kernel = sharpen_kernel;
+        break;
+    case FILTER_BOX_BLUR:
+        kernel = box_blur_kernel;
+        break;
+    case FILTER_GAUSSIAN_BLUR:
+        kernel = gaussian_blur_kernel;
+        break;
+    default:
+        return -1;
+    }
 
-    return filter_convolution33(image, m);
+    memcpy(m, kernel, sizeof(double[3][3]));
+    return 0;
 }
 
-image_t* filter_edge_detect(image_t* image) {
-    const double m[3][3] = {
-        {-1, -1, -1},
-        {-1, 8, -1},
-        {-1, -1, -1},
-    };
-
-    return filter_convolution33(image, m);
+int filter_edge_identity_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    return filter_convolution33_parallel(parallel_for, src, dst, edge_identity_kernel);
 }
 
-image_t* filter_sharpen(image_t* image) {
-    const double m[3][3] = {
-        {0, -2, 0},
-        {-2, 9, -2},
-        {0, -2, 0},
-    };
+int filter_edge_detect_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    return filter_convolution33_parallel(parallel_for, src, dst, edge_detect_kernel);
+}
 
-    return filter_convolution33(image, m);
+int filter_sharpen_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    return filter_convolution33_parallel(parallel_for, src, dst, sharpen_kernel);
 }
 
-image_t* filter_box_blur(image_t* image) {
-    const double m[3][3] = {
-        {1.0 / 9.0, 1.0 / 9.0, 1.0 / 9.0},
-        {1.0 / 9.0, 1.0 / 9.0, 1.0 / 9.0},
-        {1.0 / 9.0, 1.0 / 9.0, 1.0 / 9.0},
-    };
+int filter_box_blur_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    return filter_convolution33_parallel(parallel_for, src, dst, box_blur_kernel);
+}
 
-    return filter_convolution33(image, m);
+int filter_gaussian_blur_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    return filter_convolution33_parallel(parallel_for, src, dst, gaussian_blur_kernel);
 }
 
-image_t* filter_gaussian_blur(image_t* image) {
-    const double m[3][3] = {
-        {1.0 / 16.0, 2.0 / 16.0, 1.0 / 16.0},
-        {2.0 / 16.0, 4.0 / 16.0, 4.0 / 16.0},
-        {1.0 / 16.0, 2.0 / 16.0, 1.0 / 16.0},
-    };
+static void horizontal_flip_rows(void* args, size_t begin, size_t end) {
+    const filter_rows_args_t* rows = args;
+    const image_t* src             = rows->src;
 
-    return filter_convolution33(image, m);
+    for (size_t j = begin; j < end; j++) {
+        for (size_t i = 0; i < src->width; i++) {
+            *dst_pixel(rows->dst, (src->width - 1) - i, j) = *src_pixel(src, i, j);
+        }
+    }
 }
 
-image_t* filter_horizontal_flip(image_t* image) {
-    image_t* new_image = image_create(image->id, image->width, image->height);
-    if (new_image == NULL) {
+int filter_horizontal_flip_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    if (filter_reshape(src, dst, src->width, src->height) < 0) {
         goto fail_exit;
     }
 
-    for (int j = 0; j < image->height; j++) {
-        for (int i = 0; i < image->width; i++) {
-            pixel_t* pixel     = image_get_pixel(image, i, j);
-            pixel_t* new_pixel = image_get_pixel(new_image, (image->width - 1) - i, j);
+    filter_rows_args_t args = {.src = src, .dst = dst};
+    parallel_for_run(parallel_for, src->height, FILTER_PARALLEL_GRAIN, horizontal_flip_rows, &args);
+    return 0;
+
+fail_exit:
+    return -1;
+}
 
-            *new_pixel = *pixel;
+/* bands of source rows, each one lands on the mirrored band of the output */
+static void vertical_flip_rows(void* args, size_t begin, size_t end) {
+    const filter_rows_args_t* rows = args;
+    const image_t* src             = rows->src;
+
+    for (size_t j = begin; j < end; j++) {
+        for (size_t i = 0; i < src->width; i++) {
+            *dst_pixel(rows->dst, i, (src->height - j) - 1) = *src_pixel(src, i, j);
         }
     }
+}
 
-    return new_image;
+int filter_vertical_flip_parallel(const parallel_for_t* parallel_for, const image_t* src, image_t* dst) {
+    if (filter_reshape(src, dst, src->width, src->height) < 0) {
+        goto fail_exit;
+    }
+
+    filter_rows_args_t args = {.src = src, .dst = dst};
+    parallel_for_run(parallel_for, src->height, FILTER_PARALLEL_GRAIN, vertical_flip_rows, &args);
+    return 0;
 
 fail_exit:
-    return NULL;
+    return -1;
 }
 
-image_t* filter_vertical_flip(image_t* image) {
-    image_t* new_image = image_create(image->id, image->width, image->height);
-    if (new_image == NULL) {
-        goto fail_exit;
+/* single-threaded variants */
+
+int filter_scale_up_into(const image_t* src, image_t* dst, size_t factor) {
+    return filter_scale_up_parallel(NULL, src, dst, factor);
+}
+
+int filter_sobel_into(const image_t* src, image_t* dst) {
+    return filter_sobel_parallel(NULL, src, dst);
+}
+
+int filter_to_hsv_into(const image_t* src, image_t* dst) {
+    return filter_to_hsv_parallel(NULL, src, dst);
+}
+
+int filter_to_rgb_into(const image_t* src, image_t* dst) {
+    return filter_to_rgb_parallel(NULL, src, dst);
+}
+
+int filter_add_pixel_into(const image_t* src, image_t* dst, const pixel_t* add_pixel) {
+    return filter_add_pixel_parallel(NULL, src, dst, add_pixel);
+}
+
+int filter_desaturate_into(const image_t* src, image_t* dst) {
+    return filter_desaturate_parallel(NULL, src, dst);
+}
+
+int filter_convolution33_into(const image_t* src, image_t* dst, const double m[3][3]) {
+    return filter_convolution33_parallel(NULL, src, dst, m);
+}
+
+int filter_edge_identity_into(const image_t* src, image_t* dst) {
+    return filter_edge_identity_parallel(NULL, src, dst);
+}
+
+int filter_edge_detect_into(const image_t* src, image_t* dst) {
+    return filter_edge_detect_parallel(NULL, src, dst);
+}
+
+int filter_sharpen_into(const image_t* src, image_t* dst) {
+    return filter_sharpen_parallel(NULL, src, dst);
+}
+
+int filter_box_blur_into(const image_t* src, image_t* dst) {
+    return filter_box_blur_parallel(NULL, src, dst);
+}
+
+int filter_gaussian_blur_into(const image_t* src, image_t* dst) {
+    return filter_gaussian_blur_parallel(NULL, src, dst);
+}
+
+int filter_horizontal_flip_into(const image_t* src, image_t* dst) {
+    return filter_horizontal_flip_parallel(NULL, src, dst);
+}
+
+int filter_vertical_flip_into(const image_t* src, image_t* dst) {
+    return filter_vertical_flip_parallel(NULL, src, dst);
+}
+
+/* pool-aware variants, the new image is acquired with the output dimensions so the filter never reshapes it */
+
+static size_t border_size(size_t size) {
+    return (size >= 2) ? size - 2 : 0;
+}
+
+image_t* filter_scale_up_pool(image_pool_t* pool, image_t* image, size_t factor) {
+    image_t* new_image = image_pool_acquire(pool, image->id, factor * image->width, factor * image->height);
+    if (new_image != NULL && filter_scale_up_into(image, new_image, factor) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
     }
+    return new_image;
+}
 
-    for (int j = 0; j < image->height; j++) {
-        for (int i = 0; i < image->width; i++) {
-            pixel_t* pixel     = image_get_pixel(image, i, j);
-            pixel_t* new_pixel = image_get_pixel(new_image, i, (image->height - j) - 1);
+image_t* filter_sobel_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, border_size(image->width), border_size(image->height));
+    if (new_image != NULL && filter_sobel_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
 
-            *new_pixel = *pixel;
-        }
+image_t* filter_to_hsv_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, image->width, image->height);
+    if (new_image != NULL && filter_to_hsv_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
     }
+    return new_image;
+}
 
+image_t* filter_to_rgb_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, image->width, image->height);
+    if (new_image != NULL && filter_to_rgb_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
     return new_image;
+}
 
-fail_exit:
-    return NULL;
+image_t* filter_add_pixel_pool(image_pool_t* pool, image_t* image, pixel_t* add_pixel) {
+    image_t* new_image = image_pool_acquire(pool, image->id, image->width, image->height);
+    if (new_image != NULL && filter_add_pixel_into(image, new_image, add_pixel) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_desaturate_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, image->width, image->height);
+    if (new_image != NULL && filter_desaturate_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_convolution33_pool(image_pool_t* pool, image_t* image, const double m[3][3]) {
+    image_t* new_image = image_pool_acquire(pool, image->id, border_size(image->width), border_size(image->height));
+    if (new_image != NULL && filter_convolution33_into(image, new_image, m) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_edge_identity_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, border_size(image->width), border_size(image->height));
+    if (new_image != NULL && filter_edge_identity_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_edge_detect_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, border_size(image->width), border_size(image->height));
+    if (new_image != NULL && filter_edge_detect_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_sharpen_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, border_size(image->width), border_size(image->height));
+    if (new_image != NULL && filter_sharpen_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_box_blur_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, border_size(image->width), border_size(image->height));
+    if (new_image != NULL && filter_box_blur_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_gaussian_blur_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, border_size(image->width), border_size(image->height));
+    if (new_image != NULL && filter_gaussian_blur_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_horizontal_flip_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, image->width, image->height);
+    if (new_image != NULL && filter_horizontal_flip_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+image_t* filter_vertical_flip_pool(image_pool_t* pool, image_t* image) {
+    image_t* new_image = image_pool_acquire(pool, image->id, image->width, image->height);
+    if (new_image != NULL && filter_vertical_flip_into(image, new_image) < 0) {
+        image_destroy(new_image);
+        new_image = NULL;
+    }
+    return new_image;
+}
+
+/* allocating variants, same as the pool-aware ones without a pool */
+
+image_t* filter_scale_up(image_t* image, size_t factor) {
+    return filter_scale_up_pool(NULL, image, factor);
+}
+
+image_t* filter_sobel(image_t* image) {
+    return filter_sobel_pool(NULL, image);
+}
+
+image_t* filter_to_hsv(image_t* image) {
+    return filter_to_hsv_pool(NULL, image);
+}
+
+image_t* filter_to_rgb(image_t* image) {
+    return filter_to_rgb_pool(NULL, image);
+}
+
+image_t* filter_add_pixel(image_t* image, pixel_t* add_pixel) {
+    return filter_add_pixel_pool(NULL, image, add_pixel);
+}
+
+image_t* filter_desaturate(image_t* image) {
+    return filter_desaturate_pool(NULL, image);
+}
+
+image_t* filter_convolution33(image_t* image, const double m[3][3]) {
+    return filter_convolution33_pool(NULL, image, m);
+}
+
+image_t* filter_edge_identity(image_t* image) {
+    return filter_edge_identity_pool(NULL, image);
+}
+
+image_t* filter_edge_detect(image_t* image) {
+    return filter_edge_detect_pool(NULL, image);
+}
+
+image_t* filter_sharpen(image_t* image) {
+    return filter_sharpen_pool(NULL, image);
+}
+
+image_t* filter_box_blur(image_t* image) {
+    return filter_box_blur_pool(NULL, image);
+}
+
+image_t* filter_gaussian_blur(image_t* image) {
+    return filter_gaussian_blur_pool(NULL, image);
+}
+
+image_t* filter_horizontal_flip(image_t* image) {
+    return filter_horizontal_flip_pool(NULL, image);
+}
+
+image_t* filter_vertical_flip(image_t* image) {
+    return filter_vertical_flip_pool(NULL, image);
 }
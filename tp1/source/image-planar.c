@@ -0,0 +1,297 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter-simd.h"
+#include "image-planar.h"
+#include "log.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_PLANAR_X86
+#endif
+
+#define IMAGE_PLANAR_GRAIN 16
+
+image_planar_t* image_planar_create(size_t id, size_t width, size_t height) {
+    image_planar_t* planar = calloc(1, sizeof(*planar));
+    if (planar == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_exit;
+    }
+
+    planar->id = id;
+    if (image_planar_reshape(planar, width, height) < 0) {
+        goto fail_free_planar;
+    }
+
+    return planar;
+
+fail_free_planar:
+    free(planar);
+fail_exit:
+    return NULL;
+}
+
+void image_planar_destroy(image_planar_t* planar) {
+    free(planar->data);
+    free(planar);
+}
+
+void image_planar_init_in(image_planar_t* planar, image_t* storage) {
+    *planar         = (image_planar_t){0};
+    planar->id      = storage->id;
+    planar->storage = storage;
+}
+
+int image_planar_reshape(image_planar_t* planar, size_t width, size_t height) {
+    size_t stride = (width + IMAGE_PLANAR_ALIGN - 1) & ~(size_t)(IMAGE_PLANAR_ALIGN - 1);
+    size_t size   = 4 * stride * height;
+
+    unsigned char* base;
+    if (planar->storage != NULL) {
+        /* pixels are only aligned for pixel_t, keep room to move the planes to the next boundary */
+        size_t bytes = size + IMAGE_PLANAR_ALIGN;
+        if (image_reshape(planar->storage, (bytes + sizeof(pixel_t) - 1) / sizeof(pixel_t), 1) < 0) {
+            goto fail_exit;
+        }
+        planar->storage->id = planar->id;
+
+        uintptr_t address = (uintptr_t)planar->storage->pixels;
+        base              = (unsigned char*)((address + IMAGE_PLANAR_ALIGN - 1) & ~(uintptr_t)(IMAGE_PLANAR_ALIGN - 1));
+    } else {
+        if (size > planar->capacity) {
+            unsigned char* data = aligned_alloc(IMAGE_PLANAR_ALIGN, size);
+            if (data == NULL) {
+                LOG_ERROR_ERRNO("aligned_alloc");
+                goto fail_exit;
+            }
+
+            free(planar->data);
+            planar->data     = data;
+            planar->capacity = size;
+        }
+        base = planar->data;
+    }
+
+    planar->width  = width;
+    planar->height = height;
+    planar->stride = stride;
+    for (int c = 0; c < 4; c++) {
+        planar->planes[c] = &base[c * stride * height];
+    }
+    return 0;
+
+fail_exit:
+    return -1;
+}
+
+typedef struct image_planar_rows_args {
+    const image_t* image;
+    const image_planar_t* planar;
+} image_planar_rows_args_t;
+
+static void deinterleave_scalar(const pixel_t* src, unsigned char* planes[4], size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        for (int c = 0; c < 4; c++) {
+            planes[c][i] = src[i].bytes[c];
+        }
+    }
+}
+
+static void interleave_scalar(unsigned char* const planes[4], pixel_t* dst, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        for (int c = 0; c < 4; c++) {
+            dst[i].bytes[c] = planes[c][i];
+        }
+    }
+}
+
+#ifdef IMAGE_PLANAR_X86
+
+/*
+ * 4 pixels per 128-bit lane: a byte shuffle groups each lane as RRRR GGGG BBBB AAAA,
+ * then a 4x4 transpose of 32-bit groups across four registers gathers each channel.
+ */
+
+__attribute__((target("sse4.1"))) static size_t deinterleave_sse41(const pixel_t* src, unsigned char* planes[4],
+                                                                   size_t width) {
+    const __m128i group = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    size_t i            = 0;
+
+    for (; i + 16 <= width; i += 16) {
+        __m128i v0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&src[i]), group);
+        __m128i v1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&src[i + 4]), group);
+        __m128i v2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&src[i + 8]), group);
+        __m128i v3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&src[i + 12]), group);
+
+        __m128i rg01 = _mm_unpacklo_epi32(v0, v1);
+        __m128i ba01 = _mm_unpackhi_epi32(v0, v1);
+        __m128i rg23 = _mm_unpacklo_epi32(v2, v3);
+        __m128i ba23 = _mm_unpackhi_epi32(v2, v3);
+
+        _mm_store_si128((__m128i*)&planes[0][i], _mm_unpacklo_epi64(rg01, rg23));
+        _mm_store_si128((__m128i*)&planes[1][i], _mm_unpackhi_epi64(rg01, rg23));
+        _mm_store_si128((__m128i*)&planes[2][i], _mm_unpacklo_epi64(ba01, ba23));
+        _mm_store_si128((__m128i*)&planes[3][i], _mm_unpackhi_epi64(ba01, ba23));
+    }
+    return i;
+}
+
+__attribute__((target("sse4.1"))) static size_t interleave_sse41(unsigned char* const planes[4], pixel_t* dst,
+                                                                 size_t width) {
+    size_t i = 0;
+
+    for (; i + 16 <= width; i += 16) {
+        __m128i r = _mm_load_si128((const __m128i*)&planes[0][i]);
+        __m128i g = _mm_load_si128((const __m128i*)&planes[1][i]);
+        __m128i b = _mm_load_si128((const __m128i*)&planes[2][i]);
+        __m128i a = _mm_load_si128((const __m128i*)&planes[3][i]);
+
+        __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+        __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+        __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+        __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+
+        _mm_storeu_si128((__m128i*)&dst[i], _mm_unpacklo_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128((__m128i*)&dst[i + 4], _mm_unpackhi_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128((__m128i*)&dst[i + 8], _mm_unpacklo_epi16(rg_hi, ba_hi));
+        _mm_storeu_si128((__m128i*)&dst[i + 12], _mm_unpackhi_epi16(rg_hi, ba_hi));
+    }
+    return i;
+}
+
+/* same as SSE per 128-bit lane, the lanes hold pixels 0-3, 8-11... and 4-7, 12-15..., permuted back in order */
+__attribute__((target("avx2"))) static size_t deinterleave_avx2(const pixel_t* src, unsigned char* planes[4],
+                                                                size_t width) {
+    const __m256i group = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0, 4, 8, 12, 1, 5, 9,
+                                           13, 2, 6, 10, 14, 3, 7, 11, 15);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i            = 0;
+
+    for (; i + 32 <= width; i += 32) {
+        __m256i v0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)&src[i]), group);
+        __m256i v1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)&src[i + 8]), group);
+        __m256i v2 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)&src[i + 16]), group);
+        __m256i v3 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)&src[i + 24]), group);
+
+        __m256i rg01 = _mm256_unpacklo_epi32(v0, v1);
+        __m256i ba01 = _mm256_unpackhi_epi32(v0, v1);
+        __m256i rg23 = _mm256_unpacklo_epi32(v2, v3);
+        __m256i ba23 = _mm256_unpackhi_epi32(v2, v3);
+
+        __m256i r = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(rg01, rg23), order);
+        __m256i g = _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(rg01, rg23), order);
+        __m256i b = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(ba01, ba23), order);
+        __m256i a = _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(ba01, ba23), order);
+
+        _mm256_store_si256((__m256i*)&planes[0][i], r);
+        _mm256_store_si256((__m256i*)&planes[1][i], g);
+        _mm256_store_si256((__m256i*)&planes[2][i], b);
+        _mm256_store_si256((__m256i*)&planes[3][i], a);
+    }
+    return i;
+}
+
+/* the unpacks leave pixels 0-3 and 16-19 in the lanes of a register, 4-7 and 20-23 in the next... */
+__attribute__((target("avx2"))) static size_t interleave_avx2(unsigned char* const planes[4], pixel_t* dst,
+                                                              size_t width) {
+    size_t i = 0;
+
+    for (; i + 32 <= width; i += 32) {
+        __m256i r = _mm256_load_si256((const __m256i*)&planes[0][i]);
+        __m256i g = _mm256_load_si256((const __m256i*)&planes[1][i]);
+        __m256i b = _mm256_load_si256((const __m256i*)&planes[2][i]);
+        __m256i a = _mm256_load_si256((const __m256i*)&planes[3][i]);
+
+        __m256i rg_lo = _mm256_unpacklo_epi8(r, g);
+        __m256i rg_hi = _mm256_unpackhi_epi8(r, g);
+        __m256i ba_lo = _mm256_unpacklo_epi8(b, a);
+        __m256i ba_hi = _mm256_unpackhi_epi8(b, a);
+
+        __m256i q0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);
+        __m256i q1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+        __m256i q2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);
+        __m256i q3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+
+        _mm256_storeu_si256((__m256i*)&dst[i], _mm256_permute2x128_si256(q0, q1, 0x20));
+        _mm256_storeu_si256((__m256i*)&dst[i + 8], _mm256_permute2x128_si256(q2, q3, 0x20));
+        _mm256_storeu_si256((__m256i*)&dst[i + 16], _mm256_permute2x128_si256(q0, q1, 0x31));
+        _mm256_storeu_si256((__m256i*)&dst[i + 24], _mm256_permute2x128_si256(q2, q3, 0x31));
+    }
+    return i;
+}
+
+#endif /* IMAGE_PLANAR_X86 */
+
+static void from_image_rows(void* args, size_t begin, size_t end) {
+    const image_planar_rows_args_t* rows = args;
+    const image_t* image                 = rows->image;
+    const image_planar_t* planar         = rows->planar;
+    filter_simd_t simd                   = filter_simd_get();
+
+    for (size_t j = begin; j < end; j++) {
+        const pixel_t* src = &image->pixels[j * image->width];
+        unsigned char* planes[4];
+        for (int c = 0; c < 4; c++) {
+            planes[c] = image_planar_row(planar, c, j);
+        }
+
+        size_t i = 0;
+#ifdef IMAGE_PLANAR_X86
+        if (simd == FILTER_SIMD_AVX2) {
+            i = deinterleave_avx2(src, planes, image->width);
+        } else if (simd == FILTER_SIMD_SSE41) {
+            i = deinterleave_sse41(src, planes, image->width);
+        }
+#endif
+        deinterleave_scalar(src, planes, i, image->width);
+    }
+}
+
+static void to_image_rows(void* args, size_t begin, size_t end) {
+    const image_planar_rows_args_t* rows = args;
+    const image_t* image                 = rows->image;
+    const image_planar_t* planar         = rows->planar;
+    filter_simd_t simd                   = filter_simd_get();
+
+    for (size_t j = begin; j < end; j++) {
+        pixel_t* dst = &image->pixels[j * image->width];
+        unsigned char* planes[4];
+        for (int c = 0; c < 4; c++) {
+            planes[c] = image_planar_row(planar, c, j);
+        }
+
+        size_t i = 0;
+#ifdef IMAGE_PLANAR_X86
+        if (simd == FILTER_SIMD_AVX2) {
+            i = interleave_avx2(planes, dst, image->width);
+        } else if (simd == FILTER_SIMD_SSE41) {
+            i = interleave_sse41(planes, dst, image->width);
+        }
+#endif
+        interleave_scalar(planes, dst, i, image->width);
+    }
+}
+
+int image_planar_from_image(const parallel_for_t* parallel_for, const image_t* src, image_planar_t* dst) {
+    dst->id = src->id;
+    if (image_planar_reshape(dst, src->width, src->height) < 0) {
+        return -1;
+    }
+
+    image_planar_rows_args_t args = {.image = src, .planar = dst};
+    parallel_for_run(parallel_for, src->height, IMAGE_PLANAR_GRAIN, from_image_rows, &args);
+    return 0;
+}
+
+int image_planar_to_image(const parallel_for_t* parallel_for, const image_planar_t* src, image_t* dst) {
+    if (image_reshape(dst, src->width, src->height) < 0) {
+        return -1;
+    }
+    dst->id = src->id;
+
+    image_planar_rows_args_t args = {.image = dst, .planar = src};
+    parallel_for_run(parallel_for, src->height, IMAGE_PLANAR_GRAIN, to_image_rows, &args);
+    return 0;
+}
@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "image-pool.h"
+#include "log.h"
+
+static size_t image_bytes(image_t* image) {
+    return image->capacity * sizeof(*image->pixels);
+}
+
+static void image_pool_free(image_t* image) {
+    image->pool = NULL;
+    image_destroy(image);
+}
+
+/* moves `image` to the shared list of its class, frees it when the pool is full, called with the mutex held */
+static void image_pool_store(image_pool_t* pool, image_t* image) {
+    size_t bytes = image_bytes(image);
+    if (pool->cached_bytes + bytes > pool->max_bytes) {
+        goto evict;
+    }
+
+    image_pool_class_t* class = NULL;
+    image_pool_class_t* empty = NULL;
+    for (size_t i = 0; i < pool->num_classes; i++) {
+        if (pool->classes[i].width == image->width && pool->classes[i].height == image->height) {
+            class = &pool->classes[i];
+            break;
+        }
+        if (pool->classes[i].count == 0) {
+            empty = &pool->classes[i];
+        }
+    }
+
+    if (class == NULL) {
+        /* reuse the slot of a size nobody released lately when the table is full */
+        if (pool->num_classes < IMAGE_POOL_MAX_CLASSES) {
+            class = &pool->classes[pool->num_classes++];
+        } else if (empty != NULL) {
+            class = empty;
+        } else {
+            goto evict;
+        }
+        class->width  = image->width;
+        class->height = image->height;
+    }
+
+    if (class->count == class->capacity) {
+        size_t capacity  = (class->capacity == 0) ? 8 : 2 * class->capacity;
+        image_t** images = realloc(class->images, capacity * sizeof(*images));
+        if (images == NULL) {
+            goto evict;
+        }
+        class->images   = images;
+        class->capacity = capacity;
+    }
+
+    class->images[class->count++] = image;
+    pool->cached_bytes += bytes;
+    return;
+
+evict:
+    atomic_fetch_add(&pool->evictions, 1);
+    image_pool_free(image);
+}
+
+static void image_pool_cache_flush(void* args) {
+    image_pool_cache_t* cache = args;
+    image_pool_t* pool        = cache->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (size_t i = 0; i < cache->count; i++) {
+        image_pool_store(pool, cache->images[i]);
+    }
+    cache->count = 0;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static image_pool_cache_t* image_pool_cache(image_pool_t* pool) {
+    image_pool_cache_t* cache = pthread_getspecific(pool->cache_key);
+    if (cache != NULL) {
+        return cache;
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->pool = pool;
+
+    if (pthread_setspecific(pool->cache_key, cache) != 0) {
+        free(cache);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    cache->next  = pool->caches;
+    pool->caches = cache;
+    pthread_mutex_unlock(&pool->mutex);
+
+    return cache;
+}
+
+image_pool_t* image_pool_create(size_t max_bytes) {
+    image_pool_t* pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_exit;
+    }
+
+    pool->max_bytes = max_bytes;
+
+    errno = pthread_mutex_init(&pool->mutex, NULL);
+    if (errno != 0) {
+        LOG_ERROR_ERRNO("pthread_mutex_init");
+        goto fail_free_pool;
+    }
+
+    /* threads exiting before the pool is destroyed hand their cache back to the shared lists */
+    errno = pthread_key_create(&pool->cache_key, image_pool_cache_flush);
+    if (errno != 0) {
+        LOG_ERROR_ERRNO("pthread_key_create");
+        goto fail_destroy_mutex;
+    }
+
+    return pool;
+
+fail_destroy_mutex:
+    pthread_mutex_destroy(&pool->mutex);
+fail_free_pool:
+    free(pool);
+fail_exit:
+    return NULL;
+}
+
+void image_pool_destroy(image_pool_t* pool) {
+    pthread_key_delete(pool->cache_key);
+
+    while (pool->caches != NULL) {
+        image_pool_cache_t* cache = pool->caches;
+        pool->caches              = cache->next;
+
+        for (size_t i = 0; i < cache->count; i++) {
+            image_pool_free(cache->images[i]);
+        }
+        free(cache);
+    }
+
+    for (size_t i = 0; i < pool->num_classes; i++) {
+        for (size_t j = 0; j < pool->classes[i].count; j++) {
+            image_pool_free(pool->classes[i].images[j]);
+        }
+        free(pool->classes[i].images);
+    }
+
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+image_t* image_pool_acquire(image_pool_t* pool, size_t id, size_t width, size_t height) {
+    if (pool == NULL) {
+        return image_create(id, width, height);
+    }
+
+    image_t* image            = NULL;
+    image_pool_cache_t* cache = image_pool_cache(pool);
+
+    if (cache != NULL) {
+        for (size_t i = 0; i < cache->count; i++) {
+            if (cache->images[i]->width == width && cache->images[i]->height == height) {
+                image            = cache->images[i];
+                cache->images[i] = cache->images[--cache->count];
+                atomic_fetch_add(&pool->thread_hits, 1);
+                goto found;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    for (size_t i = 0; i < pool->num_classes; i++) {
+        image_pool_class_t* class = &pool->classes[i];
+        if (class->width == width && class->height == height && class->count > 0) {
+            image = class->images[--class->count];
+            pool->cached_bytes -= image_bytes(image);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (image != NULL) {
+        atomic_fetch_add(&pool->shared_hits, 1);
+        goto found;
+    }
+
+    atomic_fetch_add(&pool->misses, 1);
+    image = image_create(id, width, height);
+    if (image == NULL) {
+        return NULL;
+    }
+
+found:
+    image->id   = id;
+    image->pool = pool;
+    return image;
+}
+
+void image_pool_release(image_pool_t* pool, image_t* image) {
+    atomic_fetch_add(&pool->releases, 1);
+
+    image_pool_cache_t* cache = image_pool_cache(pool);
+    if (cache != NULL && cache->count < IMAGE_POOL_THREAD_CACHE) {
+        cache->images[cache->count++] = image;
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    if (cache != NULL) {
+        /* the cache is full, push one of its images to the shared lists to make room */
+        image_pool_store(pool, cache->images[0]);
+        cache->images[0] = image;
+    } else {
+        image_pool_store(pool, image);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void image_pool_print_stats(image_pool_t* pool, FILE* file) {
+    size_t thread_hits = atomic_load(&pool->thread_hits);
+    size_t shared_hits = atomic_load(&pool->shared_hits);
+    size_t misses      = atomic_load(&pool->misses);
+    size_t acquires    = thread_hits + shared_hits + misses;
+
+    fprintf(file, "image pool: %ld acquires, %ld thread cache hits, %ld shared hits, %ld misses (%.1f%% hit rate)\n",
+            acquires, thread_hits, shared_hits, misses,
+            (acquires > 0) ? 100.0 * (thread_hits + shared_hits) / acquires : 0.0);
+    fprintf(file, "image pool: %ld releases, %ld evictions, %ld bytes cached in shared lists\n",
+            atomic_load(&pool->releases), atomic_load(&pool->evictions), pool->cached_bytes);
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        fprintf(file, "image pool: %ld minor page faults, %ld major page faults\n", usage.ru_minflt, usage.ru_majflt);
+    }
+}
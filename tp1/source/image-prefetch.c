@@ -0,0 +1,195 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "image-prefetch.h"
+#include "log.h"
+
+/* how often a consumer waiting for a frame looks at `image_dir->stop`, set from a signal handler */
+#define IMAGE_PREFETCH_POLL_NS (50 * 1000 * 1000)
+
+/* asks the kernel to start reading frame `index` from disk, ignored past the last frame */
+static void image_prefetch_hint(image_prefetch_t* prefetch, size_t index) {
+    const size_t buffer_size = 256;
+    char buffer[buffer_size];
+
+    if (index >= prefetch->image_dir->load_end ||
+        image_dir_input_path(prefetch->image_dir, index, buffer, buffer_size) < 0) {
+        return;
+    }
+
+    int fd = open(buffer, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+static size_t image_prefetch_bytes(const image_t* image) {
+    return image->width * image->height * sizeof(*image->pixels);
+}
+
+static void* image_prefetch_worker(void* args) {
+    image_prefetch_t* prefetch = args;
+
+    pthread_mutex_lock(&prefetch->mutex);
+    while (1) {
+        while (!prefetch->closing && prefetch->next_claim < prefetch->end &&
+               (prefetch->next_claim >= prefetch->next_out + prefetch->depth ||
+                prefetch->ready_bytes >= prefetch->max_bytes)) {
+            pthread_cond_wait(&prefetch->space, &prefetch->mutex);
+        }
+        if (prefetch->closing || prefetch->next_claim >= prefetch->end) {
+            break;
+        }
+
+        size_t index = prefetch->next_claim++;
+        pthread_mutex_unlock(&prefetch->mutex);
+
+        image_prefetch_hint(prefetch, index + prefetch->depth);
+        image_t* image = image_dir_load(prefetch->image_dir, index);
+
+        pthread_mutex_lock(&prefetch->mutex);
+        if (image == NULL) {
+            /* past the last frame or unreadable, the frames after it are never handed out */
+            if (index < prefetch->end) {
+                prefetch->end = index;
+            }
+        } else if (index >= prefetch->end || prefetch->closing) {
+            image_destroy(image);
+        } else {
+            prefetch->slots[index % prefetch->depth] = image;
+            prefetch->ready_bytes += image_prefetch_bytes(image);
+        }
+        pthread_cond_broadcast(&prefetch->loaded);
+        pthread_cond_broadcast(&prefetch->space);
+    }
+    pthread_mutex_unlock(&prefetch->mutex);
+
+    return NULL;
+}
+
+image_prefetch_t* image_prefetch_create(image_dir_t* image_dir, size_t depth, size_t num_threads, size_t max_bytes) {
+    if (depth == 0) {
+        LOG_ERROR("prefetch depth must be positive");
+        goto fail_exit;
+    }
+
+    if (num_threads > depth) {
+        num_threads = depth;
+    }
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+
+    image_prefetch_t* prefetch = calloc(1, sizeof(*prefetch));
+    if (prefetch == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_exit;
+    }
+
+    prefetch->image_dir  = image_dir;
+    prefetch->depth      = depth;
+    prefetch->max_bytes  = max_bytes;
+    prefetch->next_claim = image_dir->load_current;
+    prefetch->next_out   = image_dir->load_current;
+    prefetch->end        = image_dir->load_end;
+    pthread_mutex_init(&prefetch->mutex, NULL);
+    pthread_cond_init(&prefetch->loaded, NULL);
+    pthread_cond_init(&prefetch->space, NULL);
+
+    prefetch->slots = calloc(depth, sizeof(*prefetch->slots));
+    if (prefetch->slots == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_destroy_prefetch;
+    }
+
+    prefetch->tids = calloc(num_threads, sizeof(*prefetch->tids));
+    if (prefetch->tids == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_destroy_prefetch;
+    }
+
+    /* the workers hint `depth` frames ahead of what they load, cover the start of the window here */
+    for (size_t i = 0; i < depth; i++) {
+        image_prefetch_hint(prefetch, prefetch->next_claim + i);
+    }
+
+    for (; prefetch->num_threads < num_threads; prefetch->num_threads++) {
+        errno = pthread_create(&prefetch->tids[prefetch->num_threads], NULL, image_prefetch_worker, prefetch);
+        if (errno != 0) {
+            LOG_ERROR_ERRNO("pthread_create");
+            goto fail_destroy_prefetch;
+        }
+    }
+
+    return prefetch;
+
+fail_destroy_prefetch:
+    image_prefetch_destroy(prefetch);
+fail_exit:
+    return NULL;
+}
+
+void image_prefetch_destroy(image_prefetch_t* prefetch) {
+    pthread_mutex_lock(&prefetch->mutex);
+    prefetch->closing = true;
+    pthread_cond_broadcast(&prefetch->space);
+    pthread_mutex_unlock(&prefetch->mutex);
+
+    for (size_t i = 0; i < prefetch->num_threads; i++) {
+        pthread_join(prefetch->tids[i], NULL);
+    }
+
+    for (size_t i = 0; prefetch->slots != NULL && i < prefetch->depth; i++) {
+        if (prefetch->slots[i] != NULL) {
+            image_destroy(prefetch->slots[i]);
+        }
+    }
+
+    pthread_cond_destroy(&prefetch->space);
+    pthread_cond_destroy(&prefetch->loaded);
+    pthread_mutex_destroy(&prefetch->mutex);
+    free(prefetch->tids);
+    free(prefetch->slots);
+    free(prefetch);
+}
+
+image_t* image_prefetch_next(image_prefetch_t* prefetch) {
+    image_t* image = NULL;
+
+    pthread_mutex_lock(&prefetch->mutex);
+    while (1) {
+        if (prefetch->image_dir->stop || prefetch->next_out >= prefetch->end) {
+            goto unlock_exit;
+        }
+
+        image = prefetch->slots[prefetch->next_out % prefetch->depth];
+        if (image != NULL) {
+            break;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += IMAGE_PREFETCH_POLL_NS;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&prefetch->loaded, &prefetch->mutex, &deadline);
+    }
+
+    prefetch->slots[prefetch->next_out % prefetch->depth] = NULL;
+    prefetch->ready_bytes -= image_prefetch_bytes(image);
+    prefetch->next_out++;
+    prefetch->image_dir->load_current = prefetch->next_out;
+    pthread_cond_broadcast(&prefetch->space);
+
+unlock_exit:
+    pthread_mutex_unlock(&prefetch->mutex);
+    return image;
+}
@@ -0,0 +1,229 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image-raw.h"
+#include "log.h"
+
+_Static_assert(sizeof(image_raw_header_t) == 64, "the raw header must stay 64 bytes");
+
+image_raw_reader_t* image_raw_open(const char* filename) {
+    image_raw_reader_t* reader = calloc(1, sizeof(*reader));
+    if (reader == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_exit;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("couldn't open `%s` (%s)", filename, strerror(errno));
+        goto fail_free_reader;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        LOG_ERROR_ERRNO("fstat");
+        goto fail_close_fd;
+    }
+
+    if (st.st_size < sizeof(image_raw_header_t)) {
+        LOG_ERROR("`%s` is too small to be a raw container", filename);
+        goto fail_close_fd;
+    }
+
+    reader->map_size = st.st_size;
+    reader->map      = mmap(NULL, reader->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (reader->map == MAP_FAILED) {
+        LOG_ERROR_ERRNO("mmap");
+        goto fail_close_fd;
+    }
+
+    /* the mapping keeps the file alive */
+    close(fd);
+
+    const image_raw_header_t* header = reader->map;
+    if (memcmp(header->magic, IMAGE_RAW_MAGIC, sizeof(header->magic)) != 0) {
+        LOG_ERROR("`%s` is not a raw container", filename);
+        goto fail_unmap;
+    }
+
+    reader->width      = header->width;
+    reader->height     = header->height;
+    reader->num_frames = header->num_frames;
+
+    size_t frame_size = reader->width * reader->height * sizeof(pixel_t);
+    if (header->frame_offset % sizeof(pixel_t) != 0 || header->frame_offset > reader->map_size ||
+        (frame_size > 0 && (reader->map_size - header->frame_offset) / frame_size < reader->num_frames)) {
+        LOG_ERROR("`%s` is truncated or corrupted", filename);
+        goto fail_unmap;
+    }
+
+    reader->frames = (const pixel_t*)((const unsigned char*)reader->map + header->frame_offset);
+
+    /* frames are consumed in order, let the kernel read ahead aggressively */
+    madvise(reader->map, reader->map_size, MADV_SEQUENTIAL);
+
+    return reader;
+
+fail_unmap:
+    munmap(reader->map, reader->map_size);
+    goto fail_free_reader;
+fail_close_fd:
+    close(fd);
+fail_free_reader:
+    free(reader);
+fail_exit:
+    return NULL;
+}
+
+void image_raw_close(image_raw_reader_t* reader) {
+    munmap(reader->map, reader->map_size);
+    free(reader);
+}
+
+image_t* image_raw_view(image_raw_reader_t* reader, size_t index) {
+    if (index >= reader->num_frames) {
+        return NULL;
+    }
+
+    image_t* image = calloc(1, sizeof(*image));
+    if (image == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        return NULL;
+    }
+
+    image->id       = index;
+    image->width    = reader->width;
+    image->height   = reader->height;
+    image->capacity = reader->width * reader->height;
+    image->pixels   = (pixel_t*)&reader->frames[index * image->capacity];
+    image->borrowed = true;
+    return image;
+}
+
+static int write_all(int fd, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+
+    while (size > 0) {
+        ssize_t count = write(fd, bytes, size);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR_ERRNO("write");
+            return -1;
+        }
+        bytes += count;
+        size -= count;
+    }
+
+    return 0;
+}
+
+static int image_raw_flush(image_raw_writer_t* writer) {
+    if (writer->buffered == 0) {
+        return 0;
+    }
+
+    int ret          = write_all(writer->fd, writer->buffer, writer->buffered);
+    writer->buffered = 0;
+    return ret;
+}
+
+image_raw_writer_t* image_raw_writer_create(const char* filename) {
+    image_raw_writer_t* writer = calloc(1, sizeof(*writer));
+    if (writer == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_exit;
+    }
+
+    writer->buffer = malloc(IMAGE_RAW_WRITE_BUFFER);
+    if (writer->buffer == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        goto fail_free_writer;
+    }
+
+    writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0) {
+        LOG_ERROR("couldn't create `%s` (%s)", filename, strerror(errno));
+        goto fail_free_buffer;
+    }
+
+    /* the header is rewritten with the final count when finishing */
+    image_raw_header_t header = {0};
+    if (write_all(writer->fd, &header, sizeof(header)) < 0) {
+        goto fail_close_fd;
+    }
+
+    return writer;
+
+fail_close_fd:
+    close(writer->fd);
+fail_free_buffer:
+    free(writer->buffer);
+fail_free_writer:
+    free(writer);
+fail_exit:
+    return NULL;
+}
+
+int image_raw_append(image_raw_writer_t* writer, const image_t* image) {
+    if (writer->num_frames == 0) {
+        writer->width  = image->width;
+        writer->height = image->height;
+    } else if (image->width != writer->width || image->height != writer->height) {
+        LOG_ERROR("frame %ld is %ldx%ld, the container holds %ldx%ld frames", image->id, image->width, image->height,
+                  writer->width, writer->height);
+        return -1;
+    }
+
+    size_t size = image->width * image->height * sizeof(pixel_t);
+
+    if (writer->buffered + size > IMAGE_RAW_WRITE_BUFFER) {
+        if (image_raw_flush(writer) < 0) {
+            return -1;
+        }
+    }
+
+    if (size >= IMAGE_RAW_WRITE_BUFFER) {
+        /* already a large write on its own, skip the copy */
+        if (write_all(writer->fd, image->pixels, size) < 0) {
+            return -1;
+        }
+    } else {
+        memcpy(&writer->buffer[writer->buffered], image->pixels, size);
+        writer->buffered += size;
+    }
+
+    writer->num_frames++;
+    return 0;
+}
+
+int image_raw_writer_finish(image_raw_writer_t* writer) {
+    int ret = image_raw_flush(writer);
+
+    image_raw_header_t header = {
+        .width        = writer->width,
+        .height       = writer->height,
+        .num_frames   = writer->num_frames,
+        .frame_offset = sizeof(header),
+    };
+    memcpy(header.magic, IMAGE_RAW_MAGIC, sizeof(header.magic));
+
+    if (ret == 0 && pwrite(writer->fd, &header, sizeof(header), 0) != sizeof(header)) {
+        LOG_ERROR_ERRNO("pwrite");
+        ret = -1;
+    }
+
+    if (close(writer->fd) < 0) {
+        LOG_ERROR_ERRNO("close");
+        ret = -1;
+    }
+
+    free(writer->buffer);
+    free(writer);
+    return ret;
+}
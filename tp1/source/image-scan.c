@@ -0,0 +1,174 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "image-scan.h"
+#include "log.h"
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+int image_scan_natural_compare(const char* a, const char* b) {
+    const char* start_a = a;
+    const char* start_b = b;
+
+    while (*a != '\0' && *b != '\0') {
+        if (!is_digit(*a) || !is_digit(*b)) {
+            if (*a != *b) {
+                return (unsigned char)*a - (unsigned char)*b;
+            }
+            a++;
+            b++;
+            continue;
+        }
+
+        /* leading zeros don't change the value, a longer run of significant digits is larger */
+        while (*a == '0') {
+            a++;
+        }
+        while (*b == '0') {
+            b++;
+        }
+
+        size_t len_a = 0;
+        size_t len_b = 0;
+        while (is_digit(a[len_a])) {
+            len_a++;
+        }
+        while (is_digit(b[len_b])) {
+            len_b++;
+        }
+
+        if (len_a != len_b) {
+            return (len_a < len_b) ? -1 : 1;
+        }
+
+        int diff = memcmp(a, b, len_a);
+        if (diff != 0) {
+            return diff;
+        }
+
+        a += len_a;
+        b += len_b;
+    }
+
+    if (*a != *b) {
+        return (unsigned char)*a - (unsigned char)*b;
+    }
+
+    /* equal values written differently ("7.png" and "007.png"), keep the order total */
+    return strcmp(start_a, start_b);
+}
+
+static int image_scan_compare(const void* a, const void* b) {
+    return image_scan_natural_compare(*(char* const*)a, *(char* const*)b);
+}
+
+static bool image_scan_is_file(const char* directory, const struct dirent* entry) {
+    if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+        return entry->d_type == DT_REG;
+    }
+
+    /* the file system didn't say, or a link that may point to a file */
+    char buffer[4096];
+    int count = snprintf(buffer, sizeof(buffer), "%s/%s", directory, entry->d_name);
+    if (count >= sizeof(buffer) - 1) {
+        return false;
+    }
+
+    struct stat st;
+    return stat(buffer, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+image_scan_t* image_scan_create(const char* directory, const char* pattern) {
+    if (pattern == NULL) {
+        pattern = IMAGE_SCAN_DEFAULT_PATTERN;
+    }
+
+    image_scan_t* scan = calloc(1, sizeof(*scan));
+    if (scan == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_exit;
+    }
+
+    DIR* dir = opendir(directory);
+    if (dir == NULL) {
+        LOG_ERROR_ERRNO("opendir");
+        goto fail_destroy_scan;
+    }
+
+    size_t capacity = 0;
+    while (1) {
+        errno = 0;
+
+        struct dirent* entry = readdir(dir);
+        if (entry == NULL) {
+            if (errno != 0) {
+                LOG_ERROR_ERRNO("readdir");
+                goto fail_close_dir;
+            }
+            break;
+        }
+
+        if (fnmatch(pattern, entry->d_name, FNM_PERIOD) != 0 || !image_scan_is_file(directory, entry)) {
+            continue;
+        }
+
+        if (scan->count == capacity) {
+            capacity     = (capacity == 0) ? 64 : 2 * capacity;
+            char** names = realloc(scan->names, capacity * sizeof(*names));
+            if (names == NULL) {
+                LOG_ERROR_ERRNO("realloc");
+                goto fail_close_dir;
+            }
+            scan->names = names;
+        }
+
+        scan->names[scan->count] = strdup(entry->d_name);
+        if (scan->names[scan->count] == NULL) {
+            LOG_ERROR_ERRNO("strdup");
+            goto fail_close_dir;
+        }
+        scan->count++;
+    }
+
+    closedir(dir);
+
+    qsort(scan->names, scan->count, sizeof(*scan->names), image_scan_compare);
+    return scan;
+
+fail_close_dir:
+    closedir(dir);
+fail_destroy_scan:
+    image_scan_destroy(scan);
+fail_exit:
+    return NULL;
+}
+
+void image_scan_destroy(image_scan_t* scan) {
+    for (size_t i = 0; i < scan->count; i++) {
+        free(scan->names[i]);
+    }
+    free(scan->names);
+    free(scan);
+}
+
+void image_scan_shard(size_t num_frames, size_t index, size_t count, size_t* begin, size_t* end) {
+    if (count == 0) {
+        *begin = 0;
+        *end   = num_frames;
+        return;
+    }
+
+    /* the remainder goes one frame each to the first shards */
+    size_t base  = num_frames / count;
+    size_t extra = num_frames % count;
+    *begin       = index * base + ((index < extra) ? index : extra);
+    *end         = *begin + base + ((index < extra) ? 1 : 0);
+}
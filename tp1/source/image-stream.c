@@ -0,0 +1,562 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "image-pool.h"
+#include "image-stream.h"
+#include "log.h"
+
+#define IMAGE_STREAM_Y4M_MAGIC "YUV4MPEG2"
+#define IMAGE_STREAM_Y4M_FRAME "FRAME"
+#define IMAGE_STREAM_LINE 1024 /* longest header or frame line accepted */
+
+static inline unsigned char clamp_u8(int value) {
+    return (value < 0) ? 0 : ((value > 255) ? 255 : value);
+}
+
+int image_stream_format_parse(const char* name, image_stream_format_t* format) {
+    if (strcmp(name, "rgba") == 0) {
+        *format = IMAGE_STREAM_RGBA;
+    } else if (strcmp(name, "y4m") == 0) {
+        *format = IMAGE_STREAM_Y4M;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static const char* image_stream_chroma_name(image_stream_chroma_t chroma) {
+    switch (chroma) {
+    case IMAGE_STREAM_C420:
+        return "420jpeg";
+    case IMAGE_STREAM_C422:
+        return "422";
+    case IMAGE_STREAM_C444:
+        return "444";
+    case IMAGE_STREAM_CMONO:
+        return "mono";
+    }
+    return NULL;
+}
+
+static int image_stream_chroma_parse(const char* name, image_stream_chroma_t* chroma) {
+    if (strcmp(name, "420") == 0 || strcmp(name, "420jpeg") == 0 || strcmp(name, "420paldv") == 0 ||
+        strcmp(name, "420mpeg2") == 0) {
+        *chroma = IMAGE_STREAM_C420;
+    } else if (strcmp(name, "422") == 0) {
+        *chroma = IMAGE_STREAM_C422;
+    } else if (strcmp(name, "444") == 0) {
+        *chroma = IMAGE_STREAM_C444;
+    } else if (strcmp(name, "mono") == 0) {
+        *chroma = IMAGE_STREAM_CMONO;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* log2 of the horizontal and vertical chroma subsampling */
+static void image_stream_chroma_shift(image_stream_chroma_t chroma, int* shift_x, int* shift_y) {
+    *shift_x = (chroma == IMAGE_STREAM_C420 || chroma == IMAGE_STREAM_C422) ? 1 : 0;
+    *shift_y = (chroma == IMAGE_STREAM_C420) ? 1 : 0;
+}
+
+/* bytes of the Y, Cb and Cr planes of a frame, `chroma_width` and `chroma_height` are 0 for mono */
+static size_t image_stream_planes_size(image_stream_chroma_t chroma, size_t width, size_t height, size_t* chroma_width,
+                                       size_t* chroma_height) {
+    int shift_x, shift_y;
+    image_stream_chroma_shift(chroma, &shift_x, &shift_y);
+
+    *chroma_width  = (chroma == IMAGE_STREAM_CMONO) ? 0 : (width + shift_x) >> shift_x;
+    *chroma_height = (chroma == IMAGE_STREAM_CMONO) ? 0 : (height + shift_y) >> shift_y;
+    return width * height + 2 * *chroma_width * *chroma_height;
+}
+
+/* returns 0 once `size` bytes are read, 1 at the end of the stream before any byte, -1 otherwise */
+static int image_stream_read_exact(image_stream_reader_t* reader, void* data, size_t size) {
+    unsigned char* dst = data;
+    size_t done        = 0;
+
+    size_t buffered = reader->end - reader->begin;
+    if (buffered > 0) {
+        size_t count = (buffered < size) ? buffered : size;
+        memcpy(dst, &reader->buffer[reader->begin], count);
+        reader->begin += count;
+        done += count;
+    }
+
+    /* the rest goes straight to the destination, as large as the kernel hands it */
+    while (done < size) {
+        ssize_t count = read(reader->fd, &dst[done], size - done);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR_ERRNO("read");
+            return -1;
+        }
+        if (count == 0) {
+            if (done == 0) {
+                return 1;
+            }
+            LOG_ERROR("stream truncated, %ld of %ld bytes read", done, size);
+            return -1;
+        }
+        done += count;
+    }
+
+    return 0;
+}
+
+/* reads up to a newline into `line` without it, returns 1 at the end of the stream before any byte */
+static int image_stream_read_line(image_stream_reader_t* reader, char* line, size_t size) {
+    size_t length = 0;
+
+    while (1) {
+        if (reader->begin == reader->end) {
+            ssize_t count = read(reader->fd, reader->buffer, IMAGE_STREAM_BUFFER);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOG_ERROR_ERRNO("read");
+                return -1;
+            }
+            if (count == 0) {
+                if (length == 0) {
+                    return 1;
+                }
+                LOG_ERROR("stream truncated in the middle of a line");
+                return -1;
+            }
+            reader->begin = 0;
+            reader->end   = count;
+        }
+
+        char c = reader->buffer[reader->begin++];
+        if (c == '\n') {
+            line[length] = '\0';
+            return 0;
+        }
+
+        if (length + 1 == size) {
+            LOG_ERROR("line longer than %ld bytes", size - 1);
+            return -1;
+        }
+        line[length++] = c;
+    }
+}
+
+static int image_stream_read_header(image_stream_reader_t* reader) {
+    char line[IMAGE_STREAM_LINE];
+    if (image_stream_read_line(reader, line, sizeof(line)) != 0) {
+        LOG_ERROR("missing Y4M header");
+        return -1;
+    }
+
+    char* save;
+    char* token = strtok_r(line, " ", &save);
+    if (token == NULL || strcmp(token, IMAGE_STREAM_Y4M_MAGIC) != 0) {
+        LOG_ERROR("not a Y4M stream");
+        return -1;
+    }
+
+    reader->width  = 0;
+    reader->height = 0;
+    reader->chroma = IMAGE_STREAM_C420;
+
+    while ((token = strtok_r(NULL, " ", &save)) != NULL) {
+        switch (token[0]) {
+        case 'W':
+            reader->width = strtoul(&token[1], NULL, 10);
+            break;
+        case 'H':
+            reader->height = strtoul(&token[1], NULL, 10);
+            break;
+        case 'C':
+            if (image_stream_chroma_parse(&token[1], &reader->chroma) < 0) {
+                LOG_ERROR("unsupported Y4M colorspace `%s`", &token[1]);
+                return -1;
+            }
+            break;
+        default: {
+            /* frame rate, interlacing, aspect ratio and extensions are kept for the output */
+            size_t length = strlen(reader->params);
+            int count     = snprintf(&reader->params[length], sizeof(reader->params) - length, " %s", token);
+            if (count >= sizeof(reader->params) - length) {
+                LOG_ERROR("Y4M header parameters too long");
+                return -1;
+            }
+            break;
+        }
+        }
+    }
+
+    if (reader->width == 0 || reader->height == 0) {
+        LOG_ERROR("Y4M header without dimensions");
+        return -1;
+    }
+
+    size_t chroma_width, chroma_height;
+    reader->planes =
+        malloc(image_stream_planes_size(reader->chroma, reader->width, reader->height, &chroma_width, &chroma_height));
+    if (reader->planes == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        return -1;
+    }
+
+    return 0;
+}
+
+image_stream_reader_t* image_stream_reader_create(int fd, image_stream_format_t format, size_t width, size_t height) {
+    image_stream_reader_t* reader = calloc(1, sizeof(*reader));
+    if (reader == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_exit;
+    }
+
+    reader->fd     = fd;
+    reader->format = format;
+    reader->width  = width;
+    reader->height = height;
+
+    reader->buffer = malloc(IMAGE_STREAM_BUFFER);
+    if (reader->buffer == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        goto fail_destroy_reader;
+    }
+
+    if (format == IMAGE_STREAM_Y4M) {
+        if (image_stream_read_header(reader) < 0) {
+            goto fail_destroy_reader;
+        }
+    } else if (width == 0 || height == 0) {
+        LOG_ERROR("the size of RGBA frames must be given");
+        goto fail_destroy_reader;
+    }
+
+    return reader;
+
+fail_destroy_reader:
+    image_stream_reader_destroy(reader);
+fail_exit:
+    return NULL;
+}
+
+void image_stream_reader_destroy(image_stream_reader_t* reader) {
+    free(reader->planes);
+    free(reader->buffer);
+    free(reader);
+}
+
+static void image_stream_yuv_to_rgba(const image_stream_reader_t* reader, image_t* image) {
+    size_t chroma_width, chroma_height;
+    image_stream_planes_size(reader->chroma, reader->width, reader->height, &chroma_width, &chroma_height);
+
+    int shift_x, shift_y;
+    image_stream_chroma_shift(reader->chroma, &shift_x, &shift_y);
+
+    const unsigned char* plane_y  = reader->planes;
+    const unsigned char* plane_cb = &plane_y[reader->width * reader->height];
+    const unsigned char* plane_cr = &plane_cb[chroma_width * chroma_height];
+
+    for (size_t y = 0; y < image->height; y++) {
+        for (size_t x = 0; x < image->width; x++) {
+            size_t chroma = (y >> shift_y) * chroma_width + (x >> shift_x);
+
+            int c = plane_y[y * image->width + x] - 16;
+            int d = (reader->chroma == IMAGE_STREAM_CMONO) ? 0 : plane_cb[chroma] - 128;
+            int e = (reader->chroma == IMAGE_STREAM_CMONO) ? 0 : plane_cr[chroma] - 128;
+
+            pixel_t* pixel  = &image->pixels[y * image->width + x];
+            pixel->bytes[0] = clamp_u8((298 * c + 409 * e + 128) >> 8);
+            pixel->bytes[1] = clamp_u8((298 * c - 100 * d - 208 * e + 128) >> 8);
+            pixel->bytes[2] = clamp_u8((298 * c + 516 * d + 128) >> 8);
+            pixel->bytes[3] = 0xFF;
+        }
+    }
+}
+
+image_t* image_stream_read(image_stream_reader_t* reader, image_pool_t* pool) {
+    if (reader->format == IMAGE_STREAM_Y4M) {
+        char line[IMAGE_STREAM_LINE];
+        int ret = image_stream_read_line(reader, line, sizeof(line));
+        if (ret == 1) {
+            goto end_exit;
+        }
+        if (ret < 0) {
+            goto fail_exit;
+        }
+
+        if (strncmp(line, IMAGE_STREAM_Y4M_FRAME, strlen(IMAGE_STREAM_Y4M_FRAME)) != 0) {
+            LOG_ERROR("expected a Y4M frame header");
+            goto fail_exit;
+        }
+    }
+
+    image_t* image = image_pool_acquire(pool, reader->num_frames, reader->width, reader->height);
+    if (image == NULL) {
+        goto fail_exit;
+    }
+
+    if (reader->format == IMAGE_STREAM_Y4M) {
+        size_t chroma_width, chroma_height;
+        size_t size =
+            image_stream_planes_size(reader->chroma, reader->width, reader->height, &chroma_width, &chroma_height);
+
+        if (image_stream_read_exact(reader, reader->planes, size) != 0) {
+            LOG_ERROR("Y4M frame %ld truncated", reader->num_frames);
+            goto fail_destroy_image;
+        }
+        image_stream_yuv_to_rgba(reader, image);
+    } else {
+        int ret = image_stream_read_exact(reader, image->pixels, image->width * image->height * sizeof(pixel_t));
+        if (ret == 1) {
+            image_destroy(image);
+            goto end_exit;
+        }
+        if (ret < 0) {
+            goto fail_destroy_image;
+        }
+    }
+
+    reader->num_frames++;
+    return image;
+
+fail_destroy_image:
+    image_destroy(image);
+fail_exit:
+    reader->failed = true;
+end_exit:
+    return NULL;
+}
+
+image_stream_writer_t* image_stream_writer_create(int fd, image_stream_format_t format,
+                                                  const image_stream_reader_t* input, size_t first_id) {
+    image_stream_writer_t* writer = calloc(1, sizeof(*writer));
+    if (writer == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        return NULL;
+    }
+
+    writer->fd      = fd;
+    writer->format  = format;
+    writer->chroma  = IMAGE_STREAM_C444;
+    writer->next_id = first_id;
+    pthread_mutex_init(&writer->mutex, NULL);
+
+    if (input != NULL && input->format == IMAGE_STREAM_Y4M) {
+        writer->chroma = input->chroma;
+        memcpy(writer->params, input->params, sizeof(writer->params));
+    } else {
+        snprintf(writer->params, sizeof(writer->params), " F25:1 Ip A1:1");
+    }
+
+    return writer;
+}
+
+static int image_stream_write_all(int fd, const void* data, size_t size) {
+    const unsigned char* src = data;
+
+    while (size > 0) {
+        ssize_t count = write(fd, src, size);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR_ERRNO("write");
+            return -1;
+        }
+        src += count;
+        size -= count;
+    }
+
+    return 0;
+}
+
+/* FRAME line and planes of `image`, chroma samples average the pixels they cover */
+static unsigned char* image_stream_rgba_to_y4m(const image_stream_writer_t* writer, const image_t* image,
+                                               size_t* size) {
+    size_t chroma_width, chroma_height;
+    size_t planes_size =
+        image_stream_planes_size(writer->chroma, image->width, image->height, &chroma_width, &chroma_height);
+    size_t header_size = strlen(IMAGE_STREAM_Y4M_FRAME) + 1;
+
+    unsigned char* data = malloc(header_size + planes_size);
+    if (data == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        return NULL;
+    }
+
+    memcpy(data, IMAGE_STREAM_Y4M_FRAME "\n", header_size);
+
+    unsigned char* plane_y  = &data[header_size];
+    unsigned char* plane_cb = &plane_y[image->width * image->height];
+    unsigned char* plane_cr = &plane_cb[chroma_width * chroma_height];
+
+    for (size_t i = 0; i < image->width * image->height; i++) {
+        const unsigned char* rgb = image->pixels[i].bytes;
+        plane_y[i]               = ((66 * rgb[0] + 129 * rgb[1] + 25 * rgb[2] + 128) >> 8) + 16;
+    }
+
+    int shift_x, shift_y;
+    image_stream_chroma_shift(writer->chroma, &shift_x, &shift_y);
+
+    for (size_t cy = 0; cy < chroma_height; cy++) {
+        for (size_t cx = 0; cx < chroma_width; cx++) {
+            int sum_cb = 0;
+            int sum_cr = 0;
+            int count  = 0;
+
+            for (size_t y = cy << shift_y; y < ((cy + 1) << shift_y) && y < image->height; y++) {
+                for (size_t x = cx << shift_x; x < ((cx + 1) << shift_x) && x < image->width; x++) {
+                    const unsigned char* rgb = image->pixels[y * image->width + x].bytes;
+                    sum_cb += (-38 * rgb[0] - 74 * rgb[1] + 112 * rgb[2] + 128) >> 8;
+                    sum_cr += (112 * rgb[0] - 94 * rgb[1] - 18 * rgb[2] + 128) >> 8;
+                    count++;
+                }
+            }
+
+            /* rounds half away from zero, the sums can be negative */
+            int half = count / 2;
+
+            plane_cb[cy * chroma_width + cx] = 128 + ((sum_cb >= 0) ? sum_cb + half : sum_cb - half) / count;
+            plane_cr[cy * chroma_width + cx] = 128 + ((sum_cr >= 0) ? sum_cr + half : sum_cr - half) / count;
+        }
+    }
+
+    *size = header_size + planes_size;
+    return data;
+}
+
+/* called with the mutex held, for the frame with id `next_id` */
+static int image_stream_emit(image_stream_writer_t* writer, size_t width, size_t height, const void* data,
+                             size_t size) {
+    if (writer->width == 0) {
+        writer->width  = width;
+        writer->height = height;
+
+        if (writer->format == IMAGE_STREAM_Y4M) {
+            char header[IMAGE_STREAM_LINE];
+            int count = snprintf(header, sizeof(header), IMAGE_STREAM_Y4M_MAGIC " W%ld H%ld C%s%s\n", width, height,
+                                 image_stream_chroma_name(writer->chroma), writer->params);
+            if (image_stream_write_all(writer->fd, header, count) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    if (width != writer->width || height != writer->height) {
+        LOG_ERROR("frame %ld is %ldx%ld, the stream holds %ldx%ld frames", writer->next_id, width, height,
+                  writer->width, writer->height);
+        return -1;
+    }
+
+    return image_stream_write_all(writer->fd, data, size);
+}
+
+int image_stream_write(image_stream_writer_t* writer, const image_t* image) {
+    unsigned char* data = NULL;
+    size_t size         = image->width * image->height * sizeof(pixel_t);
+
+    if (writer->format == IMAGE_STREAM_Y4M) {
+        data = image_stream_rgba_to_y4m(writer, image, &size);
+        if (data == NULL) {
+            goto fail_exit;
+        }
+    }
+
+    pthread_mutex_lock(&writer->mutex);
+
+    if (writer->failed) {
+        goto fail_unlock;
+    }
+
+    if (image->id != writer->next_id) {
+        /* early frame, parked until the ones before it are written */
+        image_stream_pending_t* pending = malloc(sizeof(*pending));
+        if (pending == NULL) {
+            LOG_ERROR_ERRNO("malloc");
+            goto fail_unlock;
+        }
+
+        if (data == NULL) {
+            data = malloc(size);
+            if (data == NULL) {
+                LOG_ERROR_ERRNO("malloc");
+                free(pending);
+                goto fail_unlock;
+            }
+            memcpy(data, image->pixels, size);
+        }
+
+        *pending = (image_stream_pending_t){
+            .id = image->id, .width = image->width, .height = image->height, .data = data, .size = size};
+
+        image_stream_pending_t** link = &writer->pending;
+        while (*link != NULL && (*link)->id < image->id) {
+            link = &(*link)->next;
+        }
+        pending->next = *link;
+        *link         = pending;
+        writer->num_pending++;
+
+        pthread_mutex_unlock(&writer->mutex);
+        return 0;
+    }
+
+    /* raw RGBA frames in order are written from the pixels, without a copy */
+    const void* src = (data != NULL) ? data : (const void*)image->pixels;
+    if (image_stream_emit(writer, image->width, image->height, src, size) < 0) {
+        goto fail_unlock;
+    }
+    free(data);
+    writer->next_id++;
+
+    while (writer->pending != NULL && writer->pending->id == writer->next_id) {
+        image_stream_pending_t* pending = writer->pending;
+
+        int ret         = image_stream_emit(writer, pending->width, pending->height, pending->data, pending->size);
+        writer->pending = pending->next;
+        writer->num_pending--;
+        free(pending->data);
+        free(pending);
+        if (ret < 0) {
+            writer->failed = true;
+            pthread_mutex_unlock(&writer->mutex);
+            return -1;
+        }
+        writer->next_id++;
+    }
+
+    pthread_mutex_unlock(&writer->mutex);
+    return 0;
+
+fail_unlock:
+    writer->failed = true;
+    pthread_mutex_unlock(&writer->mutex);
+    free(data);
+fail_exit:
+    return -1;
+}
+
+int image_stream_writer_destroy(image_stream_writer_t* writer) {
+    int ret = writer->failed ? -1 : 0;
+
+    if (writer->pending != NULL) {
+        LOG_ERROR("frame %ld never saved, %ld frames after it dropped", writer->next_id, writer->num_pending);
+        ret = -1;
+    }
+
+    while (writer->pending != NULL) {
+        image_stream_pending_t* pending = writer->pending;
+        writer->pending                 = pending->next;
+        free(pending->data);
+        free(pending);
+    }
+
+    pthread_mutex_destroy(&writer->mutex);
+    free(writer);
+    return ret;
+}
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter-simd.h"
+#include "image-view.h"
+#include "log.h"
+
+#define IMAGE_VIEW_GRAIN 16
+
+void image_view_init(image_view_t* view, const image_t* image) {
+    *view = (image_view_t){
+        .id     = image->id,
+        .width  = image->width,
+        .height = image->height,
+        .base   = image->pixels,
+        .step   = 1,
+        .stride = image->width,
+        .scale  = 1,
+    };
+}
+
+void image_view_scale_up(image_view_t* view, size_t factor) {
+    view->width *= factor;
+    view->height *= factor;
+    view->scale *= factor;
+    view->offset_x *= factor;
+    view->offset_y *= factor;
+}
+
+/*
+ * Mirrors one axis: with A = size - 1 + offset = q * scale + r, logical 0 now
+ * reads the source pixel of the old last one, q pixels away, and the new
+ * offset scale - 1 - r makes the columns after it walk back in step.
+ */
+static void image_view_flip(const pixel_t** base, ptrdiff_t* step, size_t* offset, size_t size, size_t scale) {
+    if (size == 0) {
+        return;
+    }
+
+    size_t last = size - 1 + *offset;
+    *base += (ptrdiff_t)(last / scale) * *step;
+    *step   = -*step;
+    *offset = scale - 1 - last % scale;
+}
+
+void image_view_flip_horizontal(image_view_t* view) {
+    image_view_flip(&view->base, &view->step, &view->offset_x, view->width, view->scale);
+}
+
+void image_view_flip_vertical(image_view_t* view) {
+    image_view_flip(&view->base, &view->stride, &view->offset_y, view->height, view->scale);
+}
+
+int image_view_crop(image_view_t* view, size_t x, size_t y, size_t width, size_t height) {
+    if (x + width > view->width || y + height > view->height) {
+        LOG_ERROR("crop %ldx%ld+%ld+%ld out of a %ldx%ld image", width, height, x, y, view->width, view->height);
+        return -1;
+    }
+
+    x += view->offset_x;
+    y += view->offset_y;
+    view->base += (ptrdiff_t)(x / view->scale) * view->step + (ptrdiff_t)(y / view->scale) * view->stride;
+    view->offset_x = x % view->scale;
+    view->offset_y = y % view->scale;
+    view->width    = width;
+    view->height   = height;
+    return 0;
+}
+
+ptrdiff_t* image_view_columns(const image_view_t* view) {
+    /* one past the last column too, so empty views still have a first one */
+    ptrdiff_t* columns = malloc((view->width + 1) * sizeof(*columns));
+    if (columns == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        return NULL;
+    }
+
+    for (size_t x = 0; x <= view->width; x++) {
+        columns[x] = image_view_column(view, x);
+    }
+    return columns;
+}
+
+/*
+ * Unflipped rows scaled by 2 are doubled like filter_scale_up, the other
+ * mappings go through the column table, a contiguous row is a single memcpy.
+ */
+void image_view_copy_row(const image_view_t* view, const ptrdiff_t* columns, size_t y, pixel_t* out) {
+    const pixel_t* in = image_view_row(view, y);
+    size_t x          = 0;
+
+    if (image_view_is_contiguous(view)) {
+        memcpy(out, in + columns[0], view->width * sizeof(*out));
+        return;
+    }
+
+    if (view->scale == 2 && view->step == 1 && view->offset_x == 0) {
+        x = 2 * filter_simd_scale_up2(in, out, view->width / 2);
+    }
+    for (; x < view->width; x++) {
+        out[x] = in[columns[x]];
+    }
+}
+
+typedef struct image_view_rows_args {
+    const image_view_t* view;
+    image_t* dst;
+    const ptrdiff_t* columns;
+} image_view_rows_args_t;
+
+static void copy_rows(void* args, size_t begin, size_t end) {
+    const image_view_rows_args_t* rows = args;
+
+    for (size_t y = begin; y < end; y++) {
+        image_view_copy_row(rows->view, rows->columns, y, &rows->dst->pixels[y * rows->view->width]);
+    }
+}
+
+int image_view_copy_into(const parallel_for_t* parallel_for, const image_view_t* view, image_t* dst) {
+    if (image_reshape(dst, view->width, view->height) < 0) {
+        goto fail_exit;
+    }
+    dst->id = view->id;
+
+    image_view_rows_args_t args = {.view = view, .dst = dst, .columns = image_view_columns(view)};
+    if (args.columns == NULL) {
+        goto fail_exit;
+    }
+
+    parallel_for_run(parallel_for, view->height, IMAGE_VIEW_GRAIN, copy_rows, &args);
+    free((ptrdiff_t*)args.columns);
+    return 0;
+
+fail_exit:
+    return -1;
+}
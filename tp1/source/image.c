@@ -1,9 +1,17 @@
 /* DO NOT EDIT THIS FILE */
 
+#include <fcntl.h>
 #include <png.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "image-pool.h"
+#include "image-prefetch.h"
+#include "image-raw.h"
+#include "image-scan.h"
+#include "image-stream.h"
 #include "image.h"
 #include "log.h"
 
@@ -18,7 +26,12 @@ image_t* image_create(size_t id, size_t width, size_t height) {
     image->width  = width;
     image->height = height;
 
-    image->pixels = malloc((image->width * image->height) * sizeof(*image->pixels));
+    image->capacity = image->width * image->height;
+    if (image->capacity == 0) {
+        return image;
+    }
+
+    image->pixels = malloc(image->capacity * sizeof(*image->pixels));
     if (image->pixels == NULL) {
         LOG_ERROR_ERRNO("malloc");
         goto fail_free_image;
@@ -32,7 +45,128 @@ fail_exit:
     return NULL;
 }
 
-image_t* image_create_from_png(char* filename) {
+/*
+ * libpng can't restart a png_struct on a new stream, so every image still gets
+ * its own, but each thread keeps the memory behind them: the allocations done
+ * by libpng and zlib (inflate/deflate state, window, row filter buffers) go to
+ * a small per-thread cache of blocks and come back with the same size for the
+ * next frame. The row pointers handed to libpng point straight into
+ * image->pixels, the transforms below always produce 8 bit RGBA.
+ */
+
+#define IMAGE_PNG_CACHED_BLOCKS 16
+#define IMAGE_PNG_BLOCK_HEADER 16 /* keeps the blocks aligned like malloc() */
+
+typedef struct image_png_block {
+    void* memory;
+    size_t size;
+} image_png_block_t;
+
+typedef struct image_png_cache {
+    png_bytep* rows;
+    size_t num_rows;
+    image_png_block_t blocks[IMAGE_PNG_CACHED_BLOCKS];
+    size_t num_blocks;
+} image_png_cache_t;
+
+static pthread_key_t image_png_cache_key;
+static pthread_once_t image_png_cache_once = PTHREAD_ONCE_INIT;
+
+static void image_png_cache_free(void* args) {
+    image_png_cache_t* cache = args;
+    for (size_t i = 0; i < cache->num_blocks; i++) {
+        free(cache->blocks[i].memory);
+    }
+    free(cache->rows);
+    free(cache);
+}
+
+static void image_png_cache_init(void) {
+    errno = pthread_key_create(&image_png_cache_key, image_png_cache_free);
+    if (errno != 0) {
+        LOG_ERROR_ERRNO("pthread_key_create");
+    }
+}
+
+static image_png_cache_t* image_png_cache(void) {
+    pthread_once(&image_png_cache_once, image_png_cache_init);
+
+    image_png_cache_t* cache = pthread_getspecific(image_png_cache_key);
+    if (cache != NULL) {
+        return cache;
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        return NULL;
+    }
+
+    errno = pthread_setspecific(image_png_cache_key, cache);
+    if (errno != 0) {
+        LOG_ERROR_ERRNO("pthread_setspecific");
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+static png_voidp image_png_malloc(png_structp png, png_alloc_size_t size) {
+    image_png_cache_t* cache = png_get_mem_ptr(png);
+
+    for (size_t i = 0; i < cache->num_blocks; i++) {
+        if (cache->blocks[i].size == size) {
+            unsigned char* memory = cache->blocks[i].memory;
+            cache->blocks[i]      = cache->blocks[--cache->num_blocks];
+            return memory + IMAGE_PNG_BLOCK_HEADER;
+        }
+    }
+
+    unsigned char* memory = malloc(IMAGE_PNG_BLOCK_HEADER + size);
+    if (memory == NULL) {
+        return NULL;
+    }
+    *(size_t*)memory = size;
+    return memory + IMAGE_PNG_BLOCK_HEADER;
+}
+
+static void image_png_free(png_structp png, png_voidp ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    image_png_cache_t* cache = png_get_mem_ptr(png);
+    unsigned char* memory    = (unsigned char*)ptr - IMAGE_PNG_BLOCK_HEADER;
+
+    if (cache->num_blocks == IMAGE_PNG_CACHED_BLOCKS) {
+        /* drop the oldest block, sizes that stopped showing up age out */
+        free(cache->blocks[0].memory);
+        cache->blocks[0] = cache->blocks[--cache->num_blocks];
+    }
+
+    cache->blocks[cache->num_blocks++] = (image_png_block_t){.memory = memory, .size = *(size_t*)memory};
+}
+
+/* row pointers into the pixels of `image`, valid until the next call in this thread */
+static png_bytep* image_png_rows(image_png_cache_t* cache, const image_t* image) {
+    if (image->height > cache->num_rows) {
+        png_bytep* rows = realloc(cache->rows, image->height * sizeof(*rows));
+        if (rows == NULL) {
+            LOG_ERROR_ERRNO("realloc");
+            return NULL;
+        }
+        cache->rows     = rows;
+        cache->num_rows = image->height;
+    }
+
+    for (size_t j = 0; j < image->height; j++) {
+        cache->rows[j] = (png_bytep)&image->pixels[j * image->width];
+    }
+    return cache->rows;
+}
+
+static image_t* image_read_png(image_pool_t* pool, char* filename) {
     if (filename == NULL) {
         LOG_ERROR_NULL_PTR();
         goto fail_exit;
@@ -40,13 +174,22 @@ image_t* image_create_from_png(char* filename) {
 
     /* source: https://gist.github.com/niw/5963798 */
 
+    image_png_cache_t* cache = image_png_cache();
+    if (cache == NULL) {
+        goto fail_exit;
+    }
+
     FILE* file = fopen(filename, "rb");
     if (file == NULL) {
         LOG_ERROR_ERRNO("fopen");
         goto fail_exit;
     }
 
-    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    /* the whole file is read once from start to end */
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    png_structp png =
+        png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, cache, image_png_malloc, image_png_free);
     if (png == NULL) {
         LOG_ERROR("couldn't create png_struct");
         goto fail_close_file;
@@ -58,20 +201,18 @@ image_t* image_create_from_png(char* filename) {
         goto fail_free_png_struct;
     }
 
+    /* assigned after setjmp and read after longjmp */
+    image_t* volatile image = NULL;
+
     if (setjmp(png_jmpbuf(png))) {
-        goto fail_free_png_info;
+        goto fail_free_image;
     }
 
     png_init_io(png, file);
     png_read_info(png, info);
 
-    image_t* image = image_create(0, png_get_image_width(png, info), png_get_image_height(png, info));
-    if (image == NULL) {
-        goto fail_free_png_info;
-    }
-
     png_byte color = png_get_color_type(png, info);
-    png_byte depth = png_get_color_type(png, info);
+    png_byte depth = png_get_bit_depth(png, info);
 
     /* read any color_type into 8 bit depth, RGBA format */
 
@@ -105,60 +246,39 @@ image_t* image_create_from_png(char* filename) {
 
     png_read_update_info(png, info);
 
-    /* read image data */
+    size_t width  = png_get_image_width(png, info);
+    size_t height = png_get_image_height(png, info);
 
-    png_bytep* row_pointers = calloc(image->height, sizeof(*row_pointers));
-    if (row_pointers == NULL) {
-        goto fail_free_image;
+    /* libpng writes the rows in place, they must have exactly the layout of image->pixels */
+    if (png_get_rowbytes(png, info) != width * sizeof(pixel_t)) {
+        LOG_ERROR("unexpected png row size %ld for width %ld", png_get_rowbytes(png, info), width);
+        goto fail_free_png_info;
     }
 
-    for (int j = 0; j < image->height; j++) {
-        row_pointers[j] = malloc(png_get_rowbytes(png, info));
-        if (row_pointers[j] == NULL) {
-            goto fail_free_rows;
-        }
+    image = image_pool_acquire(pool, 0, width, height);
+    if (image == NULL) {
+        goto fail_free_png_info;
     }
 
-    png_read_image(png, row_pointers);
-
-    /* copy image data */
-
-    for (int j = 0; j < image->height; j++) {
-        for (int i = 0; i < image->width; i++) {
-            pixel_t* pixel  = image_get_pixel(image, i, j);
-            pixel->bytes[0] = row_pointers[j][4 * i + 0];
-            pixel->bytes[1] = row_pointers[j][4 * i + 1];
-            pixel->bytes[2] = row_pointers[j][4 * i + 2];
-            pixel->bytes[3] = row_pointers[j][4 * i + 3];
-        }
+    png_bytep* rows = image_png_rows(cache, image);
+    if (rows == NULL) {
+        goto fail_free_image;
     }
 
-    /* cleanup */
-
-    for (int j = 0; j < image->height; j++) {
-        if (row_pointers[j] != NULL) {
-            free(row_pointers[j]);
-        }
-    }
-    free(row_pointers);
+    png_read_image(png, rows);
 
     png_destroy_read_struct(&png, &info, NULL);
     fclose(file);
 
     return image;
 
-fail_free_rows:
-    for (int j = 0; j < image->height; j++) {
-        if (row_pointers[j] != NULL) {
-            free(row_pointers[j]);
-        }
-    }
-    free(row_pointers);
 fail_free_image:
-    image_destroy(image);
+    if (image != NULL) {
+        image_destroy(image);
+    }
 fail_free_png_info:
     png_destroy_read_struct(&png, &info, NULL);
-    goto fail_free_image;
+    goto fail_close_file;
 fail_free_png_struct:
     png_destroy_read_struct(&png, NULL, NULL);
 fail_close_file:
@@ -167,6 +287,10 @@ fail_exit:
     return NULL;
 }
 
+image_t* image_create_from_png(char* filename) {
+    return image_read_png(NULL, filename);
+}
+
 image_t* image_copy(image_t* image) {
     image_t* new_image = image_create(image->id, image->width, image->height);
     if (new_image == NULL) {
@@ -189,13 +313,86 @@ fail_exit:
 }
 
 void image_destroy(image_t* image) {
-    if (image->pixels != NULL) {
+    if (image->pool != NULL) {
+        image_pool_release(image->pool, image);
+        return;
+    }
+
+    if (image->pixels != NULL && !image->borrowed) {
         free(image->pixels);
     }
     free(image);
 }
 
+int image_reshape(image_t* image, size_t width, size_t height) {
+    /* borrowed pixels are read-only, the image gets storage of its own */
+    if (width * height > image->capacity || image->borrowed) {
+        /* the old content doesn't need to be preserved, avoid the copy done by realloc */
+        pixel_t* pixels = malloc(width * height * sizeof(*pixels));
+        if (pixels == NULL) {
+            LOG_ERROR_ERRNO("malloc");
+            goto fail_exit;
+        }
+
+        if (!image->borrowed) {
+            free(image->pixels);
+        }
+        image->pixels   = pixels;
+        image->capacity = width * height;
+        image->borrowed = false;
+    }
+
+    image->width  = width;
+    image->height = height;
+    return 0;
+
+fail_exit:
+    return -1;
+}
+
+const char* image_png_profile_name(image_png_profile_t profile) {
+    switch (profile) {
+    case IMAGE_PNG_FAST:
+        return "fast";
+    case IMAGE_PNG_SMALL:
+        return "small";
+    default:
+        return "default";
+    }
+}
+
+int image_png_profile_parse(const char* name, image_png_profile_t* profile) {
+    for (image_png_profile_t p = IMAGE_PNG_DEFAULT; p <= IMAGE_PNG_SMALL; p++) {
+        if (strcmp(name, image_png_profile_name(p)) == 0) {
+            *profile = p;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void image_png_set_profile(png_structp png, image_png_profile_t profile) {
+    switch (profile) {
+    case IMAGE_PNG_FAST:
+        /* filtering mostly pays off at high levels, at level 1 it costs more time than it saves bytes */
+        png_set_compression_level(png, 1);
+        png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+        break;
+    case IMAGE_PNG_SMALL:
+        png_set_compression_level(png, 9);
+        png_set_compression_mem_level(png, 9);
+        png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_ALL_FILTERS);
+        break;
+    default:
+        break;
+    }
+}
+
 int image_save_png(image_t* image, char* filename) {
+    return image_save_png_profile(image, filename, IMAGE_PNG_DEFAULT);
+}
+
+int image_save_png_profile(image_t* image, char* filename, image_png_profile_t profile) {
     if (image == NULL || filename == NULL) {
         LOG_ERROR_NULL_PTR();
         goto fail_exit;
@@ -203,13 +400,24 @@ int image_save_png(image_t* image, char* filename) {
 
     /* source: https://gist.github.com/niw/5963798 */
 
+    image_png_cache_t* cache = image_png_cache();
+    if (cache == NULL) {
+        goto fail_exit;
+    }
+
+    png_bytep* rows = image_png_rows(cache, image);
+    if (rows == NULL) {
+        goto fail_exit;
+    }
+
     FILE* file = fopen(filename, "wb");
     if (file == NULL) {
         LOG_ERROR_ERRNO("fopen");
         goto fail_exit;
     }
 
-    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_structp png =
+        png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, cache, image_png_malloc, image_png_free);
     if (png == NULL) {
         LOG_ERROR("couldn't create png_struct");
         goto fail_close_file;
@@ -226,102 +434,212 @@ int image_save_png(image_t* image, char* filename) {
     }
 
     png_init_io(png, file);
+    image_png_set_profile(png, profile);
 
-    /* output is 8 bit depth, RGBA format */
+    /* output is 8 bit depth, RGBA format, written straight from image->pixels */
 
     png_set_IHDR(png, info, image->width, image->height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
                  PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
     png_write_info(png, info);
+    png_write_image(png, rows);
+    png_write_end(png, NULL);
 
-    /* copy image data */
+    png_destroy_write_struct(&png, &info);
+    fclose(file);
 
-    png_bytep* row_pointers = calloc(image->height, sizeof(*row_pointers));
-    if (row_pointers == NULL) {
-        goto fail_free_png_struct;
+    return 0;
+
+fail_free_png_info:
+    png_destroy_write_struct(&png, &info);
+    goto fail_close_file;
+fail_free_png_struct:
+    png_destroy_write_struct(&png, NULL);
+fail_close_file:
+    fclose(file);
+fail_exit:
+    return -1;
+}
+
+static int image_dir_open_raw(image_dir_t* image_dir, size_t* num_frames) {
+    const size_t buffer_size = 256;
+    char buffer[buffer_size];
+
+    int count = snprintf(buffer, buffer_size, "%s/%s", image_dir->input_dir_name, IMAGE_RAW_FILENAME);
+    if (count >= buffer_size - 1) {
+        LOG_ERROR("buffer too small");
+        return -1;
     }
 
-    for (int j = 0; j < image->height; j++) {
-        row_pointers[j] = malloc(png_get_rowbytes(png, info));
-        if (row_pointers[j] == NULL) {
-            goto fail_free_rows;
-        }
+    image_dir->raw = image_raw_open(buffer);
+    if (image_dir->raw == NULL) {
+        return -1;
     }
 
-    for (int j = 0; j < image->height; j++) {
-        for (int i = 0; i < image->width; i++) {
-            pixel_t* pixel             = image_get_pixel(image, i, j);
-            row_pointers[j][4 * i + 0] = pixel->bytes[0];
-            row_pointers[j][4 * i + 1] = pixel->bytes[1];
-            row_pointers[j][4 * i + 2] = pixel->bytes[2];
-            row_pointers[j][4 * i + 3] = pixel->bytes[3];
+    *num_frames = image_dir->raw->num_frames;
+    return 0;
+}
+
+static int image_dir_open_stream(image_dir_t* image_dir) {
+    if (image_dir->input_format == IMAGE_INPUT_Y4M || image_dir->input_format == IMAGE_INPUT_RGBA) {
+        if (image_dir->shard_count > 0) {
+            LOG_ERROR("a stream input can't be sharded");
+            return -1;
+        }
+
+        image_stream_format_t format =
+            (image_dir->input_format == IMAGE_INPUT_Y4M) ? IMAGE_STREAM_Y4M : IMAGE_STREAM_RGBA;
+        image_dir->stream_in =
+            image_stream_reader_create(STDIN_FILENO, format, image_dir->stream_width, image_dir->stream_height);
+        if (image_dir->stream_in == NULL) {
+            image_dir->open_failed = true;
+            return -1;
         }
     }
 
-    /* write PNG file */
+    if (image_dir->output_format != IMAGE_OUTPUT_PNG) {
+        image_stream_format_t format =
+            (image_dir->output_format == IMAGE_OUTPUT_Y4M) ? IMAGE_STREAM_Y4M : IMAGE_STREAM_RGBA;
+        image_dir->stream_out =
+            image_stream_writer_create(image_dir->output_fd, format, image_dir->stream_in, image_dir->load_current);
+        if (image_dir->stream_out == NULL) {
+            return -1;
+        }
+    }
 
-    png_write_image(png, row_pointers);
-    png_write_end(png, NULL);
+    return 0;
+}
 
-    /* cleanup */
+int image_dir_open(image_dir_t* image_dir) {
+    if (image_dir->raw != NULL || image_dir->scan != NULL || image_dir->stream_in != NULL) {
+        return 0;
+    }
 
-    for (int j = 0; j < image->height; j++) {
-        if (row_pointers[j] != NULL) {
-            free(row_pointers[j]);
+    size_t num_frames;
+    if (image_dir->input_format == IMAGE_INPUT_Y4M || image_dir->input_format == IMAGE_INPUT_RGBA) {
+        /* frames come one after the other until the end of the stream */
+        image_dir->load_end = SIZE_MAX;
+        return image_dir_open_stream(image_dir);
+    } else if (image_dir->input_format == IMAGE_INPUT_RAW) {
+        if (image_dir_open_raw(image_dir, &num_frames) < 0) {
+            goto fail_close;
+        }
+    } else {
+        image_dir->scan = image_scan_create(image_dir->input_dir_name, image_dir->input_pattern);
+        if (image_dir->scan == NULL) {
+            goto fail_close;
         }
+        num_frames = image_dir->scan->count;
     }
-    free(row_pointers);
 
-    png_destroy_write_struct(&png, &info);
-    fclose(file);
+    /* an empty input is a mistake in the directory or the glob, not a run with nothing to do */
+    if (num_frames == 0) {
+        LOG_ERROR("no image found in directory `%s`", image_dir->input_dir_name);
+        goto fail_close;
+    }
 
-    return 0;
+    image_scan_shard(num_frames, image_dir->shard_index, image_dir->shard_count, &image_dir->load_current,
+                     &image_dir->load_end);
+    return image_dir_open_stream(image_dir);
 
-fail_free_rows:
-    for (int j = 0; j < image->height; j++) {
-        if (row_pointers[j] != NULL) {
-            free(row_pointers[j]);
-        }
+fail_close:
+    image_dir->open_failed = true;
+    if (image_dir->raw != NULL) {
+        image_raw_close(image_dir->raw);
+        image_dir->raw = NULL;
+    }
+    if (image_dir->scan != NULL) {
+        image_scan_destroy(image_dir->scan);
+        image_dir->scan = NULL;
     }
-    free(row_pointers);
-fail_free_png_info:
-    png_destroy_write_struct(&png, &info);
-    goto fail_close_file;
-fail_free_png_struct:
-    png_destroy_write_struct(&png, NULL);
-fail_close_file:
-    fclose(file);
-fail_exit:
     return -1;
 }
 
-image_t* image_dir_load_next(image_dir_t* image_dir) {
+int image_dir_input_path(const image_dir_t* image_dir, size_t index, char* buffer, size_t size) {
+    if (image_dir->scan == NULL || index >= image_dir->scan->count) {
+        LOG_ERROR("no frame %ld in directory `%s`", index, image_dir->input_dir_name);
+        return -1;
+    }
+
+    int count = snprintf(buffer, size, "%s/%s", image_dir->input_dir_name, image_dir->scan->names[index]);
+    if (count >= size - 1) {
+        LOG_ERROR("buffer too small");
+        return -1;
+    }
+    return 0;
+}
+
+image_t* image_dir_load(image_dir_t* image_dir, size_t index) {
     const size_t buffer_size = 256;
     char buffer[buffer_size];
 
+    if (image_dir_open(image_dir) < 0) {
+        goto fail_exit;
+    }
+
+    /* frames of a raw container are views into its mapping, nothing is decoded or copied */
+    if (image_dir->raw != NULL) {
+        return image_raw_view(image_dir->raw, index);
+    }
+
+    if (image_dir->stream_in != NULL) {
+        if (index != image_dir->stream_in->num_frames) {
+            LOG_ERROR("frame %ld can't be loaded out of order from a stream", index);
+            goto fail_exit;
+        }
+        return image_stream_read(image_dir->stream_in, image_dir->pool);
+    }
+
+    if (index >= image_dir->scan->count) {
+        goto fail_exit;
+    }
+
+    if (image_dir_input_path(image_dir, index, buffer, buffer_size) < 0) {
+        goto fail_exit;
+    }
+
+    image_t* image = image_read_png(image_dir->pool, buffer);
+    if (image == NULL) {
+        goto fail_exit;
+    }
+
+    image->id = index;
+    return image;
+
+fail_exit:
+    return NULL;
+}
+
+image_t* image_dir_load_next(image_dir_t* image_dir) {
     if (image_dir->stop) {
         goto stop_exit;
     }
 
-    int count = snprintf(buffer, buffer_size, "%s/%04ld.png", image_dir->input_dir_name, image_dir->load_current);
-    if (count >= buffer_size - 1) {
-        LOG_ERROR("buffer too small");
+    if (image_dir_open(image_dir) < 0) {
         goto fail_exit;
     }
 
-    if (access(buffer, F_OK) < 0) {
-        if (image_dir->load_current == 0) {
-            LOG_ERROR("no image found in directory `%s`", image_dir->input_dir_name);
+    if (image_dir->load_current >= image_dir->load_end) {
+        goto stop_exit;
+    }
+
+    if (image_dir->prefetch_depth > 0 && image_dir->scan != NULL) {
+        if (image_dir->prefetch == NULL) {
+            image_dir->prefetch = image_prefetch_create(image_dir, image_dir->prefetch_depth, IMAGE_PREFETCH_THREADS,
+                                                        IMAGE_PREFETCH_MAX_BYTES);
+            if (image_dir->prefetch == NULL) {
+                goto fail_exit;
+            }
         }
-        goto fail_exit;
+        return image_prefetch_next(image_dir->prefetch);
     }
 
-    image_t* image = image_create_from_png(buffer);
+    image_t* image = image_dir_load(image_dir, image_dir->load_current);
     if (image == NULL) {
         goto fail_exit;
     }
 
-    image->id = image_dir->load_current++;
+    image_dir->load_current++;
     return image;
 
 stop_exit:
@@ -333,14 +651,29 @@ int image_dir_save(image_dir_t* image_dir, image_t* image) {
     const size_t buffer_size = 256;
     char buffer[buffer_size];
 
-    int count =
-        snprintf(buffer, buffer_size, "%s/%s-%04ld.png", image_dir->output_dir_name, image_dir->save_prefix, image->id);
+    if (image_dir->stream_out != NULL) {
+        return image_stream_write(image_dir->stream_out, image);
+    }
+
+    int count;
+    if (image_dir->scan != NULL && image->id < image_dir->scan->count) {
+        /* named after the input frame, with its extension replaced since the output is always PNG */
+        const char* name = image_dir->scan->names[image->id];
+        const char* dot  = strrchr(name, '.');
+        int length       = (dot != NULL && dot != name) ? dot - name : strlen(name);
+
+        count = snprintf(buffer, buffer_size, "%s/%s-%.*s.png", image_dir->output_dir_name, image_dir->save_prefix,
+                         length, name);
+    } else {
+        count = snprintf(buffer, buffer_size, "%s/%s-%04ld.png", image_dir->output_dir_name, image_dir->save_prefix,
+                         image->id);
+    }
     if (count >= buffer_size - 1) {
         LOG_ERROR("buffer too small");
         goto fail_exit;
     }
 
-    if (image_save_png(image, buffer) < 0) {
+    if (image_save_png_profile(image, buffer, image_dir->write_profile) < 0) {
         goto fail_exit;
     }
 
@@ -357,3 +690,44 @@ void image_dir_reset(image_dir_t* image_dir, const char* input_dir_name, const c
     image_dir->save_prefix     = save_prefix;
     image_dir->load_current    = 0;
 }
+
+int image_dir_close(image_dir_t* image_dir) {
+    int ret = 0;
+
+    if (image_dir->prefetch != NULL) {
+        image_prefetch_destroy(image_dir->prefetch);
+        image_dir->prefetch = NULL;
+    }
+
+    if (image_dir->raw != NULL) {
+        image_raw_close(image_dir->raw);
+        image_dir->raw = NULL;
+    }
+
+    if (image_dir->scan != NULL) {
+        image_scan_destroy(image_dir->scan);
+        image_dir->scan = NULL;
+    }
+
+    if (image_dir->open_failed) {
+        image_dir->open_failed = false;
+        ret                    = -1;
+    }
+
+    if (image_dir->stream_in != NULL) {
+        if (image_dir->stream_in->failed) {
+            ret = -1;
+        }
+        image_stream_reader_destroy(image_dir->stream_in);
+        image_dir->stream_in = NULL;
+    }
+
+    if (image_dir->stream_out != NULL) {
+        if (image_stream_writer_destroy(image_dir->stream_out) < 0) {
+            ret = -1;
+        }
+        image_dir->stream_out = NULL;
+    }
+
+    return ret;
+}
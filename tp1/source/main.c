@@ -5,10 +5,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "filter-graph.h"
+#include "filter-simd.h"
+#include "image-pool.h"
+#include "image-scan.h"
 #include "image.h"
 #include "log.h"
 #include "pipeline.h"
+#include "thread-pool.h"
 
 static void show_help(FILE* f, const char* exec_name) {
     fprintf(f, "Usage: %s [OPTION]...\n", exec_name);
@@ -17,7 +23,46 @@ static void show_help(FILE* f, const char* exec_name) {
     fprintf(f, "  --directory PATH                path to read images\n");
     fprintf(f, "  --out PATH                      path to write images\n");
     fprintf(f, "  --quiet                         don't print anything\n");
-    fprintf(f, "  --pipeline [serial|pthread|tbb] pipeline algorithm to use\n");
+    fprintf(f, "  --pipeline [serial|pthread|tbb|tbb-flow|steal|latency]\n");
+    fprintf(f, "                                  pipeline algorithm to use, steal runs frames as tasks on\n");
+    fprintf(f, "                                  work-stealing workers, latency splits each frame across all CPUs\n");
+    fprintf(f, "  --budget MIB                    frame data in flight in the tbb-flow pipeline (default: %d)\n",
+            PIPELINE_DEFAULT_BUDGET_MIB);
+    fprintf(f, "  --filters SPEC                  comma separated filters applied to every frame, see\n");
+    fprintf(f, "                                  filter-graph.h (default: " FILTER_GRAPH_DEFAULT ")\n");
+    fprintf(f, "  --fused                         run every scale_up:2,sharpen,sobel as a single stage\n");
+    fprintf(f, "  --scale-mode [nearest|bilinear|bicubic]\n");
+    fprintf(f, "                                  interpolation of the scale_up filters without a mode\n");
+    fprintf(f, "                                  (default: nearest)\n");
+    fprintf(f, "  --planar                        run the filters on planar images, converted once per stage\n");
+    fprintf(f, "  --views                         read nearest upscales, crops and flips through views\n");
+    fprintf(f, "                                  instead of copies\n");
+    fprintf(f, "  --simd [scalar|sse4.1|avx2]     instruction set used by the filters (default: best supported)\n");
+    fprintf(f, "  --pool                          recycle image buffers and print pool statistics\n");
+    fprintf(f, "  --stats json                    print per-stage latency percentiles, queue occupancy and\n");
+    fprintf(f, "                                  throughput to stderr once the pipeline is done, even with --quiet\n");
+    fprintf(f, "  --stats-file PATH               write the --stats json report to PATH instead, alone in the file\n");
+    fprintf(f, "  --input-format [png|raw|y4m|rgba]\n");
+    fprintf(f, "                                  read the PNG files or the frames.raw container of the directory,\n");
+    fprintf(f, "                                  or a Y4M or raw RGBA stream from stdin\n");
+    fprintf(f, "  --size WxH                      size of the frames of a raw RGBA input stream\n");
+    fprintf(f, "  --output-format [png|y4m|rgba]  write PNG files to the output directory, or a Y4M or raw\n");
+    fprintf(f, "                                  RGBA stream to stdout in frame order, messages then go to\n");
+    fprintf(f, "                                  stderr (default: png)\n");
+    fprintf(f, "  --write-profile [fast|default|small]\n");
+    fprintf(f, "                                  PNG compression of the saved images (default: default)\n");
+    fprintf(f, "  --glob PATTERN                  PNG frames to read, in natural order\n");
+    fprintf(f, "                                  (default: " IMAGE_SCAN_DEFAULT_PATTERN ")\n");
+    fprintf(f, "  --shard K/N                     only process the K-th of N equal ranges of frames, K from 0\n");
+    fprintf(f, "  --prefetch N                    decode up to N PNG frames ahead of the pipeline (default: 0)\n");
+    fprintf(f, "  --reorder N                     save the frames of the pthread and tbb pipelines in order,\n");
+    fprintf(f, "                                  holding back up to N frames that complete early (default: 0,\n");
+    fprintf(f, "                                  any order), tbb-flow and steal reject it\n");
+    fprintf(f, "  --threads auto|N[,N]...         pthread workers per stage, the last count repeats (default:\n");
+    fprintf(f, "                                  CPUs), also caps the concurrency of the tbb-flow stages, the\n");
+    fprintf(f, "                                  first count sets the workers of the steal pipeline; auto shares\n");
+    fprintf(f, "                                  one worker per CPU between the pthread stages and moves them to\n");
+    fprintf(f, "                                  the bottleneck\n");
 }
 
 static void fail_missing_argument(const char* exec_name, const char* opt) {
@@ -38,12 +83,159 @@ static void fail_unknown_pipeline_algorithm(const char* exec_name, const char* a
     exit(1);
 }
 
+static void fail_unsupported_simd(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: unsupported argument '%s' for option `--simd`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_unknown_scale_mode(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: unrecognized argument '%s' for option `--scale-mode`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_invalid_threads(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: invalid argument '%s' for option `--threads`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_invalid_prefetch(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: invalid argument '%s' for option `--prefetch`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_invalid_shard(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: invalid argument '%s' for option `--shard`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_unknown_input_format(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: unrecognized argument '%s' for option `--input-format`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_unknown_output_format(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: unrecognized argument '%s' for option `--output-format`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_invalid_size(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: invalid argument '%s' for option `--size`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_unknown_write_profile(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: unrecognized argument '%s' for option `--write-profile`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static int parse_stage_threads(const char* arg, pipeline_options_t* options) {
+    options->num_stage_threads = 0;
+    options->adaptive_threads  = strcmp("auto", arg) == 0;
+    if (options->adaptive_threads) {
+        return 0;
+    }
+
+    while (*arg != '\0') {
+        char* end;
+        long count = strtol(arg, &end, 10);
+        if (end == arg || count <= 0 || options->num_stage_threads == PIPELINE_MAX_STAGE_THREADS) {
+            return -1;
+        }
+
+        options->stage_threads[options->num_stage_threads++] = count;
+
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        arg = end;
+    }
+
+    return (options->num_stage_threads > 0) ? 0 : -1;
+}
+
+static int parse_shard(const char* arg, image_dir_t* image_dir) {
+    char* end;
+    long index = strtol(arg, &end, 10);
+    if (end == arg || *end != '/' || index < 0) {
+        return -1;
+    }
+
+    const char* count_arg = end + 1;
+    long count            = strtol(count_arg, &end, 10);
+    if (end == count_arg || *end != '\0' || count <= 0 || index >= count) {
+        return -1;
+    }
+
+    image_dir->shard_index = index;
+    image_dir->shard_count = count;
+    return 0;
+}
+
+static int parse_size(const char* arg, image_dir_t* image_dir) {
+    char* end;
+    long width = strtol(arg, &end, 10);
+    if (end == arg || *end != 'x' || width <= 0) {
+        return -1;
+    }
+
+    const char* height_arg = end + 1;
+    long height            = strtol(height_arg, &end, 10);
+    if (end == height_arg || *end != '\0' || height <= 0) {
+        return -1;
+    }
+
+    image_dir->stream_width  = width;
+    image_dir->stream_height = height;
+    return 0;
+}
+
+static void fail_invalid_budget(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: invalid argument '%s' for option `--budget`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_invalid_reorder(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: invalid argument '%s' for option `--reorder`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_invalid_filters(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: invalid argument '%s' for option `--filters`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
+static void fail_unknown_stats_format(const char* exec_name, const char* arg) {
+    fprintf(stderr, "%s: unrecognized argument '%s' for option `--stats`\n", exec_name, arg);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
 static void fail_multiple_pipeline(const char* exec_name) {
     fprintf(stderr, "%s: zero or one option `--pipeline` must be specified\n", exec_name);
     fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
     exit(1);
 }
 
+static void fail_unordered_pipeline(const char* exec_name) {
+    fprintf(stderr, "%s: option `--reorder` isn't supported by the tbb-flow and steal pipelines\n", exec_name);
+    fprintf(stderr, "Try '%s --help' for more information.\n", exec_name);
+    exit(1);
+}
+
 static image_dir_t image_dir = {.load_current = 0, .stop = false};
 
 static void sigint_handler(int sig) {
@@ -51,15 +243,27 @@ static void sigint_handler(int sig) {
     image_dir.stop = true;
 }
 
-__attribute__((weak)) int pipeline_serial(image_dir_t* image_dir) {
+__attribute__((weak)) int pipeline_serial(image_dir_t* image_dir, const pipeline_options_t* options) {
     return -1;
 }
 
-__attribute__((weak)) int pipeline_pthread(image_dir_t* image_dir) {
+__attribute__((weak)) int pipeline_pthread(image_dir_t* image_dir, const pipeline_options_t* options) {
     return -1;
 }
 
-__attribute__((weak)) int pipeline_tbb(image_dir_t* image_dir) {
+__attribute__((weak)) int pipeline_tbb(image_dir_t* image_dir, const pipeline_options_t* options) {
+    return -1;
+}
+
+__attribute__((weak)) int pipeline_tbb_flow(image_dir_t* image_dir, const pipeline_options_t* options) {
+    return -1;
+}
+
+__attribute__((weak)) int pipeline_steal(image_dir_t* image_dir, const pipeline_options_t* options) {
+    return -1;
+}
+
+__attribute__((weak)) int parallel_for_tbb(parallel_for_t* parallel_for) {
     return -1;
 }
 
@@ -68,10 +272,25 @@ int main(int argc, char* argv[]) {
     bool use_pipeline_serial  = false;
     bool use_pipeline_pthread = false;
     bool use_pipeline_tbb     = false;
+    bool use_pipeline_flow    = false;
+    bool use_pipeline_steal   = false;
+    bool use_pipeline_latency = false;
     int use_pipeline_count    = 0;
-    char* input_dir_name;
+    char* input_dir_name      = NULL;
     char* output_dir_name;
-    bool quiet = false;
+    bool quiet                     = false;
+    bool use_pool                  = false;
+    bool use_stats                 = false;
+    const char* stats_file         = NULL;
+    pipeline_options_t options     = {.fused             = false,
+                                      .planar            = false,
+                                      .views             = false,
+                                      .pool              = NULL,
+                                      .num_stage_threads = 0,
+                                      .budget_bytes      = (size_t)PIPELINE_DEFAULT_BUDGET_MIB * 1024 * 1024};
+    const char* filters            = FILTER_GRAPH_DEFAULT;
+    filter_scale_mode_t scale_mode = FILTER_SCALE_NEAREST;
+    static filter_graph_t graph;
 
     output_dir_name = NULL;
 
@@ -103,11 +322,192 @@ int main(int argc, char* argv[]) {
             } else if (strcmp("tbb", argv[i + 1]) == 0) {
                 use_pipeline_tbb = true;
                 use_pipeline_count++;
+            } else if (strcmp("tbb-flow", argv[i + 1]) == 0) {
+                use_pipeline_flow = true;
+                use_pipeline_count++;
+            } else if (strcmp("steal", argv[i + 1]) == 0) {
+                use_pipeline_steal = true;
+                use_pipeline_count++;
+            } else if (strcmp("latency", argv[i + 1]) == 0) {
+                use_pipeline_latency = true;
+                use_pipeline_count++;
             } else {
                 fail_unknown_pipeline_algorithm(exec_name, argv[i + 1]);
             }
 
             i++;
+        } else if (strcmp("--simd", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            filter_simd_t simd;
+            if (filter_simd_parse(argv[i + 1], &simd) < 0 || filter_simd_set(simd) < 0) {
+                fail_unsupported_simd(exec_name, argv[i + 1]);
+            }
+
+            i++;
+        } else if (strcmp("--budget", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            char* end;
+            long budget = strtol(argv[i + 1], &end, 10);
+            if (end == argv[i + 1] || *end != '\0' || budget <= 0) {
+                fail_invalid_budget(exec_name, argv[i + 1]);
+            }
+
+            options.budget_bytes = (size_t)budget * 1024 * 1024;
+            i++;
+        } else if (strcmp("--reorder", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            char* end;
+            long window = strtol(argv[i + 1], &end, 10);
+            if (end == argv[i + 1] || *end != '\0' || window < 0) {
+                fail_invalid_reorder(exec_name, argv[i + 1]);
+            }
+
+            options.reorder_window = window;
+            i++;
+        } else if (strcmp("--threads", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            if (parse_stage_threads(argv[i + 1], &options) < 0) {
+                fail_invalid_threads(exec_name, argv[i + 1]);
+            }
+
+            i++;
+        } else if (strcmp("--input-format", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            if (strcmp("png", argv[i + 1]) == 0) {
+                image_dir.input_format = IMAGE_INPUT_PNG;
+            } else if (strcmp("raw", argv[i + 1]) == 0) {
+                image_dir.input_format = IMAGE_INPUT_RAW;
+            } else if (strcmp("y4m", argv[i + 1]) == 0) {
+                image_dir.input_format = IMAGE_INPUT_Y4M;
+            } else if (strcmp("rgba", argv[i + 1]) == 0) {
+                image_dir.input_format = IMAGE_INPUT_RGBA;
+            } else {
+                fail_unknown_input_format(exec_name, argv[i + 1]);
+            }
+
+            i++;
+        } else if (strcmp("--output-format", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            if (strcmp("png", argv[i + 1]) == 0) {
+                image_dir.output_format = IMAGE_OUTPUT_PNG;
+            } else if (strcmp("y4m", argv[i + 1]) == 0) {
+                image_dir.output_format = IMAGE_OUTPUT_Y4M;
+            } else if (strcmp("rgba", argv[i + 1]) == 0) {
+                image_dir.output_format = IMAGE_OUTPUT_RGBA;
+            } else {
+                fail_unknown_output_format(exec_name, argv[i + 1]);
+            }
+
+            i++;
+        } else if (strcmp("--size", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            if (parse_size(argv[i + 1], &image_dir) < 0) {
+                fail_invalid_size(exec_name, argv[i + 1]);
+            }
+
+            i++;
+        } else if (strcmp("--glob", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            image_dir.input_pattern = argv[++i];
+        } else if (strcmp("--shard", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            if (parse_shard(argv[i + 1], &image_dir) < 0) {
+                fail_invalid_shard(exec_name, argv[i + 1]);
+            }
+
+            i++;
+        } else if (strcmp("--prefetch", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            char* end;
+            long depth = strtol(argv[i + 1], &end, 10);
+            if (end == argv[i + 1] || *end != '\0' || depth < 0) {
+                fail_invalid_prefetch(exec_name, argv[i + 1]);
+            }
+            image_dir.prefetch_depth = depth;
+
+            i++;
+        } else if (strcmp("--write-profile", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            if (image_png_profile_parse(argv[i + 1], &image_dir.write_profile) < 0) {
+                fail_unknown_write_profile(exec_name, argv[i + 1]);
+            }
+
+            i++;
+        } else if (strcmp("--pool", argv[i]) == 0) {
+            use_pool = true;
+        } else if (strcmp("--stats", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            if (strcmp("json", argv[i + 1]) != 0) {
+                fail_unknown_stats_format(exec_name, argv[i + 1]);
+            }
+
+            use_stats = true;
+            i++;
+        } else if (strcmp("--stats-file", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            use_stats  = true;
+            stats_file = argv[++i];
+        } else if (strcmp("--filters", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            filters = argv[++i];
+        } else if (strcmp("--fused", argv[i]) == 0) {
+            options.fused = true;
+        } else if (strcmp("--scale-mode", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                fail_missing_argument(exec_name, argv[i]);
+            }
+
+            if (filter_scale_mode_parse(argv[i + 1], &scale_mode) < 0) {
+                fail_unknown_scale_mode(exec_name, argv[i + 1]);
+            }
+
+            i++;
+        } else if (strcmp("--planar", argv[i]) == 0) {
+            options.planar = true;
+        } else if (strcmp("--views", argv[i]) == 0) {
+            options.views = true;
         } else if (strcmp("--quiet", argv[i]) == 0) {
             quiet = true;
         } else if (strcmp("--help", argv[i]) == 0) {
@@ -118,6 +518,12 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    if (filter_graph_parse(&graph, filters, options.fused, options.planar, options.views, scale_mode) < 0) {
+        fail_invalid_filters(exec_name, filters);
+    }
+    options.graph = &graph;
+    options.quiet = quiet;
+
     if (use_pipeline_count > 1) {
         fail_multiple_pipeline(exec_name);
     }
@@ -126,36 +532,135 @@ int main(int argc, char* argv[]) {
         use_pipeline_serial = true;
     }
 
+    /* serial and latency save one frame at a time, in order already */
+    if (options.reorder_window > 0 && (use_pipeline_flow || use_pipeline_steal)) {
+        fail_unordered_pipeline(exec_name);
+    }
+
     if (signal(SIGINT, sigint_handler) == SIG_ERR) {
         LOG_ERROR_ERRNO("signal");
         exit(1);
     }
 
+    /* the frames own stdout, everything printed goes to stderr instead */
+    if (image_dir.output_format != IMAGE_OUTPUT_PNG) {
+        image_dir.output_fd = dup(STDOUT_FILENO);
+        if (image_dir.output_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            LOG_ERROR_ERRNO("dup");
+            exit(1);
+        }
+    }
+
+    /* the JSON report gets a stream of its own, apart from the messages and left open by --quiet */
+    FILE* stats_stream = NULL;
+    if (use_stats) {
+        stats_stream = (stats_file != NULL) ? fopen(stats_file, "w") : fdopen(dup(STDERR_FILENO), "w");
+        if (stats_stream == NULL) {
+            LOG_ERROR_ERRNO("fopen");
+            exit(1);
+        }
+    }
+
     if (quiet) {
         fclose(stdout);
         fclose(stderr);
     }
 
+    bool stream_input = image_dir.input_format == IMAGE_INPUT_Y4M || image_dir.input_format == IMAGE_INPUT_RGBA;
+    if (input_dir_name == NULL && stream_input) {
+        input_dir_name = "stdin";
+    }
+
     if (!output_dir_name) {
         output_dir_name = input_dir_name;
     }
 
+    if (use_pool) {
+        options.pool = image_pool_create(IMAGE_POOL_MAX_BYTES);
+        if (options.pool == NULL) {
+            exit(1);
+        }
+        image_dir.pool = options.pool;
+    }
+
+    /* bands run on TBB when the binary has it, on a pool of pthreads otherwise */
+    parallel_for_t parallel_for;
+    thread_pool_t* thread_pool = NULL;
+    if (use_pipeline_latency) {
+        if (parallel_for_tbb(&parallel_for) < 0) {
+            thread_pool = thread_pool_create(0);
+            if (thread_pool == NULL) {
+                exit(1);
+            }
+            parallel_for = thread_pool_parallel_for(thread_pool);
+        }
+        options.parallel_for = &parallel_for;
+    }
+
+    if (use_stats) {
+        const char* name = use_pipeline_serial    ? "serial"
+                           : use_pipeline_pthread ? "pthread"
+                           : use_pipeline_tbb     ? "tbb"
+                           : use_pipeline_flow    ? "tbb-flow"
+                           : use_pipeline_steal   ? "steal"
+                                                  : "latency";
+
+        options.stats = pipeline_stats_create(name);
+        if (options.stats == NULL) {
+            exit(1);
+        }
+    }
+
     printf("Starting image pipeline, press CTRL+C to stop loading images\n");
 
+    pipeline_stats_start(options.stats);
+
     int ret;
     if (use_pipeline_serial) {
         image_dir_reset(&image_dir, input_dir_name, output_dir_name, "serial");
-        pipeline_serial(&image_dir);
+        ret = pipeline_serial(&image_dir, &options);
     } else if (use_pipeline_pthread) {
         image_dir_reset(&image_dir, input_dir_name, output_dir_name, "pthread");
-        pipeline_pthread(&image_dir);
+        ret = pipeline_pthread(&image_dir, &options);
     } else if (use_pipeline_tbb) {
         image_dir_reset(&image_dir, input_dir_name, output_dir_name, "tbb");
-        pipeline_tbb(&image_dir);
+        ret = pipeline_tbb(&image_dir, &options);
+    } else if (use_pipeline_flow) {
+        image_dir_reset(&image_dir, input_dir_name, output_dir_name, "tbb-flow");
+        ret = pipeline_tbb_flow(&image_dir, &options);
+    } else if (use_pipeline_steal) {
+        image_dir_reset(&image_dir, input_dir_name, output_dir_name, "steal");
+        ret = pipeline_steal(&image_dir, &options);
+    } else if (use_pipeline_latency) {
+        image_dir_reset(&image_dir, input_dir_name, output_dir_name, "latency");
+        ret = pipeline_latency(&image_dir, &options);
     } else {
         LOG_ERROR("no pipeline configured");
         exit(1);
     }
 
+    if (image_dir_close(&image_dir) < 0) {
+        ret = -1;
+    }
+
+    if (options.stats != NULL) {
+        pipeline_stats_stop(options.stats);
+        pipeline_stats_print_json(options.stats, stats_stream);
+        pipeline_stats_destroy(options.stats);
+        if (fclose(stats_stream) != 0) {
+            LOG_ERROR_ERRNO("fclose");
+            ret = -1;
+        }
+    }
+
+    if (thread_pool != NULL) {
+        thread_pool_destroy(thread_pool);
+    }
+
+    if (options.pool != NULL) {
+        image_pool_print_stats(options.pool, stdout);
+        image_pool_destroy(options.pool);
+    }
+
     return (ret < 0) ? 1 : 0;
 }
@@ -0,0 +1,29 @@
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+extern "C" {
+#include "parallel-for.h"
+}
+
+class TBBRange {
+    parallel_for_fn_t fn;
+    void* args;
+
+   public:
+    TBBRange(parallel_for_fn_t fn, void* args) : fn(fn), args(args) {}
+
+    void operator()(const tbb::blocked_range<size_t>& range) const {
+        fn(args, range.begin(), range.end());
+    }
+};
+
+/* nested in a TBB pipeline, the ranges go to idle workers of the same arena instead of new threads */
+static void parallel_for_tbb_run(void* ctx, size_t count, size_t grain, parallel_for_fn_t fn, void* args) {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, count, grain), TBBRange(fn, args));
+}
+
+int parallel_for_tbb(parallel_for_t* parallel_for) {
+    parallel_for->run = parallel_for_tbb_run;
+    parallel_for->ctx = NULL;
+    return 0;
+}
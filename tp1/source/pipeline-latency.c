@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "filter-graph.h"
+#include "pipeline.h"
+
+static double elapsed_ms(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+ * Same loop as the serial pipeline, but the frame itself is split in row bands
+ * so a single large image uses every core. The latency of a frame runs from the
+ * start of its load to the end of its save.
+ */
+int pipeline_latency(image_dir_t* image_dir, const pipeline_options_t* options) {
+    pipeline_stats_t* stats = options->stats;
+    uint64_t stage_ns[FILTER_GRAPH_MAX_STEPS];
+    int stage_metrics[FILTER_GRAPH_MAX_STEPS];
+
+    int load_metric = pipeline_stats_add_stage(stats, "load");
+    for (size_t i = 0; i < options->graph->num_stages; i++) {
+        stage_metrics[i] = pipeline_stats_add_stage(stats, options->graph->stages[i].name);
+    }
+    int save_metric = pipeline_stats_add_stage(stats, "save");
+
+    size_t frames       = 0;
+    double total_ms     = 0;
+    double min_ms       = 0;
+    double max_ms       = 0;
+    image_t* buffers[3] = {image_create(0, 0, 0), image_create(0, 0, 0), image_create(0, 0, 0)};
+    if (buffers[0] == NULL || buffers[1] == NULL || buffers[2] == NULL) {
+        goto fail_free_buffers;
+    }
+
+    while (1) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        uint64_t stage_start = pipeline_stats_now();
+        image_t* image1      = image_dir_load_next(image_dir);
+        if (image1 == NULL) {
+            break;
+        }
+        pipeline_stats_record_since(stats, load_metric, stage_start);
+
+        image_t* image2 = filter_graph_apply_parallel(options->parallel_for, options->graph, image1, buffers, stage_ns);
+        size_t id       = image1->id;
+        image_destroy(image1);
+        if (image2 == NULL) {
+            goto fail_free_buffers;
+        }
+
+        for (size_t i = 0; i < options->graph->num_stages; i++) {
+            pipeline_stats_record(stats, stage_metrics[i], stage_ns[i]);
+        }
+
+        stage_start = pipeline_stats_now();
+        if (image_dir_save(image_dir, image2) < 0) {
+            goto fail_free_buffers;
+        }
+        pipeline_stats_record_since(stats, save_metric, stage_start);
+        pipeline_stats_count_frame(stats);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ms = elapsed_ms(&start, &end);
+
+        printf("frame %ld: %.3f ms\n", id, ms);
+        min_ms = (frames == 0 || ms < min_ms) ? ms : min_ms;
+        max_ms = (ms > max_ms) ? ms : max_ms;
+        total_ms += ms;
+        frames++;
+    }
+
+    if (frames > 0) {
+        printf("latency: %ld frames, min %.3f ms, avg %.3f ms, max %.3f ms\n", frames, min_ms, total_ms / frames,
+               max_ms);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        image_destroy(buffers[i]);
+    }
+    return 0;
+
+fail_free_buffers:
+    for (int i = 0; i < 3; i++) {
+        if (buffers[i] != NULL) {
+            image_destroy(buffers[i]);
+        }
+    }
+    return -1;
+}
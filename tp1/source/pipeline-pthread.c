@@ -1,195 +1,575 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include "pthread.h"
+#include <time.h>
+#include <unistd.h>
 
-#include "filter.h"
-#include "pipeline.h"
-#include "queue.h"
+#include "filter-graph.h"
 #include "log.h"
+#include "pipeline.h"
+#include "reorder-buffer.h"
+#include "ring-queue.h"
 
-#define NUM_STEPS 4
-#define NUM_PARALLEL_THREADS 64
-#define NUM_QUEUES 4
 #define QUEUE_SIZE 500
+#define MAX_STAGES (FILTER_GRAPH_MAX_STEPS + 1)
+
+#define TUNER_SAMPLE_MS 10
+#define TUNER_SAMPLES 10  /* per decision */
+#define TUNER_BUSY 0.75   /* share of its workers a stage keeps busy to get more */
+#define TUNER_BACKLOG 2.0 /* mean frames waiting for a stage to get more workers */
+#define TUNER_IDLE 0.5    /* mean frames waiting for a stage to give workers away */
+
+/*
+ * Every stage owns a pool of long-lived workers looping on its input queue.
+ * Loading runs in the calling thread and ends the stream with a NULL image:
+ * the worker popping it pushes it back for its siblings, and the last worker
+ * of a stage to exit forwards it to the next stage.
+ *
+ * With a reorder window, the save workers park their frames in a reorder
+ * buffer and whoever completes the next frame saves it and the ones parked
+ * after it, so frames reach the disk in order. The loader waits for the id
+ * it loads to fit in the window.
+ *
+ * With adaptive threads, one worker per CPU is shared by the stages: every
+ * stage creates enough workers to take all but one per other stage, and only
+ * `target` of them run, the others wait in `resumed`. A tuner thread samples
+ * how many workers of each stage are processing a frame and how many frames
+ * wait in its queue, and moves the workers a stage with an idle queue leaves
+ * idle to the most backed up busy stage.
+ * A worker that lost its slot gives it back after its current frame, and only
+ * then does the receiving stage get it, so no more than `num_threads` workers
+ * ever process frames at once. That's one per CPU, or one per stage when there
+ * are more stages than CPUs.
+ */
+
+typedef struct pipeline_pthread_ctx {
+    image_dir_t* image_dir;
+    image_pool_t* pool;
+    pipeline_stats_t* stats;
+    reorder_buffer_t* reorder; /* NULL when frames are saved as they come */
+    atomic_bool failed;
+} pipeline_pthread_ctx_t;
+
+typedef struct stage stage_t;
+
+struct stage {
+    const char* name;
+    /* consumes `image`, returns the image for the next stage (ignored by the last stage) */
+    image_t* (*process)(stage_t* stage, image_t* image);
+    const filter_stage_t* filter;
+    size_t num_threads;   /* workers created */
+    atomic_size_t active; /* workers that haven't exited */
+    /* workers allowed to process frames and workers doing so, the others wait in `resumed` */
+    atomic_size_t target;
+    atomic_size_t running;
+    pthread_mutex_t mutex;
+    pthread_cond_t resumed;
+    bool done;                /* the end of the stream went through, the waiting workers exit */
+    atomic_size_t processing; /* workers in `process`, sampled by the tuner */
+    ring_queue_t* input;
+    ring_queue_t* output;
+    pthread_t* tids;
+    pipeline_pthread_ctx_t* ctx;
+    /* service time of `process` and occupancy of `output` in ctx->stats */
+    int metric;
+    int output_metric;
+};
+
+static image_t* stage_filter(stage_t* stage, image_t* image) {
+    image_t* new_image = filter_stage_apply_pool(stage->ctx->pool, stage->filter, image);
+    image_destroy(image);
+    return new_image;
+}
+
+static void save_image(pipeline_pthread_ctx_t* ctx, image_t* image) {
+    if (image_dir_save(ctx->image_dir, image) < 0) {
+        atomic_store(&ctx->failed, true);
+    } else {
+        pipeline_stats_count_frame(ctx->stats);
+    }
+    image_destroy(image);
+}
+
+/* saves the frames that are next in order, unless another thread already does */
+static void save_reordered(pipeline_pthread_ctx_t* ctx) {
+    bool releasing = false;
+    image_t* image;
+    while ((image = reorder_buffer_try_pop(ctx->reorder, &releasing)) != NULL) {
+        save_image(ctx, image);
+    }
+}
+
+static image_t* stage_save(stage_t* stage, image_t* image) {
+    pipeline_pthread_ctx_t* ctx = stage->ctx;
+    if (ctx->reorder == NULL) {
+        save_image(ctx, image);
+        return NULL;
+    }
+
+    if (reorder_buffer_push(ctx->reorder, image->id, image) < 0) {
+        atomic_store(&ctx->failed, true);
+        reorder_buffer_skip(ctx->reorder, image->id);
+        image_destroy(image);
+    }
+    save_reordered(ctx);
+    return NULL;
+}
+
+/* waits for one of the `target` slots, false once the stream ended */
+static bool stage_claim(stage_t* stage) {
+    pthread_mutex_lock(&stage->mutex);
+    while (!stage->done && atomic_load(&stage->running) >= atomic_load(&stage->target)) {
+        pthread_cond_wait(&stage->resumed, &stage->mutex);
+    }
+
+    bool claimed = !stage->done;
+    if (claimed) {
+        atomic_fetch_add(&stage->running, 1);
+    }
+    pthread_mutex_unlock(&stage->mutex);
+    return claimed;
+}
+
+/* gives the slot back when the tuner lowered `target` */
+static bool stage_yield(stage_t* stage) {
+    if (atomic_load(&stage->running) <= atomic_load(&stage->target)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&stage->mutex);
+    bool yield = atomic_load(&stage->running) > atomic_load(&stage->target);
+    if (yield) {
+        atomic_fetch_sub(&stage->running, 1);
+    }
+    pthread_mutex_unlock(&stage->mutex);
+    return yield;
+}
+
+static void stage_set_target(stage_t* stage, size_t target) {
+    pthread_mutex_lock(&stage->mutex);
+    atomic_store(&stage->target, target);
+    pthread_cond_broadcast(&stage->resumed);
+    pthread_mutex_unlock(&stage->mutex);
+}
+
+/* processes frames until the end of the stream or until the slot is taken away */
+static void stage_run(stage_t* stage) {
+    pipeline_stats_t* stats = stage->ctx->stats;
+
+    while (!stage_yield(stage)) {
+        image_t* image = ring_queue_pop(stage->input);
+        if (image == NULL) {
+            ring_queue_push(stage->input, NULL);
+
+            pthread_mutex_lock(&stage->mutex);
+            stage->done = true;
+            pthread_cond_broadcast(&stage->resumed);
+            pthread_mutex_unlock(&stage->mutex);
+            return;
+        }
+
+        size_t id      = image->id;
+        uint64_t start = pipeline_stats_now();
+        atomic_fetch_add_explicit(&stage->processing, 1, memory_order_relaxed);
+        image_t* new_image = stage->process(stage, image);
+        atomic_fetch_sub_explicit(&stage->processing, 1, memory_order_relaxed);
+        pipeline_stats_record_since(stats, stage->metric, start);
+        if (stage->output == NULL) {
+            continue;
+        }
+
+        if (new_image == NULL) {
+            /* drop the frame and stop loading new ones, the images in flight still drain */
+            LOG_ERROR("stage `%s` failed on an image", stage->name);
+            atomic_store(&stage->ctx->failed, true);
+            stage->ctx->image_dir->stop = true;
+
+            /* the frames parked after it are not waiting for it anymore */
+            if (stage->ctx->reorder != NULL) {
+                reorder_buffer_skip(stage->ctx->reorder, id);
+                save_reordered(stage->ctx);
+            }
+            continue;
+        }
+
+        pipeline_stats_record(stats, stage->output_metric, ring_queue_size(stage->output));
+        ring_queue_push(stage->output, new_image);
+    }
+}
+
+static void* stage_worker(void* args) {
+    stage_t* stage = args;
+
+    while (stage_claim(stage)) {
+        stage_run(stage);
+    }
+
+    if (atomic_fetch_sub(&stage->active, 1) == 1 && stage->output != NULL) {
+        ring_queue_push(stage->output, NULL);
+    }
+
+    return NULL;
+}
+
+static size_t num_cpus(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 0) ? cpus : 1;
+}
+
+static size_t stage_num_threads(const pipeline_options_t* options, size_t index) {
+    if (options->num_stage_threads == 0) {
+        return num_cpus();
+    }
+
+    if (index >= options->num_stage_threads) {
+        index = options->num_stage_threads - 1;
+    }
+    return options->stage_threads[index];
+}
+
+/* creates `num_threads` workers, `target` of them processing frames */
+static int stage_start(stage_t* stage, size_t target) {
+    atomic_init(&stage->active, 0);
+    atomic_init(&stage->target, target);
+    atomic_init(&stage->running, 0);
+    atomic_init(&stage->processing, 0);
+    pthread_mutex_init(&stage->mutex, NULL);
+    pthread_cond_init(&stage->resumed, NULL);
+
+    stage->tids = calloc(stage->num_threads, sizeof(*stage->tids));
+    if (stage->tids == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        stage->num_threads = 0;
+        goto fail_exit;
+    }
+    for (size_t i = 0; i < stage->num_threads; i++) {
+        atomic_fetch_add(&stage->active, 1);
+
+        errno = pthread_create(&stage->tids[i], NULL, stage_worker, stage);
+        if (errno != 0) {
+            LOG_ERROR_ERRNO("pthread_create");
+            atomic_fetch_sub(&stage->active, 1);
+            stage->num_threads = i;
+            goto fail_exit;
+        }
+    }
+
+    return 0;
+
+fail_exit:
+    return -1;
+}
+
+static void stage_join(stage_t* stage) {
+    for (size_t i = 0; i < stage->num_threads; i++) {
+        pthread_join(stage->tids[i], NULL);
+    }
+    free(stage->tids);
+    pthread_cond_destroy(&stage->resumed);
+    pthread_mutex_destroy(&stage->mutex);
+}
+
+typedef struct stage_tuner {
+    stage_t* stages;
+    size_t num_stages;
+    size_t num_threads; /* shared by the stages */
+    bool quiet;         /* keeps its decisions for itself */
+    /* slots taken from stage `from` that stage `to` gets once `from` gave them back */
+    size_t pending;
+    size_t pending_from;
+    size_t pending_to;
+    /* summed over the samples of the current decision */
+    size_t processing[MAX_STAGES];
+    size_t queued[MAX_STAGES];
+    size_t num_samples;
+    pthread_t tid;
+    pthread_mutex_t mutex;
+    pthread_cond_t stopped;
+    bool stop;
+} stage_tuner_t;
+
+static void stage_tuner_print(stage_tuner_t* tuner, const char* what) {
+    if (tuner->quiet) {
+        return;
+    }
+
+    fprintf(stderr, "threads: %s", what);
+    for (size_t i = 0; i < tuner->num_stages; i++) {
+        fprintf(stderr, " %s=%ld", tuner->stages[i].name, atomic_load(&tuner->stages[i].target));
+    }
+    fprintf(stderr, "\n");
+}
+
+/* hands the pending slots over once the workers of `pending_from` stopped using them */
+static void stage_tuner_hand_over(stage_tuner_t* tuner) {
+    stage_t* from = &tuner->stages[tuner->pending_from];
+    if (tuner->pending == 0 || atomic_load(&from->running) > atomic_load(&from->target)) {
+        return;
+    }
+
+    stage_t* to = &tuner->stages[tuner->pending_to];
+    stage_set_target(to, atomic_load(&to->target) + tuner->pending);
+    tuner->pending = 0;
+    stage_tuner_print(tuner, "handed over ->");
+}
+
+static void stage_tuner_sample(stage_tuner_t* tuner) {
+    for (size_t i = 0; i < tuner->num_stages; i++) {
+        tuner->processing[i] += atomic_load_explicit(&tuner->stages[i].processing, memory_order_relaxed);
+        tuner->queued[i] += ring_queue_size(tuner->stages[i].input);
+    }
+    tuner->num_samples++;
+}
+
+/* moves the workers a stage with an idle queue leaves idle to the most backed up busy stage */
+static void stage_tuner_step(stage_tuner_t* tuner) {
+    double busy[MAX_STAGES];
+    double queued[MAX_STAGES];
+    size_t target[MAX_STAGES];
+
+    for (size_t i = 0; i < tuner->num_stages; i++) {
+        target[i] = atomic_load(&tuner->stages[i].target);
+        busy[i]   = (double)tuner->processing[i] / (tuner->num_samples * target[i]);
+        queued[i] = (double)tuner->queued[i] / tuner->num_samples;
+
+        tuner->processing[i] = 0;
+        tuner->queued[i]     = 0;
+    }
+    tuner->num_samples = 0;
+
+    size_t to = MAX_STAGES;
+    for (size_t i = 0; i < tuner->num_stages; i++) {
+        if (busy[i] >= TUNER_BUSY && queued[i] >= TUNER_BACKLOG && (to == MAX_STAGES || queued[i] > queued[to])) {
+            to = i;
+        }
+    }
+    if (to == MAX_STAGES) {
+        return;
+    }
+
+    size_t from = MAX_STAGES;
+    for (size_t i = 0; i < tuner->num_stages; i++) {
+        if (i != to && queued[i] < TUNER_IDLE && target[i] > 1 && (from == MAX_STAGES || busy[i] < busy[from])) {
+            from = i;
+        }
+    }
+    if (from == MAX_STAGES) {
+        return;
+    }
+
+    /* `from` keeps the workers its load needs, and at least one */
+    size_t needed = ceil(busy[from] * target[from]);
+    if (needed < 1) {
+        needed = 1;
+    }
+    if (needed >= target[from]) {
+        return;
+    }
+    size_t moved = target[from] - needed;
+
+    stage_set_target(&tuner->stages[from], target[from] - moved);
+    tuner->pending      = moved;
+    tuner->pending_from = from;
+    tuner->pending_to   = to;
+
+    char what[256];
+    snprintf(what, sizeof(what), "%ld from `%s` (%.0f%% busy, %.1f queued) to `%s` (%.0f%% busy, %.1f queued) ->",
+             moved, tuner->stages[from].name, 100 * busy[from], queued[from], tuner->stages[to].name, 100 * busy[to],
+             queued[to]);
+    stage_tuner_print(tuner, what);
+    stage_tuner_hand_over(tuner);
+}
+
+static void* stage_tuner_worker(void* args) {
+    stage_tuner_t* tuner = args;
+
+    pthread_mutex_lock(&tuner->mutex);
+    while (!tuner->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += TUNER_SAMPLE_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        pthread_cond_timedwait(&tuner->stopped, &tuner->mutex, &deadline);
+        if (tuner->stop) {
+            break;
+        }
+
+        /* no new decision while slots are on their way */
+        if (tuner->pending > 0) {
+            stage_tuner_hand_over(tuner);
+            continue;
+        }
+
+        stage_tuner_sample(tuner);
+        if (tuner->num_samples == TUNER_SAMPLES) {
+            stage_tuner_step(tuner);
+        }
+    }
+    pthread_mutex_unlock(&tuner->mutex);
+
+    return NULL;
+}
+
+static int stage_tuner_start(stage_tuner_t* tuner) {
+    pthread_mutex_init(&tuner->mutex, NULL);
+    pthread_cond_init(&tuner->stopped, NULL);
+    tuner->stop    = false;
+    tuner->pending = 0;
+
+    errno = pthread_create(&tuner->tid, NULL, stage_tuner_worker, tuner);
+    if (errno != 0) {
+        LOG_ERROR_ERRNO("pthread_create");
+        pthread_cond_destroy(&tuner->stopped);
+        pthread_mutex_destroy(&tuner->mutex);
+        return -1;
+    }
+
+    char what[64];
+    snprintf(what, sizeof(what), "adaptive over %ld workers ->", tuner->num_threads);
+    stage_tuner_print(tuner, what);
+    return 0;
+}
+
+static void stage_tuner_stop(stage_tuner_t* tuner) {
+    pthread_mutex_lock(&tuner->mutex);
+    tuner->stop = true;
+    pthread_cond_signal(&tuner->stopped);
+    pthread_mutex_unlock(&tuner->mutex);
+
+    pthread_join(tuner->tid, NULL);
+    stage_tuner_print(tuner, "final ->");
+    pthread_cond_destroy(&tuner->stopped);
+    pthread_mutex_destroy(&tuner->mutex);
+}
+
+int pipeline_pthread(image_dir_t* image_dir, const pipeline_options_t* options) {
+    pipeline_pthread_ctx_t ctx = {.image_dir = image_dir, .pool = options->pool, .stats = options->stats};
+    atomic_init(&ctx.failed, false);
+
+    stage_t stages[MAX_STAGES] = {0};
+    size_t num_stages          = 0;
+
+    /* the first id is known once the input is open */
+    if (options->reorder_window > 0) {
+        if (image_dir_open(image_dir) < 0) {
+            goto fail_exit;
+        }
+
+        ctx.reorder = reorder_buffer_create(options->reorder_window, image_dir->load_current);
+        if (ctx.reorder == NULL) {
+            goto fail_exit;
+        }
+    }
+
+    for (size_t i = 0; i < options->graph->num_stages; i++) {
+        const filter_stage_t* filter = &options->graph->stages[i];
+        stages[num_stages++]         = (stage_t){.name = filter->name, .process = stage_filter, .filter = filter};
+    }
+    stages[num_stages++] = (stage_t){.name = "save", .process = stage_save};
+
+    /* queues are named after the stage consuming them */
+    int load_metric        = pipeline_stats_add_stage(options->stats, "load");
+    int load_output_metric = pipeline_stats_add_queue(options->stats, stages[0].name);
+    for (size_t i = 0; i < num_stages; i++) {
+        stages[i].metric = pipeline_stats_add_stage(options->stats, stages[i].name);
+        stages[i].output_metric =
+            (i + 1 < num_stages) ? pipeline_stats_add_queue(options->stats, stages[i + 1].name) : -1;
+    }
+
+    ring_queue_t* queues[MAX_STAGES] = {0};
+    for (size_t i = 0; i < num_stages; i++) {
+        queues[i] = ring_queue_create(QUEUE_SIZE);
+        if (queues[i] == NULL) {
+            goto fail_free_queues;
+        }
+    }
+
+    /* adaptive threads start evenly split, the loader runs in this thread and isn't counted */
+    stage_tuner_t tuner = {
+        .stages = stages, .num_stages = num_stages, .num_threads = num_cpus(), .quiet = options->quiet};
+    if (tuner.num_threads < num_stages) {
+        tuner.num_threads = num_stages;
+    }
+
+    size_t started = 0;
+    for (; started < num_stages; started++) {
+        stage_t* stage = &stages[started];
+        stage->ctx     = &ctx;
+        stage->input   = queues[started];
+        stage->output  = (started + 1 < num_stages) ? queues[started + 1] : NULL;
+
+        size_t target;
+        if (options->adaptive_threads) {
+            stage->num_threads = tuner.num_threads - (num_stages - 1);
+            target             = tuner.num_threads / num_stages + (started < tuner.num_threads % num_stages);
+        } else {
+            stage->num_threads = stage_num_threads(options, started);
+            target             = stage->num_threads;
+        }
+
+        if (stage_start(stage, target) < 0) {
+            goto fail_stop_stages;
+        }
+    }
+
+    /* without the tuner the stages keep their initial split */
+    bool tuning = options->adaptive_threads && stage_tuner_start(&tuner) == 0;
+
+    while (1) {
+        if (ctx.reorder != NULL) {
+            reorder_buffer_wait(ctx.reorder, image_dir->load_current);
+        }
+
+        uint64_t start = pipeline_stats_now();
+        image_t* image = image_dir_load_next(image_dir);
+        if (image == NULL) {
+            break;
+        }
+        pipeline_stats_record_since(options->stats, load_metric, start);
+
+        pipeline_stats_record(options->stats, load_output_metric, ring_queue_size(queues[0]));
+        ring_queue_push(queues[0], image);
+    }
+    ring_queue_push(queues[0], NULL);
+
+    for (size_t i = 0; i < num_stages; i++) {
+        stage_join(&stages[i]);
+    }
+
+    if (tuning) {
+        stage_tuner_stop(&tuner);
+    }
+
+    for (size_t i = 0; i < num_stages; i++) {
+        ring_queue_destroy(queues[i]);
+    }
+
+    if (ctx.reorder != NULL) {
+        reorder_buffer_print_stats(ctx.reorder, stdout);
+        reorder_buffer_destroy(ctx.reorder);
+    }
 
+    return atomic_load(&ctx.failed) ? -1 : 0;
 
-// Global variables
-queue_t **queues = NULL;
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
-bool read_done = false;
-bool finished = false;
-
-void* read_all_images(void* args) {
-	image_dir_t* image_dir = (image_dir_t*) args;
-
-	while (1) {
-		image_t* image = image_dir_load_next(image_dir);
-		queue_push(queues[0], image);
-		if (image == NULL) {
-			pthread_mutex_lock(&mutex);
-			read_done = true;
-			pthread_cond_broadcast(&cond);
-			pthread_mutex_unlock(&mutex);
-			break;
-		}
-	}
-	return 0;
-}
-
-void* scale_up(void* args) {
-	image_t* image = (image_t*) queue_pop(queues[0]);
-	if (image == NULL) {
-		queue_push(queues[1], NULL);
-		return 0;
-	}
-	image_t* modified = filter_scale_up(image, 2);
-	if(modified == NULL) {
-		exit(-1);
-	}
-	image_destroy(image);
-	queue_push(queues[1], modified);
-	return 0;
-}
-
-void* sharpen(void* args) {
-	image_t* image = (image_t*) queue_pop(queues[1]);
-	if (image == NULL) {
-		queue_push(queues[2], NULL);
-		return 0;
-	}
-	image_t* modified = filter_sharpen(image);
-	if(modified == NULL) {
-		exit(-1);
-	}
-	image_destroy(image);
-	queue_push(queues[2], modified);
-	return 0;
-}
-
-void* sobel(void* args) {
-	image_t* image = (image_t*) queue_pop(queues[2]);
-	if (image == NULL) {
-		queue_push(queues[3], NULL);
-		return 0;
-	}
-	image_t* modified = filter_sobel(image);
-	if(modified == NULL) {
-		exit(-1);
-	}
-	image_destroy(image);
-	queue_push(queues[3], modified);
-	return 0;
-}
-
-void* save_all_images(void* args) {
-	image_dir_t *image_dir = (image_dir_t*) args;
-	image_t* image = (image_t*) queue_pop(queues[3]);
-	if (image == NULL) {
-		pthread_mutex_lock(&mutex);
-		finished = true;
-		pthread_cond_broadcast(&cond);
-		pthread_mutex_unlock(&mutex);
-		return 0;
-	}
-	image_dir_save(image_dir, image);
-	image_destroy(image);
-	return 0;
-}
-
-void* verify_queues(void* args) {
-	pthread_mutex_lock(&mutex);
-	while (!read_done) {
-		pthread_cond_wait(&cond, &mutex);
-	}
-	pthread_mutex_unlock(&mutex);
-
-	for(int i = 0; i < NUM_PARALLEL_THREADS; i++) {
-		// Signal threads to finish
-		queue_push(queues[0], NULL);
-	}
-
-	pthread_mutex_lock(&mutex);
-	while (!finished) {
-		pthread_cond_wait(&cond, &mutex);
-	}
-	pthread_mutex_unlock(&mutex);
-	return 0;
-}
-
-int pipeline_pthread(image_dir_t* image_dir) {
-	queues = calloc(NUM_QUEUES, sizeof(queue_t*));
-	if(queues == NULL) {
-		LOG_ERROR_ERRNO("Failed to allocate memory for queues");
-		goto fail_exit;
-	}
-	for(int i = 0; i < NUM_QUEUES; i++) {
-		queues[i] = queue_create(QUEUE_SIZE);
-	}
-
-	errno = pthread_mutex_init(&mutex, NULL);
-	if(errno != 0) {
-		LOG_ERROR_ERRNO("Mutex init failed");
-		goto fail_free_queues;
-	}
-
-	errno = pthread_cond_init(&cond, NULL);
-	if(errno != 0) {
-		LOG_ERROR_ERRNO("Cond init failed");
-		goto fail_destroy_mutex;
-	}
-
-	pthread_t read_tid;
-	errno = pthread_create(&read_tid, NULL, read_all_images, image_dir);
-	if(errno != 0) {
-		LOG_ERROR_ERRNO("Failed to create read thread");
-		goto fail_destroy_cond;
-	}
-
-	pthread_t verify_queues_tid;
-	errno = pthread_create(&verify_queues_tid, NULL, verify_queues, NULL);
-	if(errno != 0) {
-		LOG_ERROR_ERRNO("Failed to create verify queues thread");
-		goto fail_destroy_cond;
-	}
-
-	pthread_t tids[NUM_PARALLEL_THREADS][NUM_STEPS] = {0};
-	while (!finished) {
-		for(int i = 0; i < NUM_PARALLEL_THREADS; i++) {
-			pthread_create(&tids[i][0], NULL, scale_up, NULL);
-			pthread_create(&tids[i][1], NULL, sharpen, NULL);
-			pthread_create(&tids[i][2], NULL, sobel, NULL);
-			pthread_create(&tids[i][3], NULL, save_all_images, image_dir);
-		}
-
-		for(int i = 0; i < NUM_PARALLEL_THREADS; i++) {
-			for(int j = 0; j < NUM_STEPS; j++) {
-				pthread_join(tids[i][j], NULL);
-			}
-		}
-	}
-
-	pthread_join(read_tid, NULL);
-	pthread_join(verify_queues_tid, NULL);
-
-	// Free resources
-	for(int i = 0; i < NUM_QUEUES; i++) {
-		queue_destroy(queues[i]);
-	}
-	free(queues);
-	pthread_mutex_destroy(&mutex);
-	
-	return 0;
-
-fail_destroy_cond:
-	pthread_cond_destroy(&cond);
-fail_destroy_mutex:
-	pthread_mutex_destroy(&mutex);
+fail_stop_stages:
+    /* the end-of-stream marker walks through every stage that has workers, including the failed one */
+    ring_queue_push(queues[0], NULL);
+    for (size_t i = 0; i <= started; i++) {
+        stage_join(&stages[i]);
+    }
 fail_free_queues:
-	for(int i = 0; i < NUM_QUEUES; i++) {
-		queue_destroy(queues[i]);
-	}
-	free(queues);
+    for (size_t i = 0; i < num_stages; i++) {
+        if (queues[i] != NULL) {
+            ring_queue_destroy(queues[i]);
+        }
+    }
+    if (ctx.reorder != NULL) {
+        reorder_buffer_destroy(ctx.reorder);
+    }
 fail_exit:
-	return -1;
+    return -1;
 }
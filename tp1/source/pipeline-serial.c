@@ -2,43 +2,66 @@
 
 #include <stdio.h>
 
-#include "filter.h"
+#include "filter-graph.h"
 #include "pipeline.h"
 
-int pipeline_serial(image_dir_t* image_dir) {
+/* frames are processed in three buffers reused for the whole run */
+int pipeline_serial(image_dir_t* image_dir, const pipeline_options_t* options) {
+    pipeline_stats_t* stats = options->stats;
+    uint64_t stage_ns[FILTER_GRAPH_MAX_STEPS];
+    int stage_metrics[FILTER_GRAPH_MAX_STEPS];
+
+    int load_metric = pipeline_stats_add_stage(stats, "load");
+    for (size_t i = 0; i < options->graph->num_stages; i++) {
+        stage_metrics[i] = pipeline_stats_add_stage(stats, options->graph->stages[i].name);
+    }
+    int save_metric = pipeline_stats_add_stage(stats, "save");
+
+    image_t* buffers[3] = {image_create(0, 0, 0), image_create(0, 0, 0), image_create(0, 0, 0)};
+    if (buffers[0] == NULL || buffers[1] == NULL || buffers[2] == NULL) {
+        goto fail_free_buffers;
+    }
+
     while (1) {
+        uint64_t start  = pipeline_stats_now();
         image_t* image1 = image_dir_load_next(image_dir);
         if (image1 == NULL) {
             break;
         }
+        pipeline_stats_record_since(stats, load_metric, start);
 
-        image_t* image2 = filter_scale_up(image1, 2);
+        image_t* image2 = filter_graph_apply_parallel(NULL, options->graph, image1, buffers, stage_ns);
         image_destroy(image1);
         if (image2 == NULL) {
-            goto fail_exit;
+            goto fail_free_buffers;
         }
 
-        image_t* image3 = filter_sharpen(image2);
-        image_destroy(image2);
-        if (image3 == NULL) {
-            goto fail_exit;
+        for (size_t i = 0; i < options->graph->num_stages; i++) {
+            pipeline_stats_record(stats, stage_metrics[i], stage_ns[i]);
         }
 
-        image_t* image4 = filter_sobel(image3);
-        image_destroy(image3);
-        if (image4 == NULL) {
-            goto fail_exit;
+        start = pipeline_stats_now();
+        if (image_dir_save(image_dir, image2) < 0) {
+            goto fail_free_buffers;
         }
+        pipeline_stats_record_since(stats, save_metric, start);
+        pipeline_stats_count_frame(stats);
 
-        image_dir_save(image_dir, image4);
         printf(".");
         fflush(stdout);
-        image_destroy(image4);
     }
 
     printf("\n");
+    for (int i = 0; i < 3; i++) {
+        image_destroy(buffers[i]);
+    }
     return 0;
 
-fail_exit:
+fail_free_buffers:
+    for (int i = 0; i < 3; i++) {
+        if (buffers[i] != NULL) {
+            image_destroy(buffers[i]);
+        }
+    }
     return -1;
 }
@@ -0,0 +1,317 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "pipeline-stats.h"
+
+#define PIPELINE_STATS_MAX_METRICS 64
+#define PIPELINE_STATS_MAX_THREADS 128 /* threads past this share one histogram per metric */
+#define PIPELINE_STATS_NAME_SIZE 64
+
+#define PIPELINE_STATS_SUB_BITS 4
+#define PIPELINE_STATS_SUB_BUCKETS (1 << PIPELINE_STATS_SUB_BITS)
+#define PIPELINE_STATS_BUCKETS ((64 - PIPELINE_STATS_SUB_BITS + 1) * PIPELINE_STATS_SUB_BUCKETS)
+
+typedef struct pipeline_histogram {
+    atomic_uint_least64_t counts[PIPELINE_STATS_BUCKETS];
+    atomic_uint_least64_t count;
+    atomic_uint_least64_t sum;
+    atomic_uint_least64_t max;
+} pipeline_histogram_t;
+
+typedef enum pipeline_metric_kind {
+    PIPELINE_METRIC_STAGE,
+    PIPELINE_METRIC_QUEUE,
+} pipeline_metric_kind_t;
+
+typedef struct pipeline_metric {
+    char name[PIPELINE_STATS_NAME_SIZE];
+    pipeline_metric_kind_t kind;
+    _Atomic(pipeline_histogram_t*) threads[PIPELINE_STATS_MAX_THREADS];
+    pipeline_histogram_t* shared;
+} pipeline_metric_t;
+
+struct pipeline_stats {
+    char name[PIPELINE_STATS_NAME_SIZE];
+    pipeline_metric_t metrics[PIPELINE_STATS_MAX_METRICS];
+    int num_metrics;
+    uint64_t start;
+    uint64_t stop;
+    atomic_uint_least64_t frames;
+};
+
+/* small id of the calling thread, given on its first record */
+static atomic_int pipeline_stats_next_thread;
+static _Thread_local int pipeline_stats_thread = -1;
+
+static size_t pipeline_histogram_bucket(uint64_t value) {
+    if (value < PIPELINE_STATS_SUB_BUCKETS) {
+        return value;
+    }
+
+    int exponent = 63 - __builtin_clzll(value);
+    int shift    = exponent - PIPELINE_STATS_SUB_BITS;
+    return (shift + 1) * PIPELINE_STATS_SUB_BUCKETS + ((value >> shift) & (PIPELINE_STATS_SUB_BUCKETS - 1));
+}
+
+/* middle of the values falling in `bucket` */
+static double pipeline_histogram_value(size_t bucket) {
+    if (bucket < PIPELINE_STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int shift    = bucket / PIPELINE_STATS_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % PIPELINE_STATS_SUB_BUCKETS;
+    double low   = (double)((PIPELINE_STATS_SUB_BUCKETS + sub) << shift);
+    return low + (double)(1ULL << shift) / 2;
+}
+
+pipeline_stats_t* pipeline_stats_create(const char* name) {
+    pipeline_stats_t* stats = calloc(1, sizeof(*stats));
+    if (stats == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        return NULL;
+    }
+
+    snprintf(stats->name, sizeof(stats->name), "%s", name);
+    atomic_init(&stats->frames, 0);
+    return stats;
+}
+
+void pipeline_stats_destroy(pipeline_stats_t* stats) {
+    for (int i = 0; i < stats->num_metrics; i++) {
+        for (int t = 0; t < PIPELINE_STATS_MAX_THREADS; t++) {
+            free(atomic_load(&stats->metrics[i].threads[t]));
+        }
+        free(stats->metrics[i].shared);
+    }
+    free(stats);
+}
+
+static int pipeline_stats_add(pipeline_stats_t* stats, const char* name, pipeline_metric_kind_t kind) {
+    if (stats == NULL) {
+        return -1;
+    }
+
+    if (stats->num_metrics == PIPELINE_STATS_MAX_METRICS) {
+        LOG_ERROR("more than %d metrics, `%s` isn't recorded", PIPELINE_STATS_MAX_METRICS, name);
+        return -1;
+    }
+
+    pipeline_metric_t* metric = &stats->metrics[stats->num_metrics];
+    metric->shared            = calloc(1, sizeof(*metric->shared));
+    if (metric->shared == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        return -1;
+    }
+
+    snprintf(metric->name, sizeof(metric->name), "%s", name);
+    metric->kind = kind;
+    return stats->num_metrics++;
+}
+
+int pipeline_stats_add_stage(pipeline_stats_t* stats, const char* name) {
+    return pipeline_stats_add(stats, name, PIPELINE_METRIC_STAGE);
+}
+
+int pipeline_stats_add_queue(pipeline_stats_t* stats, const char* name) {
+    return pipeline_stats_add(stats, name, PIPELINE_METRIC_QUEUE);
+}
+
+uint64_t pipeline_stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* the histogram only the calling thread writes, NULL when it has to share one */
+static pipeline_histogram_t* pipeline_stats_own_histogram(pipeline_metric_t* metric) {
+    if (pipeline_stats_thread < 0) {
+        pipeline_stats_thread = atomic_fetch_add(&pipeline_stats_next_thread, 1);
+    }
+    if (pipeline_stats_thread >= PIPELINE_STATS_MAX_THREADS) {
+        return NULL;
+    }
+
+    pipeline_histogram_t* histogram =
+        atomic_load_explicit(&metric->threads[pipeline_stats_thread], memory_order_relaxed);
+    if (histogram == NULL) {
+        histogram = calloc(1, sizeof(*histogram));
+        if (histogram == NULL) {
+            return NULL;
+        }
+        atomic_store_explicit(&metric->threads[pipeline_stats_thread], histogram, memory_order_release);
+    }
+    return histogram;
+}
+
+/* single writer, plain read-modify-write without a locked instruction */
+static inline void pipeline_counter_add(atomic_uint_least64_t* counter, uint64_t value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+void pipeline_stats_record(pipeline_stats_t* stats, int metric_id, uint64_t value) {
+    if (stats == NULL || metric_id < 0) {
+        return;
+    }
+
+    pipeline_metric_t* metric       = &stats->metrics[metric_id];
+    pipeline_histogram_t* histogram = pipeline_stats_own_histogram(metric);
+    size_t bucket                   = pipeline_histogram_bucket(value);
+
+    if (histogram != NULL) {
+        pipeline_counter_add(&histogram->counts[bucket], 1);
+        pipeline_counter_add(&histogram->count, 1);
+        pipeline_counter_add(&histogram->sum, value);
+        if (value > atomic_load_explicit(&histogram->max, memory_order_relaxed)) {
+            atomic_store_explicit(&histogram->max, value, memory_order_relaxed);
+        }
+        return;
+    }
+
+    histogram = metric->shared;
+    atomic_fetch_add_explicit(&histogram->counts[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed,
+                                                                 memory_order_relaxed)) {}
+}
+
+uint64_t pipeline_stats_record_since(pipeline_stats_t* stats, int metric, uint64_t start) {
+    if (stats == NULL || metric < 0) {
+        return start;
+    }
+
+    uint64_t now = pipeline_stats_now();
+    pipeline_stats_record(stats, metric, now - start);
+    return now;
+}
+
+void pipeline_stats_start(pipeline_stats_t* stats) {
+    if (stats != NULL) {
+        stats->start = pipeline_stats_now();
+    }
+}
+
+void pipeline_stats_stop(pipeline_stats_t* stats) {
+    if (stats != NULL) {
+        stats->stop = pipeline_stats_now();
+    }
+}
+
+void pipeline_stats_count_frame(pipeline_stats_t* stats) {
+    if (stats != NULL) {
+        atomic_fetch_add_explicit(&stats->frames, 1, memory_order_relaxed);
+    }
+}
+
+static void pipeline_histogram_merge(pipeline_histogram_t* into, pipeline_histogram_t* from) {
+    for (size_t b = 0; b < PIPELINE_STATS_BUCKETS; b++) {
+        into->counts[b] += atomic_load(&from->counts[b]);
+    }
+    into->count += atomic_load(&from->count);
+    into->sum += atomic_load(&from->sum);
+    if (atomic_load(&from->max) > into->max) {
+        into->max = atomic_load(&from->max);
+    }
+}
+
+static double pipeline_histogram_percentile(const pipeline_histogram_t* histogram, double percentile) {
+    uint64_t rank = (uint64_t)(percentile / 100 * histogram->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t b = 0; b < PIPELINE_STATS_BUCKETS; b++) {
+        seen += histogram->counts[b];
+        if (seen >= rank) {
+            double value = pipeline_histogram_value(b);
+            /* the middle of the last bucket can be past the largest value recorded */
+            return (value > histogram->max) ? (double)histogram->max : value;
+        }
+    }
+    return histogram->max;
+}
+
+static void pipeline_stats_print_metric(pipeline_metric_t* metric, FILE* f, double scale, const char* unit) {
+    pipeline_histogram_t* merged = calloc(1, sizeof(*merged));
+    if (merged == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        return;
+    }
+
+    size_t threads = 0;
+    for (int t = 0; t < PIPELINE_STATS_MAX_THREADS; t++) {
+        pipeline_histogram_t* histogram = atomic_load(&metric->threads[t]);
+        if (histogram != NULL) {
+            pipeline_histogram_merge(merged, histogram);
+            threads++;
+        }
+    }
+    if (atomic_load(&metric->shared->count) > 0) {
+        pipeline_histogram_merge(merged, metric->shared);
+        threads++;
+    }
+
+    uint64_t count = merged->count;
+    double mean    = (count > 0) ? (double)merged->sum / count : 0;
+
+    fprintf(f, "{\"name\": \"%s\", \"threads\": %ld, \"count\": %lu, ", metric->name, threads, count);
+    if (metric->kind == PIPELINE_METRIC_STAGE) {
+        fprintf(f, "\"busy_s\": %.6f, ", merged->sum / 1e9);
+    }
+    fprintf(f, "\"mean%s\": %.6g, \"p50%s\": %.6g, \"p95%s\": %.6g, \"p99%s\": %.6g, \"max%s\": %.6g}", unit,
+            mean * scale, unit, (count > 0) ? pipeline_histogram_percentile(merged, 50) * scale : 0, unit,
+            (count > 0) ? pipeline_histogram_percentile(merged, 95) * scale : 0, unit,
+            (count > 0) ? pipeline_histogram_percentile(merged, 99) * scale : 0, unit, merged->max * scale);
+
+    free(merged);
+}
+
+static void pipeline_stats_print_metrics(pipeline_stats_t* stats, FILE* f, pipeline_metric_kind_t kind) {
+    bool first = true;
+
+    for (int i = 0; i < stats->num_metrics; i++) {
+        if (stats->metrics[i].kind != kind) {
+            continue;
+        }
+
+        fprintf(f, "%s\n    ", first ? "" : ",");
+        if (kind == PIPELINE_METRIC_STAGE) {
+            pipeline_stats_print_metric(&stats->metrics[i], f, 1e-6, "_ms");
+        } else {
+            pipeline_stats_print_metric(&stats->metrics[i], f, 1, "");
+        }
+        first = false;
+    }
+
+    fprintf(f, "%s", first ? "" : "\n  ");
+}
+
+void pipeline_stats_print_json(pipeline_stats_t* stats, FILE* f) {
+    if (stats == NULL) {
+        return;
+    }
+
+    uint64_t frames = atomic_load(&stats->frames);
+    double seconds  = (stats->stop > stats->start) ? (stats->stop - stats->start) / 1e9 : 0;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"pipeline\": \"%s\",\n", stats->name);
+    fprintf(f, "  \"frames\": %lu,\n", frames);
+    fprintf(f, "  \"seconds\": %.6f,\n", seconds);
+    fprintf(f, "  \"frames_per_second\": %.3f,\n", (seconds > 0) ? frames / seconds : 0);
+    fprintf(f, "  \"stages\": [");
+    pipeline_stats_print_metrics(stats, f, PIPELINE_METRIC_STAGE);
+    fprintf(f, "],\n");
+    fprintf(f, "  \"queues\": [");
+    pipeline_stats_print_metrics(stats, f, PIPELINE_METRIC_QUEUE);
+    fprintf(f, "]\n");
+    fprintf(f, "}\n");
+}
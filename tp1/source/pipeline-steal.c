@@ -0,0 +1,183 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "filter-graph.h"
+#include "log.h"
+#include "pipeline.h"
+#include "work-steal.h"
+
+#define STEAL_FRAMES_PER_THREAD 2
+
+/*
+ * Every frame is a task walking through the stages: it runs one stage, then
+ * spawns itself again as the continuation running the next one, and the last
+ * continuation saves it. A continuation lands on the deque of the worker that
+ * just ran the previous stage, which picks it up while the frame is still in
+ * its cache, unless an idle worker steals it first. A costly stage then gets
+ * as many workers as it has frames, without any per-stage thread count.
+ *
+ * Loading is a single task, since frames are read in order. It loads until
+ * `max_in_flight` frames are in flight and returns, the frame that completes
+ * next spawns it again.
+ */
+
+typedef struct pipeline_steal_ctx {
+    work_steal_t* ws;
+    image_dir_t* image_dir;
+    image_pool_t* pool;
+    const filter_graph_t* graph;
+    pipeline_stats_t* stats;
+    int load_metric;
+    int stage_metrics[FILTER_GRAPH_MAX_STEPS];
+    int save_metric;
+    int in_flight_metric;
+
+    work_steal_task_t loader;
+    atomic_bool loader_waiting; /* the loader returned on a full pipeline and waits to be spawned again */
+    atomic_size_t in_flight;
+    size_t max_in_flight;
+    atomic_bool failed;
+} pipeline_steal_ctx_t;
+
+typedef struct steal_frame {
+    work_steal_task_t task; /* first, the task is the frame */
+    pipeline_steal_ctx_t* ctx;
+    size_t stage; /* next stage to run, `num_stages` to save */
+    image_t* image;
+} steal_frame_t;
+
+/* called once the frame left the pipeline, one more fits */
+static void steal_frame_done(pipeline_steal_ctx_t* ctx, steal_frame_t* frame) {
+    free(frame);
+    atomic_fetch_sub(&ctx->in_flight, 1);
+
+    bool waiting = true;
+    if (atomic_compare_exchange_strong(&ctx->loader_waiting, &waiting, false)) {
+        work_steal_spawn(ctx->ws, &ctx->loader);
+    }
+}
+
+static void steal_save(pipeline_steal_ctx_t* ctx, steal_frame_t* frame) {
+    uint64_t start = pipeline_stats_now();
+    if (image_dir_save(ctx->image_dir, frame->image) < 0) {
+        atomic_store(&ctx->failed, true);
+    } else {
+        pipeline_stats_record_since(ctx->stats, ctx->save_metric, start);
+        pipeline_stats_count_frame(ctx->stats);
+    }
+    image_destroy(frame->image);
+}
+
+static void steal_stage(work_steal_t* ws, work_steal_task_t* task) {
+    steal_frame_t* frame      = (steal_frame_t*)task;
+    pipeline_steal_ctx_t* ctx = frame->ctx;
+
+    if (frame->stage == ctx->graph->num_stages) {
+        steal_save(ctx, frame);
+        steal_frame_done(ctx, frame);
+        return;
+    }
+
+    const filter_stage_t* stage = &ctx->graph->stages[frame->stage];
+    uint64_t start              = pipeline_stats_now();
+    image_t* new_image          = filter_stage_apply_pool(ctx->pool, stage, frame->image);
+    image_destroy(frame->image);
+    if (new_image == NULL) {
+        /* drop the frame and stop loading new ones, the frames in flight still drain */
+        LOG_ERROR("stage `%s` failed on an image", stage->name);
+        atomic_store(&ctx->failed, true);
+        ctx->image_dir->stop = true;
+        steal_frame_done(ctx, frame);
+        return;
+    }
+    pipeline_stats_record_since(ctx->stats, ctx->stage_metrics[frame->stage], start);
+
+    frame->image = new_image;
+    frame->stage++;
+    work_steal_spawn(ws, &frame->task);
+}
+
+static void steal_load(work_steal_t* ws, work_steal_task_t* task) {
+    pipeline_steal_ctx_t* ctx = (pipeline_steal_ctx_t*)((char*)task - offsetof(pipeline_steal_ctx_t, loader));
+
+    while (1) {
+        if (atomic_load(&ctx->in_flight) >= ctx->max_in_flight) {
+            /* a frame completing after the flag is set respawns the loader, one completing before is seen here */
+            atomic_store(&ctx->loader_waiting, true);
+            if (atomic_load(&ctx->in_flight) >= ctx->max_in_flight) {
+                return;
+            }
+
+            bool waiting = true;
+            if (!atomic_compare_exchange_strong(&ctx->loader_waiting, &waiting, false)) {
+                return; /* a completing frame cleared it and spawned the loader again */
+            }
+        }
+
+        uint64_t start = pipeline_stats_now();
+        image_t* image = image_dir_load_next(ctx->image_dir);
+        if (image == NULL) {
+            return;
+        }
+        pipeline_stats_record_since(ctx->stats, ctx->load_metric, start);
+
+        steal_frame_t* frame = malloc(sizeof(*frame));
+        if (frame == NULL) {
+            LOG_ERROR_ERRNO("malloc");
+            image_destroy(image);
+            atomic_store(&ctx->failed, true);
+            return;
+        }
+
+        frame->task.run = steal_stage;
+        frame->ctx      = ctx;
+        frame->stage    = 0;
+        frame->image    = image;
+
+        size_t in_flight = atomic_fetch_add(&ctx->in_flight, 1);
+        pipeline_stats_record(ctx->stats, ctx->in_flight_metric, in_flight);
+        work_steal_spawn(ws, &frame->task);
+    }
+}
+
+int pipeline_steal(image_dir_t* image_dir, const pipeline_options_t* options) {
+    /* a single count sets the workers, the per-stage counts of the pthread pipeline have no meaning here */
+    size_t num_threads = (options->num_stage_threads > 0) ? options->stage_threads[0] : 0;
+
+    pipeline_steal_ctx_t ctx = {
+        .image_dir = image_dir,
+        .pool      = options->pool,
+        .graph     = options->graph,
+        .stats     = options->stats,
+        .loader    = {.run = steal_load},
+    };
+    atomic_init(&ctx.loader_waiting, false);
+    atomic_init(&ctx.in_flight, 0);
+    atomic_init(&ctx.failed, false);
+
+    ctx.load_metric = pipeline_stats_add_stage(options->stats, "load");
+    for (size_t i = 0; i < options->graph->num_stages; i++) {
+        ctx.stage_metrics[i] = pipeline_stats_add_stage(options->stats, options->graph->stages[i].name);
+    }
+    ctx.save_metric      = pipeline_stats_add_stage(options->stats, "save");
+    ctx.in_flight_metric = pipeline_stats_add_queue(options->stats, "in_flight");
+
+    ctx.ws = work_steal_create(num_threads);
+    if (ctx.ws == NULL) {
+        goto fail_exit;
+    }
+    ctx.max_in_flight = STEAL_FRAMES_PER_THREAD * work_steal_num_threads(ctx.ws);
+
+    work_steal_spawn(ctx.ws, &ctx.loader);
+    work_steal_wait(ctx.ws);
+
+    work_steal_print_stats(ctx.ws, stdout);
+    work_steal_destroy(ctx.ws);
+
+    return atomic_load(&ctx.failed) ? -1 : 0;
+
+fail_exit:
+    return -1;
+}
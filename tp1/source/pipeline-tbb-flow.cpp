@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "tbb/concurrent_queue.h"
+#include "tbb/flow_graph.h"
+
+extern "C" {
+#include "filter-graph.h"
+#include "log.h"
+#include "pipeline.h"
+}
+
+#define BUDGET_UNIT (1024 * 1024)
+
+/*
+ * Same stages as pipeline_tbb on a tbb::flow::graph:
+ *
+ *   load -> limiter -> stage 0 -> ... -> stage N-1 [-> sequencer] -> save
+ *
+ * Frames are admitted by a limiter_node counting MiB of live frame data
+ * instead of frames, so 4x upscaled frames take 16 times the room of their
+ * input. The limiter adds a single unit per frame it forwards, the loader
+ * charges the rest of the frame through the decrementer port before sending
+ * it and the save releases all of it. A charge never pushes the limiter past
+ * its threshold (it would clamp and lose count): what doesn't fit becomes a
+ * debt, paid by the next releases before they reopen the limiter. A frame is
+ * then admitted exactly when all the frames in flight plus itself fit in the
+ * budget, or when it is alone for frames larger than the whole budget.
+ *
+ * Stages run on function_nodes limited by `--threads`. The save goes through
+ * a sequencer_node and runs serially when the output is a stream, frames are
+ * saved as they complete otherwise.
+ */
+
+struct TBBFlowFrame {
+    size_t seq; /* 0, 1, 2... in load order, for the sequencer */
+    image_t* input;
+    image_t* buffers[3];
+    image_t* current;
+    long long units; /* charged to the budget */
+    bool failed;
+};
+
+typedef tbb::flow::limiter_node<TBBFlowFrame*, long long> TBBFlowLimiter;
+typedef tbb::flow::function_node<TBBFlowFrame*, TBBFlowFrame*> TBBFlowStageNode;
+
+class TBBFlowBudget {
+    TBBFlowLimiter* limiter;
+    std::mutex mutex;
+    long long threshold;
+    long long charged; /* units of the frames loaded and not released yet */
+    long long debt;    /* units charged but not yet counted by the limiter */
+   public:
+    TBBFlowBudget(TBBFlowLimiter* limiter, long long threshold)
+        : limiter(limiter), threshold(threshold), charged(0), debt(0) {}
+
+    long long units(size_t bytes) const {
+        long long units = (bytes + BUDGET_UNIT - 1) / BUDGET_UNIT;
+        return std::min(std::max(units, 1LL), threshold);
+    }
+
+    /* called by the loader before sending the frame, every frame sent before has been admitted */
+    void charge(long long units) {
+        std::lock_guard<std::mutex> lock(mutex);
+        long long count     = charged - debt;
+        long long precharge = std::min(units - 1, threshold - count);
+
+        debt += units - 1 - precharge;
+        charged += units;
+        if (precharge > 0) {
+            limiter->decrementer().try_put(-precharge);
+        }
+    }
+
+    void release(long long units) {
+        std::lock_guard<std::mutex> lock(mutex);
+        long long paid = std::min(units, debt);
+
+        debt -= paid;
+        charged -= units;
+        if (units > paid) {
+            limiter->decrementer().try_put(units - paid);
+        }
+    }
+
+    long long in_use() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return charged;
+    }
+};
+
+typedef tbb::concurrent_queue<TBBFlowFrame*> TBBFlowFrameList;
+
+/* frames are recycled with their grown buffers, new ones are only created when the budget admits more */
+class TBBFlowFrames {
+    TBBFlowFrameList free_frames;
+    std::vector<TBBFlowFrame*> all; /* only grown by the loader */
+   public:
+    ~TBBFlowFrames() {
+        for (TBBFlowFrame* frame : all) {
+            for (int b = 0; b < 3; b++) {
+                if (frame->buffers[b] != NULL) {
+                    image_destroy(frame->buffers[b]);
+                }
+            }
+            delete frame;
+        }
+    }
+
+    TBBFlowFrame* acquire() {
+        TBBFlowFrame* frame = NULL;
+        if (free_frames.try_pop(frame)) {
+            return frame;
+        }
+
+        frame = new TBBFlowFrame();
+        all.push_back(frame);
+        for (int b = 0; b < 3; b++) {
+            frame->buffers[b] = image_create(0, 0, 0);
+            if (frame->buffers[b] == NULL) {
+                return NULL;
+            }
+        }
+        return frame;
+    }
+
+    void release(TBBFlowFrame* frame) {
+        free_frames.push(frame);
+    }
+};
+
+struct TBBFlowContext {
+    image_dir_t* image_dir;
+    const filter_graph_t* graph;
+    const parallel_for_t* parallel_for;
+    TBBFlowFrames* frames;
+    TBBFlowBudget* budget;
+    pipeline_stats_t* stats;
+    int load_metric;
+    int budget_metric;
+    int save_metric;
+    std::atomic<bool> failed;
+};
+
+/* input, plus the three buffers grown to the largest image of any stage */
+static size_t frame_bytes(const filter_graph_t* graph, const image_t* input) {
+    size_t width      = input->width;
+    size_t height     = input->height;
+    size_t max_pixels = 0;
+
+    for (size_t i = 0; i < graph->num_stages; i++) {
+        const filter_stage_t* stage = &graph->stages[i];
+        size_t pixels;
+        if (filter_chain_output_size(stage->steps, stage->num_steps, width, height, &width, &height, &pixels) < 0) {
+            break;
+        }
+        max_pixels = std::max(max_pixels, pixels);
+    }
+
+    return (input->width * input->height + 3 * max_pixels) * sizeof(pixel_t);
+}
+
+class TBBFlowLoad {
+    TBBFlowContext* ctx;
+    size_t* seq;
+
+   public:
+    TBBFlowLoad(TBBFlowContext* ctx, size_t* seq) : ctx(ctx), seq(seq) {}
+
+    TBBFlowFrame* operator()(tbb::flow_control& fc) const {
+        uint64_t start = pipeline_stats_now();
+        image_t* in    = image_dir_load_next(ctx->image_dir);
+        if (in == NULL) {
+            fc.stop();
+            return NULL;
+        }
+
+        TBBFlowFrame* frame = ctx->frames->acquire();
+        if (frame == NULL) {
+            image_destroy(in);
+            ctx->failed = true;
+            fc.stop();
+            return NULL;
+        }
+        pipeline_stats_record_since(ctx->stats, ctx->load_metric, start);
+
+        frame->seq     = (*seq)++;
+        frame->input   = in;
+        frame->current = in;
+        frame->failed  = false;
+        frame->units   = ctx->budget->units(frame_bytes(ctx->graph, in));
+
+        ctx->budget->charge(frame->units);
+        pipeline_stats_record(ctx->stats, ctx->budget_metric, ctx->budget->in_use());
+        return frame;
+    }
+};
+
+class TBBFlowStage {
+    TBBFlowContext* ctx;
+    const filter_stage_t* stage;
+    int metric;
+
+   public:
+    TBBFlowStage(TBBFlowContext* ctx, const filter_stage_t* stage)
+        : ctx(ctx), stage(stage), metric(pipeline_stats_add_stage(ctx->stats, stage->name)) {}
+
+    TBBFlowFrame* operator()(TBBFlowFrame* frame) const {
+        /* a failed frame still walks to the save, which releases its budget and keeps the sequence whole */
+        if (frame->failed) {
+            return frame;
+        }
+
+        uint64_t start = pipeline_stats_now();
+        image_t* pair[2];
+        filter_graph_stage_buffers(frame->buffers, frame->current, pair);
+
+        image_t* result = filter_stage_apply_parallel(ctx->parallel_for, stage, frame->current, pair);
+        if (result == NULL) {
+            LOG_ERROR("stage `%s` failed on an image", stage->name);
+            frame->failed        = true;
+            ctx->failed          = true;
+            ctx->image_dir->stop = true;
+            return frame;
+        }
+
+        if (frame->input != NULL) {
+            image_destroy(frame->input);
+            frame->input = NULL;
+        }
+        frame->current = result;
+        pipeline_stats_record_since(ctx->stats, metric, start);
+        return frame;
+    }
+};
+
+class TBBFlowSave {
+    TBBFlowContext* ctx;
+
+   public:
+    TBBFlowSave(TBBFlowContext* ctx) : ctx(ctx) {}
+
+    tbb::flow::continue_msg operator()(TBBFlowFrame* frame) const {
+        if (!frame->failed) {
+            uint64_t start = pipeline_stats_now();
+            if (image_dir_save(ctx->image_dir, frame->current) < 0) {
+                ctx->failed = true;
+            } else {
+                pipeline_stats_record_since(ctx->stats, ctx->save_metric, start);
+                pipeline_stats_count_frame(ctx->stats);
+            }
+        }
+
+        if (frame->input != NULL) {
+            image_destroy(frame->input);
+            frame->input = NULL;
+        }
+
+        long long units = frame->units;
+        ctx->frames->release(frame);
+        ctx->budget->release(units);
+        return tbb::flow::continue_msg();
+    }
+};
+
+class TBBFlowSequence {
+   public:
+    size_t operator()(TBBFlowFrame* const& frame) const {
+        return frame->seq;
+    }
+};
+
+static size_t stage_concurrency(const pipeline_options_t* options, size_t index) {
+    if (options->num_stage_threads == 0) {
+        return tbb::flow::unlimited;
+    }
+
+    if (index >= options->num_stage_threads) {
+        index = options->num_stage_threads - 1;
+    }
+    return options->stage_threads[index];
+}
+
+int pipeline_tbb_flow(image_dir_t* image_dir, const pipeline_options_t* options) {
+    TBBFlowFrames frames;
+    parallel_for_t parallel_for;
+    parallel_for_tbb(&parallel_for);
+
+    long long threshold = std::max<long long>(options->budget_bytes / BUDGET_UNIT, 1);
+    bool ordered        = image_dir->output_format != IMAGE_OUTPUT_PNG;
+    size_t seq          = 0;
+
+    tbb::flow::graph g;
+    TBBFlowLimiter limiter(g, threshold);
+    TBBFlowBudget budget(&limiter, threshold);
+
+    TBBFlowContext ctx;
+    ctx.image_dir     = image_dir;
+    ctx.graph         = options->graph;
+    ctx.parallel_for  = &parallel_for;
+    ctx.frames        = &frames;
+    ctx.budget        = &budget;
+    ctx.stats         = options->stats;
+    ctx.load_metric   = pipeline_stats_add_stage(options->stats, "load");
+    ctx.budget_metric = pipeline_stats_add_queue(options->stats, "budget_mib");
+    ctx.failed        = false;
+
+    tbb::flow::input_node<TBBFlowFrame*> load(g, TBBFlowLoad(&ctx, &seq));
+    tbb::flow::make_edge(load, limiter);
+
+    std::vector<std::unique_ptr<TBBFlowStageNode>> stages;
+    tbb::flow::sender<TBBFlowFrame*>* last = &limiter;
+    for (size_t i = 0; i < options->graph->num_stages; i++) {
+        stages.emplace_back(
+            new TBBFlowStageNode(g, stage_concurrency(options, i), TBBFlowStage(&ctx, &options->graph->stages[i])));
+        tbb::flow::make_edge(*last, *stages.back());
+        last = stages.back().get();
+    }
+
+    ctx.save_metric = pipeline_stats_add_stage(options->stats, "save");
+    tbb::flow::function_node<TBBFlowFrame*> save(g, ordered ? tbb::flow::serial : tbb::flow::unlimited,
+                                                 TBBFlowSave(&ctx));
+    tbb::flow::sequencer_node<TBBFlowFrame*> sequencer(g, TBBFlowSequence());
+    if (ordered) {
+        tbb::flow::make_edge(*last, sequencer);
+        tbb::flow::make_edge(sequencer, save);
+    } else {
+        tbb::flow::make_edge(*last, save);
+    }
+
+    load.activate();
+    g.wait_for_all();
+
+    return ctx.failed ? -1 : 0;
+}
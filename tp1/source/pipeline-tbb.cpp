@@ -1,80 +1,261 @@
 #include <stdio.h>
+
+#include <atomic>
+#include <vector>
+
+/* TBB 2020 and older ship tbb/pipeline.h, oneTBB renamed it and scoped the filter modes */
+#if __has_include("tbb/pipeline.h")
 #include "tbb/pipeline.h"
+using tbb_filter_mode = tbb::filter::mode;
+template <typename T, typename U>
+using tbb_filter = tbb::filter_t<T, U>;
+#else
+#include "tbb/parallel_pipeline.h"
+using tbb_filter_mode = tbb::filter_mode;
+template <typename T, typename U>
+using tbb_filter = tbb::filter<T, U>;
+#endif
+#include "tbb/concurrent_queue.h"
 
 extern "C" {
-#include "filter.h"
+#include "filter-graph.h"
+#include "log.h"
 #include "pipeline.h"
+#include "reorder-buffer.h"
 }
 
+#define MAX_TOKENS 16
+
+/*
+ * Every token in flight owns a frame with three buffers, the filters write
+ * into them instead of allocating and the frame goes back to the free list
+ * once saved. A stage reads `current` and writes into the two other buffers.
+ * There are as many frames as tokens, so loading always finds one.
+ *
+ * With a reorder window of N, the save filter is serial_in_order: TBB holds a
+ * frame that completes early, token included, until the ones loaded before it
+ * are saved. Only N + 1 tokens run, so once N frames wait behind a slow one
+ * TBB stops calling the loader until it is saved, no thread spins or blocks.
+ * The frames done with their last stage and not saved yet are the ones held
+ * back, counted like the frames parked in the reorder buffer of pipeline_pthread.
+ */
+struct TBBFrame {
+    image_t* input;
+    image_t* buffers[3];
+    image_t* current;
+    bool failed; /* a stage failed on it, it skips the next ones and isn't saved */
+};
+
+typedef tbb::concurrent_queue<TBBFrame*> TBBFrameList;
+
+/* metric ids of the run, -1 without stats */
+struct TBBMetrics {
+    pipeline_stats_t* stats;
+    int load;
+    int in_flight;
+    int save;
+};
+
 class TBBLoadNext {
     image_dir_t* image_dir;
-public:
-    TBBLoadNext(image_dir_t* image_dir) : image_dir(image_dir) {}
+    TBBFrameList* frames;
+    size_t num_frames;
+    const TBBMetrics* metrics;
+
+   public:
+    TBBLoadNext(image_dir_t* image_dir, TBBFrameList* frames, size_t num_frames, const TBBMetrics* metrics)
+        : image_dir(image_dir), frames(frames), num_frames(num_frames), metrics(metrics) {}
 
-    image_t* operator()(tbb::flow_control& fc) const {
-        image_t* out = image_dir_load_next(image_dir);
-        if (out == NULL) {
+    TBBFrame* operator()(tbb::flow_control& fc) const {
+        TBBFrame* frame = NULL;
+        if (!frames->try_pop(frame)) {
             fc.stop();
+            return NULL;
         }
-        return out;
-    }
-};
 
-class TBBScaleUp {
-public:
-    TBBScaleUp() {}
-    image_t* operator()(image_t* in) const {
-        image_t* out = filter_scale_up(in, 2);
-        if (out == NULL) {
-            exit(-1);
+        uint64_t start = pipeline_stats_now();
+        image_t* in    = image_dir_load_next(image_dir);
+        if (in == NULL) {
+            frames->push(frame);
+            fc.stop();
+            return NULL;
         }
-        image_destroy(in);
-        return out;
+        pipeline_stats_record_since(metrics->stats, metrics->load, start);
+
+        /* TBB has no queues between filters, the frames taken from the free list are the backlog */
+        pipeline_stats_record(metrics->stats, metrics->in_flight, num_frames - 1 - frames->unsafe_size());
+
+        frame->input   = in;
+        frame->current = in;
+        frame->failed  = false;
+        return frame;
     }
 };
 
-class TBBSharpen {
-public:
-    TBBSharpen() {}
-    image_t* operator()(image_t* in) const {
-        image_t* out = filter_sharpen(in);
-        if (out == NULL) {
-            exit(-1);
+class TBBStage {
+    image_dir_t* image_dir;
+    const parallel_for_t* parallel_for;
+    const filter_stage_t* stage;
+    pipeline_stats_t* stats;
+    int metric;
+    std::atomic<bool>* failed;
+
+   public:
+    TBBStage(image_dir_t* image_dir, const parallel_for_t* parallel_for, const filter_stage_t* stage,
+             pipeline_stats_t* stats, std::atomic<bool>* failed)
+        : image_dir(image_dir),
+          parallel_for(parallel_for),
+          stage(stage),
+          stats(stats),
+          metric(pipeline_stats_add_stage(stats, stage->name)),
+          failed(failed) {}
+
+    TBBFrame* operator()(TBBFrame* frame) const {
+        if (frame->failed) {
+            return frame;
+        }
+
+        uint64_t start = pipeline_stats_now();
+        image_t* pair[2];
+        filter_graph_stage_buffers(frame->buffers, frame->current, pair);
+
+        image_t* result = filter_stage_apply_parallel(parallel_for, stage, frame->current, pair);
+        if (frame->input != NULL) {
+            image_destroy(frame->input);
+            frame->input = NULL;
+        }
+
+        /* drop the frame and stop loading new ones, the frames in flight still drain */
+        if (result == NULL) {
+            LOG_ERROR("stage `%s` failed on an image", stage->name);
+            frame->failed   = true;
+            *failed         = true;
+            image_dir->stop = true;
+            return frame;
         }
-        image_destroy(in);
-        return out;
+        frame->current = result;
+        pipeline_stats_record_since(stats, metric, start);
+        return frame;
     }
 };
 
-class TBBSobel {
-public:
-    TBBSobel() {}
-    image_t* operator()(image_t* in) const {
-        image_t* out = filter_sobel(in);
-        image_destroy(in);
-        return out;
+/* frames held back by the in-order save, `high_water` is only written by the serial TBBArrive */
+struct TBBReorder {
+    std::atomic<size_t> waiting;
+    size_t high_water;
+};
+
+class TBBArrive {
+    TBBReorder* reorder;
+
+   public:
+    TBBArrive(TBBReorder* reorder) : reorder(reorder) {}
+
+    TBBFrame* operator()(TBBFrame* frame) const {
+        size_t waiting = ++reorder->waiting;
+        if (waiting > reorder->high_water) {
+            reorder->high_water = waiting;
+        }
+        return frame;
     }
 };
 
 class TBBSave {
     image_dir_t* image_dir;
-public:
-    TBBSave(image_dir_t* image_dir) : image_dir(image_dir) {}
+    TBBFrameList* frames;
+    const TBBMetrics* metrics;
+    TBBReorder* reorder;
+    std::atomic<bool>* failed;
 
-    void operator()(image_t* in) const {
-        image_dir_save(image_dir, in);
-        image_destroy(in);
+   public:
+    TBBSave(image_dir_t* image_dir, TBBFrameList* frames, const TBBMetrics* metrics, TBBReorder* reorder,
+            std::atomic<bool>* failed)
+        : image_dir(image_dir), frames(frames), metrics(metrics), reorder(reorder), failed(failed) {}
+
+    void operator()(TBBFrame* frame) const {
+        if (reorder != NULL) {
+            reorder->waiting--;
+        }
+
+        if (!frame->failed) {
+            uint64_t start = pipeline_stats_now();
+            if (image_dir_save(image_dir, frame->current) < 0) {
+                *failed = true;
+            } else {
+                pipeline_stats_count_frame(metrics->stats);
+            }
+            pipeline_stats_record_since(metrics->stats, metrics->save, start);
+        }
+        frames->push(frame);
     }
 };
 
-int pipeline_tbb(image_dir_t* image_dir) {
-    tbb::parallel_pipeline(
-        16,
-        tbb::make_filter<void, image_t*>(tbb::filter::serial, TBBLoadNext(image_dir)) &
-        tbb::make_filter<image_t*, image_t*>(tbb::filter::parallel, TBBScaleUp()) &
-        tbb::make_filter<image_t*, image_t*>(tbb::filter::parallel, TBBSharpen()) &
-        tbb::make_filter<image_t*, image_t*>(tbb::filter::parallel, TBBSobel()) &
-        tbb::make_filter<image_t*, void>(tbb::filter::parallel, TBBSave(image_dir))
-    );
-    return 0;
-}
\ No newline at end of file
+/* load, one filter per stage of the graph, save, one token per frame, fails if a frame couldn't be filtered or saved */
+static int run_graph(image_dir_t* image_dir, const filter_graph_t* graph, const parallel_for_t* parallel_for,
+                     TBBFrameList* free_frames, size_t num_frames, TBBReorder* reorder, pipeline_stats_t* stats) {
+    std::atomic<bool> failed(false);
+    TBBMetrics metrics;
+    metrics.stats     = stats;
+    metrics.load      = pipeline_stats_add_stage(stats, "load");
+    metrics.in_flight = pipeline_stats_add_queue(stats, "in_flight");
+
+    tbb_filter<void, TBBFrame*> chain = tbb::make_filter<void, TBBFrame*>(
+        tbb_filter_mode::serial_in_order, TBBLoadNext(image_dir, free_frames, num_frames, &metrics));
+
+    for (size_t i = 0; i < graph->num_stages; i++) {
+        TBBStage stage(image_dir, parallel_for, &graph->stages[i], stats, &failed);
+        chain = chain & tbb::make_filter<TBBFrame*, TBBFrame*>(tbb_filter_mode::parallel, stage);
+    }
+    metrics.save = pipeline_stats_add_stage(stats, "save");
+
+    tbb_filter_mode save_mode = tbb_filter_mode::parallel;
+    if (reorder != NULL) {
+        chain =
+            chain & tbb::make_filter<TBBFrame*, TBBFrame*>(tbb_filter_mode::serial_out_of_order, TBBArrive(reorder));
+        save_mode = tbb_filter_mode::serial_in_order;
+    }
+
+    TBBSave save(image_dir, free_frames, &metrics, reorder, &failed);
+    tbb::parallel_pipeline(num_frames, chain & tbb::make_filter<TBBFrame*, void>(save_mode, save));
+    return failed ? -1 : 0;
+}
+
+int pipeline_tbb(image_dir_t* image_dir, const pipeline_options_t* options) {
+    size_t num_frames = (options->reorder_window > 0) ? options->reorder_window + 1 : MAX_TOKENS;
+    std::vector<TBBFrame> frames(num_frames);
+    TBBFrameList free_frames;
+    TBBReorder reorder = {};
+    parallel_for_t parallel_for;
+    int ret = 0;
+
+    /* frames also split in bands, which keeps cores busy when there are fewer frames in flight than workers */
+    parallel_for_tbb(&parallel_for);
+
+    for (size_t i = 0; i < num_frames; i++) {
+        for (int b = 0; b < 3; b++) {
+            frames[i].buffers[b] = image_create(0, 0, 0);
+            if (frames[i].buffers[b] == NULL) {
+                ret = -1;
+                goto free_frames;
+            }
+        }
+        free_frames.push(&frames[i]);
+    }
+
+    ret = run_graph(image_dir, options->graph, &parallel_for, &free_frames, num_frames,
+                    (options->reorder_window > 0) ? &reorder : NULL, options->stats);
+
+    if (options->reorder_window > 0) {
+        reorder_buffer_print_window(stdout, options->reorder_window, reorder.high_water);
+    }
+
+free_frames:
+    for (size_t i = 0; i < num_frames; i++) {
+        for (int b = 0; b < 3; b++) {
+            if (frames[i].buffers[b] != NULL) {
+                image_destroy(frames[i].buffers[b]);
+            }
+        }
+    }
+    return ret;
+}
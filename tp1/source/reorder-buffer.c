@@ -0,0 +1,162 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "reorder-buffer.h"
+
+typedef enum reorder_slot_state {
+    REORDER_SLOT_EMPTY,
+    REORDER_SLOT_READY,
+    REORDER_SLOT_SKIPPED,
+} reorder_slot_state_t;
+
+typedef struct reorder_slot {
+    reorder_slot_state_t state;
+    void* item;
+} reorder_slot_t;
+
+struct reorder_buffer {
+    pthread_mutex_t mutex;
+    pthread_cond_t advanced; /* `next` moved forward */
+    reorder_slot_t* slots;   /* id `next + i` lives in slot `(next + i) % window` */
+    size_t window;
+    size_t next; /* id of the next item to release */
+    size_t parked;
+    size_t high_water;
+    bool releasing; /* a thread is releasing items, the others leave theirs parked */
+};
+
+reorder_buffer_t* reorder_buffer_create(size_t window, size_t first_id) {
+    reorder_buffer_t* buffer = calloc(1, sizeof(*buffer));
+    if (buffer == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_exit;
+    }
+
+    buffer->slots = calloc(window, sizeof(*buffer->slots));
+    if (buffer->slots == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_free_buffer;
+    }
+
+    buffer->window = window;
+    buffer->next   = first_id;
+    pthread_mutex_init(&buffer->mutex, NULL);
+    pthread_cond_init(&buffer->advanced, NULL);
+    return buffer;
+
+fail_free_buffer:
+    free(buffer);
+fail_exit:
+    return NULL;
+}
+
+void reorder_buffer_destroy(reorder_buffer_t* buffer) {
+    if (buffer->parked > 0) {
+        LOG_ERROR("%ld frames still parked in the reorder buffer", buffer->parked);
+    }
+
+    pthread_cond_destroy(&buffer->advanced);
+    pthread_mutex_destroy(&buffer->mutex);
+    free(buffer->slots);
+    free(buffer);
+}
+
+static reorder_slot_t* reorder_buffer_slot(reorder_buffer_t* buffer, size_t id) {
+    return &buffer->slots[id % buffer->window];
+}
+
+/* moves `next` past the dropped ids at the head of the window, called with the mutex held */
+static void reorder_buffer_pass_skipped(reorder_buffer_t* buffer) {
+    reorder_slot_t* slot;
+    while ((slot = reorder_buffer_slot(buffer, buffer->next))->state == REORDER_SLOT_SKIPPED) {
+        slot->state = REORDER_SLOT_EMPTY;
+        buffer->next++;
+    }
+}
+
+void reorder_buffer_wait(reorder_buffer_t* buffer, size_t id) {
+    pthread_mutex_lock(&buffer->mutex);
+    while (id >= buffer->next + buffer->window) {
+        pthread_cond_wait(&buffer->advanced, &buffer->mutex);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+int reorder_buffer_push(reorder_buffer_t* buffer, size_t id, void* item) {
+    pthread_mutex_lock(&buffer->mutex);
+    if (id < buffer->next || id >= buffer->next + buffer->window) {
+        LOG_ERROR("frame %ld outside of the reorder window [%ld, %ld)", id, buffer->next,
+                  buffer->next + buffer->window);
+        goto fail_unlock;
+    }
+
+    reorder_slot_t* slot = reorder_buffer_slot(buffer, id);
+    slot->state          = REORDER_SLOT_READY;
+    slot->item           = item;
+
+    buffer->parked++;
+    if (buffer->parked > buffer->high_water) {
+        buffer->high_water = buffer->parked;
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    return 0;
+
+fail_unlock:
+    pthread_mutex_unlock(&buffer->mutex);
+    return -1;
+}
+
+void reorder_buffer_skip(reorder_buffer_t* buffer, size_t id) {
+    pthread_mutex_lock(&buffer->mutex);
+    if (id >= buffer->next && id < buffer->next + buffer->window) {
+        reorder_buffer_slot(buffer, id)->state = REORDER_SLOT_SKIPPED;
+        reorder_buffer_pass_skipped(buffer);
+        pthread_cond_broadcast(&buffer->advanced);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+void* reorder_buffer_try_pop(reorder_buffer_t* buffer, bool* releasing) {
+    void* item = NULL;
+
+    pthread_mutex_lock(&buffer->mutex);
+    if (buffer->releasing && !*releasing) {
+        goto unlock;
+    }
+
+    reorder_slot_t* slot = reorder_buffer_slot(buffer, buffer->next);
+    if (slot->state != REORDER_SLOT_READY) {
+        buffer->releasing = *releasing = false;
+        goto unlock;
+    }
+
+    item        = slot->item;
+    slot->state = REORDER_SLOT_EMPTY;
+    slot->item  = NULL;
+    buffer->parked--;
+    buffer->next++;
+    reorder_buffer_pass_skipped(buffer);
+    pthread_cond_broadcast(&buffer->advanced);
+
+    buffer->releasing = *releasing = true;
+
+unlock:
+    pthread_mutex_unlock(&buffer->mutex);
+    return item;
+}
+
+size_t reorder_buffer_high_water(reorder_buffer_t* buffer) {
+    pthread_mutex_lock(&buffer->mutex);
+    size_t high_water = buffer->high_water;
+    pthread_mutex_unlock(&buffer->mutex);
+    return high_water;
+}
+
+void reorder_buffer_print_stats(reorder_buffer_t* buffer, FILE* file) {
+    reorder_buffer_print_window(file, buffer->window, reorder_buffer_high_water(buffer));
+}
+
+void reorder_buffer_print_window(FILE* file, size_t window, size_t high_water) {
+    fprintf(file, "reorder buffer: window of %ld frames, high-water mark %ld frames\n", window, high_water);
+}
@@ -0,0 +1,189 @@
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "ring-queue.h"
+
+#define RING_QUEUE_SPIN 256
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(atomic_uint* word, unsigned int value) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+ring_queue_t* ring_queue_create(size_t size) {
+    size_t capacity = 4;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+
+    ring_queue_t* queue = aligned_alloc(RING_QUEUE_CACHE_LINE, sizeof(*queue));
+    if (queue == NULL) {
+        LOG_ERROR_ERRNO("aligned_alloc");
+        goto fail_exit;
+    }
+
+    queue->mask  = capacity - 1;
+    queue->cells = aligned_alloc(RING_QUEUE_CACHE_LINE, capacity * sizeof(*queue->cells));
+    if (queue->cells == NULL) {
+        LOG_ERROR_ERRNO("aligned_alloc");
+        goto fail_free_queue;
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
+        queue->cells[i].value = NULL;
+    }
+
+    /* spinning only helps if the thread we wait for runs on another core */
+    queue->spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? RING_QUEUE_SPIN : 0;
+
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    atomic_init(&queue->pushed, 0);
+    atomic_init(&queue->pop_waiters, 0);
+    atomic_init(&queue->popped, 0);
+    atomic_init(&queue->push_waiters, 0);
+
+    return queue;
+
+fail_free_queue:
+    free(queue);
+fail_exit:
+    return NULL;
+}
+
+void ring_queue_destroy(ring_queue_t* queue) {
+    free(queue->cells);
+    free(queue);
+}
+
+size_t ring_queue_capacity(ring_queue_t* queue) {
+    return queue->mask + 1;
+}
+
+size_t ring_queue_size(ring_queue_t* queue) {
+    /* both positions move while we read them, a consumer can claim a slot in between */
+    size_t dequeue = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    size_t enqueue = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    return (enqueue > dequeue) ? enqueue - dequeue : 0;
+}
+
+int ring_queue_try_push(ring_queue_t* queue, void* ptr) {
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+
+    while (1) {
+        ring_queue_cell_t* cell = &queue->cells[pos & queue->mask];
+        size_t sequence         = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff           = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                cell->value = ptr;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    atomic_fetch_add(&queue->pushed, 1);
+    if (atomic_load(&queue->pop_waiters) > 0) {
+        futex_wake(&queue->pushed);
+    }
+    return 0;
+}
+
+int ring_queue_try_pop(ring_queue_t* queue, void** ptr) {
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+
+    while (1) {
+        ring_queue_cell_t* cell = &queue->cells[pos & queue->mask];
+        size_t sequence         = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff           = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                *ptr = cell->value;
+                atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    atomic_fetch_add(&queue->popped, 1);
+    if (atomic_load(&queue->push_waiters) > 0) {
+        futex_wake(&queue->popped);
+    }
+    return 0;
+}
+
+/*
+ * Sleeping side of the handshake: register as a waiter, snapshot the futex
+ * word, then retry once. A push/pop that completes after the snapshot bumps
+ * the word, so futex_wait() returns immediately instead of missing the wakeup.
+ */
+
+int ring_queue_push(ring_queue_t* queue, void* ptr) {
+    for (int i = 0; i < queue->spin; i++) {
+        if (ring_queue_try_push(queue, ptr) == 0) {
+            return 0;
+        }
+        cpu_relax();
+    }
+
+    atomic_fetch_add(&queue->push_waiters, 1);
+    while (1) {
+        unsigned int popped = atomic_load(&queue->popped);
+        if (ring_queue_try_push(queue, ptr) == 0) {
+            break;
+        }
+        futex_wait(&queue->popped, popped);
+    }
+    atomic_fetch_sub(&queue->push_waiters, 1);
+
+    return 0;
+}
+
+void* ring_queue_pop(ring_queue_t* queue) {
+    void* value;
+
+    for (int i = 0; i < queue->spin; i++) {
+        if (ring_queue_try_pop(queue, &value) == 0) {
+            return value;
+        }
+        cpu_relax();
+    }
+
+    atomic_fetch_add(&queue->pop_waiters, 1);
+    while (1) {
+        unsigned int pushed = atomic_load(&queue->pushed);
+        if (ring_queue_try_pop(queue, &value) == 0) {
+            break;
+        }
+        futex_wait(&queue->pushed, pushed);
+    }
+    atomic_fetch_sub(&queue->pop_waiters, 1);
+
+    return value;
+}
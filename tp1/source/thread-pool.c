@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "thread-pool.h"
+
+/* ranges per thread, more of them balance better when some threads get descheduled */
+#define THREAD_POOL_CHUNKS_PER_THREAD 4
+
+/* claims and runs chunks of the current job until none are left, returns how many it ran */
+static size_t thread_pool_work(thread_pool_t* pool) {
+    size_t ran = 0;
+
+    while (1) {
+        size_t chunk = atomic_fetch_add(&pool->next_chunk, 1);
+        if (chunk >= pool->num_chunks) {
+            break;
+        }
+
+        size_t begin = chunk * pool->chunk;
+        size_t end   = (begin + pool->chunk < pool->count) ? begin + pool->chunk : pool->count;
+        pool->fn(pool->args, begin, end);
+        ran++;
+    }
+
+    return ran;
+}
+
+static void* thread_pool_worker(void* args) {
+    thread_pool_t* pool = args;
+    size_t generation   = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (!pool->stop && pool->generation == generation) {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if (pool->stop) {
+            break;
+        }
+
+        generation = pool->generation;
+        pool->busy++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        size_t ran = thread_pool_work(pool);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->finished_chunks += ran;
+        pool->busy--;
+        if (pool->busy == 0 || pool->finished_chunks == pool->num_chunks) {
+            pthread_cond_broadcast(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+thread_pool_t* thread_pool_create(size_t num_threads) {
+    if (num_threads == 0) {
+        long cpus   = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (cpus > 1) ? cpus - 1 : 0;
+    }
+
+    thread_pool_t* pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_exit;
+    }
+
+    atomic_init(&pool->next_chunk, 0);
+    pthread_mutex_init(&pool->run_mutex, NULL);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    if (num_threads > 0) {
+        pool->tids = calloc(num_threads, sizeof(*pool->tids));
+        if (pool->tids == NULL) {
+            LOG_ERROR_ERRNO("calloc");
+            goto fail_destroy_pool;
+        }
+    }
+
+    for (; pool->num_threads < num_threads; pool->num_threads++) {
+        errno = pthread_create(&pool->tids[pool->num_threads], NULL, thread_pool_worker, pool);
+        if (errno != 0) {
+            LOG_ERROR_ERRNO("pthread_create");
+            goto fail_destroy_pool;
+        }
+    }
+
+    return pool;
+
+fail_destroy_pool:
+    thread_pool_destroy(pool);
+fail_exit:
+    return NULL;
+}
+
+void thread_pool_destroy(thread_pool_t* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->tids[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_mutex_destroy(&pool->run_mutex);
+    free(pool->tids);
+    free(pool);
+}
+
+void thread_pool_run(thread_pool_t* pool, size_t count, size_t grain, parallel_for_fn_t fn, void* args) {
+    size_t threads = pool->num_threads + 1;
+    size_t chunk   = (count + THREAD_POOL_CHUNKS_PER_THREAD * threads - 1) / (THREAD_POOL_CHUNKS_PER_THREAD * threads);
+    if (chunk < grain) {
+        chunk = grain;
+    }
+    if (chunk == 0) {
+        chunk = 1;
+    }
+
+    pthread_mutex_lock(&pool->run_mutex);
+    pthread_mutex_lock(&pool->mutex);
+
+    /* a worker late for the previous job may still be reading it */
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+
+    pool->fn              = fn;
+    pool->args            = args;
+    pool->count           = count;
+    pool->chunk           = chunk;
+    pool->num_chunks      = (count + chunk - 1) / chunk;
+    pool->finished_chunks = 0;
+    atomic_store(&pool->next_chunk, 0);
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    size_t ran = thread_pool_work(pool);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->finished_chunks += ran;
+    while (pool->finished_chunks < pool->num_chunks) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_unlock(&pool->run_mutex);
+}
+
+static void thread_pool_parallel_for_run(void* ctx, size_t count, size_t grain, parallel_for_fn_t fn, void* args) {
+    thread_pool_run(ctx, count, grain, fn, args);
+}
+
+parallel_for_t thread_pool_parallel_for(thread_pool_t* pool) {
+    return (parallel_for_t){.run = thread_pool_parallel_for_run, .ctx = pool};
+}
@@ -0,0 +1,405 @@
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "work-steal.h"
+
+#define WORK_STEAL_CACHE_LINE 64
+#define WORK_STEAL_DEQUE_SIZE 256 /* initial capacity, doubled when full */
+#define WORK_STEAL_IDLE_ROUNDS 64 /* steal rounds before parking */
+
+/*
+ * Deque of "Correct and Efficient Work-Stealing for Weak Memory Models"
+ * (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013). The owner moves `bottom`,
+ * thieves race on `top` with a CAS, the last task is settled by a CAS too.
+ * A full array is replaced by one twice as large, the old one is kept until
+ * the deque is destroyed since a thief may still be reading it.
+ */
+
+typedef struct work_steal_array {
+    struct work_steal_array* retired; /* previous, smaller array */
+    int64_t size;
+    _Atomic(work_steal_task_t*) tasks[];
+} work_steal_array_t;
+
+typedef struct work_steal_worker {
+    alignas(WORK_STEAL_CACHE_LINE) atomic_int_least64_t top;
+    alignas(WORK_STEAL_CACHE_LINE) atomic_int_least64_t bottom;
+    _Atomic(work_steal_array_t*) array;
+
+    work_steal_t* ws;
+    pthread_t tid;
+    unsigned int seed; /* picks the victims */
+
+    /* counted by the worker only */
+    atomic_size_t ran;
+    atomic_size_t stolen;
+    atomic_size_t parked;
+} work_steal_worker_t;
+
+struct work_steal {
+    work_steal_worker_t* workers;
+    size_t num_threads;
+    atomic_bool stop;
+
+    /* tasks spawned from outside the workers */
+    pthread_mutex_t inject_mutex;
+    work_steal_task_t* inject_head;
+    work_steal_task_t* inject_tail;
+    atomic_size_t num_injected;
+
+    /* futex words: bumped by every spawn for the parked workers, tasks spawned and not finished for wait() */
+    alignas(WORK_STEAL_CACHE_LINE) atomic_uint epoch;
+    atomic_uint sleepers;
+    alignas(WORK_STEAL_CACHE_LINE) atomic_uint pending;
+};
+
+static _Thread_local work_steal_worker_t* work_steal_self;
+
+static void futex_wait(atomic_uint* word, unsigned int value) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* word, int count) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static work_steal_array_t* work_steal_array_create(int64_t size) {
+    work_steal_array_t* array = malloc(sizeof(*array) + size * sizeof(array->tasks[0]));
+    if (array == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        return NULL;
+    }
+    array->retired = NULL;
+    array->size    = size;
+    return array;
+}
+
+static void work_steal_array_destroy(work_steal_array_t* array) {
+    while (array != NULL) {
+        work_steal_array_t* retired = array->retired;
+        free(array);
+        array = retired;
+    }
+}
+
+static work_steal_task_t* work_steal_array_get(work_steal_array_t* array, int64_t i) {
+    return atomic_load_explicit(&array->tasks[i & (array->size - 1)], memory_order_relaxed);
+}
+
+static void work_steal_array_put(work_steal_array_t* array, int64_t i, work_steal_task_t* task) {
+    atomic_store_explicit(&array->tasks[i & (array->size - 1)], task, memory_order_relaxed);
+}
+
+/* owner only */
+static int work_steal_push(work_steal_worker_t* worker, work_steal_task_t* task) {
+    int64_t bottom            = atomic_load_explicit(&worker->bottom, memory_order_relaxed);
+    int64_t top               = atomic_load_explicit(&worker->top, memory_order_acquire);
+    work_steal_array_t* array = atomic_load_explicit(&worker->array, memory_order_relaxed);
+
+    if (bottom - top > array->size - 1) {
+        work_steal_array_t* bigger = work_steal_array_create(2 * array->size);
+        if (bigger == NULL) {
+            return -1;
+        }
+        for (int64_t i = top; i < bottom; i++) {
+            work_steal_array_put(bigger, i, work_steal_array_get(array, i));
+        }
+        bigger->retired = array;
+        atomic_store_explicit(&worker->array, bigger, memory_order_release);
+        array = bigger;
+    }
+
+    work_steal_array_put(array, bottom, task);
+    atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_release);
+    return 0;
+}
+
+/* owner only, newest task first */
+static work_steal_task_t* work_steal_take(work_steal_worker_t* worker) {
+    int64_t bottom            = atomic_load_explicit(&worker->bottom, memory_order_relaxed) - 1;
+    work_steal_array_t* array = atomic_load_explicit(&worker->array, memory_order_relaxed);
+    atomic_store_explicit(&worker->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&worker->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    work_steal_task_t* task = work_steal_array_get(array, bottom);
+    if (top == bottom) {
+        /* last task, a thief may be taking it too */
+        if (!atomic_compare_exchange_strong_explicit(&worker->top, &top, top + 1, memory_order_seq_cst,
+                                                     memory_order_relaxed)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+/* any thread, oldest task first, NULL when empty or when another thief won */
+static work_steal_task_t* work_steal_steal(work_steal_worker_t* victim) {
+    int64_t top = atomic_load_explicit(&victim->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&victim->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    work_steal_array_t* array = atomic_load_explicit(&victim->array, memory_order_acquire);
+    work_steal_task_t* task   = work_steal_array_get(array, top);
+    if (!atomic_compare_exchange_strong_explicit(&victim->top, &top, top + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return NULL;
+    }
+    return task;
+}
+
+static void work_steal_inject(work_steal_t* ws, work_steal_task_t* task) {
+    task->next = NULL;
+
+    pthread_mutex_lock(&ws->inject_mutex);
+    if (ws->inject_tail != NULL) {
+        ws->inject_tail->next = task;
+    } else {
+        ws->inject_head = task;
+    }
+    ws->inject_tail = task;
+    atomic_fetch_add(&ws->num_injected, 1);
+    pthread_mutex_unlock(&ws->inject_mutex);
+}
+
+static work_steal_task_t* work_steal_pop_injected(work_steal_t* ws) {
+    if (atomic_load_explicit(&ws->num_injected, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ws->inject_mutex);
+    work_steal_task_t* task = ws->inject_head;
+    if (task != NULL) {
+        ws->inject_head = task->next;
+        if (ws->inject_head == NULL) {
+            ws->inject_tail = NULL;
+        }
+        atomic_fetch_sub(&ws->num_injected, 1);
+    }
+    pthread_mutex_unlock(&ws->inject_mutex);
+    return task;
+}
+
+/* one pass over the other workers starting at a random one, then the injection list */
+static work_steal_task_t* work_steal_find(work_steal_worker_t* self) {
+    work_steal_t* ws = self->ws;
+    size_t start     = rand_r(&self->seed) % ws->num_threads;
+
+    for (size_t i = 0; i < ws->num_threads; i++) {
+        work_steal_worker_t* victim = &ws->workers[(start + i) % ws->num_threads];
+        if (victim == self) {
+            continue;
+        }
+
+        work_steal_task_t* task = work_steal_steal(victim);
+        if (task != NULL) {
+            atomic_store_explicit(&self->stolen, atomic_load_explicit(&self->stolen, memory_order_relaxed) + 1,
+                                  memory_order_relaxed);
+            return task;
+        }
+    }
+
+    return work_steal_pop_injected(ws);
+}
+
+static void work_steal_run(work_steal_worker_t* self, work_steal_task_t* task) {
+    work_steal_t* ws = self->ws;
+    task->run(ws, task);
+    atomic_store_explicit(&self->ran, atomic_load_explicit(&self->ran, memory_order_relaxed) + 1, memory_order_relaxed);
+
+    if (atomic_fetch_sub(&ws->pending, 1) == 1) {
+        futex_wake(&ws->pending, INT32_MAX);
+    }
+}
+
+/*
+ * A worker announces itself in `sleepers` before its last look for work, and
+ * a spawn publishes its task before reading `sleepers`: with both sides fenced
+ * either the worker sees the task or the spawn sees the worker and bumps the
+ * epoch it sleeps on.
+ */
+static void work_steal_park(work_steal_worker_t* self) {
+    work_steal_t* ws   = self->ws;
+    unsigned int epoch = atomic_load(&ws->epoch);
+
+    atomic_fetch_add(&ws->sleepers, 1);
+    work_steal_task_t* task = work_steal_find(self);
+    if (task != NULL) {
+        atomic_fetch_sub(&ws->sleepers, 1);
+        work_steal_run(self, task);
+        return;
+    }
+
+    if (!atomic_load(&ws->stop)) {
+        atomic_store_explicit(&self->parked, atomic_load_explicit(&self->parked, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        futex_wait(&ws->epoch, epoch);
+    }
+    atomic_fetch_sub(&ws->sleepers, 1);
+}
+
+static void* work_steal_worker(void* args) {
+    work_steal_worker_t* self = args;
+    work_steal_t* ws          = self->ws;
+    work_steal_self           = self;
+
+    while (!atomic_load_explicit(&ws->stop, memory_order_relaxed)) {
+        work_steal_task_t* task = work_steal_take(self);
+        if (task != NULL) {
+            work_steal_run(self, task);
+            continue;
+        }
+
+        for (int round = 0; round < WORK_STEAL_IDLE_ROUNDS && task == NULL; round++) {
+            task = work_steal_find(self);
+            if (task == NULL) {
+                sched_yield();
+            }
+        }
+
+        if (task != NULL) {
+            work_steal_run(self, task);
+        } else {
+            work_steal_park(self);
+        }
+    }
+
+    return NULL;
+}
+
+work_steal_t* work_steal_create(size_t num_threads) {
+    if (num_threads == 0) {
+        long cpus   = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (cpus > 0) ? cpus : 1;
+    }
+
+    work_steal_t* ws = calloc(1, sizeof(*ws));
+    if (ws == NULL) {
+        LOG_ERROR_ERRNO("calloc");
+        goto fail_exit;
+    }
+
+    pthread_mutex_init(&ws->inject_mutex, NULL);
+
+    ws->workers = aligned_alloc(WORK_STEAL_CACHE_LINE, num_threads * sizeof(*ws->workers));
+    if (ws->workers == NULL) {
+        LOG_ERROR_ERRNO("aligned_alloc");
+        goto fail_free_ws;
+    }
+
+    for (size_t i = 0; i < num_threads; i++) {
+        work_steal_worker_t* worker = &ws->workers[i];
+        atomic_init(&worker->top, 0);
+        atomic_init(&worker->bottom, 0);
+        atomic_init(&worker->ran, 0);
+        atomic_init(&worker->stolen, 0);
+        atomic_init(&worker->parked, 0);
+        worker->ws   = ws;
+        worker->seed = i + 1;
+
+        work_steal_array_t* array = work_steal_array_create(WORK_STEAL_DEQUE_SIZE);
+        atomic_init(&worker->array, array);
+        if (array == NULL) {
+            goto fail_free_arrays;
+        }
+        ws->num_threads++;
+    }
+
+    for (size_t i = 0; i < num_threads; i++) {
+        errno = pthread_create(&ws->workers[i].tid, NULL, work_steal_worker, &ws->workers[i]);
+        if (errno != 0) {
+            LOG_ERROR_ERRNO("pthread_create");
+            ws->num_threads = i;
+            work_steal_destroy(ws);
+            goto fail_exit;
+        }
+    }
+
+    return ws;
+
+fail_free_arrays:
+    for (size_t i = 0; i < ws->num_threads; i++) {
+        work_steal_array_destroy(atomic_load(&ws->workers[i].array));
+    }
+    free(ws->workers);
+fail_free_ws:
+    pthread_mutex_destroy(&ws->inject_mutex);
+    free(ws);
+fail_exit:
+    return NULL;
+}
+
+void work_steal_destroy(work_steal_t* ws) {
+    atomic_store(&ws->stop, true);
+    atomic_fetch_add(&ws->epoch, 1);
+    futex_wake(&ws->epoch, INT32_MAX);
+
+    for (size_t i = 0; i < ws->num_threads; i++) {
+        pthread_join(ws->workers[i].tid, NULL);
+    }
+
+    for (size_t i = 0; i < ws->num_threads; i++) {
+        work_steal_array_destroy(atomic_load(&ws->workers[i].array));
+    }
+    free(ws->workers);
+    pthread_mutex_destroy(&ws->inject_mutex);
+    free(ws);
+}
+
+size_t work_steal_num_threads(work_steal_t* ws) {
+    return ws->num_threads;
+}
+
+void work_steal_spawn(work_steal_t* ws, work_steal_task_t* task) {
+    atomic_fetch_add(&ws->pending, 1);
+
+    work_steal_worker_t* self = work_steal_self;
+    if (self == NULL || self->ws != ws || work_steal_push(self, task) < 0) {
+        work_steal_inject(ws, task);
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ws->sleepers, memory_order_relaxed) > 0) {
+        atomic_fetch_add(&ws->epoch, 1);
+        futex_wake(&ws->epoch, 1);
+    }
+}
+
+void work_steal_wait(work_steal_t* ws) {
+    unsigned int pending;
+    while ((pending = atomic_load(&ws->pending)) != 0) {
+        futex_wait(&ws->pending, pending);
+    }
+}
+
+void work_steal_print_stats(work_steal_t* ws, FILE* file) {
+    size_t ran = 0, stolen = 0, parked = 0;
+    for (size_t i = 0; i < ws->num_threads; i++) {
+        ran += atomic_load(&ws->workers[i].ran);
+        stolen += atomic_load(&ws->workers[i].stolen);
+        parked += atomic_load(&ws->workers[i].parked);
+    }
+
+    fprintf(file, "work stealing: %ld workers, %ld tasks run, %ld stolen (%.1f%%), %ld parks\n", ws->num_threads, ran,
+            stolen, (ran > 0) ? 100.0 * stolen / ran : 0.0, parked);
+}
@@ -0,0 +1,111 @@
+/*
+ * Converts between a directory of NNNN.png frames and a raw frame container.
+ *
+ *   raw-convert pack DIRECTORY FILE     NNNN.png frames of DIRECTORY into FILE
+ *   raw-convert unpack FILE DIRECTORY   frames of FILE into DIRECTORY/NNNN.png
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "image-raw.h"
+#include "image.h"
+#include "log.h"
+
+static int pack(const char* directory, const char* filename) {
+    image_dir_t image_dir = {0};
+    image_dir_reset(&image_dir, directory, NULL, NULL);
+
+    image_raw_writer_t* writer = image_raw_writer_create(filename);
+    if (writer == NULL) {
+        goto fail_exit;
+    }
+
+    while (1) {
+        image_t* image = image_dir_load_next(&image_dir);
+        if (image == NULL) {
+            break;
+        }
+
+        int ret = image_raw_append(writer, image);
+        image_destroy(image);
+        if (ret < 0) {
+            goto fail_finish;
+        }
+    }
+
+    /* a frame that fails to decode ends the loop like the last one */
+    if (image_dir.load_current < image_dir.load_end) {
+        LOG_ERROR("frame %ld of `%s` couldn't be loaded", image_dir.load_current, directory);
+        goto fail_finish;
+    }
+    if (writer->num_frames == 0) {
+        LOG_ERROR("no frame to pack in `%s`", directory);
+        goto fail_finish;
+    }
+
+    printf("packed %ld frames of %ldx%ld into `%s`\n", writer->num_frames, writer->width, writer->height, filename);
+    image_dir_close(&image_dir);
+    return image_raw_writer_finish(writer);
+
+fail_finish:
+    /* no container is better than a partial one passing for complete */
+    image_raw_writer_finish(writer);
+    unlink(filename);
+fail_exit:
+    image_dir_close(&image_dir);
+    return -1;
+}
+
+static int unpack(const char* filename, const char* directory) {
+    const size_t buffer_size = 256;
+    char buffer[buffer_size];
+
+    image_raw_reader_t* reader = image_raw_open(filename);
+    if (reader == NULL) {
+        goto fail_exit;
+    }
+
+    for (size_t i = 0; i < reader->num_frames; i++) {
+        int count = snprintf(buffer, buffer_size, "%s/%04ld.png", directory, i);
+        if (count >= buffer_size - 1) {
+            LOG_ERROR("buffer too small");
+            goto fail_close_reader;
+        }
+
+        image_t* image = image_raw_view(reader, i);
+        if (image == NULL) {
+            goto fail_close_reader;
+        }
+
+        int ret = image_save_png(image, buffer);
+        image_destroy(image);
+        if (ret < 0) {
+            goto fail_close_reader;
+        }
+    }
+
+    printf("unpacked %ld frames of %ldx%ld into `%s`\n", reader->num_frames, reader->width, reader->height, directory);
+    image_raw_close(reader);
+    return 0;
+
+fail_close_reader:
+    image_raw_close(reader);
+fail_exit:
+    return -1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 4 && strcmp(argv[1], "pack") == 0) {
+        return (pack(argv[2], argv[3]) < 0) ? 1 : 0;
+    }
+
+    if (argc == 4 && strcmp(argv[1], "unpack") == 0) {
+        return (unpack(argv[2], argv[3]) < 0) ? 1 : 0;
+    }
+
+    fprintf(stderr, "Usage: %s pack DIRECTORY FILE\n", argv[0]);
+    fprintf(stderr, "       %s unpack FILE DIRECTORY\n", argv[0]);
+    return 1;
+}
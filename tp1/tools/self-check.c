@@ -0,0 +1,424 @@
+/*
+ * Quick checks of the building blocks the pipelines share, run by the check target:
+ *
+ *   reorder buffer   items come out in id order, skipped ids are passed over
+ *   ring queue       FIFO order, full and empty try variants
+ *   work stealing    every spawned task runs once, including the ones spawned by workers
+ *   blurs            box_blur_radius and gaussian_blur_sigma at every instruction set
+ *                    against a direct sum of each box
+ *   scale_up         nearest against direct indexing, bilinear and bicubic at every
+ *                    instruction set within one level of a double precision reference
+ *
+ * Prints one line per check and exits 1 if any of them fails.
+ */
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter-simd.h"
+#include "filter.h"
+#include "log.h"
+#include "reorder-buffer.h"
+#include "ring-queue.h"
+#include "work-steal.h"
+
+#define CHECK_WIDTH 61
+#define CHECK_HEIGHT 37
+#define CHECK_TASKS 64
+
+/* same frame on every run, odd sizes so every vector loop has a tail */
+static image_t* image_create_synthetic(size_t width, size_t height) {
+    image_t* image = image_create(0, width, height);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    unsigned int state = 2463534242u;
+    for (size_t i = 0; i < width * height; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        memcpy(image->pixels[i].bytes, &state, sizeof(image->pixels[i].bytes));
+    }
+    return image;
+}
+
+static size_t clamp_index(ptrdiff_t index, size_t size) {
+    return (index < 0) ? 0 : (((size_t)index >= size) ? size - 1 : (size_t)index);
+}
+
+static int check_reorder(void) {
+    static int items[8];
+    reorder_buffer_t* buffer = reorder_buffer_create(4, 10);
+    bool releasing           = false;
+    size_t expected          = 10;
+    int ret                  = -1;
+    if (buffer == NULL) {
+        goto fail_exit;
+    }
+
+    /* 10 is late, 13 is dropped */
+    if (reorder_buffer_push(buffer, 12, &items[2]) < 0 || reorder_buffer_push(buffer, 11, &items[1]) < 0) {
+        goto fail_destroy;
+    }
+    if (reorder_buffer_try_pop(buffer, &releasing) != NULL) {
+        LOG_ERROR("reorder buffer released an item before id 10");
+        goto fail_destroy;
+    }
+    reorder_buffer_skip(buffer, 13);
+    if (reorder_buffer_push(buffer, 10, &items[0]) < 0) {
+        goto fail_destroy;
+    }
+
+    int* item;
+    while ((item = reorder_buffer_try_pop(buffer, &releasing)) != NULL) {
+        if (item != &items[expected - 10]) {
+            LOG_ERROR("reorder buffer released item %ld instead of %ld", (long)(item - items) + 10, expected);
+            goto fail_destroy;
+        }
+        expected++;
+    }
+    if (expected != 13 || reorder_buffer_high_water(buffer) != 3) {
+        LOG_ERROR("reorder buffer stopped before id %ld with a high-water mark of %ld", expected,
+                  reorder_buffer_high_water(buffer));
+        goto fail_destroy;
+    }
+
+    /* 13 was skipped, 14 fits now and is next */
+    if (reorder_buffer_push(buffer, 14, &items[4]) < 0 || reorder_buffer_try_pop(buffer, &releasing) != &items[4]) {
+        LOG_ERROR("reorder buffer didn't release id 14 after the skipped id 13");
+        goto fail_destroy;
+    }
+    reorder_buffer_try_pop(buffer, &releasing);
+    ret = 0;
+
+fail_destroy:
+    reorder_buffer_destroy(buffer);
+fail_exit:
+    return ret;
+}
+
+static int check_ring_queue(void) {
+    static int items[8];
+    ring_queue_t* queue = ring_queue_create(5);
+    int ret             = -1;
+    if (queue == NULL) {
+        goto fail_exit;
+    }
+
+    size_t capacity = ring_queue_capacity(queue);
+    if (capacity != 8) {
+        LOG_ERROR("ring queue of 5 slots rounded to %ld instead of 8", capacity);
+        goto fail_destroy;
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        if (ring_queue_try_push(queue, &items[i]) < 0) {
+            LOG_ERROR("ring queue full after %ld of %ld items", i, capacity);
+            goto fail_destroy;
+        }
+    }
+    if (ring_queue_try_push(queue, &items[0]) == 0 || ring_queue_size(queue) != capacity) {
+        LOG_ERROR("full ring queue took one more item");
+        goto fail_destroy;
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        void* item = ring_queue_pop(queue);
+        if (item != &items[i]) {
+            LOG_ERROR("ring queue popped out of order at item %ld", i);
+            goto fail_destroy;
+        }
+    }
+
+    void* item;
+    if (ring_queue_try_pop(queue, &item) == 0) {
+        LOG_ERROR("empty ring queue popped an item");
+        goto fail_destroy;
+    }
+    ret = 0;
+
+fail_destroy:
+    ring_queue_destroy(queue);
+fail_exit:
+    return ret;
+}
+
+typedef struct check_task {
+    work_steal_task_t task; /* first, the task is the check_task_t */
+    struct check_task* child;
+    atomic_size_t* runs;
+} check_task_t;
+
+static void check_task_run(work_steal_t* ws, work_steal_task_t* task) {
+    check_task_t* check = (check_task_t*)task;
+    if (check->child != NULL) {
+        work_steal_spawn(ws, &check->child->task);
+    }
+    atomic_fetch_add(check->runs, 1);
+}
+
+static int check_work_steal(void) {
+    static check_task_t tasks[CHECK_TASKS];
+    atomic_size_t runs;
+    atomic_init(&runs, 0);
+
+    work_steal_t* ws = work_steal_create(4);
+    if (ws == NULL) {
+        return -1;
+    }
+
+    /* the first half spawned from here, each of them spawns one of the second half from a worker */
+    for (size_t i = 0; i < CHECK_TASKS; i++) {
+        tasks[i] = (check_task_t){.task = {.run = check_task_run}, .runs = &runs};
+        if (i < CHECK_TASKS / 2) {
+            tasks[i].child = &tasks[i + CHECK_TASKS / 2];
+        }
+    }
+    for (size_t i = 0; i < CHECK_TASKS / 2; i++) {
+        work_steal_spawn(ws, &tasks[i].task);
+    }
+    work_steal_wait(ws);
+    work_steal_destroy(ws);
+
+    if (atomic_load(&runs) != CHECK_TASKS) {
+        LOG_ERROR("%ld tasks ran instead of %d", atomic_load(&runs), CHECK_TASKS);
+        return -1;
+    }
+    return 0;
+}
+
+/* box blur of filter-blur.c, the 2 * radius + 1 taps of both passes summed for every pixel, `dst` may be `src` */
+static int direct_box(const image_t* src, image_t* dst, size_t radius) {
+    size_t width    = src->width;
+    size_t height   = src->height;
+    uint16_t* sums  = malloc(4 * width * height * sizeof(*sums));
+    uint32_t area   = (2 * radius + 1) * (2 * radius + 1);
+    ptrdiff_t reach = radius;
+    if (sums == NULL) {
+        LOG_ERROR_ERRNO("malloc");
+        return -1;
+    }
+
+    for (size_t y = 0; y < height; y++) {
+        const unsigned char* in = src->pixels[y * width].bytes;
+        for (size_t n = 0; n < 4 * width; n++) {
+            unsigned int sum = 0;
+            for (ptrdiff_t i = -reach; i <= reach; i++) {
+                sum += in[4 * clamp_index(n / 4 + i, width) + n % 4];
+            }
+            sums[4 * y * width + n] = sum;
+        }
+    }
+
+    if (image_reshape(dst, width, height) < 0) {
+        free(sums);
+        return -1;
+    }
+
+    for (size_t y = 0; y < height; y++) {
+        unsigned char* out = dst->pixels[y * width].bytes;
+        for (size_t n = 0; n < 4 * width; n++) {
+            uint32_t sum = 0;
+            for (ptrdiff_t i = -reach; i <= reach; i++) {
+                sum += sums[4 * clamp_index(y + i, height) * width + n];
+            }
+            out[n] = (sum + area / 2) / area;
+        }
+    }
+
+    free(sums);
+    return 0;
+}
+
+static bool image_equal(const image_t* a, const image_t* b) {
+    return a->width == b->width && a->height == b->height &&
+           memcmp(a->pixels, b->pixels, a->width * a->height * sizeof(*a->pixels)) == 0;
+}
+
+static int check_blur(const image_t* src) {
+    static const size_t radii[]  = {0, 1, 5, 40};
+    static const double sigmas[] = {0.5, 2, 9};
+    image_t* expected            = image_create(0, 0, 0);
+    image_t* result              = image_create(0, 0, 0);
+    int ret                      = -1;
+    if (expected == NULL || result == NULL) {
+        goto fail_destroy;
+    }
+
+    for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); r++) {
+        if (direct_box(src, expected, radii[r]) < 0) {
+            goto fail_destroy;
+        }
+        for (filter_simd_t simd = FILTER_SIMD_SCALAR; simd <= filter_simd_supported(); simd++) {
+            filter_simd_set(simd);
+            if (filter_box_blur_radius_parallel(NULL, src, result, radii[r]) < 0 || !image_equal(result, expected)) {
+                LOG_ERROR("box_blur_radius:%ld (%s) differs from the direct sums", radii[r], filter_simd_name(simd));
+                goto fail_destroy;
+            }
+        }
+    }
+
+    for (size_t s = 0; s < sizeof(sigmas) / sizeof(sigmas[0]); s++) {
+        size_t boxes[3];
+        filter_gaussian_blur_radii(sigmas[s], boxes);
+        if (direct_box(src, expected, boxes[0]) < 0 || direct_box(expected, expected, boxes[1]) < 0 ||
+            direct_box(expected, expected, boxes[2]) < 0) {
+            goto fail_destroy;
+        }
+        for (filter_simd_t simd = FILTER_SIMD_SCALAR; simd <= filter_simd_supported(); simd++) {
+            filter_simd_set(simd);
+            if (filter_gaussian_blur_sigma_parallel(NULL, src, result, sigmas[s]) < 0 ||
+                !image_equal(result, expected)) {
+                LOG_ERROR("gaussian_blur_sigma:%g (%s) differs from the direct sums", sigmas[s],
+                          filter_simd_name(simd));
+                goto fail_destroy;
+            }
+        }
+    }
+    ret = 0;
+
+fail_destroy:
+    filter_simd_set(filter_simd_supported());
+    if (expected != NULL) {
+        image_destroy(expected);
+    }
+    if (result != NULL) {
+        image_destroy(result);
+    }
+    return ret;
+}
+
+static double cubic_weight(double x) {
+    x = fabs(x);
+    if (x < 1) {
+        return (1.5 * x - 2.5) * x * x + 1;
+    }
+    if (x < 2) {
+        return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+    }
+    return 0;
+}
+
+/* source taps of output coordinate `x` and their weights, edge pixels repeat */
+static int reference_taps(size_t x, size_t factor, size_t size, filter_scale_mode_t mode, size_t index[4],
+                          double weights[4]) {
+    double position = (x + 0.5) / factor - 0.5;
+    double first    = floor(position);
+    double fraction = position - first;
+    int taps        = (mode == FILTER_SCALE_BICUBIC) ? 4 : 2;
+    ptrdiff_t start = (ptrdiff_t)first - taps / 2 + 1;
+
+    for (int t = 0; t < taps; t++) {
+        index[t] = clamp_index(start + t, size);
+        weights[t] =
+            (mode == FILTER_SCALE_BICUBIC) ? cubic_weight(fraction - (t - 1)) : ((t == 0) ? 1 - fraction : fraction);
+    }
+    return taps;
+}
+
+/* largest difference between `result` and a double precision scale of `src` */
+static int reference_scale_error(const image_t* src, const image_t* result, size_t factor, filter_scale_mode_t mode) {
+    int error = 0;
+
+    for (size_t y = 0; y < result->height; y++) {
+        size_t y_index[4], x_index[4];
+        double y_weights[4], x_weights[4];
+        int y_taps = reference_taps(y, factor, src->height, mode, y_index, y_weights);
+
+        for (size_t x = 0; x < result->width; x++) {
+            int x_taps = reference_taps(x, factor, src->width, mode, x_index, x_weights);
+
+            for (int c = 0; c < 4; c++) {
+                double sum = 0;
+                for (int j = 0; j < y_taps; j++) {
+                    for (int i = 0; i < x_taps; i++) {
+                        sum += y_weights[j] * x_weights[i] * src->pixels[y_index[j] * src->width + x_index[i]].bytes[c];
+                    }
+                }
+
+                long value = lround(fmin(fmax(sum, 0), 255));
+                int diff   = abs((int)value - result->pixels[y * result->width + x].bytes[c]);
+                if (diff > error) {
+                    error = diff;
+                }
+            }
+        }
+    }
+    return error;
+}
+
+static int check_scale(const image_t* src) {
+    static const filter_scale_mode_t modes[] = {FILTER_SCALE_BILINEAR, FILTER_SCALE_BICUBIC};
+    image_t* result                          = image_create(0, 0, 0);
+    int ret                                  = -1;
+    if (result == NULL) {
+        goto fail_exit;
+    }
+
+    for (size_t factor = 1; factor <= 4; factor++) {
+        for (filter_simd_t simd = FILTER_SIMD_SCALAR; simd <= filter_simd_supported(); simd++) {
+            filter_simd_set(simd);
+
+            if (filter_scale_up_mode_parallel(NULL, src, result, factor, FILTER_SCALE_NEAREST) < 0) {
+                goto fail_destroy;
+            }
+            for (size_t y = 0; y < result->height; y++) {
+                for (size_t x = 0; x < result->width; x++) {
+                    const pixel_t* in = &src->pixels[(y / factor) * src->width + x / factor];
+                    if (memcmp(&result->pixels[y * result->width + x], in, sizeof(*in)) != 0) {
+                        LOG_ERROR("scale_up:%ld/nearest (%s) differs at %ld,%ld", factor, filter_simd_name(simd), x, y);
+                        goto fail_destroy;
+                    }
+                }
+            }
+
+            for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+                if (filter_scale_up_mode_parallel(NULL, src, result, factor, modes[m]) < 0) {
+                    goto fail_destroy;
+                }
+                int error = reference_scale_error(src, result, factor, modes[m]);
+                if (error > 1) {
+                    LOG_ERROR("scale_up:%ld/%s (%s) is %d levels off the reference", factor,
+                              (modes[m] == FILTER_SCALE_BICUBIC) ? "bicubic" : "bilinear", filter_simd_name(simd),
+                              error);
+                    goto fail_destroy;
+                }
+            }
+        }
+    }
+    ret = 0;
+
+fail_destroy:
+    filter_simd_set(filter_simd_supported());
+    image_destroy(result);
+fail_exit:
+    return ret;
+}
+
+static int report(const char* name, int ret) {
+    printf("%-16s %s\n", name, (ret < 0) ? "FAILED" : "ok");
+    return ret;
+}
+
+int main(void) {
+    image_t* src = image_create_synthetic(CHECK_WIDTH, CHECK_HEIGHT);
+    if (src == NULL) {
+        return 1;
+    }
+
+    int ret = 0;
+    ret |= report("reorder buffer", check_reorder());
+    ret |= report("ring queue", check_ring_queue());
+    ret |= report("work stealing", check_work_steal());
+    ret |= report("blurs", check_blur(src));
+    ret |= report("scale_up", check_scale(src));
+
+    image_destroy(src);
+    return (ret < 0) ? 1 : 0;
+}